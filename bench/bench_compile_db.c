@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string.h>
+
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "cJSON.h"
+#include "asm_project.h"
+#include "asm_instance.h"
+
+/*
+ * startup scaling of the compile database. a synthetic
+ * compile_commands.json is written per size, then a child process finds
+ * and parses it and looks up a spread of files the way the server does
+ * on the first request for a buffer. each child reports one json line,
+ * so peak rss is per size and not the high water mark of the biggest run
+ */
+
+#define BENCH_LOOKUPS 64
+#define BENCH_MODULES 97
+
+static void display_usage() {
+  fprintf(stderr, "usage:\n"
+                  "  bench-compile-db [entries ...]   defaults to 1000 10000 100000 500000\n"
+      );
+  exit(1);
+}
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void source_path(char *out, size_t max, const char *dir, unsigned long i)
+{
+  snprintf(out, max, "%s/src/mod%03lu_file%07lu.cpp", dir, i % BENCH_MODULES, i);
+}
+
+
+/* the indices looked up, first and last entry always included */
+static unsigned long lookup_index(unsigned long entries, unsigned int k)
+{
+  return (unsigned long)((double)k * (entries-1) / (BENCH_LOOKUPS-1));
+}
+
+
+/* cmake style entries, defines and include lists vary per module like a real tree */
+static int write_compile_db(const char *dir, unsigned long entries)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" ASM_PROJECT_FILE, dir);
+
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    return -1;
+  }
+
+  char src[PATH_MAX];
+  fputs("[\n", fp);
+  for (unsigned long i=0; i<entries; i++) {
+    const unsigned long mod = i % BENCH_MODULES;
+    source_path(src, sizeof(src), dir, i);
+
+    fprintf(fp, "{\n  \"directory\": \"%s/build\",\n  \"command\": \"/usr/bin/c++"
+                " -DPROJECT_VERSION=\\\"4.2.%lu\\\" -DMODULE_%03lu_EXPORTS -DNDEBUG -D_GNU_SOURCE",
+            dir, mod, mod);
+    for (unsigned long d=0; d<mod%7; d++)
+      fprintf(fp, " -DFEATURE_%03lu_%lu=1", mod, d);
+
+    fprintf(fp, " -I%s/include -I%s/src/mod%03lu -I%s/build/generated/mod%03lu", dir, dir, mod, dir, mod);
+    for (unsigned long d=0; d<1+mod%5; d++)
+      fprintf(fp, " -isystem %s/third_party/lib%lu/include", dir, d);
+
+    fprintf(fp, " -O2 -g -std=gnu++17 -fPIC -Wall -Wextra -Wno-unused-parameter"
+                " -o CMakeFiles/mod%03lu.dir/src/mod%03lu_file%07lu.cpp.o -c %s\",\n"
+                "  \"file\": \"%s\",\n"
+                "  \"output\": \"CMakeFiles/mod%03lu.dir/src/mod%03lu_file%07lu.cpp.o\"\n}%s\n",
+            mod, mod, i, src, src, mod, mod, i, i+1 < entries ? "," : "");
+  }
+  fputs("]\n", fp);
+
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Error: [libc] fclose - %s\n", strerror(errno));
+    return -1;
+  }
+
+  /* AsmInstance_alloc resolves the path, only the looked up sources need to exist */
+  for (unsigned int k=0; k<BENCH_LOOKUPS; k++) {
+    source_path(src, sizeof(src), dir, lookup_index(entries, k));
+    fp = fopen(src, "w");
+    if (!fp) {
+      fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+      return -1;
+    }
+    fclose(fp);
+  }
+  return 0;
+}
+
+
+static void remove_compile_db(const char *dir, unsigned long entries)
+{
+  char path[PATH_MAX];
+  for (unsigned int k=0; k<BENCH_LOOKUPS; k++) {
+    source_path(path, sizeof(path), dir, lookup_index(entries, k));
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/" ASM_PROJECT_FILE, dir);
+  unlink(path);
+}
+
+
+/* runs in the child, the parent only generates and collects */
+static int run_size(const char *dir, unsigned long entries)
+{
+  char project_path[PATH_MAX];
+  snprintf(project_path, sizeof(project_path), "%s", dir);
+
+  const uint64_t start_ns = now_ns();
+  if (!AsmProject_find(project_path, ASM_PROJECT_FILE)) {
+    fprintf(stderr, "Error: could not find project commands\n");
+    return 1;
+  }
+  const uint64_t found_ns = now_ns();
+
+  size_t bytes = 0;
+  cJSON *root = AsmProject_parse(project_path, &bytes);
+  if (!root) {
+    fprintf(stderr, "Error: failed to parse compile_commands.json\n");
+    return 1;
+  }
+  const uint64_t parsed_ns = now_ns();
+
+  double lookup_sum_us = 0;
+  double lookup_max_us = 0;
+  double lookup_first_us = 0;
+  double lookup_last_us = 0;
+  unsigned int failed = 0;
+
+  char src[PATH_MAX];
+  for (unsigned int k=0; k<BENCH_LOOKUPS; k++) {
+    source_path(src, sizeof(src), dir, lookup_index(entries, k));
+    AsmInstance *inst = AsmInstance_alloc(src);
+    if (!inst) {
+      failed++;
+      continue;
+    }
+
+    const uint64_t lookup_ns = now_ns();
+    if (AsmInstance_parse_command_C(inst, root) != ASM_INST_OK)
+      failed++;
+    const double us = (now_ns() - lookup_ns) / 1e3;
+    AsmInstance_free(inst);
+
+    lookup_sum_us += us;
+    if (us > lookup_max_us)
+      lookup_max_us = us;
+    if (k == 0)
+      lookup_first_us = us;
+    if (k == BENCH_LOOKUPS-1)
+      lookup_last_us = us;
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("{\"entries\":%lu,\"bytes\":%zu,\"find_ms\":%.3f,\"parse_ms\":%.3f,"
+         "\"load_ms\":%.3f,\"peak_rss_kb\":%ld,\"lookups\":%u,\"lookup_failed\":%u,"
+         "\"lookup_mean_us\":%.3f,\"lookup_first_us\":%.3f,\"lookup_last_us\":%.3f,"
+         "\"lookup_max_us\":%.3f}\n",
+         entries, bytes, (found_ns - start_ns) / 1e6, (parsed_ns - found_ns) / 1e6,
+         (parsed_ns - start_ns) / 1e6, ru.ru_maxrss, BENCH_LOOKUPS, failed,
+         lookup_sum_us / BENCH_LOOKUPS, lookup_first_us, lookup_last_us, lookup_max_us);
+  fflush(stdout);
+
+  cJSON_Delete(root);
+  return failed ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  unsigned long sizes[32] = { 1000, 10000, 100000, 500000 };
+  unsigned int nsizes = 4;
+
+  if (argc > 1) {
+    nsizes = 0;
+    for (int i=1; i<argc && nsizes < 32; i++) {
+      char *end;
+      sizes[nsizes] = strtoul(argv[i], &end, 10);
+      if (*end || !sizes[nsizes])
+        display_usage();
+      nsizes++;
+    }
+  }
+
+  /* resolved, so the "file" fields match what realpath gives back */
+  char tmpl[] = "/tmp/asm_bench_XXXXXX";
+  char dir[PATH_MAX];
+  if (!mkdtemp(tmpl) || !realpath(tmpl, dir)) {
+    fprintf(stderr, "Error: [libc] mkdtemp - %s\n", strerror(errno));
+    return 1;
+  }
+
+  char src_dir[PATH_MAX];
+  snprintf(src_dir, sizeof(src_dir), "%s/src", dir);
+  if (mkdir(src_dir, 0700) != 0) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    rmdir(dir);
+    return 1;
+  }
+
+  int ret = 0;
+  for (unsigned int s=0; s<nsizes && !ret; s++) {
+    if (write_compile_db(dir, sizes[s]) != 0) {
+      ret = 1;
+      break;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "Error: [libc] fork - %s\n", strerror(errno));
+      ret = 1;
+    }
+    else if (pid == 0)
+      _exit(run_size(dir, sizes[s]));
+    else {
+      int status;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ret = 1;
+    }
+
+    remove_compile_db(dir, sizes[s]);
+  }
+
+  rmdir(src_dir);
+  rmdir(dir);
+  return ret;
+}
@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "asm_filter.h"
+#include "asm_funcs.h"
+
+/*
+ * throughput of the text kernels over recorded compiler output, run from
+ * memory in pipe sized chunks the way the server sees them:
+ *   filter     AsmFilter over raw -S output
+ *   functions  AsmNameScan over raw -S output
+ *   index      AsmFunctionIndex over the filtered output
+ * every output is compared against <file>.<kernel> goldens, -r records
+ * them. goldens from a known good build prove a new kernel byte identical.
+ * -p runs the filter with pipeline stages on, the filter and index goldens
+ * are named after them, e.g <file>.filter+labels+data. -l also builds
+ * the tokenized line table, the text must not change so goldens are shared
+ */
+
+#define PAGE_SIZE 4096
+#define ASM_WINDOW 4*PAGE_SIZE
+
+#define BENCH_MIN_NS  300000000ULL
+#define BENCH_MAX_FILES 256
+
+struct bench_output {
+  char *data;
+  size_t len;
+};
+
+static void display_usage() {
+  fprintf(stderr, "usage:\n"
+                  "  bench-filter [-r] [-l] [-n iterations] [-p labels,data] <corpus dir | file.s ...>\n"
+                  "    -r  record goldens instead of checking them\n"
+                  "    -l  tokenize the filtered lines as the server does\n"
+                  "    -p  filter pipeline stages\n"
+      );
+  exit(1);
+}
+
+
+static unsigned int filter_options = 0;
+static bool track_lines = false;
+static char filter_name[64] = "filter";
+static char index_name[64]  = "index";
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static char* read_file(const char *path, size_t *len)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return NULL;
+
+  struct stat sb;
+  if (fstat(fileno(fp), &sb) == -1) {
+    fclose(fp);
+    return NULL;
+  }
+
+  char *data = (char*)malloc(sb.st_size + 1);
+  *len = fread(data, 1, sb.st_size, fp);
+  data[*len] = '\0';
+  fclose(fp);
+  return data;
+}
+
+
+static void run_filter(const char *input, size_t len, struct bench_output *out)
+{
+  AsmFilter filter;
+  AsmLines lines;
+  AsmFilter_init(&filter);
+  AsmFilter_set_options(&filter, filter_options);
+  AsmLines_init(&lines);
+  if (track_lines)
+    AsmFilter_track_lines(&filter, &lines);
+  for (size_t i=0; i<len; i+=ASM_WINDOW) {
+    const size_t chunk = len-i < ASM_WINDOW ? len-i : ASM_WINDOW;
+    if (AsmFilter_feed(&filter, input+i, chunk) != ASM_FILTER_OK)
+      break;
+  }
+
+  unsigned long long asm_len;
+  out->data = AsmFilter_finish(&filter, &asm_len);
+  out->len  = asm_len;
+
+  unsigned int nstats;
+  free(AsmFilter_take_stats(&filter, &nstats));
+  AsmLines_free(&lines);
+}
+
+
+static void run_functions(const char *input, size_t len, struct bench_output *out)
+{
+  AsmNameScan scan;
+  AsmNameScan_init(&scan);
+  for (size_t i=0; i<len; i+=ASM_WINDOW) {
+    const size_t chunk = len-i < ASM_WINDOW ? len-i : ASM_WINDOW;
+    if (AsmNameScan_feed(&scan, input+i, chunk) != ASM_FILTER_OK)
+      break;
+  }
+  out->data = AsmNameScan_finish(&scan, &out->len);
+}
+
+
+/* the golden is a dump of the index, one function per line */
+static void run_index(const char *input, size_t len, struct bench_output *out)
+{
+  AsmFunctionIndex index;
+  out->data = NULL;
+  out->len  = 0;
+  if (AsmFunctionIndex_build(&index, input, len) != ASM_FUNCS_OK)
+    return;
+
+  size_t max = 4096;
+  out->data = (char*)malloc(max);
+  for (unsigned int i=0; i<index.nfuncs; i++) {
+    AsmFunction *func = &index.funcs[i];
+    while (out->len + func->name_len + 128 > max) {
+      max *= 2;
+      out->data = (char*)realloc(out->data, max);
+    }
+    out->len += snprintf(out->data+out->len, max-out->len, "%.*s\t%zu\t%zu\t%u\t%u\t%016llx\n",
+                         (int)func->name_len, func->name, func->body_start, func->body_end,
+                         func->ninstr, func->est_size, (unsigned long long)func->hash);
+  }
+  AsmFunctionIndex_free(&index);
+}
+
+
+/* "ok", "recorded", "missing" or the line of the first difference */
+static void check_golden(const char *path, const char *kernel, struct bench_output *out,
+                         bool record, char *result, size_t result_max)
+{
+  char golden_path[PATH_MAX];
+  snprintf(golden_path, sizeof(golden_path), "%s.%s", path, kernel);
+
+  if (record) {
+    FILE *fp = fopen(golden_path, "wb");
+    if (!fp || fwrite(out->data, 1, out->len, fp) != out->len) {
+      snprintf(result, result_max, "write failed: %s", strerror(errno));
+      if (fp)
+        fclose(fp);
+      return;
+    }
+    fclose(fp);
+    snprintf(result, result_max, "recorded");
+    return;
+  }
+
+  size_t golden_len;
+  char *golden = read_file(golden_path, &golden_len);
+  if (!golden) {
+    snprintf(result, result_max, "missing");
+    return;
+  }
+
+  size_t i = 0;
+  size_t line = 1;
+  const size_t common = golden_len < out->len ? golden_len : out->len;
+  for (; i<common && golden[i] == out->data[i]; i++)
+    line += golden[i] == '\n';
+
+  if (i == common && golden_len == out->len)
+    snprintf(result, result_max, "ok");
+  else
+    snprintf(result, result_max, "mismatch at line %zu", line);
+  free(golden);
+}
+
+
+typedef void (*bench_kernel)(const char*, size_t, struct bench_output*);
+
+/* best of as many runs as fit in BENCH_MIN_NS, at least one */
+static int bench_file(const char *path, unsigned int iterations, bool record)
+{
+  size_t len;
+  char *input = read_file(path, &len);
+  if (!input) {
+    fprintf(stderr, "Error: [libc] fopen %s - %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  const char *names[] = { filter_name, "functions", index_name };
+  static const bench_kernel kernels[] = { run_filter, run_functions, run_index };
+
+  struct bench_output filtered = { NULL, 0 };
+  int failed = 0;
+  for (unsigned int k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++) {
+    /* the index runs over the filter output, not the raw text */
+    const char *kernel_input = k == 2 ? filtered.data : input;
+    const size_t kernel_len  = k == 2 ? filtered.len : len;
+    if (!kernel_input)
+      continue;
+
+    size_t lines = 0;
+    for (size_t i=0; i<kernel_len; i++)
+      lines += kernel_input[i] == '\n';
+
+    struct bench_output out = { NULL, 0 };
+    uint64_t best_ns = UINT64_MAX;
+    uint64_t total_ns = 0;
+    unsigned int runs = 0;
+    while (runs < 1 || (iterations ? runs < iterations : total_ns < BENCH_MIN_NS)) {
+      if (out.data != filtered.data)
+        free(out.data);
+
+      const uint64_t start_ns = now_ns();
+      kernels[k](kernel_input, kernel_len, &out);
+      const uint64_t ns = now_ns() - start_ns;
+
+      total_ns += ns;
+      if (ns < best_ns)
+        best_ns = ns;
+      runs++;
+    }
+
+    char result[128];
+    if (out.data)
+      check_golden(path, names[k], &out, record, result, sizeof(result));
+    else
+      snprintf(result, sizeof(result), "no output");
+    if (strcmp(result, "ok") != 0 && strcmp(result, "recorded") != 0)
+      failed = 1;
+
+    printf("{\"file\":\"%s\",\"kernel\":\"%s\",\"bytes\":%zu,\"lines\":%zu,\"output_bytes\":%zu,"
+           "\"runs\":%u,\"best_ms\":%.3f,\"mb_s\":%.1f,\"ns_line\":%.2f,\"golden\":\"%s\"}\n",
+           path, names[k], kernel_len, lines, out.len, runs, best_ns / 1e6,
+           kernel_len / (best_ns / 1e9) / (1024.0 * 1024.0), (double)best_ns / (lines ? lines : 1),
+           result);
+    fflush(stdout);
+
+    if (k == 0)
+      filtered = out;
+    else
+      free(out.data);
+  }
+
+  free(filtered.data);
+  free(input);
+  return failed;
+}
+
+
+static int compare_path(const void *a, const void *b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+/* the .s files of a corpus directory, in name order */
+static unsigned int list_corpus(const char *dirpath, char *files[], unsigned int max)
+{
+  DIR *dir = opendir(dirpath);
+  if (!dir) {
+    fprintf(stderr, "Error: [libc] opendir - %s\n", strerror(errno));
+    return 0;
+  }
+
+  unsigned int n = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL && n < max) {
+    const size_t len = strlen(entry->d_name);
+    if (len < 3 || strcmp(entry->d_name+len-2, ".s") != 0)
+      continue;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+    files[n++] = strdup(path);
+  }
+  closedir(dir);
+
+  qsort(files, n, sizeof(char*), compare_path);
+  return n;
+}
+
+
+int main(int argc, char *argv[])
+{
+  bool record = false;
+  unsigned int iterations = 0;
+  char *files[BENCH_MAX_FILES];
+  unsigned int nfiles = 0;
+
+  for (int i=1; i<argc; i++) {
+    const char *ptr = argv[i];
+    if (strcmp(ptr, "-r") == 0)
+      record = true;
+    else if (strcmp(ptr, "-l") == 0)
+      track_lines = true;
+    else if (strcmp(ptr, "-n") == 0 && i+1 < argc)
+      iterations = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(ptr, "-p") == 0 && i+1 < argc) {
+      const char *stages = argv[++i];
+      if (strstr(stages, "labels")) {
+        filter_options |= ASM_FILTER_UNUSED_LABELS;
+        strcat(filter_name, "+labels");
+        strcat(index_name, "+labels");
+      }
+      if (strstr(stages, "data")) {
+        filter_options |= ASM_FILTER_DATA;
+        strcat(filter_name, "+data");
+        strcat(index_name, "+data");
+      }
+    }
+    else if (ptr[0] == '-')
+      display_usage();
+    else {
+      struct stat sb;
+      if (stat(ptr, &sb) == 0 && S_ISDIR(sb.st_mode))
+        nfiles += list_corpus(ptr, files+nfiles, BENCH_MAX_FILES-nfiles);
+      else if (nfiles < BENCH_MAX_FILES)
+        files[nfiles++] = strdup(ptr);
+    }
+  }
+
+  if (!nfiles)
+    display_usage();
+
+  int failed = 0;
+  for (unsigned int i=0; i<nfiles; i++) {
+    failed |= bench_file(files[i], iterations, record);
+    free(files[i]);
+  }
+  return failed;
+}
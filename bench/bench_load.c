@@ -0,0 +1,486 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#include <string.h>
+
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cJSON.h"
+
+/*
+ * server overhead under concurrent clients. a generated project points
+ * every compile command at this binary in --stub-cc mode, which prints
+ * canned assembly, so the compiler costs next to nothing and what is
+ * measured is the poll loop, parsing, filtering, serialization and the
+ * socket writes. for each client count a fresh server is started, every
+ * client runs its requests back to back on its own thread, and one json
+ * line reports throughput, latency, fairness and the server's own queue
+ * wait histogram
+ */
+
+#ifndef ASM_SERVER_BIN
+#define ASM_SERVER_BIN "asm-server"
+#endif
+
+#define LOAD_MAX_CLIENTS 64
+#define STUB_FUNCTIONS   200
+
+struct load_client {
+  pthread_t thread;
+  const char *socket_path;
+  const char *dir;
+  unsigned int id;
+  unsigned int requests;
+  unsigned int nfiles;
+  unsigned int assembly_pct;
+  unsigned int edit_pct;
+  unsigned int done;
+  unsigned int errors;
+  double *latency_ms;
+  double wall_ms;
+};
+
+static void display_usage() {
+  fprintf(stderr, "usage:\n"
+                  "  bench-load [-c 1,2,4,8,16] [-n requests per client] [-f files]\n"
+                  "             [-a assembly percent] [-e edit percent] [-s asm-server]\n"
+      );
+  exit(1);
+}
+
+
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/* canned -S output, the shape of gcc's with .type directives and .loc lines */
+static int stub_compiler(int argc, char *argv[])
+{
+  for (int i=1; i<argc-1; i++) {
+    if (strcmp(argv[i], "-MF") == 0) {
+      FILE *fp = fopen(argv[i+1], "w");
+      if (fp) {
+        fprintf(fp, "tu: %s\n", argv[argc-1]);
+        fclose(fp);
+      }
+    }
+  }
+
+  printf("\t.file\t\"stub.c\"\n\t.intel_syntax noprefix\n\t.text\n");
+  for (unsigned int f=0; f<STUB_FUNCTIONS; f++) {
+    printf("\t.p2align 4\n\t.globl\tstub_%u\n\t.type\tstub_%u, @function\nstub_%u:\n"
+           ".LFB%u:\n\t.loc 1 %u 1\n\t.cfi_startproc\n", f, f, f, f, f*10+1);
+    printf("\ttest\tedi, edi\n\tjle\t.L%u\n\tlea\teax, [rdi+%u]\n\timul\teax, esi\n"
+           "\t.loc 1 %u 5\n\tadd\teax, edx\n\tret\n.L%u:\n\txor\teax, eax\n\tret\n",
+           f, f, f*10+3, f);
+    printf("\t.cfi_endproc\n.LFE%u:\n\t.size\tstub_%u, .-stub_%u\n", f, f, f);
+  }
+  printf("\t.ident\t\"stub\"\n\t.section\t.note.GNU-stack,\"\",@progbits\n");
+  return 0;
+}
+
+
+static void source_path(char *out, size_t max, const char *dir, unsigned int i)
+{
+  snprintf(out, max, "%s/file%04u.c", dir, i);
+}
+
+
+static int write_project(const char *dir, unsigned int nfiles, const char *self)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/compile_commands.json", dir);
+
+  cJSON *root = cJSON_CreateArray();
+  for (unsigned int i=0; i<nfiles; i++) {
+    char src[PATH_MAX];
+    source_path(src, sizeof(src), dir, i);
+    FILE *fp = fopen(src, "w");
+    if (!fp) {
+      fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+      cJSON_Delete(root);
+      return -1;
+    }
+    fprintf(fp, "int f%u(int a, int b) { return a * b + %u; }\n", i, i);
+    fclose(fp);
+
+    char cmd[3*PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "%s --stub-cc -O2 -o file%04u.o -c %s", self, i, src);
+
+    cJSON *entry = cJSON_CreateObject();
+    cJSON_AddStringToObject(entry, "directory", dir);
+    cJSON_AddStringToObject(entry, "command", cmd);
+    cJSON_AddStringToObject(entry, "file", src);
+    cJSON_AddItemToArray(root, entry);
+  }
+
+  char *json = cJSON_Print(root);
+  cJSON_Delete(root);
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    cJSON_free(json);
+    return -1;
+  }
+  fputs(json, fp);
+  fclose(fp);
+  cJSON_free(json);
+  return 0;
+}
+
+
+static void remove_project(const char *dir, unsigned int nfiles)
+{
+  char path[PATH_MAX];
+  for (unsigned int i=0; i<nfiles; i++) {
+    source_path(path, sizeof(path), dir, i);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/compile_commands.json", dir);
+  unlink(path);
+  rmdir(dir);
+}
+
+
+static pid_t spawn_server(const char *server, const char *dir, char *socket_path, size_t max)
+{
+  int fds[2];
+  if (pipe(fds) == -1) {
+    fprintf(stderr, "Error: [libc] pipe - %s\n", strerror(errno));
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Error: [libc] fork - %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* server logs would drown the report */
+    freopen("/dev/null", "w", stderr);
+    execl(server, server, dir, (char*)NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  FILE *fp = fdopen(fds[0], "r");
+  if (!fp || !fgets(socket_path, max, fp) || strncmp(socket_path, "VIMASM_NULL", 11) == 0) {
+    fprintf(stderr, "Error: server did not start\n");
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  socket_path[strcspn(socket_path, "\n")] = '\0';
+  return pid;
+}
+
+
+static int connect_server(const char *socket_path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+static bool read_full(int fd, char *buffer, size_t len, int timeout_ms)
+{
+  size_t got = 0;
+  while (got < len) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+      return false;
+
+    ssize_t bytes = read(fd, buffer+got, len-got);
+    if (bytes == -1 && errno == EINTR)
+      continue;
+    if (bytes <= 0)
+      return false;
+    got += bytes;
+  }
+  return true;
+}
+
+
+/* returns the response body, NULL when none arrived */
+static char* round_trip(int fd, const char *request, uint32_t *len)
+{
+  const size_t request_len = strlen(request);
+  if (write(fd, request, request_len) != (ssize_t)request_len)
+    return NULL;
+
+  uint32_t msg_bytes;
+  if (!read_full(fd, (char*)&msg_bytes, sizeof(msg_bytes), 10000))
+    return NULL;
+
+  char *msg = (char*)malloc(msg_bytes+1);
+  if (!read_full(fd, msg, msg_bytes, 10000)) {
+    free(msg);
+    return NULL;
+  }
+  msg[msg_bytes] = '\0';
+  *len = msg_bytes;
+  return msg;
+}
+
+
+/* an edit rewrites the source so the next assembly request recompiles */
+static void edit_source(const char *dir, unsigned int file, unsigned int serial)
+{
+  char src[PATH_MAX];
+  source_path(src, sizeof(src), dir, file);
+  FILE *fp = fopen(src, "w");
+  if (fp) {
+    fprintf(fp, "int f%u(int a, int b) { return a * b + %u; }\n", file, serial);
+    fclose(fp);
+  }
+}
+
+
+static void* client_thread(void *arg)
+{
+  struct load_client *client = (struct load_client*)arg;
+  unsigned int seed = 0x9e3779b9u * (client->id + 1);
+
+  int fd = connect_server(client->socket_path);
+  if (fd == -1) {
+    client->errors = client->requests;
+    return NULL;
+  }
+
+  const double start = now_ms();
+  for (unsigned int i=0; i<client->requests; i++) {
+    const unsigned int file = rand_r(&seed) % client->nfiles;
+    const bool assembly = (unsigned int)(rand_r(&seed) % 100) < client->assembly_pct;
+    if (assembly && (unsigned int)(rand_r(&seed) % 100) < client->edit_pct)
+      edit_source(client->dir, file, client->id * client->requests + i);
+
+    char src[PATH_MAX];
+    char request[PATH_MAX + 64];
+    source_path(src, sizeof(src), client->dir, file);
+    snprintf(request, sizeof(request), "{\"filepath\":\"%s\",\"command\":\"%s\"}\n",
+             src, assembly ? "assembly" : "functions");
+
+    const double sent = now_ms();
+    uint32_t len;
+    char *msg = round_trip(fd, request, &len);
+    if (!msg) {
+      client->errors++;
+      continue;
+    }
+    free(msg);
+    client->latency_ms[client->done++] = now_ms() - sent;
+  }
+  client->wall_ms = now_ms() - start;
+
+  close(fd);
+  return NULL;
+}
+
+
+static int compare_double(const void *a, const void *b)
+{
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+
+static int run_clients(const char *server, const char *dir, unsigned int nclients,
+                       unsigned int requests, unsigned int nfiles,
+                       unsigned int assembly_pct, unsigned int edit_pct)
+{
+  char socket_path[PATH_MAX];
+  pid_t pid = spawn_server(server, dir, socket_path, sizeof(socket_path));
+  if (pid == -1)
+    return 1;
+
+  /* the server exits when its last client leaves, this one holds it open */
+  int control_fd = connect_server(socket_path);
+  if (control_fd == -1) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return 1;
+  }
+
+  struct load_client clients[LOAD_MAX_CLIENTS];
+  const double start = now_ms();
+  for (unsigned int c=0; c<nclients; c++) {
+    struct load_client *client = &clients[c];
+    memset(client, 0, sizeof(*client));
+    client->socket_path  = socket_path;
+    client->dir          = dir;
+    client->id           = c;
+    client->requests     = requests;
+    client->nfiles       = nfiles;
+    client->assembly_pct = assembly_pct;
+    client->edit_pct     = edit_pct;
+    client->latency_ms   = (double*)malloc(requests * sizeof(double));
+    pthread_create(&client->thread, NULL, client_thread, client);
+  }
+
+  for (unsigned int c=0; c<nclients; c++)
+    pthread_join(clients[c].thread, NULL);
+  const double wall_ms = now_ms() - start;
+
+  /* server side view, queue wait is time from poll wakeup to dispatch */
+  uint32_t len;
+  char *stats = round_trip(control_fd, "{\"command\":\"stats\"}\n", &len);
+  cJSON *js_stats = stats ? cJSON_Parse(stats) : NULL;
+  free(stats);
+  close(control_fd);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  unsigned int total = 0;
+  unsigned int errors = 0;
+  double sum_x = 0, sum_x2 = 0;
+  double *all = (double*)malloc(nclients * requests * sizeof(double));
+  for (unsigned int c=0; c<nclients; c++) {
+    struct load_client *client = &clients[c];
+    memcpy(all+total, client->latency_ms, client->done * sizeof(double));
+    total  += client->done;
+    errors += client->errors;
+
+    /* jain's index over per client throughput, 1.0 is perfectly fair */
+    const double x = client->wall_ms > 0 ? client->done / client->wall_ms : 0;
+    sum_x  += x;
+    sum_x2 += x*x;
+    free(client->latency_ms);
+  }
+  qsort(all, total, sizeof(double), compare_double);
+
+  cJSON *report = cJSON_CreateObject();
+  cJSON_AddNumberToObject(report, "clients", nclients);
+  cJSON_AddNumberToObject(report, "requests", total);
+  cJSON_AddNumberToObject(report, "errors", errors);
+  cJSON_AddNumberToObject(report, "wall_s", wall_ms / 1e3);
+  cJSON_AddNumberToObject(report, "throughput_rps", total / (wall_ms / 1e3));
+  cJSON_AddNumberToObject(report, "fairness", sum_x2 > 0 ? sum_x*sum_x / (nclients * sum_x2) : 0);
+  if (total) {
+    cJSON_AddNumberToObject(report, "p50_ms", all[(total-1) * 50 / 100]);
+    cJSON_AddNumberToObject(report, "p95_ms", all[(total-1) * 95 / 100]);
+    cJSON_AddNumberToObject(report, "p99_ms", all[(total-1) * 99 / 100]);
+    cJSON_AddNumberToObject(report, "max_ms", all[total-1]);
+  }
+
+  cJSON *latency = cJSON_GetObjectItemCaseSensitive(js_stats, "latency");
+  cJSON *queue = cJSON_GetObjectItemCaseSensitive(latency, "queue_wait");
+  cJSON *request = cJSON_GetObjectItemCaseSensitive(latency, "request");
+  if (queue)
+    cJSON_AddItemToObject(report, "server_queue_wait",
+                          cJSON_DetachItemFromObjectCaseSensitive(latency, "queue_wait"));
+  if (request)
+    cJSON_AddItemToObject(report, "server_request",
+                          cJSON_DetachItemFromObjectCaseSensitive(latency, "request"));
+
+  char *json = cJSON_PrintUnformatted(report);
+  printf("%s\n", json);
+  fflush(stdout);
+  cJSON_free(json);
+  cJSON_Delete(report);
+  cJSON_Delete(js_stats);
+  free(all);
+  return errors ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && strcmp(argv[1], "--stub-cc") == 0)
+    return stub_compiler(argc, argv);
+
+  unsigned int counts[LOAD_MAX_CLIENTS] = { 1, 2, 4, 8, 16 };
+  unsigned int ncounts = 5;
+  unsigned int requests = 200;
+  unsigned int nfiles = 32;
+  unsigned int assembly_pct = 70;
+  unsigned int edit_pct = 10;
+  const char *server = ASM_SERVER_BIN;
+
+  for (int i=1; i<argc; i++) {
+    if (i+1 >= argc)
+      display_usage();
+
+    const char *opt = argv[i++];
+    if (strcmp(opt, "-c") == 0) {
+      ncounts = 0;
+      for (char *tok = strtok(argv[i], ","); tok && ncounts < LOAD_MAX_CLIENTS; tok = strtok(NULL, ","))
+        counts[ncounts++] = strtoul(tok, NULL, 10);
+    }
+    else if (strcmp(opt, "-n") == 0)
+      requests = strtoul(argv[i], NULL, 10);
+    else if (strcmp(opt, "-f") == 0)
+      nfiles = strtoul(argv[i], NULL, 10);
+    else if (strcmp(opt, "-a") == 0)
+      assembly_pct = strtoul(argv[i], NULL, 10);
+    else if (strcmp(opt, "-e") == 0)
+      edit_pct = strtoul(argv[i], NULL, 10);
+    else if (strcmp(opt, "-s") == 0)
+      server = argv[i];
+    else
+      display_usage();
+  }
+
+  for (unsigned int i=0; i<ncounts; i++) {
+    /* one client slot is taken by the control connection */
+    if (!counts[i] || counts[i] >= LOAD_MAX_CLIENTS)
+      display_usage();
+  }
+  if (!requests || !nfiles)
+    display_usage();
+
+  char self[PATH_MAX];
+  if (!realpath("/proc/self/exe", self)) {
+    fprintf(stderr, "Error: [libc] realpath - %s\n", strerror(errno));
+    return 1;
+  }
+
+  char tmpl[] = "/tmp/asm_load_XXXXXX";
+  char dir[PATH_MAX];
+  if (!mkdtemp(tmpl) || !realpath(tmpl, dir)) {
+    fprintf(stderr, "Error: [libc] mkdtemp - %s\n", strerror(errno));
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  int ret = write_project(dir, nfiles, self);
+  for (unsigned int i=0; i<ncounts && !ret; i++)
+    ret = run_clients(server, dir, counts[i], requests, nfiles, assembly_pct, edit_pct);
+
+  remove_project(dir, nfiles);
+  return ret;
+}
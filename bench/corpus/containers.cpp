@@ -0,0 +1,80 @@
+// templated C++: containers, algorithms and lambdas, long mangled names
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace corpus {
+
+struct Point {
+  double x, y;
+  bool operator<(const Point &o) const { return x < o.x || (x == o.x && y < o.y); }
+};
+
+template <typename T>
+T sum(const std::vector<T> &v)
+{
+  return std::accumulate(v.begin(), v.end(), T{});
+}
+
+std::vector<int> sorted_unique(std::vector<int> v)
+{
+  std::sort(v.begin(), v.end());
+  v.erase(std::unique(v.begin(), v.end()), v.end());
+  return v;
+}
+
+class Shape {
+public:
+  virtual ~Shape() = default;
+  virtual double area() const = 0;
+};
+
+class Circle : public Shape {
+  double r;
+public:
+  explicit Circle(double r) : r(r) {}
+  double area() const override { return 3.14159265358979 * r * r; }
+};
+
+class Rect : public Shape {
+  double w, h;
+public:
+  Rect(double w, double h) : w(w), h(h) {}
+  double area() const override { return w * h; }
+};
+
+double total_area(const std::vector<std::unique_ptr<Shape>> &shapes)
+{
+  double total = 0;
+  for (const auto &s : shapes)
+    total += s->area();
+  return total;
+}
+
+std::vector<std::unique_ptr<Shape>> make_shapes(int n)
+{
+  std::vector<std::unique_ptr<Shape>> shapes;
+  for (int i=0; i<n; i++) {
+    if (i & 1)
+      shapes.push_back(std::make_unique<Circle>(i));
+    else
+      shapes.push_back(std::make_unique<Rect>(i, i+1));
+  }
+  return shapes;
+}
+
+std::vector<Point> hull_sorted(std::vector<Point> pts)
+{
+  std::sort(pts.begin(), pts.end());
+  auto last = std::remove_if(pts.begin(), pts.end(), [](const Point &p) { return p.x < 0; });
+  pts.erase(last, pts.end());
+  return pts;
+}
+
+template double sum<double>(const std::vector<double>&);
+template int sum<int>(const std::vector<int>&);
+template long sum<long>(const std::vector<long>&);
+
+}
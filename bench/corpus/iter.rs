@@ -0,0 +1,57 @@
+// rust iterators, generics and trait objects, legacy and v0 style symbols
+use std::collections::HashMap;
+
+pub trait Shape {
+    fn area(&self) -> f64;
+}
+
+pub struct Circle(pub f64);
+pub struct Square(pub f64);
+
+impl Shape for Circle {
+    fn area(&self) -> f64 { 3.14159265358979 * self.0 * self.0 }
+}
+
+impl Shape for Square {
+    fn area(&self) -> f64 { self.0 * self.0 }
+}
+
+#[inline(never)]
+pub fn total_area(shapes: &[Box<dyn Shape>]) -> f64 {
+    shapes.iter().map(|s| s.area()).sum()
+}
+
+#[inline(never)]
+pub fn dot(a: &[f32], b: &[f32]) -> f32 {
+    a.iter().zip(b).map(|(x, y)| x * y).sum()
+}
+
+#[inline(never)]
+pub fn word_counts(text: &str) -> HashMap<&str, usize> {
+    let mut counts = HashMap::new();
+    for w in text.split_whitespace() {
+        *counts.entry(w).or_insert(0) += 1;
+    }
+    counts
+}
+
+#[inline(never)]
+pub fn evens_squared(v: &[i64]) -> Vec<i64> {
+    v.iter().filter(|x| *x % 2 == 0).map(|x| x * x).collect()
+}
+
+#[inline(never)]
+pub fn largest<T: PartialOrd + Copy>(v: &[T]) -> Option<T> {
+    let mut it = v.iter();
+    let mut best = *it.next()?;
+    for &x in it {
+        if x > best {
+            best = x;
+        }
+    }
+    Some(best)
+}
+
+pub fn instantiate(a: &[i32], b: &[f64]) -> (Option<i32>, Option<f64>) {
+    (largest(a), largest(b))
+}
@@ -0,0 +1,108 @@
+/* plain C kernels: loops, reductions, a small state machine */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+float dot(const float *a, const float *b, size_t n)
+{
+  float sum = 0;
+  for (size_t i=0; i<n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+void saxpy(float *y, const float *x, float a, size_t n)
+{
+  for (size_t i=0; i<n; i++)
+    y[i] += a * x[i];
+}
+
+uint64_t fnv1a(const char *data, size_t len)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+void insertion_sort(int *v, size_t n, int (*cmp)(const void*, const void*))
+{
+  for (size_t i=1; i<n; i++) {
+    int key = v[i];
+    size_t j = i;
+    while (j && cmp(&v[j-1], &key) > 0) {
+      v[j] = v[j-1];
+      j--;
+    }
+    v[j] = key;
+  }
+}
+
+void sort_ints(int *v, size_t n)
+{
+  insertion_sort(v, n, cmp_int);
+}
+
+size_t count_words(const char *s)
+{
+  size_t words = 0;
+  int state = 0;
+  for (; *s; s++) {
+    switch (*s) {
+      case ' ': case '\t': case '\n':
+        state = 0;
+        break;
+      default:
+        if (!state)
+          words++;
+        state = 1;
+        break;
+    }
+  }
+  return words;
+}
+
+void matmul(const double *a, const double *b, double *c, int n)
+{
+  for (int i=0; i<n; i++)
+    for (int j=0; j<n; j++) {
+      double sum = 0;
+      for (int k=0; k<n; k++)
+        sum += a[i*n+k] * b[k*n+j];
+      c[i*n+j] = sum;
+    }
+}
+
+size_t copy_nonzero(int *dst, const int *src, size_t n)
+{
+  size_t j = 0;
+  for (size_t i=0; i<n; i++)
+    if (src[i])
+      dst[j++] = src[i];
+  return j;
+}
+
+int parse_int(const char *s, int *out)
+{
+  int sign = 1, value = 0;
+  if (*s == '-') {
+    sign = -1;
+    s++;
+  }
+  if (!*s)
+    return -1;
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9')
+      return -1;
+    value = value*10 + (*s - '0');
+  }
+  *out = sign * value;
+  return 0;
+}
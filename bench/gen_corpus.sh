@@ -0,0 +1,59 @@
+#!/bin/sh
+# raw -S output for bench-filter, built with the flags the server adds.
+# every compiler found on PATH contributes, then the largest C++ output
+# is repeated into 1M, 10M and 100M files for throughput at scale.
+#
+#   gen_corpus.sh <out dir>
+#   bench-filter -r <out dir>    record goldens with a known good build
+#   bench-filter <out dir>       measure and compare
+
+set -e
+
+if [ $# -ne 1 ]; then
+  echo "usage: gen_corpus.sh <out dir>" >&2
+  exit 1
+fi
+
+src=$(cd "$(dirname "$0")/corpus" && pwd)
+out=$1
+mkdir -p "$out"
+
+C_FLAGS="-g1 -fno-inline -fcf-protection=none -fno-unwind-tables -fno-asynchronous-unwind-tables -masm=intel"
+RUST_FLAGS="-C opt-level=3 -C llvm-args=--x86-asm-syntax=intel"
+
+for cc in gcc clang; do
+  command -v $cc > /dev/null || continue
+  for opt in O0 O2; do
+    $cc -$opt -S $C_FLAGS "$src/kernels.c" -o "$out/${cc}_c_$opt.s"
+  done
+done
+
+for cxx in g++:gcc clang++:clang; do
+  name=${cxx#*:}
+  cxx=${cxx%:*}
+  command -v $cxx > /dev/null || continue
+  for opt in O0 O2; do
+    $cxx -$opt -std=c++17 -S $C_FLAGS "$src/containers.cpp" -o "$out/${name}_cpp_$opt.s"
+  done
+done
+
+if command -v rustc > /dev/null; then
+  rustc --crate-type=lib $RUST_FLAGS --emit asm "$src/iter.rs" -o "$out/rustc_O3.s"
+fi
+
+base=$(ls -S "$out"/*_cpp_O2.s 2> /dev/null | head -n 1)
+if [ -z "$base" ]; then
+  echo "gen_corpus.sh: no C++ compiler found, skipping the scaled files" >&2
+  exit 0
+fi
+
+for size in 1 10 100; do
+  target=$((size * 1024 * 1024))
+  file="$out/scaled_${size}M.s"
+  : > "$file"
+  while [ $(wc -c < "$file") -lt $target ]; do
+    cat "$base" >> "$file"
+  done
+done
+
+ls -l "$out"
@@ -0,0 +1,55 @@
+#ifndef ASM_CRATE_H
+#define ASM_CRATE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+/*
+ * rustc compiles a crate at a time, whichever of its files was asked for.
+ * the crate's assembly is built once into an unfiltered buffer and every
+ * file of the crate filters its own functions out of it by .file/.loc,
+ * so opening five modules costs one rustc run. the crate is stale once
+ * any source named in its debug info is newer than the sources the last
+ * build read, to the nanosecond.
+ * with a cache root the compile keeps rustc incremental state there, one
+ * directory per crate, so a rebuild only redoes the modules that changed
+ */
+
+#define ASM_CRATE_OK    0
+#define ASM_CRATE_FAIL -1
+
+/* pinned so the incremental state is never invalidated by a flag change */
+#define ASM_CRATE_CODEGEN_UNITS "16"
+
+typedef struct AsmCrate {
+  char root[PATH_MAX];             // crate root source, the compile db "file"
+  char dir[PATH_MAX];              // the compile db "directory"
+  char *command;                   // whole crate to assembly on stdout
+  char err_path[PATH_MAX];         // the command's stderr, empty when discarded
+  char *error;                     // stderr of the last compile if it failed
+  char incremental[PATH_MAX];      // rustc incremental dir, empty if none
+  char *raw;                       // unfiltered output, shared by every file
+  size_t raw_len;
+  int status;                      // of the last compile
+  struct timespec built;           // newest source mtime the last compile read
+  unsigned long long generation;   // bumped when the output changes
+  unsigned long long runs;         // rustc invocations, changed output or not
+  char **sources;                  // crate files named by .file directives
+  unsigned int nsources;
+  struct AsmCrate *next;
+} AsmCrate;
+
+
+AsmCrate* AsmCrate_alloc(const char *root, const char *dir, const char *command,
+                         const char *cache_root) __nonnull((1,2,3));
+void      AsmCrate_free(AsmCrate*) __nonnull((1));
+AsmCrate* AsmCrate_find(AsmCrate *list, const char *root) __nonnull((2));
+size_t    AsmCrate_memory(const AsmCrate*) __nonnull((1));
+
+int       AsmCrate_compile(AsmCrate*, const struct timespec *mtime) __nonnull((1,2));
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef ASM_DEMANGLE_H
+#define ASM_DEMANGLE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * in process symbol demangling, replaces the old c++filt/rustfilt pipes.
+ * handles itanium C++ (_Z), rust legacy (_ZN..17h<hash>E) and rust v0 (_R)
+ * symbols, results are memoized so repeated names cost a single lookup.
+ * the memo is flushed once it holds DEMANGLE_MAX_ENTRIES names, a returned
+ * name is only valid until the next lookup
+ */
+
+#define DEMANGLE_HT_SIZE     4096
+#define DEMANGLE_MAX_ENTRIES 65536
+
+const char* AsmDemangle_symbol(const char *sym, size_t len) __nonnull((1));
+size_t      AsmDemangle_line(const char *line, size_t len,
+                             char *out, size_t out_max) __nonnull((1,3));
+void        AsmDemangle_clear(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef ASM_DIFF_H
+#define ASM_DIFF_H
+
+#include <stdlib.h>
+
+#include "cJSON.h"
+
+/*
+ * function level diff between two filtered asm buffers. functions are
+ * matched by name, compared by their label normalized body hash and the
+ * changed ones get a myers line diff
+ */
+
+#define MYERS_MAX_D 2048
+
+cJSON* AsmDiff_functions(const char *old_asm, size_t old_len,
+                         const char *new_asm, size_t new_len);
+
+#endif
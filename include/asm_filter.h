@@ -0,0 +1,110 @@
+#ifndef ASM_FILTER_H
+#define ASM_FILTER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "asm_funcs.h"
+#include "asm_lines.h"
+
+/*
+ * streaming filter over raw compiler -S output. lines can be fed whole,
+ * or as arbitrary chunks straight off a pipe, which lets several
+ * compilers be drained at once from a single poll loop
+ */
+
+#define ASM_FILTER_OK    0
+#define ASM_FILTER_FAIL -1
+
+#define FILTER_LINE_MAX     4096
+#define FILTER_DEMANGLE_MAX 16384
+#define FILTER_MAX_FILES    4096   // .file ids tracked by the source filter
+
+/* pipeline stages on top of the default filter, all off by default */
+#define ASM_FILTER_UNUSED_LABELS 0x1   // drop .L labels nothing refers to
+#define ASM_FILTER_DATA          0x2   // keep data directives under referenced labels
+
+/* a removable label line, plus any data under it */
+typedef struct AsmFilterRange {
+  uint64_t key;                // hash of the label name
+  unsigned long long start;
+  unsigned long long len;
+} AsmFilterRange;
+
+typedef struct AsmFilter {
+  char *asm_buffer;
+  unsigned long long asm_len;
+  size_t buf_max;
+  size_t line_len;
+  AsmFuncStats *stats;         // one entry per function label kept
+  unsigned int nstats;
+  unsigned int max_stats;
+
+  /*
+   * source filter, a function is kept when its first .loc points into
+   * one of keep_paths (exact real paths, or directories ending in '/').
+   * symbols without a ".type <name>, @function" are data and dropped
+   */
+  const char *const *keep_paths;
+  unsigned int nkeep;
+  int func_state;
+  unsigned long long func_start;
+  unsigned int func_nstats;
+  uint64_t func_type;          // label hash of the last @function .type, 0 for none
+  char comp_dir[PATH_MAX];
+  uint8_t keep_ids[FILTER_MAX_FILES/8];
+
+  /*
+   * label usage is only known at the end, references come before and
+   * after definitions. removable ranges are recorded as the text
+   * streams in and cut out in one compaction in AsmFilter_finish
+   */
+  unsigned int options;
+  AsmFilterRange *ranges;
+  unsigned int nranges;
+  unsigned int max_ranges;
+  uint64_t *used;              // referenced label hashes, open addressing
+  unsigned int nused;
+  unsigned int max_used;
+  int data_range;              // range data lines extend, -1 for none
+  bool data_open;              // directly under a label, data may follow
+  bool meta_section;           // debug and unwind sections, never shown
+
+  AsmLines *lines;             // tokenized copy of the output, NULL when off
+  uint16_t loc_file;           // last .loc, stamped on the lines after it
+  uint32_t loc_line;
+
+  char line_buffer[FILTER_LINE_MAX];
+  char demangle_buffer[FILTER_DEMANGLE_MAX];
+} AsmFilter;
+
+#define SCAN_NAME_MAX 8192
+
+/* function names from the ".type <name>, @function" directives */
+typedef struct AsmNameScan {
+  unsigned int phase;          // directive, name or @function suffix
+  unsigned int state;          // characters matched in the current phase
+  size_t name_len;
+  char *names;                 // newline separated, demangled
+  size_t len;
+  size_t max;
+  char name[SCAN_NAME_MAX];
+} AsmNameScan;
+
+
+void  AsmFilter_init(AsmFilter*) __nonnull((1));
+void  AsmFilter_keep_sources(AsmFilter*, const char *const *paths, unsigned int npaths) __nonnull((1));
+void  AsmFilter_set_options(AsmFilter*, unsigned int options) __nonnull((1));
+void  AsmFilter_track_lines(AsmFilter*, AsmLines *lines) __nonnull((1));
+int   AsmFilter_line(AsmFilter*, const char *line, size_t len) __nonnull((1,2));
+int   AsmFilter_feed(AsmFilter*, const char *chunk, size_t len) __nonnull((1,2));
+char* AsmFilter_finish(AsmFilter*, unsigned long long *len) __nonnull((1,2));
+AsmFuncStats* AsmFilter_take_stats(AsmFilter*, unsigned int *nstats) __nonnull((1,2));
+
+void  AsmNameScan_init(AsmNameScan*) __nonnull((1));
+int   AsmNameScan_feed(AsmNameScan*, const char *chunk, size_t len) __nonnull((1,2));
+char* AsmNameScan_finish(AsmNameScan*, size_t *len) __nonnull((1,2));
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef ASM_FUNCS_H
+#define ASM_FUNCS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * function index over filtered assembly, every symbol label opens a
+ * function that runs until the next one. names and bodies point straight
+ * into the asm buffer, so the index is only valid while that buffer is
+ */
+
+#define ASM_FUNCS_OK    0
+#define ASM_FUNCS_FAIL -1
+
+#define ASM_LABEL_MAP_MAX 4096
+
+typedef struct AsmFunction {
+  const char *name;
+  size_t name_len;
+  size_t body_start;       // offset of the first line after the label
+  size_t body_end;
+  unsigned int ninstr;
+  unsigned int est_size;   // rough x86-64 encoding size in bytes
+  uint64_t hash;           // body hash with .L labels renumbered
+  uint64_t name_hash;
+} AsmFunction;
+
+#define ASM_VECTOR_NONE 0
+#define ASM_VECTOR_XMM  1
+#define ASM_VECTOR_YMM  2
+#define ASM_VECTOR_ZMM  3
+
+/* per function counters gathered while filtering */
+typedef struct AsmFuncStats {
+  size_t name_offset;      // into the filtered buffer, which may still move
+  size_t name_len;
+  unsigned int ninstr;
+  unsigned int est_size;
+  unsigned int ncalls;
+  unsigned int nbranches;
+  unsigned int nvector;    // packed vector instructions, not scalar sse
+  unsigned int vector_width;
+} AsmFuncStats;
+
+/* .L labels in order of first use, reset for every function */
+typedef struct AsmLabelMap {
+  uint64_t keys[ASM_LABEL_MAP_MAX];
+  unsigned int nkeys;
+} AsmLabelMap;
+
+typedef struct AsmFunctionIndex {
+  const char *asm_buffer;
+  AsmFunction *funcs;
+  unsigned int nfuncs;
+  int *buckets;            // name hash -> first function, -1 terminated chains
+  int *chain;
+  unsigned int nbuckets;
+} AsmFunctionIndex;
+
+
+int          AsmFunctionIndex_build(AsmFunctionIndex*, const char *asm_buffer,
+                                    size_t len) __nonnull((1));
+void         AsmFunctionIndex_free(AsmFunctionIndex*) __nonnull((1));
+AsmFunction* AsmFunctionIndex_find(AsmFunctionIndex*, const char *name,
+                                   size_t len) __nonnull((1,2));
+
+size_t       AsmFuncs_normalize_line(const char *line, size_t len,
+                                     char *out, size_t out_max,
+                                     AsmLabelMap *labels) __nonnull((1,3,5));
+unsigned int AsmFuncs_estimate_size(const char *line, size_t len) __nonnull((1));
+void         AsmFuncs_stats_line(AsmFuncStats*, const char *line, size_t len) __nonnull((1,2));
+const char*  AsmFuncs_vector_name(unsigned int width);
+
+#endif
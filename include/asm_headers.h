@@ -0,0 +1,51 @@
+#ifndef ASM_HEADERS_H
+#define ASM_HEADERS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+/*
+ * headers are never in compile_commands.json, so a header request is
+ * served by compiling a translation unit that includes it. the index maps
+ * header real paths to compile db entries, filled from -MM dependency
+ * output. it is built lazily: units naming the header in an #include are
+ * scanned first, the whole database only when that finds nothing
+ */
+
+#define ASM_HEADERS_OK    0
+#define ASM_HEADERS_FAIL -1
+
+#define ASM_HEADER_JOBS 8
+
+typedef struct AsmHeaderEntry {
+  char *path;
+  int *tus;                // indices into nodes
+  unsigned int ntus;
+  unsigned int max_tus;
+} AsmHeaderEntry;
+
+typedef struct AsmHeaderIndex {
+  cJSON **nodes;           // C and C++ compile db entries
+  unsigned int nnodes;
+  bool *scanned;
+  unsigned int nscanned;
+  AsmHeaderEntry *entries;
+  unsigned int nentries;
+  unsigned int max_entries;
+  int *buckets;            // path hash -> entry, open addressing, -1 empty
+  unsigned int nbuckets;
+} AsmHeaderIndex;
+
+/* lets the caller prefer a unit whose assembly it already holds */
+typedef bool (*AsmHeaderCached)(const char *tu_file, void *ctx);
+
+
+int    AsmHeaders_init(AsmHeaderIndex*, cJSON *root) __nonnull((1,2));
+void   AsmHeaders_free(AsmHeaderIndex*) __nonnull((1));
+bool   AsmHeaders_is_header(const char *path) __nonnull((1));
+cJSON* AsmHeaders_find_tu(AsmHeaderIndex*, const char *header,
+                          AsmHeaderCached cached, void *ctx) __nonnull((1,2));
+
+#endif
@@ -12,9 +12,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <poll.h>
+
 #include <sys/stat.h>
 
 #include "cJSON.h"
+#include "asm_tucache.h"
+#include "asm_funcs.h"
+#include "asm_lines.h"
+#include "asm_crate.h"
+#include "asm_object.h"
 
 #define ASM_INST_OK    0
 #define ASM_INST_FAIL -1
@@ -28,19 +35,66 @@
 #define FILE_TYPE_CPP  1
 #define FILE_TYPE_RUST 2
 
+#define ASM_MAX_VARIANTS     16
+#define ASM_VARIANT_NAME_MAX 64
+#define ASM_DEFAULT_VARIANT  "default"
+#define ASM_MAX_KEEP_PATHS   16
+#define ASM_RANGE_MAX_LINES  4096   // most lines one ranged response carries
+#define ASM_RANGE_CONTEXT    8      // lines either side of a requested function
+
+/* 
+ * an alternative build of the same file, e.g -O3 or another compiler, 
+ * cached separately from the default output 
+ */
+typedef struct AsmVariant {
+  char name[ASM_VARIANT_NAME_MAX]; 
+  char *rebuild_command; 
+  char *asm_buffer; 
+  time_t time_changed;            // source mtime of the cached output
+  char *compile_error;            // stderr of the last compile if it failed
+  unsigned long long generation; 
+  unsigned long long asm_buflen; 
+  AsmFuncStats *stats;            // names are offsets into asm_buffer
+  unsigned int nstats; 
+  AsmLines lines;                 // asm_buffer tokenized by the filter
+} AsmVariant; 
+
 typedef struct AsmInstance {
   char infile[PATH_MAX];          
   char *rebuild_command;
+  char *base_command;             // original flags, no -o and none of ours
+  char *pch_command;
+  char *source_file;              // headers and rust modules, the unit compiled for them
+  char **keep_paths;              // sources whose functions are kept, none keeps all
+  unsigned int nkeep;
+  unsigned int filter_options;    // ASM_FILTER_* pipeline stages
+  bool highlight;                 // assembly responses carry "hl" spans
+  AsmTUCache *tu_cache; 
+  AsmCrate *crate;                // rust, the crate compile shared by its files
+  unsigned long long crate_generation; 
+  char *object_file;              // the build's output for this unit, if any
+  bool from_object;               // asm_buffer was disassembled from it
   cJSON *compile_node; 
   char  *asm_buffer; 
-  unsigned long long time_changed; 
+  char  *prev_asm_buffer;         // the compile before this one, for diffs
+  time_t time_changed;            // source mtime of the cached output
+  char *compile_error;            // stderr of the last compile if it failed
+  unsigned long long generation; 
+  unsigned long long deps_generation; 
   unsigned long long asm_buflen;
+  unsigned long long prev_asm_buflen;
+  AsmFuncStats *stats;
+  unsigned int nstats;
+  AsmLines lines; 
+  AsmVariant variants[ASM_MAX_VARIANTS]; 
+  unsigned int nvariants; 
   unsigned short ft;  
 } AsmInstance; 
 
 
 AsmInstance* AsmInstance_alloc(char *fname) __nonnull((1)); 
 void         AsmInstance_free(AsmInstance*) __nonnull((1)); 
+size_t       AsmInstance_memory(AsmInstance*) __nonnull((1)); 
 
 cJSON* AsmInstance_get_compile_node(AsmInstance *inst) __nonnull((1)); 
 char*  AsmInstance_get_filename(AsmInstance *inst) __nonnull((1)); 
@@ -50,8 +104,32 @@ const char*  AsmInstance_get_filetype(AsmInstance *inst) __nonnull((1));
 
 int    AsmInstance_parse_command_C(AsmInstance*, cJSON*) __nonnull((1,2)); 
 int    AsmInstance_parse_command_RUST(AsmInstance*, cJSON*) __nonnull((1,2)); 
-
+int    AsmInstance_set_crate(AsmInstance*, AsmCrate*) __nonnull((1,2)); 
+int    AsmInstance_parse_command_header(AsmInstance*, cJSON*) __nonnull((1,2)); 
+int    AsmInstance_keep_sources(AsmInstance*, const char *const*, unsigned int) __nonnull((1)); 
+void   AsmInstance_set_filter_options(AsmInstance*, unsigned int) __nonnull((1)); 
+int    AsmInstance_enable_tu_cache(AsmInstance*, const char*) __nonnull((1,2)); 
+
+int    AsmInstance_compile(AsmInstance*) __nonnull((1)); 
+int    AsmInstance_compile_variant(AsmInstance*, const char*) __nonnull((1)); 
+int    AsmInstance_add_variant(AsmInstance*, const char*, 
+                               const char*, const char*) __nonnull((1,2)); 
+AsmVariant* AsmInstance_get_variant(AsmInstance*, const char*) __nonnull((1,2)); 
+
+int    AsmInstance_send_json(int, cJSON*) __nonnull((2)); 
 int    AsmInstance_assembly_message(AsmInstance*, int) __nonnull((1)); 
+int    AsmInstance_variant_message(AsmInstance*, const char*, int) __nonnull((1)); 
+int    AsmInstance_variants_message(AsmInstance*, int) __nonnull((1)); 
+int    AsmInstance_diff_message(AsmInstance*, int) __nonnull((1)); 
+int    AsmInstance_stats_message(AsmInstance*, const char*, int) __nonnull((1)); 
+int    AsmInstance_range_message(AsmInstance*, const char *variant, unsigned int start_line, 
+                                 unsigned int count, const char *function, 
+                                 unsigned int context, int) __nonnull((1)); 
+int    AsmInstance_analyze_message(AsmInstance*, const char *variant, const char *function, 
+                                   const char *start_label, const char *end_label, 
+                                   const char *work_dir, int) __nonnull((1,3,6)); 
+int    AsmInstance_profile_message(AsmInstance*, const char *variant, const char *perf_file, 
+                                   int) __nonnull((1,3)); 
 int    AsmInstance_function_message(AsmInstance*, int) __nonnull((1));
 
 
@@ -0,0 +1,86 @@
+#ifndef ASM_LINES_H
+#define ASM_LINES_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * the filtered text tokenized once, as it is written. one entry per
+ * output line in parallel arrays, so a pass over one field (kinds for
+ * paging, operand spans for highlighting) only touches that field.
+ * offsets point into the filter's asm buffer and move with it
+ */
+
+#define ASM_LINES_OK    0
+#define ASM_LINES_FAIL -1
+
+#define ASM_LINE_BLANK 0
+#define ASM_LINE_FUNC  1   // symbol label, opens a function
+#define ASM_LINE_LABEL 2   // .L label
+#define ASM_LINE_INSTR 3
+#define ASM_LINE_DATA  4   // kept data directive
+
+#define ASM_LINES_NONE UINT32_MAX
+
+/* highlight classes, the client maps them onto its own groups */
+#define ASM_HL_MNEMONIC  0
+#define ASM_HL_REGISTER  1
+#define ASM_HL_IMMEDIATE 2
+#define ASM_HL_LABEL     3
+#define ASM_HL_MEMORY    4
+#define ASM_HL_COMMENT   5
+
+/* interned strings, ids start at 1 so 0 can mean none */
+typedef struct AsmNameTable {
+  char *pool;
+  size_t pool_len;
+  size_t pool_max;
+  uint32_t *offsets;       // id -> pool offset, names are '\0' terminated
+  uint32_t n;
+  uint32_t max;
+  uint32_t *buckets;       // hash -> id, 0 empty
+  uint32_t nbuckets;
+} AsmNameTable;
+
+typedef struct AsmLines {
+  uint32_t n;
+  uint32_t max;
+  uint32_t *offset;        // line start in the asm buffer
+  uint16_t *len;           // without the newline
+  uint8_t  *kind;
+  uint8_t  *nops;
+  uint16_t *mnemonic;      // instruction or directive name, 0 none
+  uint32_t *op_first;      // index of the first operand span
+  uint32_t *label;         // label defined here, or a branch target, 0 none
+  uint32_t *func;          // owning function, ASM_LINES_NONE before the first
+  uint16_t *src_file;      // last .loc seen, 0 unknown
+  uint32_t *src_line;
+
+  /* operand spans, relative to the line start */
+  uint32_t nspans;
+  uint32_t max_spans;
+  uint16_t *span_start;
+  uint16_t *span_len;
+
+  uint32_t nfuncs;
+  AsmNameTable mnemonics;
+  AsmNameTable labels;
+} AsmLines;
+
+
+void     AsmLines_init(AsmLines*) __nonnull((1));
+void     AsmLines_free(AsmLines*) __nonnull((1));
+size_t   AsmLines_memory(const AsmLines*) __nonnull((1));
+
+int      AsmLines_add(AsmLines*, const char *text, size_t offset, size_t len,
+                      bool func, uint16_t src_file, uint32_t src_line) __nonnull((1,2));
+void     AsmLines_truncate(AsmLines*, size_t offset, uint32_t nfuncs) __nonnull((1));
+
+uint32_t    AsmLines_at_offset(const AsmLines*, size_t offset) __nonnull((1));
+const char* AsmLines_name(const AsmNameTable*, uint32_t id) __nonnull((1));
+
+char*       AsmLines_highlight(const AsmLines*, const char *asm_buffer, uint32_t first,
+                               uint32_t count, size_t *len) __nonnull((1,2,5));
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ASM_MCA_H
+#define ASM_MCA_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+/*
+ * throughput analysis of a block of filtered assembly through llvm-mca.
+ * symbol operands are replaced before the block is handed over, since
+ * demangled names are not valid assembler input and do not change the
+ * timing. results are memoized on (block text, cpu)
+ */
+
+#define ASM_MCA_OK    0
+#define ASM_MCA_FAIL -1
+
+#define ASM_MCA_BIN     "llvm-mca"
+#define ASM_MCA_CPU_MAX 64
+#define MCA_HT_SIZE     1024
+
+int    AsmMca_cpu_from_command(const char *cmd, char *cpu, size_t cpu_max) __nonnull((1,2));
+cJSON* AsmMca_analyze(const char *block, size_t len, const char *cpu,
+                      const char *work_dir, bool *cached) __nonnull((1,3,4));
+void   AsmMca_clear(void);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef ASM_METRICS_H
+#define ASM_METRICS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+/*
+ * server side counters and latency histograms. histograms are log2
+ * buckets of microseconds, so recording is a clz and an increment and
+ * percentiles come back as bucket upper bounds
+ */
+
+#define ASM_METRICS_OK    0
+#define ASM_METRICS_FAIL -1
+
+#define METRICS_BUCKETS 32
+
+enum {
+  ASM_PHASE_QUEUE = 0,     // socket readable in the poll loop to dispatch
+  ASM_PHASE_COMPILE,       // first compiler spawned to last one reaped
+  ASM_PHASE_FILTER,        // time inside the filter, overlaps compile
+  ASM_PHASE_SERIALIZE,
+  ASM_PHASE_WRITE,
+  ASM_PHASE_REQUEST,       // dispatch start to response written
+  ASM_PHASE_COUNT
+};
+
+enum {
+  ASM_COUNT_REQUESTS = 0,
+  ASM_COUNT_ERRORS,
+  ASM_COUNT_CACHE_HIT,     // output still fresh, no compiler run
+  ASM_COUNT_CACHE_MISS,
+  ASM_COUNT_CACHE_EVICT,   // a cached output dropped for a newer one
+  ASM_COUNT_COMPILES,
+  ASM_COUNT_OBJECTS,       // outputs disassembled from a fresh build object
+  ASM_COUNT_BYTES_IN,
+  ASM_COUNT_BYTES_OUT,
+  ASM_COUNT_COUNT
+};
+
+typedef struct AsmHistogram {
+  uint64_t buckets[METRICS_BUCKETS];
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+} AsmHistogram;
+
+
+void     AsmMetrics_init(void);
+uint64_t AsmMetrics_now(void);
+void     AsmMetrics_record(int phase, uint64_t ns);
+void     AsmMetrics_since(int phase, uint64_t start_ns);
+void     AsmMetrics_count(int counter, uint64_t n);
+void     AsmMetrics_jobs(int delta);
+cJSON*   AsmMetrics_json(void);
+int      AsmMetrics_write_file(cJSON *metrics, const char *path) __nonnull((1,2));
+
+#endif
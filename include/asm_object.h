@@ -0,0 +1,25 @@
+#ifndef ASM_OBJECT_H
+#define ASM_OBJECT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * the build's own object for a unit, disassembled instead of recompiled
+ * while it is as new as the source and everything the build's depfile
+ * names. function symbols come from the ELF symbol table read in process,
+ * objdump (or llvm-objdump) only supplies the instruction text, which is
+ * written back out in the -S form (labels, .L jump targets, symbols from
+ * relocations) so the usual filter runs over it.
+ * the object carries the build's flags, not the server's, so functions
+ * the build inlined are not there
+ */
+
+#define ASM_OBJECT_OK    0
+#define ASM_OBJECT_FAIL -1
+
+bool  AsmObject_fresh(const char *object, const struct timespec *source_mtime, const char *directory) __nonnull((1,2));
+char* AsmObject_disassemble(const char *object, size_t *len) __nonnull((1,2));
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef ASM_PERF_H
+#define ASM_PERF_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "cJSON.h"
+
+/*
+ * sampling profiles imported from perf text output. `perf script` gives
+ * one symbol+offset per sample, `perf annotate --stdio` gives a percent
+ * per disassembled instruction. both are reduced to per symbol sample
+ * lists and mapped back onto a filtered asm buffer through the function
+ * index. the last profile loaded stays cached until the file changes
+ */
+
+#define ASM_PERF_OK    0
+#define ASM_PERF_FAIL -1
+
+typedef struct AsmPerfSample {
+  uint64_t offset;         // bytes from the symbol start
+  int ordinal;             // instruction number for annotate input, -1 otherwise
+  double count;
+} AsmPerfSample;
+
+typedef struct AsmPerfSymbol {
+  char *name;
+  size_t name_len;
+  double total;
+  AsmPerfSample *samples;
+  unsigned int nsamples;
+  unsigned int max_samples;
+} AsmPerfSymbol;
+
+typedef struct AsmPerfProfile {
+  char *path;
+  time_t mtime;
+  off_t size;
+  double total;
+  AsmPerfSymbol *syms;
+  unsigned int nsyms;
+  unsigned int max_syms;
+  int *buckets;            // name hash -> symbol, -1 for empty
+  unsigned int nbuckets;
+} AsmPerfProfile;
+
+
+AsmPerfProfile* AsmPerf_get(const char *path) __nonnull((1));
+void            AsmPerf_clear(void);
+cJSON*          AsmPerf_annotate(AsmPerfProfile*, const char *asm_buffer,
+                                 size_t len) __nonnull((1));
+
+#endif
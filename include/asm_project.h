@@ -0,0 +1,21 @@
+#ifndef ASM_PROJECT_H
+#define ASM_PROJECT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "cJSON.h"
+
+/*
+ * locating and loading the project compile database. the directory given
+ * to the server and its parent are searched, the file is mapped and
+ * parsed in one go
+ */
+
+#define ASM_PROJECT_FILE "compile_commands.json"
+
+bool   AsmProject_find(char project_path[PATH_MAX], const char *project_file) __nonnull((1,2));
+cJSON* AsmProject_parse(const char *project_path, size_t *bytes) __nonnull((1));
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef ASM_TRACE_H
+#define ASM_TRACE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * opt-in chrome trace-event output (loads in perfetto / chrome://tracing).
+ * spans are pushed into a per-thread single producer ring without locks
+ * and only formatted when AsmTrace_flush() runs, which the server does
+ * while idle. a full ring drops events instead of blocking the request.
+ * names must be string literals, only the pointer is kept
+ */
+
+#define ASM_TRACE_OK    0
+#define ASM_TRACE_FAIL -1
+
+#define ASM_TRACE_RING        8192   // events per thread, power of two
+#define ASM_TRACE_MAX_THREADS 16
+#define ASM_TRACE_ARG_MAX     64
+
+typedef struct AsmTraceEvent {
+  const char *name;
+  uint64_t ts_ns;
+  uint64_t dur_ns;
+  uint32_t id;                     // async spans, 0 for a plain span
+  char arg[ASM_TRACE_ARG_MAX];
+} AsmTraceEvent;
+
+extern bool asm_trace_enabled;
+
+int      AsmTrace_open(const char *path) __nonnull((1));
+void     AsmTrace_close(void);
+uint64_t AsmTrace_now(void);
+void     AsmTrace_span(const char *name, uint64_t start_ns, uint64_t end_ns,
+                       uint32_t id, const char *arg) __nonnull((1));
+unsigned AsmTrace_pending(void);
+void     AsmTrace_flush(void);
+
+/* zero when tracing is off, so the disabled cost is one branch */
+static inline uint64_t AsmTrace_begin(void)
+{
+  return asm_trace_enabled ? AsmTrace_now() : 0;
+}
+
+static inline void AsmTrace_end(const char *name, uint64_t start_ns)
+{
+  if (start_ns)
+    AsmTrace_span(name, start_ns, AsmTrace_now(), 0, NULL);
+}
+
+static inline void AsmTrace_end_arg(const char *name, uint64_t start_ns, const char *arg)
+{
+  if (start_ns)
+    AsmTrace_span(name, start_ns, AsmTrace_now(), 0, arg);
+}
+
+#endif
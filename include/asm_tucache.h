@@ -0,0 +1,67 @@
+#ifndef ASM_TUCACHE_H
+#define ASM_TUCACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <sys/types.h>
+
+/*
+ * translation unit cache for C|C++ instances. the leading #include block
+ * of a source file is compiled once into a precompiled header, and every
+ * dependency seen by the compiler is content hashed so a rebuild can be
+ * skipped (or the pch reused) when only the body of the .c|.cpp changed.
+ * the artifact directory belongs to one server process and goes with the
+ * cache, the prefix compiles with -iquote <source dir> so quoted includes
+ * still resolve from there. the pch builds in the background, compiles go
+ * without it until it is ready
+ */
+
+#define TU_CACHE_OK    0
+#define TU_CACHE_FAIL -1
+
+typedef struct AsmDepFile {
+  char *path;
+  uint64_t hash;
+  time_t mtime;
+  off_t size;
+} AsmDepFile;
+
+typedef struct AsmDepList {
+  AsmDepFile *files;
+  unsigned int nfiles;
+} AsmDepList;
+
+typedef struct AsmTUCache {
+  char dir[PATH_MAX];          // per instance artifact directory
+  char prefix_header[PATH_MAX];
+  char tu_depfile[PATH_MAX];
+  char source_dir[PATH_MAX];   // -iquote for the prefix, it lives in dir
+  char *pch_command;           // compile flags without the source file
+  uint64_t prefix_key;         // include prefix text + flags
+  uint64_t pch_failed_key;     // prefix that did not build, not retried
+  uint64_t tu_key;             // source + dependency contents, last compile
+  uint64_t pch_build_key;      // prefix the running pch build is for
+  pid_t pch_pid;               // running pch build, 0 for none
+  AsmDepList prefix_deps;
+  AsmDepList tu_deps;
+  bool pch_valid;
+  bool is_cpp;
+  bool is_clang;
+} AsmTUCache;
+
+
+AsmTUCache* AsmTUCache_alloc(const char *cache_root, const char *infile,
+                             const char *pch_command, bool is_cpp) __nonnull((1,2,3));
+void        AsmTUCache_free(AsmTUCache*) __nonnull((1));
+
+bool        AsmTUCache_deps_fresh(AsmTUCache*) __nonnull((1));
+uint64_t    AsmTUCache_tu_key(AsmTUCache*, const char *infile) __nonnull((1,2));
+int         AsmTUCache_prepare_pch(AsmTUCache*, const char *infile) __nonnull((1,2));
+int         AsmTUCache_update_deps(AsmTUCache*) __nonnull((1));
+
+uint64_t    AsmTUCache_hash(uint64_t seed, const void *data, size_t len);
+
+#endif
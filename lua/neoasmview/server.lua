@@ -11,6 +11,25 @@ M.augroup = nil
 M.file_to_buf = {}
 M.buf_to_file = {}
 
+-- only functions defined in the file itself, plus any keep paths
+-- (absolute, or relative to the cwd, directories end in "/")
+M.source_only = false
+M.source_keep = {}
+
+-- filter pipeline stages: labels (drop unused), data (referenced constants)
+M.filters = { labels = false, data = false }
+
+-- server computed highlight spans instead of the regex syntax of
+-- filetype=asm, applied only to the lines being drawn
+M.highlight = true
+M.hl_spans = {}
+M.hl_groups = { [0] = "Keyword", "Identifier", "Number", "Label", "Special", "Comment" }
+
+-- outputs are fetched a page at a time around the windows showing them,
+-- 0 asks for the whole output in one response
+M.page_lines = 2000
+M.pages = {}
+
 M.handle = nil
 M.stdout = nil
 M.stderr = nil
@@ -125,7 +144,87 @@ function M.start()
         local filepath = json_obj.filepath
         local asm = json_obj.asm
 
+        -- one page of a ranged assembly request
+        if json_obj.total_lines then
+          M.apply_page(filepath, json_obj)
+          return
+        end
+
+        -- server wide metrics, no buffer attached
+        if json_obj.latency then
+          local c = json_obj.counters
+          local out = { string.format("[vimasm] %d requests, %d errors, cache hit %.0f%%, %d instances (%d KiB)",
+                                      c.requests, c.errors, c.cache_hit_rate * 100,
+                                      json_obj.instances.count, json_obj.instances.bytes / 1024) }
+          for name, h in pairs(json_obj.latency) do
+            if h.count > 0 then
+              table.insert(out, string.format("  %-13s n=%-5d p50 %8.2fms  p99 %8.2fms  max %8.2fms",
+                                              name, h.count, h.p50_ms, h.p99_ms, h.max_ms))
+            end
+          end
+          vim.notify(table.concat(out, "\n"), vim.log.levels.INFO)
+          return
+        end
+
+        -- perf hotness, drawn over the lines already in the buffer
+        if json_obj.profile then
+          M.apply_profile(filepath, json_obj)
+          return
+        end
+
+        -- llvm-mca summary, shown without touching the asm buffer
+        if json_obj.block_rthroughput then
+          local out = { string.format("[vimasm] %s (%s): block rthroughput %.2f, %.2f uops, ipc %.2f",
+                                      json_obj.function, json_obj.cpu, json_obj.block_rthroughput,
+                                      json_obj.uops, json_obj.ipc) }
+          for name, usage in pairs(json_obj.resource_pressure) do
+            if usage > 0 then
+              table.insert(out, string.format("  %-14s %.2f", name, usage))
+            end
+          end
+          vim.notify(table.concat(out, "\n"), vim.log.levels.INFO)
+          return
+        end
+
+        -- variants side by side, one block per name
+        if json_obj.variants then
+          local blocks = {}
+          for _, v in ipairs(json_obj.variants) do
+            table.insert(blocks, "; ==== " .. v.name .. " ====\n" .. v.asm)
+          end
+          asm = table.concat(blocks, "\n")
+        end
+
+        -- per function codegen diff
+        if json_obj.summary and json_obj.functions then
+          local s = json_obj.summary
+          local out = { string.format("; unchanged %d, changed %d, added %d, removed %d",
+                                      s.unchanged, s.changed, s.added, s.removed) }
+          for _, f in ipairs(json_obj.functions) do
+            if f.status ~= "unchanged" then
+              table.insert(out, string.format("\n; %s %s (instructions %+d, size %+d)",
+                                              f.status, f.name, f.instructions_delta, f.size_delta))
+              if f.diff then table.insert(out, f.diff) end
+            end
+          end
+          asm = table.concat(out, "\n")
+        end
+
+        -- per function instruction stats
+        if json_obj.totals and json_obj.functions then
+          local t = json_obj.totals
+          local out = { string.format("; %d functions, %d instructions, ~%d bytes, widest vector %s",
+                                      t.functions, t.instructions, t.size, t.vector_width) }
+          for _, f in ipairs(json_obj.functions) do
+            table.insert(out, string.format("%6d %6d %4d %4d %4s  %s",
+                                            f.instructions, f.size, f.calls, f.branches,
+                                            f.vector_width, f.name))
+          end
+          asm = table.concat(out, "\n")
+        end
+
         M.send_to_buffer(filepath, asm)
+        M.set_highlight(filepath, json_obj.hl)
       end
     end))
   end)
@@ -172,6 +271,8 @@ function M.register_buffer(filename, bufnr)
     callback = function()
       M.file_to_buf[path] = nil
       M.buf_to_file[bufnr] = nil
+      M.hl_spans[bufnr] = nil
+      M.pages[bufnr] = nil
 
       -- If no buffers left, stop server
       if vim.tbl_isempty(M.file_to_buf) then
@@ -274,7 +375,19 @@ function M.open_functions_vertical()
 end
 
 
-function M.send_assembly_request(filename)
+function M.source_keep_paths()
+  if not M.source_only or #M.source_keep == 0 then
+    return nil
+  end
+  local paths = {}
+  for _, path in ipairs(M.source_keep) do
+    table.insert(paths, vim.fn.fnamemodify(path, ":p"))
+  end
+  return paths
+end
+
+
+function M.send_assembly_request(filename, variant, range)
   if not M.startup_done then
     print("[vimasm] server socket not available")
     return
@@ -283,6 +396,152 @@ function M.send_assembly_request(filename)
   local request = {
     filepath = filename,
     command = "assembly",
+    variant = variant,
+    source_only = M.source_only,
+    keep = M.source_keep_paths(),
+    filters = M.filters,
+    highlight = M.highlight,
+  }
+
+  -- a fresh request starts the pages over, the output may have changed
+  if not range and M.page_lines > 0 and variant ~= "all" then
+    local bufid = M.file_to_buf[filename]
+    if bufid then M.pages[bufid] = nil end
+    range = { start_line = 0, count = M.page_lines }
+  end
+  if range then
+    request.start_line = range.start_line
+    request.count = range.count
+    request["function"] = range["function"]
+    request.context = range.context
+  end
+  
+  local json = vim.json.encode(request) .. "\n"
+  
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+function M.send_diff_request(filename)
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+  
+  local request = {
+    filepath = filename,
+    command = "diff",
+  }
+  
+  local json = vim.json.encode(request) .. "\n"
+  
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+function M.send_stats_request(filename, variant)
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+  
+  local request = {
+    filepath = filename,
+    command = "stats",
+    variant = variant,
+  }
+  
+  local json = vim.json.encode(request) .. "\n"
+  
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+function M.send_server_stats_request()
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+
+  local json = vim.json.encode({ command = "stats" }) .. "\n"
+
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+function M.send_profile_request(filename, perf_file)
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+  
+  local request = {
+    filepath = filename,
+    command = "profile",
+    perf = perf_file,
+  }
+  
+  local json = vim.json.encode(request) .. "\n"
+  
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+function M.send_analyze_request(filename, func, start_label, end_label)
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+  
+  local request = {
+    filepath = filename,
+    command = "analyze",
+    ["function"] = func,
+    start_label = start_label,
+    end_label = end_label,
+  }
+  
+  local json = vim.json.encode(request) .. "\n"
+  
+  uv.write(M.client, json, function(err)
+    if err then
+      print("[vimasm] failed to write to server socket:", err)
+    end
+  end)
+end
+
+
+-- variants = { { name = "O3", flags = "-O3", compiler = "clang" }, ... }
+function M.send_variants_request(filename, variants)
+  if not M.startup_done then
+    print("[vimasm] server socket not available")
+    return
+  end
+  
+  local request = {
+    filepath = filename,
+    command = "variants",
+    variants = variants,
   }
   
   local json = vim.json.encode(request) .. "\n"
@@ -304,6 +563,8 @@ function M.send_function_request(filename)
   local request = {
     filepath = filename,
     command = "functions",
+    source_only = M.source_only,
+    keep = M.source_keep_paths(),
   }
   
   local json = vim.json.encode(request) .. "\n"
@@ -336,6 +597,148 @@ end
 
 
 -- multiplex on file path
+M.profile_ns = vim.api.nvim_create_namespace("vimasm_profile")
+
+function M.apply_profile(filename, profile)
+  local bufid = M.file_to_buf[filename]
+  if bufid == nil then
+    print("[vimasm] no buffer associated with file" .. filename)
+    return
+  end
+
+  vim.api.nvim_buf_clear_namespace(bufid, M.profile_ns, 0, -1)
+  local nlines = vim.api.nvim_buf_line_count(bufid)
+  for _, f in ipairs(profile.functions) do
+    for _, l in ipairs(f.lines) do
+      if l.line < nlines then
+        local hl = l.percent >= 10 and "ErrorMsg" or (l.percent >= 2 and "WarningMsg" or "Comment")
+        vim.api.nvim_buf_set_extmark(bufid, M.profile_ns, l.line, 0, {
+          virt_text = { { string.format("%5.1f%%", l.percent), hl } },
+          virt_text_pos = "eol",
+        })
+      end
+    end
+  end
+end
+
+
+-- spans come as flat {line delta, col, len, class} quads, lines are made
+-- absolute once and indexed by their first span for the redraw hook.
+-- pages add a chunk each, a whole output replaces them all
+M.hl_ns = vim.api.nvim_create_namespace("vimasm_highlight")
+
+function M.clear_highlight(bufid)
+  if M.hl_spans[bufid] then
+    M.hl_spans[bufid] = nil
+    vim.api.nvim_buf_set_option(bufid, "syntax", "asm")
+  end
+end
+
+
+function M.set_highlight(filename, hl, base)
+  local bufid = M.file_to_buf[filename]
+  if bufid == nil then
+    return
+  end
+
+  if not base then
+    M.clear_highlight(bufid)
+  end
+  if not hl then
+    return
+  end
+
+  local first = {}
+  local line = base or 0
+  for i = 1, #hl, 4 do
+    line = line + hl[i]
+    hl[i] = line
+    if first[line] == nil then first[line] = i end
+  end
+
+  local chunks = M.hl_spans[bufid] or {}
+  table.insert(chunks, { spans = hl, first = first })
+  M.hl_spans[bufid] = chunks
+  vim.api.nvim_buf_set_option(bufid, "syntax", "OFF")
+end
+
+
+function M.draw_highlight_line(bufid, row)
+  for _, chunk in ipairs(M.hl_spans[bufid]) do
+    local spans = chunk.spans
+    local i = chunk.first[row]
+    while i and i <= #spans and spans[i] == row do
+      pcall(vim.api.nvim_buf_set_extmark, bufid, M.hl_ns, row, spans[i+1], {
+        end_col = spans[i+1] + spans[i+2],
+        hl_group = M.hl_groups[spans[i+3]],
+        ephemeral = true,
+      })
+      i = i + 4
+    end
+  end
+end
+
+
+-- the buffer holds total_lines lines, blank until their page arrives
+function M.apply_page(filename, page)
+  local bufid = M.file_to_buf[filename]
+  if bufid == nil then
+    print("[vimasm] no buffer associated with file" .. filename)
+    return
+  end
+
+  local lines = vim.split(page.asm, "\n", { plain = true })
+  table.remove(lines)  -- the slice ends in a newline
+
+  vim.api.nvim_buf_set_option(bufid, "modifiable", true)
+  local state = M.pages[bufid]
+  if not state or state.total ~= page.total_lines or state.variant ~= page.variant then
+    state = { total = page.total_lines, variant = page.variant, loaded = {} }
+    M.pages[bufid] = state
+    M.clear_highlight(bufid)
+
+    local blank = {}
+    for i = 1, page.total_lines do blank[i] = "" end
+    vim.api.nvim_buf_set_lines(bufid, 0, -1, false, blank)
+  end
+  vim.api.nvim_buf_set_lines(bufid, page.start_line, page.start_line + #lines, false, lines)
+  vim.api.nvim_buf_set_option(bufid, "modifiable", false)
+
+  if page.start_line % M.page_lines == 0 then
+    state.loaded[page.start_line / M.page_lines] = true
+  end
+  M.set_highlight(filename, page.hl, page.start_line)
+
+  if page.function_line then
+    for _, win in ipairs(vim.fn.win_findbuf(bufid)) do
+      vim.api.nvim_win_set_cursor(win, { page.function_line + 1, 0 })
+    end
+  end
+  M.load_visible(bufid)
+end
+
+
+-- pages under every window showing the buffer, plus half a page ahead
+function M.load_visible(bufid)
+  local state = M.pages[bufid]
+  if not state or M.page_lines <= 0 then
+    return
+  end
+
+  for _, win in ipairs(vim.fn.win_findbuf(bufid)) do
+    local top = vim.fn.line("w0", win) - 1
+    local bot = vim.fn.line("w$", win) - 1 + M.page_lines / 2
+    for p = math.floor(top / M.page_lines), math.floor(bot / M.page_lines) do
+      if p * M.page_lines < state.total and not state.loaded[p] then
+        state.loaded[p] = true
+        M.send_assembly_request(M.buf_to_file[bufid], state.variant,
+                                { start_line = p * M.page_lines, count = M.page_lines })
+      end
+    end
+  end
+end
+
+
 function M.send_to_buffer(filename, data)
   local bufid = M.file_to_buf[filename]
   if bufid == nil then
@@ -344,6 +747,7 @@ function M.send_to_buffer(filename, data)
   end
   
   local lines = vim.split(data, "\n", { plain = true, trimempty = false })
+  M.pages[bufid] = nil
   
   vim.api.nvim_buf_set_option(bufid, "modifiable", true)
   vim.api.nvim_buf_set_lines(bufid, 0, -1, false, lines)
@@ -353,6 +757,24 @@ end
 function M.setup() 
   M.root_dir = vim.fn.getcwd()
 
+  vim.api.nvim_create_autocmd("WinScrolled", {
+    callback = function(args)
+      local win = tonumber(args.match)
+      if win and vim.api.nvim_win_is_valid(win) then
+        M.load_visible(vim.api.nvim_win_get_buf(win))
+      end
+    end
+  })
+
+  vim.api.nvim_set_decoration_provider(M.hl_ns, {
+    on_win = function(_, _, bufid)
+      return M.hl_spans[bufid] ~= nil
+    end,
+    on_line = function(_, _, bufid, row)
+      M.draw_highlight_line(bufid, row)
+    end,
+  })
+
   vim.api.nvim_create_autocmd("VimLeavePre", {
     group = M.augroup,
     callback = function()
@@ -379,6 +801,193 @@ function M.setup()
       M.send_assembly_request(filename)
     end, {}
   )
+
+  vim.api.nvim_create_user_command(
+    "VimasmDiff",
+    function()
+      local filename = M.get_buf_filename()
+      if not filename then
+        vim.notify("[vimasm] No file associated with current buffer", vim.log.levels.WARN)
+        return
+      end
+      M.send_diff_request(filename)
+    end, {}
+  )
+
+  -- :VimasmVariant O3 -O3 -march=native, or :VimasmVariant all
+  vim.api.nvim_create_user_command(
+    "VimasmVariant",
+    function(opts)
+      local filename = M.get_buf_filename()
+      if not filename then
+        vim.notify("[vimasm] No file associated with current buffer", vim.log.levels.WARN)
+        return
+      end
+
+      local name = opts.fargs[1]
+      if #opts.fargs > 1 then
+        local flags = table.concat(vim.list_slice(opts.fargs, 2), " ")
+        M.send_variants_request(filename, { { name = name, flags = flags } })
+      else
+        M.send_assembly_request(filename, name)
+      end
+    end, { nargs = "+" }
+  )
+
+  -- :VimasmProfile perf.txt, text from perf script or perf annotate --stdio
+  vim.api.nvim_create_user_command(
+    "VimasmProfile",
+    function(opts)
+      local filename = M.get_buf_filename()
+      if not filename then
+        vim.notify("[vimasm] No file associated with current buffer", vim.log.levels.WARN)
+        return
+      end
+      M.send_profile_request(filename, vim.fn.fnamemodify(opts.fargs[1], ":p"))
+    end, { nargs = 1, complete = "file" }
+  )
+
+  -- run from the asm buffer, :VimasmAnalyze loop narrows to the block under the cursor
+  vim.api.nvim_create_user_command(
+    "VimasmAnalyze",
+    function(opts)
+      local bufnr = vim.api.nvim_get_current_buf()
+      local filename = M.buf_to_file[bufnr]
+      if not filename then
+        vim.notify("[vimasm] Not an assembly buffer", vim.log.levels.WARN)
+        return
+      end
+
+      local row = vim.api.nvim_win_get_cursor(0)[1]
+      local lines = vim.api.nvim_buf_get_lines(bufnr, 0, -1, false)
+      local func, start_label, end_label
+      for i = row, 1, -1 do
+        local label = lines[i]:match("^(%.L[%w_]+):$")
+        if label and not start_label then
+          start_label = label
+        elseif lines[i]:match("^[^%s%.].*:$") then
+          func = lines[i]:sub(1, -2)
+          break
+        end
+      end
+      if not func then
+        vim.notify("[vimasm] No function under cursor", vim.log.levels.WARN)
+        return
+      end
+
+      if opts.fargs[1] == "loop" and start_label then
+        for i = row + 1, #lines do
+          local label = lines[i]:match("^(%.L[%w_]+):$")
+          if label then end_label = label break end
+          if lines[i]:match("^[^%s%.].*:$") then break end
+        end
+      else
+        start_label = nil
+      end
+
+      M.send_analyze_request(filename, func, start_label, end_label)
+    end, { nargs = "?" }
+  )
+
+  vim.api.nvim_create_user_command(
+    "VimasmStats",
+    function(opts)
+      local filename = M.get_buf_filename()
+      if not filename then
+        vim.notify("[vimasm] No file associated with current buffer", vim.log.levels.WARN)
+        return
+      end
+      M.send_stats_request(filename, opts.fargs[1])
+    end, { nargs = "?" }
+  )
+
+  -- :VimasmSourceOnly [on|off] [keep paths...], no arguments toggles
+  vim.api.nvim_create_user_command(
+    "VimasmSourceOnly",
+    function(opts)
+      local mode = opts.fargs[1]
+      if mode == "on" then
+        M.source_only = true
+      elseif mode == "off" then
+        M.source_only = false
+      else
+        M.source_only = not M.source_only
+      end
+      if #opts.fargs > 1 then
+        M.source_keep = vim.list_slice(opts.fargs, 2)
+      end
+
+      local filename = M.get_buf_filename()
+      if filename then
+        M.send_assembly_request(filename)
+      end
+    end, { nargs = "*", complete = "file" }
+  )
+
+  -- :VimasmFilter labels|data [on|off], no state toggles
+  vim.api.nvim_create_user_command(
+    "VimasmFilter",
+    function(opts)
+      local stage = opts.fargs[1]
+      if M.filters[stage] == nil then
+        vim.notify("[vimasm] unknown filter " .. stage, vim.log.levels.WARN)
+        return
+      end
+      if opts.fargs[2] == "on" then
+        M.filters[stage] = true
+      elseif opts.fargs[2] == "off" then
+        M.filters[stage] = false
+      else
+        M.filters[stage] = not M.filters[stage]
+      end
+
+      local filename = M.get_buf_filename()
+      if filename then
+        M.send_assembly_request(filename)
+      end
+    end, { nargs = "+", complete = function() return { "labels", "data" } end }
+  )
+
+  -- :VimasmGoto name, pages in a function and moves the cursor to it
+  vim.api.nvim_create_user_command(
+    "VimasmGoto",
+    function(opts)
+      local bufnr = vim.api.nvim_get_current_buf()
+      local filename = M.buf_to_file[bufnr] or M.get_buf_filename()
+      if not filename then
+        vim.notify("[vimasm] No file associated with current buffer", vim.log.levels.WARN)
+        return
+      end
+      local state = M.pages[M.file_to_buf[filename]]
+      M.send_assembly_request(filename, state and state.variant, { ["function"] = opts.args })
+    end, { nargs = 1 }
+  )
+
+  -- :VimasmHighlight [on|off], no state toggles
+  vim.api.nvim_create_user_command(
+    "VimasmHighlight",
+    function(opts)
+      if opts.fargs[1] == "on" then
+        M.highlight = true
+      elseif opts.fargs[1] == "off" then
+        M.highlight = false
+      else
+        M.highlight = not M.highlight
+      end
+
+      local filename = M.get_buf_filename()
+      if filename then
+        M.send_assembly_request(filename)
+      end
+    end, { nargs = "?", complete = function() return { "on", "off" } end }
+  )
+
+  vim.api.nvim_create_user_command(
+    "VimasmServerStats",
+    function()
+      M.send_server_stats_request()
+    end, {}
+  )
 end
 
 return M
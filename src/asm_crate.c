@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "asm_crate.h"
+#include "asm_tucache.h"
+
+#define CRATE_READ 65536
+#define CRATE_ERROR_MAX 16384
+
+
+/* <cache_root>/rs_<root hash>, kept apart from cargo's own target dir */
+static bool incremental_dir(AsmCrate *crate, const char *cache_root)
+{
+  if (mkdir(cache_root, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    return false;
+  }
+
+  const uint64_t key = AsmTUCache_hash(0, crate->root, strlen(crate->root));
+  snprintf(crate->incremental, sizeof(crate->incremental), "%s/rs_%016llx",
+           cache_root, (unsigned long long)key);
+  if (mkdir(crate->incremental, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    crate->incremental[0] = '\0';
+    return false;
+  }
+  return true;
+}
+
+
+AsmCrate* AsmCrate_alloc(const char *root, const char *dir, const char *command,
+                         const char *cache_root)
+{
+  AsmCrate *crate = (AsmCrate*)calloc(1, sizeof(AsmCrate));
+  if (!crate)
+    return NULL;
+  snprintf(crate->root, sizeof(crate->root), "%s", root);
+  if (!realpath(dir, crate->dir))
+    snprintf(crate->dir, sizeof(crate->dir), "%s", dir);
+
+  /* the incremental flags go in before the command's trailing redirect */
+  const char *redirect = strstr(command, " 2>");
+  const size_t cmd_len = redirect ? (size_t)(redirect - command) : strlen(command);
+  char flags[PATH_MAX + 64] = "";
+  if (cache_root && incremental_dir(crate, cache_root)) {
+    snprintf(flags, sizeof(flags), " -C incremental=%s%s", crate->incremental,
+             strstr(command, "codegen-units=") ? "" : " -C codegen-units=" ASM_CRATE_CODEGEN_UNITS);
+  }
+
+  /* stderr is kept for the client when the crate fails to build */
+  snprintf(crate->err_path, sizeof(crate->err_path), "%s/asm_crate_XXXXXX", P_tmpdir);
+  const int fd = redirect ? mkstemp(crate->err_path) : -1;
+  if (fd == -1)
+    crate->err_path[0] = '\0';
+  else
+    close(fd);
+
+  /* relative sources in the command are against the crate directory */
+  const size_t max = strlen(dir) + strlen(command) + strlen(flags) + PATH_MAX + 16;
+  crate->command = (char*)malloc(max);
+  if (crate->err_path[0])
+    snprintf(crate->command, max, "cd '%s' && %.*s%s 2> %s", dir, (int)cmd_len, command,
+             flags, crate->err_path);
+  else
+    snprintf(crate->command, max, "cd '%s' && %.*s%s%s", dir, (int)cmd_len, command,
+             flags, redirect ? redirect : "");
+  return crate;
+}
+
+
+void AsmCrate_free(AsmCrate *crate)
+{
+  for (unsigned int i=0; i<crate->nsources; i++)
+    free(crate->sources[i]);
+  free(crate->sources);
+  free(crate->command);
+  free(crate->raw);
+  free(crate->error);
+  if (crate->err_path[0])
+    unlink(crate->err_path);
+  free(crate);
+}
+
+
+AsmCrate* AsmCrate_find(AsmCrate *list, const char *root)
+{
+  for (; list; list = list->next) {
+    if (strcmp(list->root, root) == 0)
+      return list;
+  }
+  return NULL;
+}
+
+
+size_t AsmCrate_memory(const AsmCrate *crate)
+{
+  size_t bytes = sizeof(AsmCrate) + crate->raw_len + strlen(crate->command)+1;
+  for (unsigned int i=0; i<crate->nsources; i++)
+    bytes += strlen(crate->sources[i])+1;
+  return bytes;
+}
+
+
+static void add_source(AsmCrate *crate, const char *path)
+{
+  for (unsigned int i=0; i<crate->nsources; i++) {
+    if (strcmp(crate->sources[i], path) == 0)
+      return;
+  }
+  char **sources = (char**)realloc(crate->sources, sizeof(char*) * (crate->nsources+1));
+  if (!sources)
+    return;
+  crate->sources = sources;
+  crate->sources[crate->nsources++] = strdup(path);
+}
+
+
+/* "\t.file\tN "dir" "name"", only files under the crate directory count */
+static void collect_sources(AsmCrate *crate)
+{
+  const size_t dir_len = strlen(crate->dir);
+  char path[2*PATH_MAX];
+  char real[PATH_MAX];
+
+  const char *end = crate->raw + crate->raw_len;
+  for (const char *line = crate->raw; line < end; ) {
+    const char *eol = memchr(line, '\n', end-line);
+    if (!eol)
+      eol = end;
+
+    const char *p = line;
+    while (p < eol && (*p == ' ' || *p == '\t'))
+      p++;
+    if (eol-p > 6 && memcmp(p, ".file", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+      const char *q1 = memchr(p, '"', eol-p);
+      const char *q2 = q1 ? memchr(q1+1, '"', eol-q1-1) : NULL;
+      const char *q3 = q2 ? memchr(q2+1, '"', eol-q2-1) : NULL;
+      const char *q4 = q3 ? memchr(q3+1, '"', eol-q3-1) : NULL;
+
+      if (q4 && q3[1] == '/')
+        snprintf(path, sizeof(path), "%.*s", (int)(q4-q3-1), q3+1);
+      else if (q4)
+        snprintf(path, sizeof(path), "%.*s/%.*s", (int)(q2-q1-1), q1+1, (int)(q4-q3-1), q3+1);
+      else if (q2 && q1[1] == '/')
+        snprintf(path, sizeof(path), "%.*s", (int)(q2-q1-1), q1+1);
+      else
+        path[0] = '\0';
+
+      if (path[0] && realpath(path, real) &&
+          strncmp(real, crate->dir, dir_len) == 0 && real[dir_len] == '/')
+      {
+        add_source(crate, real);
+      }
+    }
+    line = eol+1;
+  }
+}
+
+
+static bool mtime_newer(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+
+/* sources written after limit were saved during the compile, left stale */
+static void newest_source(const AsmCrate *crate, struct timespec *newest,
+                          const struct timespec *limit)
+{
+  for (unsigned int i=0; i<crate->nsources; i++) {
+    struct stat sb;
+    if (stat(crate->sources[i], &sb) != 0 || (limit && mtime_newer(&sb.st_mtim, limit)))
+      continue;
+    if (mtime_newer(&sb.st_mtim, newest))
+      *newest = sb.st_mtim;
+  }
+}
+
+
+static void read_error(AsmCrate *crate)
+{
+  free(crate->error);
+  crate->error = NULL;
+  if (!crate->err_path[0] || crate->status == 0)
+    return;
+
+  FILE *fp = fopen(crate->err_path, "r");
+  if (!fp)
+    return;
+  crate->error = (char*)malloc(CRATE_ERROR_MAX);
+  const size_t len = fread(crate->error, 1, CRATE_ERROR_MAX-1, fp);
+  crate->error[len] = '\0';
+  fclose(fp);
+}
+
+
+/*
+ * rebuilt when never compiled, or mtime or any known source is newer
+ * than what the last compile read. the generation only moves when the
+ * output does, a failed compile keeps the last good output with status
+ * and error set
+ */
+int AsmCrate_compile(AsmCrate *crate, const struct timespec *mtime)
+{
+  struct timespec newest = *mtime;
+  newest_source(crate, &newest, NULL);
+  if ((crate->raw || crate->status) && !mtime_newer(&newest, &crate->built))
+    return ASM_CRATE_OK;
+
+  /* a save after this is newer than anything the compile can have read */
+  struct timespec start;
+  clock_gettime(CLOCK_REALTIME, &start);
+
+  FILE *pipe = popen(crate->command, "r");
+  if (!pipe) {
+    fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno));
+    return ASM_CRATE_FAIL;
+  }
+
+  size_t max = crate->raw_len + CRATE_READ;
+  size_t len = 0;
+  char *raw = (char*)malloc(max);
+  while (raw) {
+    if (max - len < CRATE_READ) {
+      char *grown = (char*)realloc(raw, max*2);
+      if (!grown) {
+        free(raw);
+        raw = NULL;
+        break;
+      }
+      raw = grown;
+      max *= 2;
+    }
+    const size_t bytes = fread(raw+len, 1, max-len, pipe);
+    if (!bytes)
+      break;
+    len += bytes;
+  }
+  crate->status = pclose(pipe);
+  crate->runs++;
+  read_error(crate);
+
+  if (!raw) {
+    fprintf(stderr, "Error: [libc] realloc\n");
+    return ASM_CRATE_FAIL;
+  }
+
+  crate->built = mtime_newer(&newest, &start) ? start : newest;
+  if (crate->status != 0 ||
+      (crate->raw && len == crate->raw_len && memcmp(raw, crate->raw, len) == 0))
+  {
+    free(raw);
+    return ASM_CRATE_OK;
+  }
+
+  free(crate->raw);
+  crate->raw     = raw;
+  crate->raw_len = len;
+  crate->generation++;
+  collect_sources(crate);
+  newest_source(crate, &crate->built, &start);
+  return ASM_CRATE_OK;
+}
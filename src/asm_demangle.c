@@ -0,0 +1,902 @@
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "asm_demangle.h"
+#include "asm_trace.h"
+
+/* itanium demangler that c++filt itself uses, comes with libstdc++ */
+extern char* __cxa_demangle(const char *mangled, char *buf,
+                            size_t *len, int *status);
+
+#define V0_MAX_DEPTH 256
+
+
+struct demangle_entry {
+  char *key;
+  char *value;   // NULL when the symbol could not be demangled
+  size_t key_len;
+  struct demangle_entry *next;
+};
+
+static struct demangle_entry *demangle_table[DEMANGLE_HT_SIZE] = {NULL};
+static unsigned int demangle_entries = 0;
+
+
+static uint32_t symbol_hash(const char *str, size_t len)
+{
+  unsigned long hash = 5381;
+  for (size_t i=0; i<len; i++)
+    hash = ((hash << 5) + hash) + (unsigned char)str[i]; /* hash * 33 + c */
+  return hash % DEMANGLE_HT_SIZE;
+}
+
+
+static inline bool is_symbol_char(unsigned char ch)
+{
+  return (ch >= 'a' && ch <= 'z') ||
+         (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') ||
+         ch == '_' || ch == '$' || ch == '.';
+}
+
+
+static inline bool is_hex_char(unsigned char ch)
+{
+  return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f');
+}
+
+
+/*
+ * growable output for the rust demanglers
+ */
+struct out_buffer {
+  char *buf;
+  size_t len;
+  size_t max;
+  bool quiet;  // parse without printing (impl paths, instantiating crate)
+};
+
+
+static void out_putn(struct out_buffer *o, const char *s, size_t n)
+{
+  if (o->quiet || !n)
+    return;
+
+  if (o->len + n + 1 > o->max) {
+    size_t new_max = o->max ? o->max : 128;
+    while (o->len + n + 1 > new_max)
+      new_max *= 2;
+    char *new_buffer = (char*)realloc(o->buf, new_max);
+    if (!new_buffer) {
+      fprintf(stderr, "Error: [libc] realloc\n");
+      return;
+    }
+    o->buf = new_buffer;
+    o->max = new_max;
+  }
+  memcpy(o->buf + o->len, s, n);
+  o->len += n;
+  o->buf[o->len] = '\0';
+}
+
+
+static inline void out_puts(struct out_buffer *o, const char *s)
+{
+  out_putn(o, s, strlen(s));
+}
+
+
+/*
+ * rust legacy mangling, itanium shaped _ZN <len><ident>... 17h<hash> E
+ * with $..$ escapes for punctuation. the hash is dropped like rustfilt
+ */
+static bool is_rust_legacy(const char *sym, size_t len)
+{
+  if (len < 3 + 20 || memcmp(sym, "_ZN", 3) != 0)
+    return false;
+
+  /* tolerate .llvm.<n> suffixes after the terminating E */
+  const char *end = sym + len;
+  for (size_t i=3; i+6 <= len; i++) {
+    if (sym[i] == '.' && memcmp(sym+i, ".llvm.", 6) == 0) {
+      end = sym + i;
+      break;
+    }
+  }
+
+  if (end - sym < 23 || end[-1] != 'E')
+    return false;
+
+  const char *hash = end - 20;
+  if (memcmp(hash, "17h", 3) != 0)
+    return false;
+  for (unsigned int i=3; i<19; i++) {
+    if (!is_hex_char(hash[i]))
+      return false;
+  }
+  return true;
+}
+
+
+static const struct {
+  const char *escape;
+  const char *value;
+} legacy_escapes[] = {
+  {"$SP$", "@"}, {"$BP$", "*"}, {"$RF$", "&"}, {"$LT$", "<"},
+  {"$GT$", ">"}, {"$LP$", "("}, {"$RP$", ")"}, {"$C$",  ","},
+};
+
+
+static void legacy_ident(struct out_buffer *o, const char *s, size_t n)
+{
+  size_t i = 0;
+  if (n > 1 && s[0] == '_' && s[1] == '$')
+    i++;
+
+  while (i < n) {
+    if (s[i] == '.') {
+      if (i+1 < n && s[i+1] == '.') {
+        out_puts(o, "::");
+        i += 2;
+      }
+      else {
+        out_putn(o, ".", 1);
+        i++;
+      }
+      continue;
+    }
+
+    if (s[i] == '$') {
+      bool matched = false;
+      for (unsigned int e=0; e<sizeof(legacy_escapes)/sizeof(legacy_escapes[0]); e++) {
+        size_t elen = strlen(legacy_escapes[e].escape);
+        if (i + elen <= n && memcmp(s+i, legacy_escapes[e].escape, elen) == 0) {
+          out_puts(o, legacy_escapes[e].value);
+          i += elen;
+          matched = true;
+          break;
+        }
+      }
+
+      /* $u7e$ style unicode escapes */
+      if (!matched && i+2 < n && s[i+1] == 'u') {
+        unsigned int cp = 0;
+        size_t j = i+2;
+        for (; j<n && is_hex_char(s[j]); j++)
+          cp = cp*16 + (s[j] <= '9' ? s[j]-'0' : s[j]-'a'+10);
+        if (j < n && s[j] == '$' && cp && cp < 0x80) {
+          char ch = (char)cp;
+          out_putn(o, &ch, 1);
+          i = j+1;
+          matched = true;
+        }
+      }
+
+      if (matched)
+        continue;
+    }
+
+    out_putn(o, s+i, 1);
+    i++;
+  }
+}
+
+
+static char* demangle_rust_legacy(const char *sym, size_t len)
+{
+  struct out_buffer o = {0};
+  size_t i = 3;
+  bool first = true;
+
+  while (i < len && sym[i] != 'E') {
+    size_t n = 0;
+    if (sym[i] < '0' || sym[i] > '9')
+      goto fail;
+    for (; i<len && sym[i] >= '0' && sym[i] <= '9'; i++)
+      n = n*10 + (sym[i]-'0');
+    if (!n || i + n > len)
+      goto fail;
+
+    /* trailing hash segment is not printed */
+    bool is_hash = (n == 17 && sym[i] == 'h' && i+n < len && sym[i+n] == 'E');
+    if (!is_hash) {
+      if (!first)
+        out_puts(&o, "::");
+      legacy_ident(&o, sym+i, n);
+      first = false;
+    }
+    i += n;
+  }
+
+  if (!o.buf)
+    goto fail;
+  return o.buf;
+
+fail:
+  free(o.buf);
+  return NULL;
+}
+
+
+/*
+ * rust v0 mangling (RFC 2603), recursive descent printer.
+ * lifetimes are printed as '_ and punycode identifiers are left encoded
+ */
+struct v0_parser {
+  const char *s;
+  size_t len;
+  size_t pos;
+  unsigned int depth;
+  bool err;
+  struct out_buffer *out;
+};
+
+static void v0_path(struct v0_parser *p, bool in_value);
+static void v0_type(struct v0_parser *p);
+
+
+static inline char v0_peek(struct v0_parser *p)
+{
+  return (!p->err && p->pos < p->len) ? p->s[p->pos] : '\0';
+}
+
+
+static inline bool v0_eat(struct v0_parser *p, char ch)
+{
+  if (v0_peek(p) == ch) {
+    p->pos++;
+    return true;
+  }
+  return false;
+}
+
+
+static inline char v0_next(struct v0_parser *p)
+{
+  char ch = v0_peek(p);
+  if (!ch)
+    p->err = true;
+  else
+    p->pos++;
+  return ch;
+}
+
+
+static uint64_t v0_base62(struct v0_parser *p)
+{
+  if (v0_eat(p, '_'))
+    return 0;
+
+  uint64_t x = 0;
+  for (;;) {
+    char ch = v0_next(p);
+    if (p->err)
+      return 0;
+    if (ch == '_')
+      break;
+    if (ch >= '0' && ch <= '9')
+      x = x*62 + (ch-'0');
+    else if (ch >= 'a' && ch <= 'z')
+      x = x*62 + (ch-'a'+10);
+    else if (ch >= 'A' && ch <= 'Z')
+      x = x*62 + (ch-'A'+36);
+    else {
+      p->err = true;
+      return 0;
+    }
+  }
+  return x+1;
+}
+
+
+static uint64_t v0_opt_base62(struct v0_parser *p, char tag)
+{
+  if (!v0_eat(p, tag))
+    return 0;
+  return v0_base62(p) + 1;
+}
+
+
+static void v0_ident(struct v0_parser *p, const char **ident,
+                     size_t *ident_len, bool *punycode)
+{
+  *punycode = v0_eat(p, 'u');
+
+  size_t n = 0;
+  char ch = v0_peek(p);
+  if (ch < '0' || ch > '9') {
+    p->err = true;
+    return;
+  }
+  if (ch == '0')
+    p->pos++;
+  else {
+    while ((ch = v0_peek(p)) >= '0' && ch <= '9') {
+      n = n*10 + (ch-'0');
+      p->pos++;
+    }
+  }
+
+  v0_eat(p, '_');
+  if (p->pos + n > p->len) {
+    p->err = true;
+    return;
+  }
+
+  *ident = p->s + p->pos;
+  *ident_len = n;
+  p->pos += n;
+}
+
+
+static void v0_print_ident(struct v0_parser *p, const char *ident,
+                           size_t ident_len, bool punycode)
+{
+  if (punycode) {
+    out_puts(p->out, "punycode{");
+    out_putn(p->out, ident, ident_len);
+    out_puts(p->out, "}");
+  }
+  else
+    out_putn(p->out, ident, ident_len);
+}
+
+
+static bool v0_backref(struct v0_parser *p, size_t *saved)
+{
+  size_t start = p->pos - 1;
+  uint64_t target = v0_base62(p);
+  if (p->err || target >= start) {
+    p->err = true;
+    return false;
+  }
+  *saved = p->pos;
+  p->pos = target;
+  return true;
+}
+
+
+static const char* v0_basic_type(char tag)
+{
+  switch (tag) {
+    case 'a': return "i8";
+    case 'b': return "bool";
+    case 'c': return "char";
+    case 'd': return "f64";
+    case 'e': return "str";
+    case 'f': return "f32";
+    case 'h': return "u8";
+    case 'i': return "isize";
+    case 'j': return "usize";
+    case 'l': return "i32";
+    case 'm': return "u32";
+    case 'n': return "i128";
+    case 'o': return "u128";
+    case 's': return "i16";
+    case 't': return "u16";
+    case 'u': return "()";
+    case 'v': return "...";
+    case 'x': return "i64";
+    case 'y': return "u64";
+    case 'z': return "!";
+    case 'p': return "_";
+  }
+  return NULL;
+}
+
+
+static void v0_const(struct v0_parser *p)
+{
+  if (++p->depth > V0_MAX_DEPTH) {
+    p->err = true;
+    return;
+  }
+
+  char tag = v0_next(p);
+  if (tag == 'B') {
+    size_t saved;
+    if (v0_backref(p, &saved)) {
+      v0_const(p);
+      p->pos = saved;
+    }
+  }
+  else if (tag == 'p')
+    out_puts(p->out, "_");
+  else if (v0_basic_type(tag)) {
+    bool negative = v0_eat(p, 'n');
+    size_t start = p->pos;
+    uint64_t value = 0;
+    bool fits = true;
+    char ch;
+    while ((ch = v0_next(p)) != '_' && !p->err) {
+      if (!is_hex_char(ch)) {
+        p->err = true;
+        break;
+      }
+      if (value >> 60)
+        fits = false;
+      value = value*16 + (ch <= '9' ? ch-'0' : ch-'a'+10);
+    }
+
+    char num[32];
+    if (tag == 'b')
+      out_puts(p->out, value ? "true" : "false");
+    else if (tag == 'c' && fits && value < 0x80 && value >= 0x20) {
+      snprintf(num, sizeof(num), "'%c'", (char)value);
+      out_puts(p->out, num);
+    }
+    else if (fits) {
+      snprintf(num, sizeof(num), "%s%llu", negative ? "-" : "",
+               (unsigned long long)value);
+      out_puts(p->out, num);
+    }
+    else {
+      out_puts(p->out, negative ? "-0x" : "0x");
+      out_putn(p->out, p->s+start, p->pos-start-1);
+    }
+  }
+  else
+    p->err = true;
+
+  p->depth--;
+}
+
+
+static void v0_lifetime(struct v0_parser *p)
+{
+  v0_base62(p);
+  out_puts(p->out, "'_");
+}
+
+
+static void v0_generic_arg(struct v0_parser *p)
+{
+  if (v0_eat(p, 'L'))
+    v0_lifetime(p);
+  else if (v0_eat(p, 'K'))
+    v0_const(p);
+  else
+    v0_type(p);
+}
+
+
+static void v0_fn_sig(struct v0_parser *p)
+{
+  if (v0_eat(p, 'G'))
+    v0_base62(p);
+  if (v0_eat(p, 'U'))
+    out_puts(p->out, "unsafe ");
+
+  if (v0_eat(p, 'K')) {
+    out_puts(p->out, "extern \"");
+    if (v0_eat(p, 'C'))
+      out_puts(p->out, "C");
+    else {
+      const char *abi;
+      size_t abi_len = 0;
+      bool punycode;
+      v0_ident(p, &abi, &abi_len, &punycode);
+      for (size_t i=0; i<abi_len && !p->err; i++)
+        out_putn(p->out, abi[i] == '_' ? "-" : abi+i, 1);
+    }
+    out_puts(p->out, "\" ");
+  }
+
+  out_puts(p->out, "fn(");
+  for (unsigned int i=0; !p->err && !v0_eat(p, 'E'); i++) {
+    if (i)
+      out_puts(p->out, ", ");
+    v0_type(p);
+  }
+  out_puts(p->out, ")");
+
+  if (v0_eat(p, 'u'))
+    return;
+  out_puts(p->out, " -> ");
+  v0_type(p);
+}
+
+
+static void v0_dyn_bounds(struct v0_parser *p)
+{
+  if (v0_eat(p, 'G'))
+    v0_base62(p);
+
+  for (unsigned int i=0; !p->err && !v0_eat(p, 'E'); i++) {
+    if (i)
+      out_puts(p->out, " + ");
+    v0_path(p, false);
+
+    /* associated type bindings, Trait<Item = T> */
+    for (unsigned int j=0; !p->err && v0_eat(p, 'p'); j++) {
+      const char *name;
+      size_t name_len = 0;
+      bool punycode;
+      out_puts(p->out, j ? ", " : "<");
+      v0_ident(p, &name, &name_len, &punycode);
+      v0_print_ident(p, name, name_len, punycode);
+      out_puts(p->out, " = ");
+      v0_type(p);
+      if (v0_peek(p) != 'p')
+        out_puts(p->out, ">");
+    }
+  }
+}
+
+
+static void v0_type(struct v0_parser *p)
+{
+  if (++p->depth > V0_MAX_DEPTH) {
+    p->err = true;
+    return;
+  }
+
+  char tag = v0_peek(p);
+  const char *basic = v0_basic_type(tag);
+  if (basic) {
+    p->pos++;
+    out_puts(p->out, basic);
+    p->depth--;
+    return;
+  }
+
+  size_t saved;
+  switch (tag) {
+    case 'A':
+      p->pos++;
+      out_puts(p->out, "[");
+      v0_type(p);
+      out_puts(p->out, "; ");
+      v0_const(p);
+      out_puts(p->out, "]");
+      break;
+
+    case 'S':
+      p->pos++;
+      out_puts(p->out, "[");
+      v0_type(p);
+      out_puts(p->out, "]");
+      break;
+
+    case 'T': {
+      p->pos++;
+      out_puts(p->out, "(");
+      unsigned int i = 0;
+      for (; !p->err && !v0_eat(p, 'E'); i++) {
+        if (i)
+          out_puts(p->out, ", ");
+        v0_type(p);
+      }
+      if (i == 1)
+        out_puts(p->out, ",");
+      out_puts(p->out, ")");
+      break;
+    }
+
+    case 'R':
+    case 'Q':
+      p->pos++;
+      out_puts(p->out, "&");
+      if (v0_eat(p, 'L')) {
+        if (v0_base62(p))
+          out_puts(p->out, "'_ ");
+      }
+      if (tag == 'Q')
+        out_puts(p->out, "mut ");
+      v0_type(p);
+      break;
+
+    case 'P':
+      p->pos++;
+      out_puts(p->out, "*const ");
+      v0_type(p);
+      break;
+
+    case 'O':
+      p->pos++;
+      out_puts(p->out, "*mut ");
+      v0_type(p);
+      break;
+
+    case 'F':
+      p->pos++;
+      v0_fn_sig(p);
+      break;
+
+    case 'D':
+      p->pos++;
+      out_puts(p->out, "dyn ");
+      v0_dyn_bounds(p);
+      if (v0_eat(p, 'L') && v0_base62(p))
+        out_puts(p->out, " + '_");
+      break;
+
+    case 'B':
+      p->pos++;
+      if (v0_backref(p, &saved)) {
+        v0_type(p);
+        p->pos = saved;
+      }
+      break;
+
+    default:
+      v0_path(p, false);
+      break;
+  }
+
+  p->depth--;
+}
+
+
+static void v0_path(struct v0_parser *p, bool in_value)
+{
+  if (++p->depth > V0_MAX_DEPTH) {
+    p->err = true;
+    return;
+  }
+
+  const char *ident = NULL;
+  size_t ident_len = 0;
+  bool punycode = false;
+  bool quiet;
+  size_t saved;
+
+  char tag = v0_next(p);
+  switch (tag) {
+    case 'C':
+      v0_opt_base62(p, 's');
+      v0_ident(p, &ident, &ident_len, &punycode);
+      v0_print_ident(p, ident, ident_len, punycode);
+      break;
+
+    case 'N': {
+      char ns = v0_next(p);
+      v0_path(p, in_value);
+      uint64_t dis = v0_opt_base62(p, 's');
+      v0_ident(p, &ident, &ident_len, &punycode);
+      if (p->err)
+        break;
+
+      if (ns >= 'A' && ns <= 'Z') {
+        char num[32];
+        out_puts(p->out, "::{");
+        if (ns == 'C')
+          out_puts(p->out, "closure");
+        else if (ns == 'S')
+          out_puts(p->out, "shim");
+        else
+          out_putn(p->out, &ns, 1);
+        if (ident_len) {
+          out_puts(p->out, ":");
+          v0_print_ident(p, ident, ident_len, punycode);
+        }
+        snprintf(num, sizeof(num), "#%llu}", (unsigned long long)dis);
+        out_puts(p->out, num);
+      }
+      else if (ident_len) {
+        out_puts(p->out, "::");
+        v0_print_ident(p, ident, ident_len, punycode);
+      }
+      break;
+    }
+
+    case 'M':
+    case 'X':
+    case 'Y':
+      /* the impl path is only there for uniqueness, skip printing it */
+      if (tag != 'Y') {
+        v0_opt_base62(p, 's');
+        quiet = p->out->quiet;
+        p->out->quiet = true;
+        v0_path(p, false);
+        p->out->quiet = quiet;
+      }
+      out_puts(p->out, "<");
+      v0_type(p);
+      if (tag != 'M') {
+        out_puts(p->out, " as ");
+        v0_path(p, false);
+      }
+      out_puts(p->out, ">");
+      break;
+
+    case 'I':
+      v0_path(p, in_value);
+      if (in_value)
+        out_puts(p->out, "::");
+      out_puts(p->out, "<");
+      for (unsigned int i=0; !p->err && !v0_eat(p, 'E'); i++) {
+        if (i)
+          out_puts(p->out, ", ");
+        v0_generic_arg(p);
+      }
+      out_puts(p->out, ">");
+      break;
+
+    case 'B':
+      if (v0_backref(p, &saved)) {
+        v0_path(p, in_value);
+        p->pos = saved;
+      }
+      break;
+
+    default:
+      p->err = true;
+      break;
+  }
+
+  p->depth--;
+}
+
+
+static char* demangle_rust_v0(const char *sym, size_t len)
+{
+  struct out_buffer o = {0};
+  struct v0_parser p = {0};
+
+  /* backrefs are offsets from after the _R prefix */
+  p.s = sym + 2;
+  p.len = len - 2;
+  p.out = &o;
+
+  /* optional encoding version */
+  while (v0_peek(&p) >= '0' && v0_peek(&p) <= '9')
+    p.pos++;
+
+  v0_path(&p, true);
+
+  /* instantiating crate is not printed */
+  if (!p.err && p.pos < p.len && v0_peek(&p) >= 'A' && v0_peek(&p) <= 'Z') {
+    o.quiet = true;
+    v0_path(&p, false);
+  }
+
+  if (p.err || !o.buf) {
+    free(o.buf);
+    return NULL;
+  }
+  return o.buf;
+}
+
+
+static char* demangle_itanium(const char *sym, size_t len)
+{
+  char stack_buffer[1024];
+  char *mangled = len < sizeof(stack_buffer) ? stack_buffer : (char*)malloc(len+1);
+  memcpy(mangled, sym, len);
+  mangled[len] = '\0';
+
+  int status = 0;
+  char *demangled = __cxa_demangle(mangled, NULL, NULL, &status);
+  if (mangled != stack_buffer)
+    free(mangled);
+
+  if (status != 0) {
+    free(demangled);
+    return NULL;
+  }
+  return demangled;
+}
+
+
+static char* demangle_uncached(const char *sym, size_t len)
+{
+  /* macho style extra underscore */
+  if (len > 3 && sym[0] == '_' && sym[1] == '_' && sym[2] == 'Z') {
+    sym++;
+    len--;
+  }
+
+  if (len > 2 && sym[0] == '_' && sym[1] == 'R') {
+    /* v0 symbols may carry a .llvm. suffix, cut at the first dot */
+    const char *dot = memchr(sym, '.', len);
+    return demangle_rust_v0(sym, dot ? (size_t)(dot-sym) : len);
+  }
+
+  if (len > 2 && sym[0] == '_' && sym[1] == 'Z') {
+    if (is_rust_legacy(sym, len))
+      return demangle_rust_legacy(sym, len);
+    return demangle_itanium(sym, len);
+  }
+
+  return NULL;
+}
+
+
+const char* AsmDemangle_symbol(const char *sym, size_t len)
+{
+  uint32_t hash_idx = symbol_hash(sym, len);
+  struct demangle_entry *slot = demangle_table[hash_idx];
+
+  while (slot) {
+    if (slot->key_len == len && memcmp(slot->key, sym, len) == 0)
+      return slot->value;
+    slot = slot->next;
+  }
+
+  /* long sessions on template heavy code, start over rather than grow */
+  if (demangle_entries >= DEMANGLE_MAX_ENTRIES)
+    AsmDemangle_clear();
+
+  struct demangle_entry *entry = (struct demangle_entry*)malloc(sizeof(struct demangle_entry));
+  entry->key = (char*)malloc(len+1);
+  memcpy(entry->key, sym, len);
+  entry->key[len] = '\0';
+  entry->key_len = len;
+
+  const uint64_t trace_ns = AsmTrace_begin();
+  entry->value = demangle_uncached(sym, len);
+  AsmTrace_end("demangle", trace_ns);
+  entry->next = demangle_table[hash_idx];
+  demangle_table[hash_idx] = entry;
+  demangle_entries++;
+  return entry->value;
+}
+
+
+size_t AsmDemangle_line(const char *line, size_t len, char *out, size_t out_max)
+{
+  size_t j = 0;
+  size_t i = 0;
+
+  if (!out_max)
+    return 0;
+
+  while (i < len && j < out_max-1) {
+    unsigned char ch = line[i];
+
+    /* only tokens that start like a mangled name are looked up */
+    if (ch == '_' &&
+        (i == 0 || !is_symbol_char(line[i-1])) &&
+        i+2 < len &&
+        (line[i+1] == 'Z' || line[i+1] == 'R' ||
+         (line[i+1] == '_' && line[i+2] == 'Z')))
+    {
+      size_t start = i;
+      while (i < len && is_symbol_char(line[i]))
+        i++;
+
+      /* a name that does not fit stays mangled rather than cut short */
+      const char *demangled = AsmDemangle_symbol(line+start, i-start);
+      const char *src = demangled ? demangled : line+start;
+      size_t src_len = demangled ? strlen(demangled) : i-start;
+      if (src_len > out_max-1-j && demangled) {
+        src = line+start;
+        src_len = i-start;
+      }
+      if (src_len > out_max-1-j)
+        src_len = out_max-1-j;
+
+      memcpy(out+j, src, src_len);
+      j += src_len;
+      continue;
+    }
+
+    out[j++] = ch;
+    i++;
+  }
+
+  out[j] = '\0';
+  return j;
+}
+
+
+void AsmDemangle_clear(void)
+{
+  for (unsigned int i=0; i<DEMANGLE_HT_SIZE; i++) {
+    struct demangle_entry *slot = demangle_table[i];
+    struct demangle_entry *prev;
+    while (slot) {
+      prev = slot;
+      slot = slot->next;
+      free(prev->key);
+      free(prev->value);
+      free(prev);
+    }
+    demangle_table[i] = NULL;
+  }
+  demangle_entries = 0;
+}
@@ -0,0 +1,303 @@
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "asm_diff.h"
+#include "asm_funcs.h"
+
+#define DIFF_LINE_MAX 16384
+
+
+/* a function body split into label normalized lines */
+struct diff_lines {
+  char **text;
+  size_t *len;
+  unsigned int n;
+};
+
+
+static void diff_lines_split(struct diff_lines *lines, const char *asm_buffer,
+                             AsmFunction *func, AsmLabelMap *labels)
+{
+  unsigned int max = 64;
+  lines->text = (char**)malloc(sizeof(char*) * max);
+  lines->len  = (size_t*)malloc(sizeof(size_t) * max);
+  lines->n    = 0;
+  labels->nkeys = 0;
+
+  char norm[DIFF_LINE_MAX];
+  size_t pos = func->body_start;
+  while (pos < func->body_end) {
+    const char *line = asm_buffer + pos;
+    const char *nl = memchr(line, '\n', func->body_end - pos);
+    const size_t line_len = nl ? (size_t)(nl - line) : func->body_end - pos;
+    pos += line_len + 1;
+
+    if (!line_len)
+      continue;
+
+    if (lines->n == max) {
+      max *= 2;
+      lines->text = (char**)realloc(lines->text, sizeof(char*) * max);
+      lines->len  = (size_t*)realloc(lines->len, sizeof(size_t) * max);
+    }
+
+    size_t norm_len = AsmFuncs_normalize_line(line, line_len, norm, sizeof(norm), labels);
+    lines->text[lines->n] = strndup(norm, norm_len);
+    lines->len[lines->n]  = norm_len;
+    lines->n++;
+  }
+}
+
+
+static void diff_lines_free(struct diff_lines *lines)
+{
+  for (unsigned int i=0; i<lines->n; i++)
+    free(lines->text[i]);
+  free(lines->text);
+  free(lines->len);
+}
+
+
+static inline bool line_eq(struct diff_lines *a, unsigned int i,
+                           struct diff_lines *b, unsigned int j)
+{
+  return a->len[i] == b->len[j] && memcmp(a->text[i], b->text[j], a->len[i]) == 0;
+}
+
+
+struct diff_out {
+  char *buf;
+  size_t len;
+  size_t max;
+};
+
+
+static void diff_out_line(struct diff_out *out, char tag, const char *text, size_t len)
+{
+  while (out->len + len + 3 > out->max) {
+    out->max = out->max ? out->max*2 : 4096;
+    out->buf = (char*)realloc(out->buf, out->max);
+  }
+  out->buf[out->len++] = tag;
+  out->buf[out->len++] = ' ';
+  memcpy(out->buf + out->len, text, len);
+  out->len += len;
+  out->buf[out->len++] = '\n';
+  out->buf[out->len] = '\0';
+}
+
+
+/*
+ * greedy O((N+M)D) myers diff, the furthest reaching x of every diagonal
+ * is kept per edit distance so the script can be walked back from (N,M)
+ */
+static char* myers_diff(struct diff_lines *a, struct diff_lines *b)
+{
+  const int n = a->n;
+  const int m = b->n;
+  int max_d = n + m;
+  if (max_d > MYERS_MAX_D)
+    max_d = MYERS_MAX_D;
+
+  int **trace = (int**)malloc(sizeof(int*) * (max_d+1));
+  int ntrace = 0;
+  int final_d = -1;
+
+  for (int d=0; d<=max_d && final_d < 0; d++) {
+    int *cur = (int*)malloc(sizeof(int) * (2*d+1));
+    int *prev = d ? trace[d-1] : NULL;
+    trace[ntrace++] = cur;
+
+    for (int k=-d; k<=d; k+=2) {
+      int x;
+      if (d == 0)
+        x = 0;
+      else if (k == -d || (k != d && prev[k-1+(d-1)] < prev[k+1+(d-1)]))
+        x = prev[k+1+(d-1)];        // down, insertion
+      else
+        x = prev[k-1+(d-1)] + 1;    // right, deletion
+
+      int y = x - k;
+      while (x < n && y < m && line_eq(a, x, b, y)) {
+        x++;
+        y++;
+      }
+      cur[k+d] = x;
+
+      if (x >= n && y >= m) {
+        final_d = d;
+        break;
+      }
+    }
+  }
+
+  struct diff_out out = {0};
+
+  if (final_d < 0) {
+    /* too far apart to be worth a minimal script, show a full replace */
+    for (int i=0; i<n; i++)
+      diff_out_line(&out, '-', a->text[i], a->len[i]);
+    for (int j=0; j<m; j++)
+      diff_out_line(&out, '+', b->text[j], b->len[j]);
+  }
+  else {
+    /* walk back collecting (tag, index) in reverse */
+    const size_t max_ops = n + m + 1;
+    char *tags = (char*)malloc(max_ops);
+    int *idx = (int*)malloc(sizeof(int) * max_ops);
+    size_t nops = 0;
+
+    int x = n;
+    int y = m;
+    for (int d=final_d; d>0; d--) {
+      int *prev = trace[d-1];
+      int k = x - y;
+      int prev_k;
+      if (k == -d || (k != d && prev[k-1+(d-1)] < prev[k+1+(d-1)]))
+        prev_k = k+1;
+      else
+        prev_k = k-1;
+
+      int prev_x = prev[prev_k+(d-1)];
+      int prev_y = prev_x - prev_k;
+
+      while (x > prev_x && y > prev_y) {
+        tags[nops] = ' ';
+        idx[nops++] = --x;
+        y--;
+      }
+
+      if (x == prev_x) {
+        tags[nops] = '+';
+        idx[nops++] = --y;
+      }
+      else {
+        tags[nops] = '-';
+        idx[nops++] = --x;
+      }
+    }
+    while (x > 0 && y > 0) {
+      tags[nops] = ' ';
+      idx[nops++] = --x;
+      y--;
+    }
+
+    for (size_t i=nops; i>0; i--) {
+      int line = idx[i-1];
+      if (tags[i-1] == '+')
+        diff_out_line(&out, '+', b->text[line], b->len[line]);
+      else
+        diff_out_line(&out, tags[i-1], a->text[line], a->len[line]);
+    }
+
+    free(tags);
+    free(idx);
+  }
+
+  for (int d=0; d<ntrace; d++)
+    free(trace[d]);
+  free(trace);
+
+  return out.buf ? out.buf : strdup("");
+}
+
+
+static cJSON* function_node(AsmFunction *func, const char *status)
+{
+  cJSON *node = cJSON_CreateObject();
+  char name[DIFF_LINE_MAX];
+  size_t name_len = func->name_len < sizeof(name)-1 ? func->name_len : sizeof(name)-1;
+  memcpy(name, func->name, name_len);
+  name[name_len] = '\0';
+
+  cJSON_AddStringToObject(node, "name", name);
+  cJSON_AddStringToObject(node, "status", status);
+  cJSON_AddNumberToObject(node, "instructions", func->ninstr);
+  cJSON_AddNumberToObject(node, "size", func->est_size);
+  return node;
+}
+
+
+cJSON* AsmDiff_functions(const char *old_asm, size_t old_len,
+                         const char *new_asm, size_t new_len)
+{
+  AsmFunctionIndex old_index;
+  AsmFunctionIndex new_index;
+  if (AsmFunctionIndex_build(&old_index, old_asm, old_len) != ASM_FUNCS_OK)
+    return NULL;
+  if (AsmFunctionIndex_build(&new_index, new_asm, new_len) != ASM_FUNCS_OK) {
+    AsmFunctionIndex_free(&old_index);
+    return NULL;
+  }
+
+  AsmLabelMap *labels = (AsmLabelMap*)malloc(sizeof(AsmLabelMap));
+  unsigned int counts[4] = {0}; // unchanged, changed, added, removed
+
+  cJSON *result = cJSON_CreateObject();
+  cJSON *list = cJSON_AddArrayToObject(result, "functions");
+
+  for (unsigned int i=0; i<new_index.nfuncs; i++) {
+    AsmFunction *func = &new_index.funcs[i];
+    AsmFunction *prev = AsmFunctionIndex_find(&old_index, func->name, func->name_len);
+    cJSON *node;
+
+    if (!prev) {
+      node = function_node(func, "added");
+      cJSON_AddNumberToObject(node, "instructions_delta", func->ninstr);
+      cJSON_AddNumberToObject(node, "size_delta", func->est_size);
+      counts[2]++;
+    }
+    else if (prev->hash == func->hash) {
+      node = function_node(func, "unchanged");
+      cJSON_AddNumberToObject(node, "instructions_delta", 0);
+      cJSON_AddNumberToObject(node, "size_delta", 0);
+      counts[0]++;
+    }
+    else {
+      node = function_node(func, "changed");
+      cJSON_AddNumberToObject(node, "instructions_delta",
+                              (double)func->ninstr - (double)prev->ninstr);
+      cJSON_AddNumberToObject(node, "size_delta",
+                              (double)func->est_size - (double)prev->est_size);
+
+      struct diff_lines a;
+      struct diff_lines b;
+      diff_lines_split(&a, old_asm, prev, labels);
+      diff_lines_split(&b, new_asm, func, labels);
+      char *diff = myers_diff(&a, &b);
+      cJSON_AddStringToObject(node, "diff", diff);
+      free(diff);
+      diff_lines_free(&a);
+      diff_lines_free(&b);
+      counts[1]++;
+    }
+    cJSON_AddItemToArray(list, node);
+  }
+
+  for (unsigned int i=0; i<old_index.nfuncs; i++) {
+    AsmFunction *func = &old_index.funcs[i];
+    if (AsmFunctionIndex_find(&new_index, func->name, func->name_len))
+      continue;
+
+    cJSON *node = function_node(func, "removed");
+    cJSON_AddNumberToObject(node, "instructions_delta", -(double)func->ninstr);
+    cJSON_AddNumberToObject(node, "size_delta", -(double)func->est_size);
+    cJSON_AddItemToArray(list, node);
+    counts[3]++;
+  }
+
+  cJSON *summary = cJSON_AddObjectToObject(result, "summary");
+  cJSON_AddNumberToObject(summary, "unchanged", counts[0]);
+  cJSON_AddNumberToObject(summary, "changed", counts[1]);
+  cJSON_AddNumberToObject(summary, "added", counts[2]);
+  cJSON_AddNumberToObject(summary, "removed", counts[3]);
+
+  free(labels);
+  AsmFunctionIndex_free(&old_index);
+  AsmFunctionIndex_free(&new_index);
+  return result;
+}
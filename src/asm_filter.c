@@ -0,0 +1,911 @@
+
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "asm_filter.h"
+#include "asm_demangle.h"
+
+#define PAGE_SIZE 4096
+#define ASM_WINDOW 4*PAGE_SIZE
+
+
+void AsmFilter_init(AsmFilter *filter)
+{
+  filter->buf_max    = ASM_WINDOW;
+  filter->asm_buffer = (char*)malloc(filter->buf_max);
+  filter->asm_len    = 0;
+  filter->line_len   = 0;
+  filter->stats      = NULL;
+  filter->nstats     = 0;
+  filter->max_stats  = 0;
+  filter->keep_paths = NULL;
+  filter->nkeep      = 0;
+  filter->options    = 0;
+  filter->ranges     = NULL;
+  filter->nranges    = 0;
+  filter->max_ranges = 0;
+  filter->used       = NULL;
+  filter->nused      = 0;
+  filter->max_used   = 0;
+  filter->data_range = -1;
+  filter->data_open  = false;
+  filter->meta_section = false;
+  filter->lines      = NULL;
+  filter->loc_file   = 0;
+  filter->loc_line   = 0;
+}
+
+
+void AsmFilter_set_options(AsmFilter *filter, unsigned int options)
+{
+  filter->options = options;
+}
+
+
+/* lines must be initialised, it is filled alongside the text */
+void AsmFilter_track_lines(AsmFilter *filter, AsmLines *lines)
+{
+  filter->lines = lines;
+}
+
+
+/* FUNC_DATA is a dropped function's constants, kept until back in .text */
+enum { FUNC_NONE, FUNC_UNDECIDED, FUNC_KEEP, FUNC_DROP, FUNC_DATA };
+
+/* paths must stay valid until the filter is finished */
+void AsmFilter_keep_sources(AsmFilter *filter, const char *const *paths, unsigned int npaths)
+{
+  filter->keep_paths  = paths;
+  filter->nkeep       = npaths;
+  filter->func_state  = FUNC_NONE;
+  filter->func_start  = 0;
+  filter->func_nstats = 0;
+  filter->func_type   = 0;
+  filter->comp_dir[0] = '\0';
+  memset(filter->keep_ids, 0, sizeof(filter->keep_ids));
+}
+
+
+/* quoted string at p, returns the character after the closing quote */
+static const char* quoted(const char *p, const char *end, char *out, size_t out_max)
+{
+  while (p < end && *p != '"')
+    p++;
+  if (p == end)
+    return NULL;
+
+  size_t j = 0;
+  for (p++; p < end && *p != '"'; p++) {
+    if (*p == '\\' && p+1 < end)
+      p++;
+    if (j < out_max-1)
+      out[j++] = *p;
+  }
+  out[j] = '\0';
+  return p < end ? p+1 : NULL;
+}
+
+
+static bool keep_path(AsmFilter *filter, const char *path)
+{
+  char real[PATH_MAX];
+  if (!realpath(path, real))
+    return false;
+
+  for (unsigned int k=0; k<filter->nkeep; k++) {
+    const char *keep = filter->keep_paths[k];
+    const size_t keep_len = strlen(keep);
+    if (keep_len && keep[keep_len-1] == '/') {
+      if (strncmp(real, keep, keep_len) == 0)
+        return true;
+    }
+    else if (strcmp(real, keep) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/*
+ * \t.file 0 "dir" "name"   compilation directory (dwarf 5)
+ * \t.file N "dir" "name"
+ * \t.file N "name"         relative to the compilation directory
+ */
+static void source_file(AsmFilter *filter, const char *p, const char *end)
+{
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  if (p == end || !isdigit((unsigned char)*p))
+    return;
+
+  unsigned long id = strtoul(p, NULL, 10);
+  char first[PATH_MAX];
+  char second[PATH_MAX];
+  p = quoted(p, end, first, sizeof(first));
+  if (!p)
+    return;
+  const bool has_dir = quoted(p, end, second, sizeof(second)) != NULL;
+
+  const char *dir  = has_dir ? first : filter->comp_dir;
+  const char *name = has_dir ? second : first;
+  if (id == 0 && has_dir)
+    snprintf(filter->comp_dir, sizeof(filter->comp_dir), "%s", first);
+
+  char path[2*PATH_MAX];
+  if (name[0] == '/' || !dir[0])
+    snprintf(path, sizeof(path), "%s", name);
+  else
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  if (id < FILTER_MAX_FILES && keep_path(filter, path))
+    filter->keep_ids[id/8] |= 1 << (id%8);
+}
+
+
+/* 1 for a switch into code, 0 into anything else, -1 when not a switch */
+static int section_switch(const char *p, const char *end)
+{
+  if (end-p >= 5 && memcmp(p, ".text", 5) == 0 && (end-p == 5 || isspace((unsigned char)p[5])))
+    return 1;
+  if ((end-p >= 5 && memcmp(p, ".data", 5) == 0 && (end-p == 5 || isspace((unsigned char)p[5]))) ||
+      (end-p >= 4 && memcmp(p, ".bss", 4) == 0 && (end-p == 4 || isspace((unsigned char)p[4]))))
+    return 0;
+  if (end-p < 9 || memcmp(p, ".section", 8) != 0 || !isspace((unsigned char)p[8]))
+    return -1;
+
+  p += 8;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  return end-p >= 5 && memcmp(p, ".text", 5) == 0;
+}
+
+
+static uint64_t label_hash(const char *name, size_t len);
+
+/* "\t.type\tname, @function", the hash of name or 0 for any other type */
+static uint64_t function_type(const char *p, const char *end)
+{
+  p += 5;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  const char *name = p;
+  while (p < end && *p != ',' && !isspace((unsigned char)*p))
+    p++;
+  const size_t name_len = p - name;
+  while (p < end && (*p == ',' || isspace((unsigned char)*p)))
+    p++;
+  if (!name_len || end-p < 9 || memcmp(p, "@function", 9) != 0)
+    return 0;
+  return label_hash(name, name_len);
+}
+
+
+/* cut the current function back out, nothing after its label was written */
+static void drop_function(AsmFilter *filter)
+{
+  filter->asm_len = filter->func_start;
+  filter->nstats  = filter->func_nstats;
+  while (filter->nranges && filter->ranges[filter->nranges-1].start >= filter->func_start)
+    filter->nranges--;
+  if (filter->lines)
+    AsmLines_truncate(filter->lines, filter->func_start, filter->func_nstats);
+  filter->data_range = -1;
+  filter->data_open  = false;
+}
+
+
+/*
+ * runs ahead of the normal filter when keep_paths is set. returns true
+ * when the line is consumed. a function label is emitted as usual, the
+ * first .loc after it decides, and a dropped function is cut back out
+ * before any of its instructions were written. a data symbol has no
+ * .loc to decide on, e.g DW.ref.__gxx_personality_v0, and is dropped
+ */
+static bool source_filter(AsmFilter *filter, const char *line, size_t len)
+{
+  const char *end = line+len;
+  const char *p = line;
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  if (end-p > 5 && memcmp(p, ".loc", 4) == 0 && isspace((unsigned char)p[4])) {
+    if (filter->func_state == FUNC_UNDECIDED) {
+      const unsigned long id = strtoul(p+5, NULL, 10);
+      const bool keep = id < FILTER_MAX_FILES && (filter->keep_ids[id/8] & (1 << (id%8)));
+      filter->func_state = keep ? FUNC_KEEP : FUNC_DROP;
+      if (!keep)
+        drop_function(filter);
+    }
+    return true;
+  }
+
+  /* code before any line info belongs to no source, e.g rustc's main shim */
+  if (filter->func_state == FUNC_UNDECIDED && p > line && p < end &&
+      *p != '.' && *p != '#' && *p != '\n')
+  {
+    filter->func_state = FUNC_DROP;
+    drop_function(filter);
+    return true;
+  }
+
+  if (end-p > 6 && memcmp(p, ".file", 5) == 0 && isspace((unsigned char)p[5])) {
+    source_file(filter, p+5, end);
+    return true;
+  }
+
+  if (end-p > 6 && memcmp(p, ".type", 5) == 0 && isspace((unsigned char)p[5]))
+    filter->func_type = function_type(p, end);
+
+  /*
+   * constants can follow a dropped function, a kept one may use them.
+   * jump tables sit in the middle of one, so .text drops again
+   */
+  if (filter->func_state == FUNC_DROP || filter->func_state == FUNC_DATA) {
+    int text = section_switch(p, end);
+    if (text == 0 && filter->func_state == FUNC_DROP)
+      filter->func_state = FUNC_DATA;
+    else if (text == 1 && filter->func_state == FUNC_DATA)
+      filter->func_state = FUNC_DROP;
+  }
+
+  /* a symbol label opens the next function */
+  if (p == line && len > 1 && line[0] != '.') {
+    size_t n = len;
+    while (n && (line[n-1] == '\n' || line[n-1] == ' '))
+      n--;
+    if (n && line[n-1] == ':') {
+      const bool function = filter->func_type && label_hash(line, n-1) == filter->func_type;
+      filter->func_type   = 0;
+      filter->func_state  = function ? FUNC_UNDECIDED : FUNC_DROP;
+      filter->func_start  = filter->asm_len;
+      filter->func_nstats = filter->nstats;
+      return !function;
+    }
+  }
+
+  return filter->func_state == FUNC_DROP;
+}
+
+
+/*
+ * kept lines are already split into labels and instructions here, so
+ * the per function stats ride along for free
+ */
+static void filter_stats(AsmFilter *filter, size_t offset,
+                         const char *line, size_t len, bool label)
+{
+  if (label) {
+    size_t name_len = len;
+    while (name_len && (line[name_len-1] == '\n' || line[name_len-1] == ' '))
+      name_len--;
+    if (!name_len || line[name_len-1] != ':')
+      return;
+
+    if (filter->nstats == filter->max_stats) {
+      filter->max_stats = filter->max_stats ? filter->max_stats*2 : 64;
+      AsmFuncStats *new_stats = (AsmFuncStats*)realloc(filter->stats,
+                                                       sizeof(AsmFuncStats) * filter->max_stats);
+      if (!new_stats) {
+        fprintf(stderr, "Error: [libc] realloc\n");
+        return;
+      }
+      filter->stats = new_stats;
+    }
+
+    AsmFuncStats *stats = &filter->stats[filter->nstats++];
+    memset(stats, 0, sizeof(AsmFuncStats));
+    stats->name_offset = offset;
+    stats->name_len    = name_len-1;
+    return;
+  }
+
+  if (filter->nstats)
+    AsmFuncs_stats_line(&filter->stats[filter->nstats-1], line, len);
+}
+
+
+#define LABEL_FNV_OFFSET 0xcbf29ce484222325ULL
+#define LABEL_FNV_PRIME  0x100000001b3ULL
+
+/* never 0, that marks an empty slot */
+static uint64_t label_hash(const char *name, size_t len)
+{
+  uint64_t hash = LABEL_FNV_OFFSET;
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= LABEL_FNV_PRIME;
+  }
+  return hash | 1;
+}
+
+
+static bool label_used(AsmFilter *filter, uint64_t key)
+{
+  if (!filter->max_used)
+    return false;
+  for (unsigned int b = key & (filter->max_used-1); filter->used[b]; b = (b+1) & (filter->max_used-1)) {
+    if (filter->used[b] == key)
+      return true;
+  }
+  return false;
+}
+
+
+static void mark_used(AsmFilter *filter, uint64_t key)
+{
+  if (label_used(filter, key))
+    return;
+
+  if (2*(filter->nused+1) > filter->max_used) {
+    const unsigned int old_max = filter->max_used;
+    uint64_t *old = filter->used;
+    filter->max_used = old_max ? old_max*2 : 256;
+    filter->used = (uint64_t*)calloc(filter->max_used, sizeof(uint64_t));
+    if (!filter->used) {
+      fprintf(stderr, "Error: [libc] calloc\n");
+      filter->used = old;
+      filter->max_used = old_max;
+      return;
+    }
+    filter->nused = 0;
+    for (unsigned int i=0; i<old_max; i++) {
+      if (old[i])
+        mark_used(filter, old[i]);
+    }
+    free(old);
+  }
+
+  unsigned int b = key & (filter->max_used-1);
+  while (filter->used[b])
+    b = (b+1) & (filter->max_used-1);
+  filter->used[b] = key;
+  filter->nused++;
+}
+
+
+static bool label_char(unsigned char ch)
+{
+  return isalnum(ch) || ch == '_';
+}
+
+
+/* every .L name on the line counts as a use, skip is the definition */
+static void scan_refs(AsmFilter *filter, const char *line, size_t len, size_t skip)
+{
+  const char *end = line+len;
+  const char *p = line+skip;
+  while ((p = memchr(p, '.', end-p)) != NULL) {
+    if (end-p < 3 || p[1] != 'L' || (p > line && (label_char(p[-1]) || p[-1] == '.'))) {
+      p++;
+      continue;
+    }
+
+    const char *q = p+2;
+    while (q < end && label_char(*q))
+      q++;
+    if (q > p+2)
+      mark_used(filter, label_hash(p, q-p));
+    p = q;
+  }
+}
+
+
+/* length of the name when the line is a column 0 label */
+static size_t label_name_len(const char *line, size_t len)
+{
+  if (!len || line[0] == ' ' || line[0] == '\t')
+    return 0;
+
+  size_t n = len;
+  while (n && (line[n-1] == '\n' || line[n-1] == ' '))
+    n--;
+  return n > 1 && line[n-1] == ':' ? n-1 : 0;
+}
+
+
+static bool data_directive(const char *p, const char *end)
+{
+  static const char *const names[] = {
+    "byte", "short", "value", "word", "hword", "long", "int", "quad", "octa",
+    "2byte", "4byte", "8byte", "zero", "string", "ascii", "asciz", "float",
+    "single", "double", NULL
+  };
+
+  if (p == end || *p != '.')
+    return false;
+  p++;
+  const char *q = p;
+  while (q < end && !isspace((unsigned char)*q))
+    q++;
+
+  for (unsigned int i=0; names[i]; i++) {
+    if ((size_t)(q-p) == strlen(names[i]) && memcmp(p, names[i], q-p) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/* debug info and unwind tables reference every label, they never count */
+static bool meta_section(const char *p, const char *end)
+{
+  p += 8;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  return (end-p >= 6 && memcmp(p, ".debug", 6) == 0) ||
+         (end-p >= 17 && memcmp(p, ".gcc_except_table", 17) == 0) ||
+         (end-p >= 9 && memcmp(p, ".eh_frame", 9) == 0);
+}
+
+
+static int emit_line(AsmFilter *filter, const char *line, size_t len, bool blank, bool label)
+{
+  char *asm_buffer = filter->asm_buffer;
+  unsigned long long asm_len = filter->asm_len;
+
+  /* symbols are demangled in place, only kept lines pay for it */
+  const size_t dlen = AsmDemangle_line(line, len,
+                                       filter->demangle_buffer,
+                                       sizeof(filter->demangle_buffer));
+
+  /* room for the label newline and the terminator */
+  while (asm_len + dlen + 2 > filter->buf_max) {
+    filter->buf_max *= 2;
+    char *new_buffer = (char*)realloc(asm_buffer, filter->buf_max);
+    if (!new_buffer) {
+      fprintf(stderr, "Error: [libc] realloc\n");
+      free(asm_buffer);
+      filter->asm_buffer = NULL;
+      return ASM_FILTER_FAIL;
+    }
+    asm_buffer = new_buffer;
+  }
+
+  if (blank) {
+    if (filter->lines)
+      AsmLines_add(filter->lines, "", asm_len, 0, false, 0, 0);
+    asm_buffer[asm_len++] = '\n';
+  }
+
+  const unsigned int nstats = filter->nstats;
+  memcpy(asm_buffer+asm_len, filter->demangle_buffer, dlen);
+  filter_stats(filter, asm_len, filter->demangle_buffer, dlen, label);
+  if (filter->lines)
+    AsmLines_add(filter->lines, filter->demangle_buffer, asm_len, dlen,
+                 filter->nstats > nstats, filter->loc_file, filter->loc_line);
+  asm_len += dlen;
+
+  filter->asm_buffer = asm_buffer;
+  filter->asm_len    = asm_len;
+  return ASM_FILTER_OK;
+}
+
+
+/* a label just written, removable when it is a .L name */
+static void label_written(AsmFilter *filter, const char *line, size_t name_len,
+                          unsigned long long start)
+{
+  const uint64_t key = label_hash(line, name_len);
+  filter->data_open  = true;
+  filter->data_range = -1;
+
+  if (name_len < 3 || line[0] != '.' || line[1] != 'L')
+    return;
+
+  const bool jump = line[2] >= '0' && line[2] <= '9';
+  if (jump && !(filter->options & ASM_FILTER_UNUSED_LABELS)) {
+    mark_used(filter, key);
+    return;
+  }
+
+  if (filter->nranges == filter->max_ranges) {
+    const unsigned int max = filter->max_ranges ? filter->max_ranges*2 : 256;
+    AsmFilterRange *ranges = (AsmFilterRange*)realloc(filter->ranges, sizeof(AsmFilterRange) * max);
+    if (!ranges) {
+      fprintf(stderr, "Error: [libc] realloc\n");
+      mark_used(filter, key);
+      return;
+    }
+    filter->ranges = ranges;
+    filter->max_ranges = max;
+  }
+
+  AsmFilterRange *range = &filter->ranges[filter->nranges];
+  range->key   = key;
+  range->start = start;
+  range->len   = filter->asm_len - start;
+  filter->data_range = filter->nranges++;
+}
+
+
+/*
+ * label bookkeeping and data under labels. returns 1 when the line was
+ * handled here, 0 to carry on with the default filter
+ */
+static int pipeline_line(AsmFilter *filter, const char *line, size_t len, int *status)
+{
+  const char *end = line+len;
+  const char *p = line;
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  const int text = section_switch(p, end);
+  if (text != -1) {
+    filter->meta_section = text == 0 && end-p > 8 && memcmp(p, ".section", 8) == 0 &&
+                           meta_section(p, end);
+    filter->data_open = false;
+    return 0;
+  }
+  if (filter->meta_section)
+    return 0;
+
+  const size_t name_len = label_name_len(line, len);
+  scan_refs(filter, line, len, name_len ? name_len+1 : 0);
+  if (name_len)
+    return 0;
+
+  if (!filter->data_open || !data_directive(p, end)) {
+    filter->data_open = false;
+    return 0;
+  }
+
+  /* a directive either way, the default filter would drop it */
+  *status = ASM_FILTER_OK;
+  if (!(filter->options & ASM_FILTER_DATA))
+    return 1;
+
+  const unsigned long long start = filter->asm_len;
+  *status = emit_line(filter, line, len, false, false);
+  if (*status == ASM_FILTER_OK && filter->data_range >= 0)
+    filter->ranges[filter->data_range].len += filter->asm_len - start;
+  return 1;
+}
+
+
+/* "\t.loc <file> <line> <column>" */
+static void track_loc(AsmFilter *filter, const char *line, size_t len)
+{
+  size_t p = 0;
+  while (p < len && (line[p] == ' ' || line[p] == '\t'))
+    p++;
+  if (len-p < 6 || memcmp(line+p, ".loc", 4) != 0 || !isspace((unsigned char)line[p+4]))
+    return;
+
+  char *end;
+  const unsigned long file = strtoul(line+p+5, &end, 10);
+  filter->loc_file = file <= UINT16_MAX ? file : 0;
+  filter->loc_line = strtoul(end, NULL, 10);
+}
+
+
+int AsmFilter_line(AsmFilter *filter, const char *line_buffer, size_t len)
+{
+  unsigned int state = 0;
+
+  if (!filter->asm_buffer)
+    return ASM_FILTER_FAIL;
+
+  if (filter->lines)
+    track_loc(filter, line_buffer, len);
+
+  if (filter->nkeep && source_filter(filter, line_buffer, len))
+    return ASM_FILTER_OK;
+
+  int status;
+  if (filter->options && pipeline_line(filter, line_buffer, len, &status))
+    return status;
+
+  /*
+   * keep jmp labels and their assembly
+   * e.g .L183: <asm>
+   */
+  bool blank = false;
+  if (len > 2 &&
+      line_buffer[0] == '.' &&
+      line_buffer[1] == 'L')
+  {
+    if (line_buffer[2] >= '0' &&
+        line_buffer[2] <= '9')
+    {
+      blank = true;
+      state = 1;
+    }
+    /* .LC0: and friends head the data they label */
+    else if ((filter->options & ASM_FILTER_DATA) && !filter->meta_section &&
+             label_name_len(line_buffer, len))
+    {
+      blank = true;
+      state = 1;
+    }
+  }
+
+  unsigned int i;
+  for (i=0; i<len && !state; i++) {
+    unsigned char ch = line_buffer[i];
+    switch (ch) {
+      case ' ':
+      case '\t':
+        break;
+
+      case '.':
+        state = -1;
+        break;
+
+      default:
+        state = 1;
+        break;
+    }
+  }
+
+  if (state != 1)
+    return ASM_FILTER_OK;
+
+  const unsigned long long start = filter->asm_len;
+  if (emit_line(filter, line_buffer, len, blank || i==1, i==1) != ASM_FILTER_OK)
+    return ASM_FILTER_FAIL;
+
+  if (filter->options && !filter->meta_section) {
+    const size_t name_len = label_name_len(line_buffer, len);
+    if (name_len)
+      label_written(filter, line_buffer, name_len, start);
+  }
+  return ASM_FILTER_OK;
+}
+
+
+/* same line splitting as fgets into a FILTER_LINE_MAX buffer */
+int AsmFilter_feed(AsmFilter *filter, const char *chunk, size_t len)
+{
+  for (size_t i=0; i<len; i++) {
+    filter->line_buffer[filter->line_len++] = chunk[i];
+    if (chunk[i] == '\n' || filter->line_len == FILTER_LINE_MAX-1) {
+      filter->line_buffer[filter->line_len] = '\0';
+      if (AsmFilter_line(filter, filter->line_buffer, filter->line_len) != ASM_FILTER_OK)
+        return ASM_FILTER_FAIL;
+      filter->line_len = 0;
+    }
+  }
+  return ASM_FILTER_OK;
+}
+
+
+/*
+ * same sweep over the tokenized lines, lines inside a removed range go
+ * and the rest shift down. operand spans are relative, they stay put
+ */
+static void remove_unused_lines(AsmFilter *filter)
+{
+  AsmLines *lines = filter->lines;
+  unsigned long long removed = 0;
+  unsigned int r = 0;
+  uint32_t out = 0;
+
+  for (uint32_t i=0; i<lines->n; i++) {
+    const unsigned long long offset = lines->offset[i];
+    for (; r<filter->nranges; r++) {
+      const AsmFilterRange *range = &filter->ranges[r];
+      if (range->start + range->len > offset)
+        break;
+      if (!label_used(filter, range->key))
+        removed += range->len;
+    }
+
+    if (r < filter->nranges && filter->ranges[r].start <= offset &&
+        !label_used(filter, filter->ranges[r].key))
+      continue;
+
+    lines->offset[out]   = offset - removed;
+    lines->len[out]      = lines->len[i];
+    lines->kind[out]     = lines->kind[i];
+    lines->nops[out]     = lines->nops[i];
+    lines->mnemonic[out] = lines->mnemonic[i];
+    lines->op_first[out] = lines->op_first[i];
+    lines->label[out]    = lines->label[i];
+    lines->func[out]     = lines->func[i];
+    lines->src_file[out] = lines->src_file[i];
+    lines->src_line[out] = lines->src_line[i];
+    out++;
+  }
+  lines->n = out;
+}
+
+
+/*
+ * the fixup pass, unreferenced ranges are squeezed out in one sweep and
+ * the stats offsets behind them move down by what was removed before
+ */
+static void remove_unused(AsmFilter *filter)
+{
+  char *buffer = filter->asm_buffer;
+  unsigned long long rd = 0;
+  unsigned long long wr = 0;
+  unsigned int s = 0;
+
+  for (unsigned int r=0; r<filter->nranges; r++) {
+    AsmFilterRange *range = &filter->ranges[r];
+    if (label_used(filter, range->key))
+      continue;
+
+    for (; s<filter->nstats && filter->stats[s].name_offset < range->start; s++)
+      filter->stats[s].name_offset -= rd - wr;
+
+    memmove(buffer+wr, buffer+rd, range->start - rd);
+    wr += range->start - rd;
+    rd  = range->start + range->len;
+  }
+
+  for (; s<filter->nstats; s++)
+    filter->stats[s].name_offset -= rd - wr;
+  memmove(buffer+wr, buffer+rd, filter->asm_len - rd);
+  filter->asm_len = wr + filter->asm_len - rd;
+
+  if (filter->lines)
+    remove_unused_lines(filter);
+}
+
+
+char* AsmFilter_finish(AsmFilter *filter, unsigned long long *len)
+{
+  if (filter->line_len && filter->asm_buffer) {
+    filter->line_buffer[filter->line_len] = '\0';
+    AsmFilter_line(filter, filter->line_buffer, filter->line_len);
+    filter->line_len = 0;
+  }
+
+  if (!filter->asm_buffer) {
+    *len = 0;
+    return NULL;
+  }
+
+  if (filter->nranges)
+    remove_unused(filter);
+  free(filter->ranges);
+  free(filter->used);
+  filter->ranges  = NULL;
+  filter->nranges = filter->max_ranges = 0;
+  filter->used    = NULL;
+  filter->nused   = filter->max_used = 0;
+
+  filter->asm_buffer[filter->asm_len] = '\0'; // safety for strchr and ptr return
+  *len = filter->asm_len;
+  return filter->asm_buffer;
+}
+
+
+/* ownership of the stats moves to the caller */
+AsmFuncStats* AsmFilter_take_stats(AsmFilter *filter, unsigned int *nstats)
+{
+  AsmFuncStats *stats = filter->stats;
+  *nstats = filter->nstats;
+  filter->stats     = NULL;
+  filter->nstats    = 0;
+  filter->max_stats = 0;
+  return stats;
+}
+
+
+enum { SCAN_TYPE, SCAN_NAME, SCAN_LABEL };
+
+static const char scan_type[]  = "\t.type";
+static const char scan_label[] = "@function\n";
+
+
+void AsmNameScan_init(AsmNameScan *scan)
+{
+  scan->phase    = SCAN_TYPE;
+  scan->state    = 0;
+  scan->name_len = 0;
+  scan->max      = 16384;
+  scan->len      = 0;
+  scan->names    = (char*)malloc(scan->max);
+}
+
+
+/* name is "<ws><symbol>, ", cut at the last comma */
+static int scan_emit(AsmNameScan *scan)
+{
+  size_t end = scan->name_len;
+  while (end && scan->name[end-1] != ',')
+    end--;
+  if (end)
+    end--;
+  else
+    end = scan->name_len;
+
+  const char *p = scan->name;
+  while (p < scan->name+end && (*p == ' ' || *p == '\t'))
+    p++;
+  size_t flen = scan->name+end - p;
+
+  const char *demangled = AsmDemangle_symbol(p, flen);
+  if (demangled) {
+    p = demangled;
+    flen = strlen(p);
+  }
+
+  while (scan->len + flen+2 > scan->max) {
+    scan->max *= 2;
+    char *new_names = (char*)realloc(scan->names, scan->max);
+    if (!new_names) {
+      fprintf(stderr, "Error: [libc] realloc\n");
+      free(scan->names);
+      scan->names = NULL;
+      return ASM_FILTER_FAIL;
+    }
+    scan->names = new_names;
+  }
+
+  memcpy(scan->names+scan->len, p, flen);
+  scan->len += flen;
+  scan->names[scan->len++] = '\n';
+  return ASM_FILTER_OK;
+}
+
+
+/*
+ * matches "\t.type", takes everything up to '@' as the name and then
+ * expects "@function\n". a failed suffix rescans the same character for
+ * the directive. state carries across chunks, pipe reads split anywhere
+ */
+int AsmNameScan_feed(AsmNameScan *scan, const char *chunk, size_t len)
+{
+  if (!scan->names)
+    return ASM_FILTER_FAIL;
+
+  size_t i = 0;
+  while (i < len) {
+    const unsigned char ch = chunk[i];
+    switch (scan->phase) {
+      case SCAN_TYPE:
+        scan->state = scan_type[scan->state] == ch ? scan->state+1 : 0;
+        i++;
+        if (scan->state == sizeof(scan_type)-1) {
+          scan->state    = 0;
+          scan->name_len = 0;
+          scan->phase    = SCAN_NAME;
+        }
+        break;
+
+      case SCAN_NAME:
+        if (ch == '@') {
+          scan->state = 0;
+          scan->phase = SCAN_LABEL;
+          break;
+        }
+        if (scan->name_len < SCAN_NAME_MAX)
+          scan->name[scan->name_len++] = ch;
+        i++;
+        break;
+
+      case SCAN_LABEL:
+        if (scan_label[scan->state] != ch) {
+          scan->state = 0;
+          scan->phase = SCAN_TYPE;
+          break;
+        }
+        i++;
+        if (++scan->state == sizeof(scan_label)-1) {
+          if (scan_emit(scan) != ASM_FILTER_OK)
+            return ASM_FILTER_FAIL;
+          scan->state = 0;
+          scan->phase = SCAN_TYPE;
+        }
+        break;
+    }
+  }
+  return ASM_FILTER_OK;
+}
+
+
+/* the caller owns the returned buffer */
+char* AsmNameScan_finish(AsmNameScan *scan, size_t *len)
+{
+  char *names = scan->names;
+  *len = names ? scan->len : 0;
+  if (names)
+    names[scan->len] = '\0';
+  scan->names = NULL;
+  return names;
+}
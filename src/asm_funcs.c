@@ -0,0 +1,398 @@
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "asm_funcs.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define NORMALIZE_LINE_MAX 16384
+
+
+static inline uint64_t fnv_hash(uint64_t hash, const char *data, size_t len)
+{
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static inline bool is_symbol_char(unsigned char ch)
+{
+  return (ch >= 'a' && ch <= 'z') ||
+         (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') ||
+         ch == '_' || ch == '$' || ch == '.';
+}
+
+
+static inline bool is_function_label(const char *line, size_t len)
+{
+  return len > 1 &&
+         line[0] != ' ' && line[0] != '\t' && line[0] != '.' &&
+         line[len-1] == ':';
+}
+
+
+/*
+ * .L<letters><digits> tokens are replaced by their order of first use, so
+ * a function that only had its labels renumbered normalizes to the same
+ * text
+ */
+size_t AsmFuncs_normalize_line(const char *line, size_t len,
+                               char *out, size_t out_max,
+                               AsmLabelMap *labels)
+{
+  size_t j = 0;
+  size_t i = 0;
+
+  if (!out_max)
+    return 0;
+
+  while (i < len && j < out_max-1) {
+    if (line[i] == '.' && i+2 < len && line[i+1] == 'L' &&
+        (i == 0 || !is_symbol_char(line[i-1])))
+    {
+      size_t k = i+2;
+      while (k < len && ((line[k] >= 'a' && line[k] <= 'z') ||
+                         (line[k] >= 'A' && line[k] <= 'Z') ||
+                         line[k] == '_'))
+        k++;
+      size_t prefix_end = k;
+      while (k < len && line[k] >= '0' && line[k] <= '9')
+        k++;
+
+      if (k > prefix_end && (k == len || !is_symbol_char(line[k]))) {
+        uint64_t key = fnv_hash(FNV_OFFSET, line+i, k-i);
+        unsigned int id;
+        for (id=0; id<labels->nkeys; id++) {
+          if (labels->keys[id] == key)
+            break;
+        }
+        if (id == labels->nkeys && labels->nkeys < ASM_LABEL_MAP_MAX)
+          labels->keys[labels->nkeys++] = key;
+
+        char num[16];
+        const size_t num_len = snprintf(num, sizeof(num), "%u", id);
+        const size_t prefix_len = prefix_end - i;
+        if (j + prefix_len + num_len >= out_max)
+          break;
+        memcpy(out+j, line+i, prefix_len);
+        j += prefix_len;
+        memcpy(out+j, num, num_len);
+        j += num_len;
+        i = k;
+        continue;
+      }
+    }
+
+    out[j++] = line[i++];
+  }
+
+  out[j] = '\0';
+  return j;
+}
+
+
+static bool is_gpr64(const char *op, size_t len)
+{
+  static const char *regs[] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+  };
+
+  for (size_t i=0; i+2 < len; i++) {
+    if (op[i] != 'r' || (i && is_symbol_char(op[i-1])))
+      continue;
+    if (op[i+1] >= '0' && op[i+1] <= '9')
+      return true;  // r8 .. r15 and their sub registers
+    for (unsigned int r=0; r<sizeof(regs)/sizeof(regs[0]); r++) {
+      if (memcmp(op+i, regs[r], 3) == 0 && (i+3 == len || !is_symbol_char(op[i+3])))
+        return true;
+    }
+  }
+  return false;
+}
+
+
+static bool contains(const char *s, size_t len, const char *needle)
+{
+  const size_t n = strlen(needle);
+  for (size_t i=0; i+n <= len; i++) {
+    if (memcmp(s+i, needle, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/*
+ * estimated x86-64 encoding size of an intel syntax instruction line. there
+ * is no assembler in the loop so this only counts prefixes, modrm/sib,
+ * displacement and immediate widths, good enough for relative comparisons
+ */
+unsigned int AsmFuncs_estimate_size(const char *line, size_t len)
+{
+  size_t i = 0;
+  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+
+  const char *mnemonic = line+i;
+  while (i < len && line[i] != ' ' && line[i] != '\t' && line[i] != '\n')
+    i++;
+  const size_t mlen = (line+i) - mnemonic;
+  if (!mlen || mnemonic[0] == '.' || mnemonic[mlen-1] == ':')
+    return 0;
+
+  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+  const char *ops = line+i;
+  size_t ops_len = len - i;
+  while (ops_len && (ops[ops_len-1] == '\n' || ops[ops_len-1] == ' '))
+    ops_len--;
+
+  /* branches, short form for local labels */
+  if (mnemonic[0] == 'j') {
+    if (contains(ops, ops_len, ".L"))
+      return 2;
+    return (mlen == 3 && memcmp(mnemonic, "jmp", 3) == 0) ? 5 : 6;
+  }
+  if (mlen == 4 && memcmp(mnemonic, "call", 4) == 0)
+    return ops_len && ops[0] != '[' && !is_gpr64(ops, ops_len) ? 5 : 3;
+  if (!ops_len)
+    return 1;
+
+  unsigned int size = 2;  // opcode + modrm
+
+  if (contains(ops, ops_len, "zmm"))
+    size += 4;  // evex
+  else if (mnemonic[0] == 'v' && contains(ops, ops_len, "mm"))
+    size += 2;  // vex
+  else if (contains(ops, ops_len, "xmm"))
+    size += 2;  // legacy sse prefix + 0f escape
+  else if (is_gpr64(ops, ops_len))
+    size += 1;  // rex
+
+  const char *mem = memchr(ops, '[', ops_len);
+  if (mem) {
+    const char *mem_end = memchr(mem, ']', ops_len - (mem-ops));
+    size_t mem_len = mem_end ? (size_t)(mem_end-mem) : ops_len - (mem-ops);
+    if (contains(mem, mem_len, "rip"))
+      size += 4;
+    else {
+      if (memchr(mem, '*', mem_len) || contains(mem, mem_len, "rsp"))
+        size += 1;  // sib
+      const char *sign = NULL;
+      for (size_t k=1; k<mem_len; k++) {
+        if (mem[k] == '+' || mem[k] == '-')
+          sign = mem+k;
+      }
+      if (sign && sign+1 < mem+mem_len && sign[1] >= '0' && sign[1] <= '9') {
+        long disp = strtol(sign+1, NULL, 0);
+        size += (disp <= 127) ? 1 : 4;
+      }
+    }
+  }
+
+  /* trailing immediate */
+  const char *comma = NULL;
+  for (size_t k=0; k<ops_len; k++) {
+    if (ops[k] == ',')
+      comma = ops+k;
+  }
+  const char *last = comma ? comma+1 : ops;
+  while (last < ops+ops_len && *last == ' ')
+    last++;
+  if (last < ops+ops_len && ((*last >= '0' && *last <= '9') || *last == '-')) {
+    long long imm = strtoll(last, NULL, 0);
+    if (mlen == 6 && memcmp(mnemonic, "movabs", 6) == 0)
+      size += 8;
+    else
+      size += (imm >= -128 && imm <= 127) ? 1 : 4;
+  }
+
+  return size > 15 ? 15 : size;
+}
+
+
+/*
+ * counts one instruction line towards a function. packed means the
+ * instruction touches a vector register and is not a scalar ss/sd op
+ */
+void AsmFuncs_stats_line(AsmFuncStats *stats, const char *line, size_t len)
+{
+  size_t i = 0;
+  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+
+  const char *mnemonic = line+i;
+  while (i < len && line[i] != ' ' && line[i] != '\t' && line[i] != '\n')
+    i++;
+  const size_t mlen = (line+i) - mnemonic;
+  if (!mlen || mnemonic[0] == '.')
+    return;
+
+  stats->ninstr++;
+  stats->est_size += AsmFuncs_estimate_size(line, len);
+
+  if (mnemonic[0] == 'j')
+    stats->nbranches++;
+  else if (mlen == 4 && memcmp(mnemonic, "call", 4) == 0)
+    stats->ncalls++;
+
+  unsigned int width = ASM_VECTOR_NONE;
+  const char *ops = line+i;
+  const size_t ops_len = len-i;
+  if (contains(ops, ops_len, "zmm"))
+    width = ASM_VECTOR_ZMM;
+  else if (contains(ops, ops_len, "ymm"))
+    width = ASM_VECTOR_YMM;
+  else if (contains(ops, ops_len, "xmm"))
+    width = ASM_VECTOR_XMM;
+
+  if (width == ASM_VECTOR_NONE)
+    return;
+
+  const bool scalar = mlen > 2 &&
+                      mnemonic[mlen-2] == 's' &&
+                      (mnemonic[mlen-1] == 's' || mnemonic[mlen-1] == 'd');
+  if (!scalar)
+    stats->nvector++;
+  if (width > stats->vector_width)
+    stats->vector_width = width;
+}
+
+
+const char* AsmFuncs_vector_name(unsigned int width)
+{
+  switch (width) {
+    case ASM_VECTOR_XMM: return "xmm";
+    case ASM_VECTOR_YMM: return "ymm";
+    case ASM_VECTOR_ZMM: return "zmm";
+  }
+  return "none";
+}
+
+
+int AsmFunctionIndex_build(AsmFunctionIndex *index, const char *asm_buffer, size_t len)
+{
+  memset(index, 0, sizeof(AsmFunctionIndex));
+  index->asm_buffer = asm_buffer;
+
+  if (!asm_buffer)
+    return ASM_FUNCS_OK;
+
+  unsigned int max_funcs = 64;
+  index->funcs = (AsmFunction*)malloc(sizeof(AsmFunction) * max_funcs);
+
+  AsmLabelMap *labels = (AsmLabelMap*)malloc(sizeof(AsmLabelMap));
+  char *norm = (char*)malloc(NORMALIZE_LINE_MAX);
+  AsmFunction *func = NULL;
+
+  size_t pos = 0;
+  while (pos < len) {
+    const char *line = asm_buffer + pos;
+    const char *nl = memchr(line, '\n', len - pos);
+    const size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+    const size_t next = pos + line_len + (nl ? 1 : 0);
+
+    if (!line_len) {
+      pos = next;
+      continue;
+    }
+
+    if (is_function_label(line, line_len)) {
+      if (func)
+        func->body_end = pos;
+
+      if (index->nfuncs == max_funcs) {
+        max_funcs *= 2;
+        AsmFunction *new_funcs = (AsmFunction*)realloc(index->funcs,
+                                                       sizeof(AsmFunction) * max_funcs);
+        if (!new_funcs) {
+          fprintf(stderr, "Error: [libc] realloc\n");
+          free(labels);
+          free(norm);
+          AsmFunctionIndex_free(index);
+          return ASM_FUNCS_FAIL;
+        }
+        index->funcs = new_funcs;
+      }
+
+      func = &index->funcs[index->nfuncs++];
+      memset(func, 0, sizeof(AsmFunction));
+      func->name       = line;
+      func->name_len   = line_len-1;
+      func->body_start = next;
+      func->body_end   = next;
+      func->hash       = FNV_OFFSET;
+      labels->nkeys    = 0;
+    }
+    else if (func) {
+      if (line[0] == ' ' || line[0] == '\t') {
+        func->ninstr++;
+        func->est_size += AsmFuncs_estimate_size(line, line_len);
+      }
+      size_t norm_len = AsmFuncs_normalize_line(line, line_len, norm,
+                                                NORMALIZE_LINE_MAX, labels);
+      func->hash = fnv_hash(func->hash, norm, norm_len+1);  // '\0' separates lines
+      func->body_end = next;
+    }
+
+    pos = next;
+  }
+
+  free(labels);
+  free(norm);
+
+  /* name lookup table, power of two buckets */
+  index->nbuckets = 64;
+  while (index->nbuckets < index->nfuncs*2)
+    index->nbuckets *= 2;
+  index->buckets = (int*)malloc(sizeof(int) * index->nbuckets);
+  index->chain   = (int*)malloc(sizeof(int) * (index->nfuncs ? index->nfuncs : 1));
+  memset(index->buckets, -1, sizeof(int) * index->nbuckets);
+
+  for (unsigned int i=0; i<index->nfuncs; i++) {
+    AsmFunction *f = &index->funcs[i];
+    f->name_hash = fnv_hash(FNV_OFFSET, f->name, f->name_len);
+    unsigned int b = f->name_hash & (index->nbuckets-1);
+    index->chain[i] = index->buckets[b];
+    index->buckets[b] = i;
+  }
+
+  return ASM_FUNCS_OK;
+}
+
+
+void AsmFunctionIndex_free(AsmFunctionIndex *index)
+{
+  free(index->funcs);
+  free(index->buckets);
+  free(index->chain);
+  index->funcs    = NULL;
+  index->buckets  = NULL;
+  index->chain    = NULL;
+  index->nfuncs   = 0;
+  index->nbuckets = 0;
+}
+
+
+AsmFunction* AsmFunctionIndex_find(AsmFunctionIndex *index, const char *name, size_t len)
+{
+  if (!index->nbuckets)
+    return NULL;
+
+  const uint64_t hash = fnv_hash(FNV_OFFSET, name, len);
+  for (int i = index->buckets[hash & (index->nbuckets-1)]; i != -1; i = index->chain[i]) {
+    AsmFunction *func = &index->funcs[i];
+    if (func->name_hash == hash && 
+        func->name_len == len && 
+        memcmp(func->name, name, len) == 0)
+      return func;
+  }
+  return NULL;
+}
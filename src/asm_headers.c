@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/stat.h>
+
+#include "asm_headers.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+struct scan_job {
+  int node;
+  FILE *pipe;
+  char *out;
+  size_t len;
+  size_t max;
+};
+
+
+static uint64_t path_hash(const char *path)
+{
+  uint64_t hash = FNV_OFFSET;
+  for (; *path; path++) {
+    hash ^= (unsigned char)*path;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static bool has_ext(const char *path, const char *const exts[])
+{
+  const char *ext = strrchr(path, '.');
+  if (!ext)
+    return false;
+  for (unsigned int i=0; exts[i]; i++) {
+    if (strcmp(ext+1, exts[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+bool AsmHeaders_is_header(const char *path)
+{
+  static const char *const exts[] = { "h", "hh", "hpp", "hxx", "inl", NULL };
+  return has_ext(path, exts);
+}
+
+
+int AsmHeaders_init(AsmHeaderIndex *index, cJSON *root)
+{
+  static const char *const exts[] = { "c", "cc", "cpp", "cxx", NULL };
+  memset(index, 0, sizeof(AsmHeaderIndex));
+
+  const int n = cJSON_GetArraySize(root);
+  index->nodes   = (cJSON**)malloc(sizeof(cJSON*) * (n ? n : 1));
+  index->scanned = (bool*)calloc(n ? n : 1, sizeof(bool));
+
+  for (cJSON *node = root->child; node; node = node->next) {
+    char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file"));
+    if (file && has_ext(file, exts))
+      index->nodes[index->nnodes++] = node;
+  }
+
+  index->nbuckets = 1024;
+  index->buckets  = (int*)malloc(sizeof(int) * index->nbuckets);
+  memset(index->buckets, -1, sizeof(int) * index->nbuckets);
+  return ASM_HEADERS_OK;
+}
+
+
+void AsmHeaders_free(AsmHeaderIndex *index)
+{
+  for (unsigned int i=0; i<index->nentries; i++) {
+    free(index->entries[i].path);
+    free(index->entries[i].tus);
+  }
+  free(index->entries);
+  free(index->buckets);
+  free(index->nodes);
+  free(index->scanned);
+  memset(index, 0, sizeof(AsmHeaderIndex));
+}
+
+
+static AsmHeaderEntry* lookup(AsmHeaderIndex *index, const char *path)
+{
+  unsigned int b = path_hash(path) & (index->nbuckets-1);
+  for (; index->buckets[b] != -1; b = (b+1) & (index->nbuckets-1)) {
+    AsmHeaderEntry *entry = &index->entries[index->buckets[b]];
+    if (strcmp(entry->path, path) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+
+static void rehash(AsmHeaderIndex *index)
+{
+  index->nbuckets *= 2;
+  index->buckets = (int*)realloc(index->buckets, sizeof(int) * index->nbuckets);
+  memset(index->buckets, -1, sizeof(int) * index->nbuckets);
+  for (unsigned int i=0; i<index->nentries; i++) {
+    unsigned int b = path_hash(index->entries[i].path) & (index->nbuckets-1);
+    while (index->buckets[b] != -1)
+      b = (b+1) & (index->nbuckets-1);
+    index->buckets[b] = i;
+  }
+}
+
+
+static void add_dep(AsmHeaderIndex *index, const char *path, int node)
+{
+  AsmHeaderEntry *entry = lookup(index, path);
+  if (!entry) {
+    if (index->nentries == index->max_entries) {
+      index->max_entries = index->max_entries ? index->max_entries*2 : 256;
+      index->entries = (AsmHeaderEntry*)realloc(index->entries,
+                                                sizeof(AsmHeaderEntry) * index->max_entries);
+    }
+    if (2*(index->nentries+1) > index->nbuckets)
+      rehash(index);
+
+    entry = &index->entries[index->nentries];
+    memset(entry, 0, sizeof(AsmHeaderEntry));
+    entry->path = strdup(path);
+
+    unsigned int b = path_hash(path) & (index->nbuckets-1);
+    while (index->buckets[b] != -1)
+      b = (b+1) & (index->nbuckets-1);
+    index->buckets[b] = index->nentries++;
+  }
+
+  if (entry->ntus && entry->tus[entry->ntus-1] == node)
+    return;
+  if (entry->ntus == entry->max_tus) {
+    entry->max_tus = entry->max_tus ? entry->max_tus*2 : 4;
+    entry->tus = (int*)realloc(entry->tus, sizeof(int) * entry->max_tus);
+  }
+  entry->tus[entry->ntus++] = node;
+}
+
+
+/* "tu: a.c b.h \
+ *  c.h" relative paths are against the entry's directory */
+static void parse_deps(AsmHeaderIndex *index, int node, const char *out, size_t len)
+{
+  const char *dir = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(index->nodes[node], "directory"));
+  char token[PATH_MAX];
+  char path[2*PATH_MAX];
+  char real[PATH_MAX];
+
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && (out[i] == ' ' || out[i] == '\t' || out[i] == '\n' || out[i] == '\\'))
+      i++;
+
+    size_t j = 0;
+    while (i < len && out[i] != ' ' && out[i] != '\t' && out[i] != '\n') {
+      if (out[i] == '\\' && i+1 < len && out[i+1] == ' ')
+        i++;
+      else if (out[i] == '\\' && i+1 < len && out[i+1] == '\n')
+        break;
+      if (j < sizeof(token)-1)
+        token[j++] = out[i];
+      i++;
+    }
+    token[j] = '\0';
+    if (!j || token[j-1] == ':')
+      continue;
+
+    if (token[0] == '/' || !dir)
+      snprintf(path, sizeof(path), "%s", token);
+    else
+      snprintf(path, sizeof(path), "%s/%s", dir, token);
+
+    if (realpath(path, real) && AsmHeaders_is_header(real))
+      add_dep(index, real, node);
+  }
+}
+
+
+/* the entry's command minus its output, asking for dependencies only */
+static char* scan_command(cJSON *node)
+{
+  const char *cmd = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "command"));
+  const char *dir = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "directory"));
+  if (!cmd)
+    return NULL;
+
+  const size_t max = strlen(cmd) + (dir ? strlen(dir) : 0) + 64;
+  char *out = (char*)malloc(max);
+  size_t j = dir ? (size_t)snprintf(out, max, "cd '%s' && ", dir) : 0;
+
+  for (const char *p = cmd; *p; ) {
+    if (p[0] == '-' && p[1] == 'o' && p[2] == ' ' && (p == cmd || p[-1] == ' ')) {
+      p += 3;
+      while (*p && *p != ' ')
+        p++;
+      continue;
+    }
+    out[j++] = *p++;
+  }
+  snprintf(out+j, max-j, " -MM -MT tu 2> /dev/null");
+  return out;
+}
+
+
+/* dependency scans of the given entries, ASM_HEADER_JOBS at a time */
+static void scan_nodes(AsmHeaderIndex *index, const int *todo, unsigned int ntodo)
+{
+  struct scan_job jobs[ASM_HEADER_JOBS];
+  struct pollfd fds[ASM_HEADER_JOBS];
+  unsigned int running = 0;
+  unsigned int next = 0;
+
+  while (next < ntodo || running) {
+    while (running < ASM_HEADER_JOBS && next < ntodo) {
+      const int node = todo[next++];
+      index->scanned[node] = true;
+      index->nscanned++;
+
+      char *cmd = scan_command(index->nodes[node]);
+      FILE *pipe = cmd ? popen(cmd, "r") : NULL;
+      free(cmd);
+      if (!pipe)
+        continue;
+
+      struct scan_job *job = &jobs[running++];
+      job->node = node;
+      job->pipe = pipe;
+      job->len  = 0;
+      job->max  = 4096;
+      job->out  = (char*)malloc(job->max);
+    }
+
+    if (!running)
+      break;
+
+    for (unsigned int i=0; i<running; i++) {
+      fds[i].fd = fileno(jobs[i].pipe);
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll(fds, running, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Error: [libc] poll - %s\n", strerror(errno));
+      break;
+    }
+
+    for (unsigned int i=0; i<running; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      struct scan_job *job = &jobs[i];
+      if (job->len == job->max) {
+        job->max *= 2;
+        job->out = (char*)realloc(job->out, job->max);
+      }
+
+      ssize_t bytes = read(fds[i].fd, job->out+job->len, job->max-job->len);
+      if (bytes == -1 && errno == EINTR)
+        continue;
+      if (bytes > 0) {
+        job->len += bytes;
+        continue;
+      }
+
+      if (pclose(job->pipe) == 0)
+        parse_deps(index, job->node, job->out, job->len);
+      free(job->out);
+
+      /* swap the last job in, its poll result moves with it */
+      jobs[i] = jobs[--running];
+      fds[i]  = fds[running];
+      i--;
+    }
+  }
+
+  for (unsigned int i=0; i<running; i++) {
+    pclose(jobs[i].pipe);
+    free(jobs[i].out);
+  }
+}
+
+
+/* cheap pre-pass, an #include line naming the header's file name */
+static bool names_header(const char *file, const char *base)
+{
+  FILE *fp = fopen(file, "r");
+  if (!fp)
+    return false;
+
+  char line[4096];
+  bool found = false;
+  while (!found && fgets(line, sizeof(line), fp)) {
+    const char *p = line;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p++ != '#')
+      continue;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (strncmp(p, "include", 7) == 0 && strstr(p+7, base))
+      found = true;
+  }
+  fclose(fp);
+  return found;
+}
+
+
+static cJSON* pick_tu(AsmHeaderIndex *index, AsmHeaderEntry *entry,
+                      AsmHeaderCached cached, void *ctx)
+{
+  cJSON *best = NULL;
+  off_t best_size = 0;
+  for (unsigned int i=0; i<entry->ntus; i++) {
+    cJSON *node = index->nodes[entry->tus[i]];
+    const char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file"));
+    if (cached && cached(file, ctx))
+      return node;
+
+    struct stat sb;
+    if (stat(file, &sb) == 0 && (!best || sb.st_size < best_size)) {
+      best = node;
+      best_size = sb.st_size;
+    }
+  }
+  return best;
+}
+
+
+/* a cached unit first, otherwise the smallest source including the header */
+cJSON* AsmHeaders_find_tu(AsmHeaderIndex *index, const char *header,
+                          AsmHeaderCached cached, void *ctx)
+{
+  AsmHeaderEntry *entry = lookup(index, header);
+  if (entry)
+    return pick_tu(index, entry, cached, ctx);
+
+  if (index->nscanned == index->nnodes)
+    return NULL;
+
+  int *todo = (int*)malloc(sizeof(int) * index->nnodes);
+  unsigned int ntodo = 0;
+
+  const char *base = strrchr(header, '/');
+  base = base ? base+1 : header;
+  for (unsigned int i=0; i<index->nnodes; i++) {
+    const char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(index->nodes[i], "file"));
+    if (!index->scanned[i] && file && names_header(file, base))
+      todo[ntodo++] = i;
+  }
+  scan_nodes(index, todo, ntodo);
+
+  /* only reachable through other headers, everything left gets scanned */
+  entry = lookup(index, header);
+  if (!entry) {
+    ntodo = 0;
+    for (unsigned int i=0; i<index->nnodes; i++) {
+      if (!index->scanned[i])
+        todo[ntodo++] = i;
+    }
+    scan_nodes(index, todo, ntodo);
+    entry = lookup(index, header);
+  }
+
+  free(todo);
+  return entry ? pick_tu(index, entry, cached, ctx) : NULL;
+}
@@ -1,28 +1,58 @@
 
 
 #include "asm_instance.h"
-
-
-static bool check_tool(const char *cmd) {
-  char *path = getenv("PATH");
-  if (!path) 
-    return false;
-
-  char buf[PATH_MAX];
-  char *paths = strdup(path);
-  char *saveptr = NULL;
-  
-  char *p = strtok_r(paths, ":", &saveptr);
-  for (; p; p = strtok_r(NULL, ":", &saveptr)) {
-    snprintf(buf, sizeof(buf), "%s/%s", p, cmd);
-    if (access(buf, X_OK) == 0) {
-      free(paths);
-      return true; 
+#include "asm_demangle.h"
+#include "asm_tucache.h"
+#include "asm_filter.h"
+#include "asm_mca.h"
+#include "asm_perf.h"
+#include "asm_metrics.h"
+#include "asm_trace.h"
+#include "asm_diff.h"
+
+#define ASM_RUST_FLAGS " -o - -C opt-level=3 -C debuginfo=1 -C llvm-args=--x86-asm-syntax=intel"
+#define ASM_C_FLAGS " -g1 -fno-inline -fcf-protection=none -fno-unwind-tables -fno-asynchronous-unwind-tables -masm=intel"
+#define ASM_NULL_ERR " 2> /dev/null"
+#define ASM_ERROR_MAX 16384   // compiler stderr kept for the client
+
+
+/* 
+ * compile flags with the source file argument removed, used to build 
+ * the precompiled header for the include prefix 
+ */
+static char* strip_source_arg(const char *cmd, const char *src) 
+{
+  const size_t len = strlen(cmd); 
+  const size_t src_len = strlen(src); 
+  char *out = (char*)malloc(len + sizeof(ASM_C_FLAGS)); 
+
+  bool found = false; 
+  size_t j = 0; 
+  size_t i = 0; 
+  while (i < len) {
+    size_t end = i; 
+    while (end < len && cmd[end] != ' ')
+      end++; 
+
+    if (end - i == src_len && memcmp(cmd+i, src, src_len) == 0) 
+      found = true; 
+    else if (end > i) {
+      if (j)
+        out[j++] = ' '; 
+      memcpy(out+j, cmd+i, end-i); 
+      j += end-i; 
     }
+    i = end+1; 
+  }
+  out[j] = '\0'; 
+
+  if (!found) {
+    free(out); 
+    return NULL; 
   }
 
-  free(paths);
-  return false;
+  strcat(out, ASM_C_FLAGS); 
+  return out; 
 }
 
 
@@ -42,12 +72,64 @@ void AsmInstance_free(AsmInstance *inst)
 {
   if (inst->asm_buffer)
     free(inst->asm_buffer); 
+  if (inst->prev_asm_buffer)
+    free(inst->prev_asm_buffer); 
+  if (inst->stats)
+    free(inst->stats); 
   if (inst->rebuild_command)
     free(inst->rebuild_command); 
+  if (inst->pch_command)
+    free(inst->pch_command); 
+  if (inst->base_command)
+    free(inst->base_command); 
+  free(inst->object_file); 
+  free(inst->source_file); 
+  free(inst->compile_error); 
+  for (unsigned int i=0; i<inst->nkeep; i++)
+    free(inst->keep_paths[i]); 
+  free(inst->keep_paths); 
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    free(inst->variants[i].rebuild_command); 
+    free(inst->variants[i].asm_buffer); 
+    free(inst->variants[i].compile_error); 
+    free(inst->variants[i].stats); 
+    AsmLines_free(&inst->variants[i].lines); 
+  }
+  AsmLines_free(&inst->lines); 
+  if (inst->tu_cache)
+    AsmTUCache_free(inst->tu_cache); 
   free(inst); 
 }
 
 
+/* heap held by one instance, cached outputs dominate */
+size_t AsmInstance_memory(AsmInstance *inst) 
+{
+  size_t bytes = sizeof(AsmInstance) + inst->asm_buflen + inst->prev_asm_buflen + 
+                 sizeof(AsmFuncStats) * inst->nstats + AsmLines_memory(&inst->lines); 
+  if (inst->rebuild_command) 
+    bytes += strlen(inst->rebuild_command)+1; 
+  if (inst->base_command) 
+    bytes += strlen(inst->base_command)+1; 
+  if (inst->pch_command) 
+    bytes += strlen(inst->pch_command)+1; 
+  if (inst->object_file) 
+    bytes += strlen(inst->object_file)+1; 
+  if (inst->tu_cache) 
+    bytes += sizeof(AsmTUCache) + 
+             sizeof(AsmDepFile) * (inst->tu_cache->prefix_deps.nfiles + inst->tu_cache->tu_deps.nfiles); 
+
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    AsmVariant *variant = &inst->variants[i]; 
+    bytes += variant->asm_buflen + sizeof(AsmFuncStats) * variant->nstats + 
+             AsmLines_memory(&variant->lines); 
+    if (variant->rebuild_command) 
+      bytes += strlen(variant->rebuild_command)+1; 
+  }
+  return bytes; 
+}
+
+
 cJSON* AsmInstance_get_compile_node(AsmInstance *inst) 
 {
   return inst->compile_node; 
@@ -86,30 +168,35 @@ const char* AsmInstance_get_filetype(AsmInstance *inst)
 }
 
 
-int AsmInstance_parse_command_C(AsmInstance *inst, cJSON *root) 
+/* 
+ * the entry's "output", else its -o, relative to its "directory". the 
+ * build's object can stand in for a compile while it is fresh 
+ */
+static void set_object_file(AsmInstance *inst, cJSON *compile_node, 
+                            const char *output, size_t output_len) 
 {
-  /* 
-   * compile_commands.json has a specific structure
-   * this works for the minimal project 
-   */
-  char *filename = AsmInstance_get_filename(inst);
-
-  if (*filename == '\0')
-    return ASM_INST_FAIL; 
-  
-  cJSON *compile_node = NULL;
-  for (cJSON *node = root->child; node; node = node->next) {
-    cJSON *name_node = cJSON_GetObjectItemCaseSensitive(node, "file");
-    char *str = cJSON_GetStringValue(name_node); 
-    if (name_node && strcmp(str, filename) == 0) {
-      compile_node = node; 
-      break;
-    }
+  const char *field = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(compile_node, "output")); 
+  if (field && *field) {
+    output = field; 
+    output_len = strlen(field); 
   }
-  
-  if (!compile_node)
-    return ASM_INST_FAIL; 
+  if (!output || !output_len || (output_len == 1 && output[0] == '-')) 
+    return; 
+
+  const char *directory = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(compile_node, "directory")); 
+  const size_t max = output_len + PATH_MAX + 2; 
+  free(inst->object_file); 
+  inst->object_file = (char*)malloc(max); 
+  if (output[0] == '/' || !directory) 
+    snprintf(inst->object_file, max, "%.*s", (int)output_len, output); 
+  else 
+    snprintf(inst->object_file, max, "%s/%.*s", directory, (int)output_len, output); 
+}
+
 
+/* rebuild, base and pch commands from a C/C++ compile db entry */
+static int command_from_node(AsmInstance *inst, cJSON *compile_node) 
+{
   inst->compile_node = compile_node;
   cJSON *command_node = cJSON_GetObjectItemCaseSensitive(compile_node, 
                                                          "command");
@@ -128,6 +215,8 @@ int AsmInstance_parse_command_C(AsmInstance *inst, cJSON *root)
   inst->rebuild_command = (char*)malloc(PATH_MAX + len); 
   
   int j = 0; 
+  const char *output = NULL; 
+  size_t output_len = 0; 
   for (unsigned int i=0; i<len; i++) {
     /* ignore the -o dash */
     if (i<len-3 && 
@@ -136,12 +225,16 @@ int AsmInstance_parse_command_C(AsmInstance *inst, cJSON *root)
         str[i+2] == ' ') 
     {
       i+=3; 
+      output = str+i; 
       for (; i<len; i++) {
         if (str[i] == ' ') {
           i++; 
           break; 
         }
       }
+      output_len = str+i - output; 
+      while (output_len && output[output_len-1] == ' ') 
+        output_len--; 
 
       if (i==len-1) 
         return ASM_INST_FAIL; 
@@ -151,24 +244,228 @@ int AsmInstance_parse_command_C(AsmInstance *inst, cJSON *root)
   }
   inst->rebuild_command[j] = '\0'; 
 
-  strcat(inst->rebuild_command, " -S -g1 -fno-inline -fcf-protection=none -fno-unwind-tables -fno-asynchronous-unwind-tables -masm=intel -o - 2> /dev/null"); 
+  inst->base_command = strdup(inst->rebuild_command); 
+  set_object_file(inst, compile_node, output, output_len); 
+
+  cJSON *file_node = cJSON_GetObjectItemCaseSensitive(compile_node, "file"); 
+  inst->pch_command = strip_source_arg(inst->rebuild_command, 
+                                       cJSON_GetStringValue(file_node)); 
 
-  char *ext = strrchr(filename, '.'); 
+  strcat(inst->rebuild_command, " -S" ASM_C_FLAGS " -o -" ASM_NULL_ERR); 
+
+  char *ext = strrchr(cJSON_GetStringValue(file_node), '.'); 
   if (ext) {
     ext++; 
-    /* demangler for C++ */
-    if ((strcmp(ext, "cpp")==0 || strcmp(ext, "hpp")==0) &&
-         check_tool("c++filt")) 
-    {
-      /* do we have c++filt avaliable */
-      strcat(inst->rebuild_command, " | c++filt"); 
+    if (strcmp(ext, "cpp")==0 || strcmp(ext, "hpp")==0)
+      inst->ft = FILE_TYPE_CPP; 
+  }
+
+  return ASM_INST_OK; 
+}
+
+
+int AsmInstance_parse_command_C(AsmInstance *inst, cJSON *root) 
+{
+  /* 
+   * compile_commands.json has a specific structure
+   * this works for the minimal project 
+   */
+  char *filename = AsmInstance_get_filename(inst);
+
+  if (*filename == '\0')
+    return ASM_INST_FAIL; 
+  
+  cJSON *compile_node = NULL;
+  for (cJSON *node = root->child; node; node = node->next) {
+    cJSON *name_node = cJSON_GetObjectItemCaseSensitive(node, "file");
+    char *str = cJSON_GetStringValue(name_node); 
+    if (name_node && strcmp(str, filename) == 0) {
+      compile_node = node; 
+      break;
     }
   }
+  
+  if (!compile_node)
+    return ASM_INST_FAIL; 
+
+  return command_from_node(inst, compile_node); 
+}
+
+
+/* 
+ * a header has no entry of its own, it is compiled through a unit that 
+ * includes it and only the functions whose .loc lines point into the 
+ * header are kept 
+ */
+int AsmInstance_parse_command_header(AsmInstance *inst, cJSON *compile_node) 
+{
+  char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(compile_node, "file")); 
+  if (!file || *inst->infile == '\0')
+    return ASM_INST_FAIL; 
+
+  if (command_from_node(inst, compile_node) != ASM_INST_OK) 
+    return ASM_INST_FAIL; 
+
+  inst->source_file = strdup(file); 
+  return AsmInstance_keep_sources(inst, (const char *const[]){ inst->infile }, 1); 
+}
+
+
+/* 
+ * the crate root shows the whole crate, as it did before sharing, a 
+ * module keeps only the functions whose code is in it 
+ */
+int AsmInstance_set_crate(AsmInstance *inst, AsmCrate *crate) 
+{
+  inst->crate = crate; 
+  inst->crate_generation = 0; 
+  if (!inst->source_file) 
+    return ASM_INST_OK; 
+  return AsmInstance_keep_sources(inst, (const char *const[]){ inst->infile }, 1); 
+}
+
+
+/* a different pipeline changes every output, same invalidation as keep paths */
+void AsmInstance_set_filter_options(AsmInstance *inst, unsigned int options) 
+{
+  if (options == inst->filter_options) 
+    return; 
+
+  inst->filter_options = options; 
+  inst->deps_generation++; 
+  if (inst->tu_cache) 
+    inst->tu_cache->tu_key = 0; 
+}
+
+
+/* NULL or none keeps every function */
+int AsmInstance_keep_sources(AsmInstance *inst, const char *const *paths, unsigned int npaths) 
+{
+  /* unchanged, the cached outputs stay valid */
+  if (!paths) 
+    npaths = 0; 
+  if (npaths == inst->nkeep) {
+    unsigned int same = 0; 
+    while (same < npaths && strcmp(paths[same], inst->keep_paths[same]) == 0) 
+      same++; 
+    if (same == npaths) 
+      return ASM_INST_OK; 
+  }
 
+  for (unsigned int i=0; i<inst->nkeep; i++)
+    free(inst->keep_paths[i]); 
+  free(inst->keep_paths); 
+  inst->keep_paths = NULL; 
+  inst->nkeep = 0; 
+
+  /* cached outputs were filtered differently, the tu key would still match */
+  inst->deps_generation++; 
+  if (inst->tu_cache) 
+    inst->tu_cache->tu_key = 0; 
+
+  if (!npaths) 
+    return ASM_INST_OK; 
+
+  inst->keep_paths = (char**)malloc(sizeof(char*) * npaths); 
+  for (unsigned int i=0; i<npaths; i++) 
+    inst->keep_paths[inst->nkeep++] = strdup(paths[i]); 
+  return ASM_INST_OK; 
+}
+
+
+int AsmInstance_enable_tu_cache(AsmInstance *inst, const char *cache_dir) 
+{
+  if (!inst->pch_command)
+    return ASM_INST_FAIL; 
+
+  inst->tu_cache = AsmTUCache_alloc(cache_dir, inst->infile, inst->pch_command,
+                                    inst->ft == FILE_TYPE_CPP); 
+  if (!inst->tu_cache)
+    return ASM_INST_FAIL; 
   return ASM_INST_OK; 
 }
 
 
+/* 
+ * modules are not in the compile db, their crate is the entry whose 
+ * manifest directory holds them. the deepest one wins, a library root 
+ * over a binary in the same package 
+ */
+static cJSON* crate_root_node(cJSON *root, const char *filename) 
+{
+  cJSON *best = NULL; 
+  size_t best_len = 0; 
+  for (cJSON *node = root->child; node; node = node->next) {
+    const char *dir  = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "directory")); 
+    const char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file")); 
+    if (!dir || !file) 
+      continue; 
+
+    const size_t len = strlen(dir); 
+    if (strncmp(filename, dir, len) != 0 || filename[len] != '/' || len < best_len) 
+      continue; 
+    const size_t flen = strlen(file); 
+    const bool lib = flen > 7 && strcmp(file + flen - 7, "/lib.rs") == 0; 
+    if (len > best_len || !best || lib) {
+      best = node; 
+      best_len = len; 
+    }
+  }
+  return best; 
+}
+
+
+/* 
+ * removes every "-C <name>=value" (or -C<name>=) from a command in place, 
+ * values may be single quoted 
+ */
+static void drop_codegen_flag(char *cmd, const char *name) 
+{
+  const size_t name_len = strlen(name); 
+  char *p = cmd; 
+  while ((p = strstr(p, "-C")) != NULL) {
+    char *arg = p + 2; 
+    while (*arg == ' ') 
+      arg++; 
+    if ((p != cmd && p[-1] != ' ') || strncmp(arg, name, name_len) != 0 || arg[name_len] != '=') {
+      p += 2; 
+      continue; 
+    }
+
+    char *end = arg + name_len + 1; 
+    bool quoted = false; 
+    for (; *end && (quoted || *end != ' '); end++) {
+      if (*end == '\'') 
+        quoted = !quoted; 
+    }
+    while (*end == ' ') 
+      end++; 
+    memmove(p, end, strlen(end)+1); 
+  }
+}
+
+
+/* "--name=value" or "--name value" dropped from a command */
+static void drop_long_flag(char *cmd, const char *name) 
+{
+  const size_t name_len = strlen(name); 
+  char *p = cmd; 
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p != cmd && p[-1] != ' ') || (p[name_len] != '=' && p[name_len] != ' ')) {
+      p += name_len; 
+      continue; 
+    }
+
+    char *end = p + name_len + 1; 
+    while (*end && *end != ' ') 
+      end++; 
+    while (*end == ' ') 
+      end++; 
+    memmove(p, end, strlen(end)+1); 
+  }
+}
+
+
 int AsmInstance_parse_command_RUST(AsmInstance *inst, cJSON *root)
 {
   /* 
@@ -190,8 +487,12 @@ int AsmInstance_parse_command_RUST(AsmInstance *inst, cJSON *root)
     }
   }
   
-  if (!compile_node)
-    return ASM_INST_FAIL; 
+  if (!compile_node) {
+    compile_node = crate_root_node(root, filename); 
+    if (!compile_node) 
+      return ASM_INST_FAIL; 
+    inst->source_file = strdup(cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(compile_node, "file"))); 
+  }
 
   inst->compile_node = compile_node;
   cJSON *command_node = cJSON_GetObjectItemCaseSensitive(compile_node, 
@@ -239,17 +540,468 @@ int AsmInstance_parse_command_RUST(AsmInstance *inst, cJSON *root)
     }
   }
   inst->rebuild_command[j] = '\0'; 
+
+  /* cargo's incremental dir belongs to its own builds, never write there */
+  drop_codegen_flag(inst->rebuild_command, "incremental"); 
+
+  /* cargo reads json diagnostics, a failed compile is shown to a person */
+  drop_long_flag(inst->rebuild_command, "--error-format"); 
+  drop_long_flag(inst->rebuild_command, "--json"); 
   
-  strcat(inst->rebuild_command, " -o - -C opt-level=3 -C llvm-args=--x86-asm-syntax=intel 2> /dev/null");  
-  if (check_tool("rustfilt")) 
-    strcat(inst->rebuild_command, " | rustfilt"); 
+  inst->base_command = strdup(inst->rebuild_command); 
+  strcat(inst->rebuild_command, ASM_RUST_FLAGS ASM_NULL_ERR);  
+  inst->ft = FILE_TYPE_RUST; 
   return ASM_INST_OK; 
 }
 
-int AsmInstance_compile(AsmInstance *inst) 
+/* 
+ * a single compiler invocation, its stdout is filtered as it arrives so 
+ * any number of these can be drained together 
+ */
+struct compile_job {
+  char *cmd; 
+  FILE *pipe; 
+  int status; 
+  char err_path[PATH_MAX];   // the compiler's stderr, empty when discarded 
+  char *error;               // read back from err_path when the compile failed 
+  bool done; 
+  AsmFilter filter; 
+  AsmLines lines; 
+  uint64_t trace_ns;   // spawn time, 0 when not tracing 
+  bool first_byte; 
+  bool from_object;    // filtered from the build's object, nothing to run 
+  const char *const *keep_paths; 
+  unsigned int nkeep; 
+  unsigned int filter_options; 
+}; 
+
+
+/* jobs overlap each other, async trace tracks need an id per job */
+static uint32_t trace_id(struct compile_job *job) 
+{
+  return (uint32_t)(job->trace_ns / 1000) | 1; 
+}
+
+
+/* 
+ * the trailing /dev/null redirect becomes a temp file, so a failed 
+ * compile can tell the client why 
+ */
+static FILE* open_job(struct compile_job *job) 
+{
+  const size_t cmd_len = strlen(job->cmd); 
+  const size_t err_len = strlen(ASM_NULL_ERR); 
+  job->err_path[0] = '\0'; 
+  if (cmd_len <= err_len || strcmp(job->cmd + cmd_len - err_len, ASM_NULL_ERR) != 0) 
+    return popen(job->cmd, "r"); 
+
+  snprintf(job->err_path, sizeof(job->err_path), "%s/asm_err_XXXXXX", P_tmpdir); 
+  const int fd = mkstemp(job->err_path); 
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] mkstemp - %s\n", strerror(errno)); 
+    job->err_path[0] = '\0'; 
+    return popen(job->cmd, "r"); 
+  }
+  close(fd); 
+
+  const size_t max = cmd_len + PATH_MAX + 8; 
+  char *cmd = (char*)malloc(max); 
+  snprintf(cmd, max, "%.*s 2> %s", (int)(cmd_len - err_len), job->cmd, job->err_path); 
+  FILE *pipe = popen(cmd, "r"); 
+  free(cmd); 
+  return pipe; 
+}
+
+
+static void close_job(struct compile_job *job) 
+{
+  job->status = pclose(job->pipe); 
+  job->pipe = NULL; 
+  job->done = true; 
+  if (!job->err_path[0]) 
+    return; 
+
+  if (job->status != 0) {
+    FILE *fp = fopen(job->err_path, "r"); 
+    if (fp) {
+      job->error = (char*)malloc(ASM_ERROR_MAX); 
+      const size_t len = fread(job->error, 1, ASM_ERROR_MAX-1, fp); 
+      job->error[len] = '\0'; 
+      fclose(fp); 
+    }
+  }
+  unlink(job->err_path); 
+}
+
+
+static void init_job_filter(struct compile_job *job) 
+{
+  AsmFilter_init(&job->filter); 
+  if (job->nkeep) 
+    AsmFilter_keep_sources(&job->filter, job->keep_paths, job->nkeep); 
+  AsmFilter_set_options(&job->filter, job->filter_options); 
+  AsmLines_init(&job->lines); 
+  AsmFilter_track_lines(&job->filter, &job->lines); 
+}
+
+
+static int run_compile_jobs(struct compile_job *jobs[], unsigned int njobs) 
+{
+  struct pollfd fds[ASM_MAX_VARIANTS+1]; 
+  unsigned int running = 0; 
+  uint64_t filter_ns = 0; 
+  const uint64_t start_ns = AsmMetrics_now(); 
+
+  for (unsigned int i=0; i<njobs; i++) {
+    struct compile_job *job = jobs[i]; 
+    init_job_filter(job); 
+    job->trace_ns = AsmTrace_begin(); 
+    job->first_byte = false; 
+    job->pipe = open_job(job); 
+    AsmTrace_end("spawn", job->trace_ns); 
+    if (!job->pipe) {
+      fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno)); 
+      if (job->err_path[0]) 
+        unlink(job->err_path); 
+      job->status = -1; 
+      job->done = true; 
+      continue; 
+    }
+    job->done = false; 
+    running++; 
+  }
+  AsmMetrics_count(ASM_COUNT_COMPILES, njobs); 
+  AsmMetrics_jobs(running); 
+
+  char buffer[ASM_WINDOW]; 
+  while (running) {
+    for (unsigned int i=0; i<njobs; i++) {
+      fds[i].fd = jobs[i]->done ? -1 : fileno(jobs[i]->pipe); 
+      fds[i].events = POLLIN; 
+      fds[i].revents = 0; 
+    }
+
+    if (poll(fds, njobs, -1) == -1) {
+      if (errno == EINTR) 
+        continue; 
+      fprintf(stderr, "Error: [libc] poll - %s\n", strerror(errno)); 
+      break; 
+    }
+
+    for (unsigned int i=0; i<njobs; i++) {
+      struct compile_job *job = jobs[i]; 
+      if (job->done || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue; 
+
+      ssize_t bytes = read(fds[i].fd, buffer, sizeof(buffer)); 
+      if (bytes == -1 && errno == EINTR) 
+        continue; 
+
+      if (bytes > 0) {
+        const uint64_t feed_ns = AsmMetrics_now(); 
+        if (job->trace_ns && !job->first_byte) 
+          AsmTrace_span("first_byte", job->trace_ns, feed_ns, trace_id(job), NULL); 
+        job->first_byte = true; 
+
+        const int fed = AsmFilter_feed(&job->filter, buffer, bytes); 
+        const uint64_t fed_ns = AsmMetrics_now(); 
+        filter_ns += fed_ns - feed_ns; 
+        if (job->trace_ns) 
+          AsmTrace_span("filter", feed_ns, fed_ns, 0, NULL); 
+        if (fed == ASM_FILTER_OK) 
+          continue; 
+      }
+
+      close_job(job); 
+      running--; 
+      if (job->trace_ns) 
+        AsmTrace_span("compile", job->trace_ns, AsmTrace_now(), trace_id(job), NULL); 
+      AsmMetrics_jobs(-1); 
+    }
+  }
+
+  /* only reached on a poll failure */
+  for (unsigned int i=0; i<njobs; i++) {
+    if (!jobs[i]->done) {
+      close_job(jobs[i]); 
+      AsmMetrics_jobs(-1); 
+    }
+  }
+
+  AsmMetrics_since(ASM_PHASE_COMPILE, start_ns); 
+  AsmMetrics_record(ASM_PHASE_FILTER, filter_ns); 
+
+  return ASM_INST_OK; 
+}
+
+
+/* 
+ * a dependency changing invalidates every variant, bump a generation 
+ * rather than tracking per output. nothing recorded yet (no compile) 
+ * has nothing to invalidate 
+ */
+static void check_deps(AsmInstance *inst) 
+{
+  if (inst->tu_cache && inst->tu_cache->tu_deps.nfiles && 
+      !AsmTUCache_deps_fresh(inst->tu_cache)) 
+    inst->deps_generation++; 
+}
+
+
+/* 
+ * a fresh object from the build is disassembled into the job's filter 
+ * in place of a compile. units filtered to some sources need the .loc 
+ * lines only a compile has 
+ */
+static int disassemble_object(AsmInstance *inst, struct stat *sb, 
+                              struct compile_job *job) 
+{
+  if (!inst->object_file || inst->nkeep) 
+    return ASM_INST_FAIL; 
+
+  cJSON *directory = cJSON_GetObjectItemCaseSensitive(inst->compile_node, "directory"); 
+  if (!AsmObject_fresh(inst->object_file, &sb->st_mtim, cJSON_GetStringValue(directory))) 
+    return ASM_INST_FAIL; 
+
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  size_t raw_len; 
+  char *raw = AsmObject_disassemble(inst->object_file, &raw_len); 
+  if (!raw) 
+    return ASM_INST_FAIL; 
+  AsmTrace_end_arg("disassemble", trace_ns, inst->object_file); 
+  AsmMetrics_count(ASM_COUNT_OBJECTS, 1); 
+
+  init_job_filter(job); 
+  const uint64_t filter_ns = AsmMetrics_now(); 
+  for (size_t i=0; i<raw_len; i+=ASM_WINDOW) {
+    const size_t chunk = raw_len-i < ASM_WINDOW ? raw_len-i : ASM_WINDOW; 
+    if (AsmFilter_feed(&job->filter, raw+i, chunk) != ASM_FILTER_OK) 
+      break; 
+  }
+  AsmMetrics_since(ASM_PHASE_FILTER, filter_ns); 
+  free(raw); 
+
+  job->from_object = true; 
+  return ASM_INST_OK; 
+}
+
+
+/* 
+ * returns ASM_INST_OK when the default output is still valid or was 
+ * filled from the build's object (job->from_object), otherwise fills 
+ * the job with the command to run 
+ */
+static int prepare_default_job(AsmInstance *inst, struct stat *sb, 
+                               struct compile_job *job) 
 {
   char *cmd = AsmInstance_get_cmd(inst); 
-  if (!cmd)
+  const char *file = AsmInstance_get_filename(inst); 
+  AsmTUCache *tu_cache = inst->tu_cache; 
+
+  /* assembly will still be valid */
+  if (sb->st_mtime == inst->time_changed && 
+      inst->generation == inst->deps_generation) 
+  {
+    return ASM_INST_OK; 
+  }
+
+  if (disassemble_object(inst, sb, job) == ASM_INST_OK) 
+    return ASM_INST_OK; 
+
+  if (tu_cache) {
+    /* saved without changes, or a header touched but not modified */
+    if (inst->asm_buffer && 
+        tu_cache->tu_key && 
+        AsmTUCache_tu_key(tu_cache, file) == tu_cache->tu_key) 
+    {
+      inst->time_changed = sb->st_mtime; 
+      inst->generation   = inst->deps_generation; 
+      return ASM_INST_OK; 
+    }
+
+    /* 
+     * the redirect is the tail of the rebuild command, splice the cache 
+     * flags in before it 
+     */
+    const size_t cmd_len = strlen(cmd); 
+    const size_t err_len = strlen(ASM_NULL_ERR); 
+    if (cmd_len > err_len && strcmp(cmd + cmd_len - err_len, ASM_NULL_ERR) == 0) {
+      /* the pch builds in the background, first compiles go without it */
+      const bool use_pch = AsmTUCache_prepare_pch(tu_cache, file) == TU_CACHE_OK; 
+      const size_t cache_max = cmd_len + 4*PATH_MAX; 
+      job->cmd = (char*)malloc(cache_max); 
+      snprintf(job->cmd, cache_max, "%.*s%s%s%s%s -MD -MF %s -MT tu" ASM_NULL_ERR, 
+               (int)(cmd_len - err_len), cmd, 
+               use_pch ? " -iquote " : "", 
+               use_pch ? tu_cache->source_dir : "", 
+               use_pch ? " -include " : "", 
+               use_pch ? tu_cache->prefix_header : "", 
+               tu_cache->tu_depfile); 
+      return ASM_INST_FAIL; 
+    }
+  }
+
+  job->cmd = strdup(cmd); 
+  return ASM_INST_FAIL; 
+}
+
+
+/* a failed compile's output is dropped, the last good one stays cached */
+static void discard_job(struct compile_job *job) 
+{
+  unsigned long long asm_len; 
+  unsigned int nstats; 
+  free(AsmFilter_finish(&job->filter, &asm_len)); 
+  free(AsmFilter_take_stats(&job->filter, &nstats)); 
+  AsmLines_free(&job->lines); 
+}
+
+
+static int finish_default_job(AsmInstance *inst, struct stat *sb, 
+                              struct compile_job *job) 
+{
+  free(inst->compile_error); 
+  inst->compile_error = job->error; 
+  job->error = NULL; 
+  if (job->status != 0) {
+    discard_job(job); 
+    return ASM_INST_FAIL; 
+  }
+
+  unsigned long long asm_len; 
+  char *asm_buffer = AsmFilter_finish(&job->filter, &asm_len); 
+  AsmTUCache *tu_cache = inst->tu_cache; 
+
+  /* dependency set may have changed with this compile */
+  if (tu_cache && job->status == 0 && !job->from_object && 
+      AsmTUCache_update_deps(tu_cache) == TU_CACHE_OK) 
+    tu_cache->tu_key = AsmTUCache_tu_key(tu_cache, inst->infile); 
+
+  /* 
+   * one generation is kept around for the diff command, an object's 
+   * output was built with other flags and would diff as noise 
+   */
+  if (inst->from_object || job->from_object) {
+    free(inst->asm_buffer); 
+  }
+  else {
+    if (inst->prev_asm_buffer) 
+      AsmMetrics_count(ASM_COUNT_CACHE_EVICT, 1); 
+    free(inst->prev_asm_buffer); 
+    inst->prev_asm_buffer = inst->asm_buffer; 
+    inst->prev_asm_buflen = inst->asm_buflen; 
+  }
+  inst->from_object = job->from_object; 
+
+  inst->asm_buffer   = asm_buffer; 
+  inst->asm_buflen   = asm_len; 
+  inst->time_changed = sb->st_mtime; 
+
+  free(inst->stats); 
+  inst->stats = AsmFilter_take_stats(&job->filter, &inst->nstats); 
+  AsmLines_free(&inst->lines); 
+  inst->lines = job->lines; 
+  inst->generation   = inst->deps_generation; 
+  return ASM_INST_OK; 
+}
+
+
+static int finish_variant_job(AsmVariant *variant, struct stat *sb, 
+                              unsigned long long generation, 
+                              struct compile_job *job) 
+{
+  free(variant->compile_error); 
+  variant->compile_error = job->error; 
+  job->error = NULL; 
+  if (job->status != 0) {
+    discard_job(job); 
+    return ASM_INST_FAIL; 
+  }
+
+  unsigned long long asm_len; 
+  char *asm_buffer = AsmFilter_finish(&job->filter, &asm_len); 
+
+  if (variant->asm_buffer) 
+    AsmMetrics_count(ASM_COUNT_CACHE_EVICT, 1); 
+  free(variant->asm_buffer); 
+  variant->asm_buffer   = asm_buffer; 
+  variant->asm_buflen   = asm_len; 
+  variant->time_changed = sb->st_mtime; 
+  variant->generation   = generation; 
+
+  free(variant->stats); 
+  variant->stats = AsmFilter_take_stats(&job->filter, &variant->nstats); 
+  AsmLines_free(&variant->lines); 
+  variant->lines = job->lines; 
+  return ASM_INST_OK; 
+}
+
+
+/* 
+ * rust files share their crate's compile, the default output is the 
+ * crate's assembly filtered down to this file. the filter is the only 
+ * per file cost 
+ */
+static int compile_from_crate(AsmInstance *inst, struct stat *sb, 
+                              struct compile_job *job) 
+{
+  AsmCrate *crate = inst->crate; 
+  const unsigned long long runs = crate->runs; 
+  const uint64_t start_ns = AsmMetrics_now(); 
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  if (AsmCrate_compile(crate, &sb->st_mtim) != ASM_CRATE_OK) 
+    return ASM_INST_FAIL; 
+  if (crate->runs != runs) {
+    AsmMetrics_count(ASM_COUNT_COMPILES, 1); 
+    AsmMetrics_since(ASM_PHASE_COMPILE, start_ns); 
+    AsmTrace_end_arg("crate_compile", trace_ns, crate->root); 
+  }
+  if (crate->status != 0) {
+    free(inst->compile_error); 
+    inst->compile_error = crate->error ? strdup(crate->error) : NULL; 
+    return ASM_INST_FAIL; 
+  }
+
+  if (inst->asm_buffer && 
+      inst->crate_generation == crate->generation && 
+      inst->generation == inst->deps_generation) 
+  {
+    AsmMetrics_count(ASM_COUNT_CACHE_HIT, 1); 
+    return ASM_INST_OK; 
+  }
+  AsmMetrics_count(ASM_COUNT_CACHE_MISS, 1); 
+
+  memset(job, 0, sizeof(struct compile_job)); 
+  job->keep_paths = (const char *const*)inst->keep_paths; 
+  job->nkeep = inst->nkeep; 
+  job->filter_options = inst->filter_options; 
+  init_job_filter(job); 
+
+  const uint64_t filter_ns = AsmMetrics_now(); 
+  for (size_t i=0; i<crate->raw_len; i+=ASM_WINDOW) {
+    const size_t chunk = crate->raw_len-i < ASM_WINDOW ? crate->raw_len-i : ASM_WINDOW; 
+    if (AsmFilter_feed(&job->filter, crate->raw+i, chunk) != ASM_FILTER_OK) 
+      break; 
+  }
+  AsmMetrics_since(ASM_PHASE_FILTER, filter_ns); 
+
+  job->status = crate->status; 
+  if (finish_default_job(inst, sb, job) != ASM_INST_OK) 
+    return ASM_INST_FAIL; 
+  inst->crate_generation = crate->generation; 
+  return ASM_INST_OK; 
+}
+
+
+/* 
+ * compile the default output and/or named variants, every stale output 
+ * is rebuilt concurrently. NULL selects the default plus every variant, 
+ * each keeping its own compile_error, a named output fails with its 
+ * compile 
+ */
+int AsmInstance_compile_variant(AsmInstance *inst, const char *name) 
+{
+  if (!AsmInstance_get_cmd(inst))
     return ASM_INST_FAIL; 
 
   /* first check if there has been a modification */
@@ -261,112 +1013,234 @@ int AsmInstance_compile(AsmInstance *inst)
   if (lstat(file, &sb) != 0) 
     return ASM_INST_FAIL;
 
-  /* assembly will still be valid */
-  if (sb.st_mtime == inst->time_changed) 
-    return ASM_INST_OK;  
+  /* a header is also stale when the unit compiled for it changes */
+  struct stat source_sb; 
+  if (inst->source_file && lstat(inst->source_file, &source_sb) == 0 && 
+      (source_sb.st_mtim.tv_sec > sb.st_mtim.tv_sec || 
+       (source_sb.st_mtim.tv_sec == sb.st_mtim.tv_sec && 
+        source_sb.st_mtim.tv_nsec > sb.st_mtim.tv_nsec))) 
+  {
+    sb.st_mtim = source_sb.st_mtim; 
+  }
+
+  check_deps(inst); 
+
+  /* a job embeds its filter's line buffers, too big for the stack */
+  struct compile_job *job_storage = (struct compile_job*)malloc(sizeof(struct compile_job) * 
+                                                                (inst->nvariants+1)); 
+  struct compile_job *jobs[ASM_MAX_VARIANTS+1]; 
+  AsmVariant *job_variant[ASM_MAX_VARIANTS+1]; 
+  unsigned int njobs = 0; 
+
+  const bool want_default = !name || strcmp(name, ASM_DEFAULT_VARIANT) == 0; 
+  if (want_default && inst->crate) {
+    /* a broken crate still lets the variants of an "all" request build */
+    if (compile_from_crate(inst, &sb, &job_storage[0]) != ASM_INST_OK && name) {
+      free(job_storage); 
+      return ASM_INST_FAIL; 
+    }
+  }
+  else if (want_default) {
+    struct compile_job *job = &job_storage[njobs]; 
+    memset(job, 0, sizeof(struct compile_job)); 
+    job->keep_paths = (const char *const*)inst->keep_paths; 
+    job->nkeep = inst->nkeep; 
+    job->filter_options = inst->filter_options; 
+    if (prepare_default_job(inst, &sb, job) != ASM_INST_OK) {
+      job_variant[njobs] = NULL; 
+      jobs[njobs++] = job; 
+      AsmMetrics_count(ASM_COUNT_CACHE_MISS, 1); 
+    }
+    else if (job->from_object) {
+      finish_default_job(inst, &sb, job); 
+      AsmMetrics_count(ASM_COUNT_CACHE_MISS, 1); 
+    }
+    else 
+      AsmMetrics_count(ASM_COUNT_CACHE_HIT, 1); 
+  }
+
+  bool found = want_default; 
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    AsmVariant *variant = &inst->variants[i]; 
+    if (name && strcmp(name, variant->name) != 0)
+      continue; 
+    found = true; 
+
+    if (variant->asm_buffer && 
+        variant->time_changed == sb.st_mtime && 
+        variant->generation == inst->deps_generation) 
+    {
+      AsmMetrics_count(ASM_COUNT_CACHE_HIT, 1); 
+      continue; 
+    }
+    AsmMetrics_count(ASM_COUNT_CACHE_MISS, 1); 
+
+    struct compile_job *job = &job_storage[njobs]; 
+    memset(job, 0, sizeof(struct compile_job)); 
+    job->cmd = strdup(variant->rebuild_command); 
+    job->keep_paths = (const char *const*)inst->keep_paths; 
+    job->nkeep = inst->nkeep; 
+    job->filter_options = inst->filter_options; 
+    job_variant[njobs] = variant; 
+    jobs[njobs++] = job; 
+  }
 
-  FILE *p = popen(cmd,"r");
-  if (!p) {
-    fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno)); 
+  if (!found) {
+    fprintf(stderr, "[asm viewer] error - no variant named %s\n", name); 
+    for (unsigned int i=0; i<njobs; i++) 
+      free(jobs[i]->cmd); 
+    free(job_storage); 
     return ASM_INST_FAIL; 
   }
 
-  size_t buf_max = ASM_WINDOW;
-  if (!inst->asm_buffer) 
-    inst->asm_buffer = (char*)malloc(buf_max); 
+  if (njobs) 
+    run_compile_jobs(jobs, njobs); 
+
+  int ret = ASM_INST_OK; 
+  for (unsigned int i=0; i<njobs; i++) {
+    const int finished = job_variant[i] ? 
+      finish_variant_job(job_variant[i], &sb, inst->deps_generation, jobs[i]) : 
+      finish_default_job(inst, &sb, jobs[i]); 
+    if (finished != ASM_INST_OK && name) 
+      ret = ASM_INST_FAIL; 
+    free(jobs[i]->cmd); 
+  }
 
-  unsigned long long asm_len = 0; 
-  char *asm_buffer = inst->asm_buffer; 
+  free(job_storage); 
+  return ret; 
+}
 
-  char line_buffer[4096];
-  while (fgets(line_buffer, sizeof(line_buffer), p)) {
 
-    unsigned int state = 0; 
-    const size_t len = strlen(line_buffer);
-    
-    /*
-     * keep jmp labels and their assembly
-     * e.g .L183: <asm> 
-     */
-    if (len > 2 && 
-        line_buffer[0] == '.' && 
-        line_buffer[1] == 'L') 
-    {
-      if (line_buffer[2] >= '0' &&
-          line_buffer[2] <= '9')
-      {
-        asm_buffer[asm_len++] = '\n'; 
-        state = 1; 
-      }
-    }
-    
-    unsigned int i; 
-    for (i=0; i<len && !state; i++) {
-      unsigned char ch = line_buffer[i]; 
-      switch (ch) {
-        case ' ':
-        case '\t':
-          break; 
+int AsmInstance_compile(AsmInstance *inst) 
+{
+  return AsmInstance_compile_variant(inst, ASM_DEFAULT_VARIANT); 
+}
 
-        case '.':
-          state = -1; 
-          break; 
 
-        default:
-          state = 1; 
-          break;
-      }
-    } 
-    
-    if (state == 1) {
-      if (asm_len + len > buf_max) {
-        buf_max *= 2;
-        char *new_buffer = (char*)realloc(asm_buffer, buf_max); 
-        if (!new_buffer) {
-          fprintf(stderr, "Error: [libc] realloc\n");
-          free(asm_buffer);
-          return ASM_INST_FAIL;
-        }
-        asm_buffer = new_buffer; 
-      }
-      
-      if (i==1) // label
-        asm_buffer[asm_len++] = '\n'; 
+int AsmInstance_add_variant(AsmInstance *inst, const char *name, 
+                            const char *compiler, const char *flags) 
+{
+  if (!inst->base_command || !*name || strlen(name) >= ASM_VARIANT_NAME_MAX)
+    return ASM_INST_FAIL; 
+
+  if (strcmp(name, ASM_DEFAULT_VARIANT) == 0) 
+    return ASM_INST_FAIL; 
 
-      memcpy(asm_buffer+asm_len, line_buffer, len); 
-      asm_len += len; 
+  AsmVariant *variant = NULL; 
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    if (strcmp(inst->variants[i].name, name) == 0) {
+      variant = &inst->variants[i]; 
+      break; 
     }
   }
-  
-  asm_buffer[asm_len] = '\0'; // safety for strchr and ptr return
-  pclose(p);
-  
-  inst->asm_buflen   = asm_len; 
-  inst->time_changed = sb.st_mtime; 
-  inst->asm_buffer   = asm_buffer; 
+
+  if (!variant) {
+    if (inst->nvariants == ASM_MAX_VARIANTS) {
+      fprintf(stderr, "[asm viewer] error - too many variants for %s\n", inst->infile); 
+      return ASM_INST_FAIL; 
+    }
+    variant = &inst->variants[inst->nvariants++]; 
+    memset(variant, 0, sizeof(AsmVariant)); 
+    strcpy(variant->name, name); 
+  }
+
+  /* swap the compiler, the first word of the command */
+  const char *args = inst->base_command; 
+  if (compiler && *compiler) {
+    args = strchr(inst->base_command, ' '); 
+    if (!args)
+      args = ""; 
+  }
+  else 
+    compiler = ""; 
+
+  if (!flags)
+    flags = ""; 
+
+  /* flags go after ours so -O and friends override the originals */
+  const char *tail = inst->ft == FILE_TYPE_RUST ? ASM_RUST_FLAGS : " -S" ASM_C_FLAGS; 
+  const char *out  = inst->ft == FILE_TYPE_RUST ? "" : " -o -"; 
+
+  const size_t cmd_max = strlen(compiler) + strlen(args) + strlen(tail) + 
+                         strlen(flags) + 64; 
+  free(variant->rebuild_command); 
+  variant->rebuild_command = (char*)malloc(cmd_max); 
+  snprintf(variant->rebuild_command, cmd_max, "%s%s%s %s%s" ASM_NULL_ERR, 
+           compiler, args, tail, flags, out); 
+
+  /* force a rebuild on next use */
+  free(variant->asm_buffer); 
+  variant->asm_buffer   = NULL; 
+  variant->asm_buflen   = 0; 
+  AsmLines_free(&variant->lines); 
+  variant->time_changed = 0; 
   return ASM_INST_OK; 
 }
 
 
-int AsmInstance_function_message(AsmInstance *inst, int client_fd)
+AsmVariant* AsmInstance_get_variant(AsmInstance *inst, const char *name) 
 {
-  size_t bytes; 
-  char buffer[ASM_WINDOW]; 
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    if (strcmp(inst->variants[i].name, name) == 0)
+      return &inst->variants[i]; 
+  }
+  return NULL; 
+}
 
-  int i = 0; 
-  int func_len = 0; 
-  char function_name[8192]; 
-    
-  unsigned int state = 0; 
-  const char *type = "\t.type";
-  const char *label = "@function\n";
 
-  const size_t type_chars = strlen(type);
-  const size_t label_chars = strlen(label);
+/* 
+ * a compile that failed answers with the compiler's stderr instead of 
+ * output, the last good output stays cached. no reply without one 
+ */
+static int compile_error_message(AsmInstance *inst, const char *name, int client_fd) 
+{
+  const bool named = name && strcmp(name, ASM_DEFAULT_VARIANT) != 0; 
+  AsmVariant *variant = named ? AsmInstance_get_variant(inst, name) : NULL; 
+  const char *error = variant ? variant->compile_error : inst->compile_error; 
+  if (!error || (named && !variant)) 
+    return ASM_INST_FAIL; 
+
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  if (variant) 
+    cJSON_AddStringToObject(msg, "variant", variant->name); 
+  cJSON_AddStringToObject(msg, "error", error); 
+  AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ASM_INST_FAIL; 
+}
+
+
+/* 
+ * the raw output names every function of the unit, a source filtered 
+ * instance lists the labels its filter kept instead, same layout. so 
+ * does one filtered from the build's object, the list then matches it 
+ */
+static char* kept_function_names(AsmInstance *inst, size_t *len) 
+{
+  *len = 0; 
+  if (AsmInstance_compile(inst) != ASM_INST_OK || !inst->asm_buffer) 
+    return NULL; 
 
-  size_t buf_len = 0; 
-  size_t buf_max = 16384;
-  char *msg_buffer = (char*)malloc(buf_max); 
+  size_t max = 1; 
+  for (unsigned int i=0; i<inst->nstats; i++) 
+    max += inst->stats[i].name_len + 1; 
+
+  char *names = (char*)malloc(max); 
+  for (unsigned int i=0; i<inst->nstats; i++) {
+    memcpy(names + *len, inst->asm_buffer + inst->stats[i].name_offset, inst->stats[i].name_len); 
+    *len += inst->stats[i].name_len; 
+    names[(*len)++] = '\n'; 
+  }
+  names[*len] = '\0'; 
+  return names; 
+}
+
+
+int AsmInstance_function_message(AsmInstance *inst, int client_fd)
+{
+  size_t bytes; 
+  char buffer[ASM_WINDOW]; 
 
   char *cmd = AsmInstance_get_cmd(inst); 
   if (!cmd)
@@ -376,123 +1250,61 @@ int AsmInstance_function_message(AsmInstance *inst, int client_fd)
   if (!*filename) 
     return ASM_INST_FAIL; 
 
-  FILE *fp = popen(cmd,"r");
-  if (!fp) {
-    fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno)); 
-    return ASM_INST_FAIL; 
+  size_t buf_len; 
+  char *msg_buffer; 
+  const bool object = inst->object_file && !inst->nkeep && 
+                      AsmInstance_compile(inst) == ASM_INST_OK && inst->from_object; 
+  if (inst->nkeep || object) {
+    msg_buffer = kept_function_names(inst, &buf_len); 
+    if (!msg_buffer) 
+      return compile_error_message(inst, NULL, client_fd); 
   }
-  
-  while((bytes = fread(buffer, 1, sizeof(buffer), fp))) {
-    i = 0; 
-jmp_type_state:
-    for (; i<bytes; i++) {
-      unsigned char ch = buffer[i];
-      if (type[state] == ch)
-        state++;
-      else 
-        state = 0; 
-
-      if (state == type_chars) {
-        func_len = 0; state = 0; i++; 
-        goto jmp_read_state;
-      }
-    } 
-  }
-  goto jmp_write_message;
-
-  while((bytes = fread(buffer, 1, sizeof(buffer), fp))) {
-    i = 0; 
-jmp_read_state:
-    for (; i<bytes; i++) {
-      unsigned char ch = buffer[i];
-      if (ch == '@') {
-        state = 0; 
-        goto jmp_label_state; 
-      }
-      function_name[func_len++] = ch;
+  else {
+    FILE *fp = popen(cmd,"r");
+    if (!fp) {
+      fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno)); 
+      return ASM_INST_FAIL; 
+    }
+    
+    /* ".type <name>, @function" directives, scanned as the pipe is read */
+    AsmNameScan scan; 
+    AsmNameScan_init(&scan); 
+    while((bytes = fread(buffer, 1, sizeof(buffer), fp))) {
+      if (AsmNameScan_feed(&scan, buffer, bytes) != ASM_FILTER_OK) 
+        break; 
     }
+    msg_buffer = AsmNameScan_finish(&scan, &buf_len); 
+    pclose(fp); 
   }
-  goto jmp_write_message;
-
-  while((bytes = fread(buffer, 1, sizeof(buffer), fp))) {
-    i = 0; 
-jmp_label_state:
-    for (; i<bytes; i++) {
-      unsigned char ch = buffer[i];
-      if (label[state] == ch)
-        state++;
-      else {
-        state = 0; 
-        goto jmp_type_state;
-      }
-
-      if (state == label_chars) {
-        for (; func_len >= 0; func_len--) {
-          if (function_name[func_len] == ',')
-            break;
-        }
 
-        function_name[func_len] = '\0';
-
-        char *p = function_name; 
-        while (p && (*p == ' ' || *p == '\t'))
-          p++; 
-        size_t flen = strlen(p);
-          
-        if (buf_len + flen+1 > buf_max) {
-          buf_max *= 2; 
-          char *new_buffer = realloc(msg_buffer, buf_max);
-          if (!new_buffer) {
-            fprintf(stderr, "Error: [libc] realloc\n");
-            fclose(fp); 
-            free(msg_buffer);
-            return ASM_INST_FAIL;
-          }
-          msg_buffer = new_buffer; 
-        }
-
-        memcpy(msg_buffer+buf_len, p, flen);
-        buf_len += flen; 
-        msg_buffer[buf_len++] = '\n';
-        state = 0;  
-        goto jmp_type_state;
-      }
-    } 
+  if (!buf_len) {
+    free(msg_buffer); 
+    return ASM_INST_FAIL; 
   }
 
+  /* demangled names can carry quotes, extern "C" and operator"" */
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", filename); 
+  cJSON_AddStringToObject(msg, "asm", msg_buffer); 
+  free(msg_buffer); 
 
-jmp_write_message:
-  msg_buffer[buf_len] = '\0';
-  if (!buf_len)
-    return ASM_INST_FAIL; 
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
 
-  const size_t brackets_cnt = 2;
-  const size_t colon_cnt    = 2;
-  const size_t comma_cnt    = 2;
-  const size_t quotes_cnt   = 4;
-  const size_t field_len    = 8 + 3; // filepath and asm 
-  const size_t filename_len = strlen(filename); 
 
-  const uint32_t msg_bytes = brackets_cnt + 
-                             colon_cnt +
-                             comma_cnt + 
-                             quotes_cnt +
-                             field_len +
-                             filename_len +
-                             buf_len;
-  
-  /* prefix the number of bytes for iterative decoding on the other side 
-   * its a shame i cant let lua just look at this memory.. classic IPC */
-  if (write(client_fd, &msg_bytes, sizeof(uint32_t)) == -1) {
-    fprintf(stderr, "Error [libc] write - %s\n", strerror(errno));
-    return ASM_INST_FAIL; 
-  } 
+/* spans for the whole output, NULL unless the client asked for them */
+static char* highlight_spans(AsmInstance *inst, const char *asm_buffer, 
+                             const AsmLines *lines, size_t *len) 
+{
+  if (!inst->highlight || !asm_buffer || !lines->n) 
+    return NULL; 
 
-  dprintf(client_fd,"{\"filepath\":\"%s\",\"asm\":\"%s\"}", filename, msg_buffer);   
-  
-  free(msg_buffer); 
-  fclose(fp); 
-  return ASM_INST_OK; 
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  char *hl = AsmLines_highlight(lines, asm_buffer, 0, lines->n, len); 
+  AsmTrace_end("highlight", trace_ns); 
+  return hl; 
 }
 
 
@@ -500,37 +1312,507 @@ int AsmInstance_assembly_message(AsmInstance *inst, int client_fd)
 {
   if (AsmInstance_compile(inst) != ASM_INST_OK)  {
     fprintf(stderr, "[asm viewer] error - failed to compile filtered assembly\n");
-    return ASM_INST_FAIL; 
+    return compile_error_message(inst, NULL, client_fd); 
   }
  
   /* "small" json responce, vim internals make this an easy parse */
   char *assembly = AsmInstance_get_asm(inst); 
   char *filename = AsmInstance_get_filename(inst); 
+  size_t hl_len = 0; 
+  char *hl = highlight_spans(inst, assembly, &inst->lines, &hl_len); 
+
+  /* 
+   * kept data directives can carry string literals, quotes and 
+   * backslashes need the escaping writer 
+   */
+  if (assembly && strpbrk(assembly, "\"\\")) {
+    cJSON *msg = cJSON_CreateObject(); 
+    cJSON_AddStringToObject(msg, "filepath", filename); 
+    cJSON_AddStringToObject(msg, "asm", assembly); 
+    if (inst->from_object) 
+      cJSON_AddStringToObject(msg, "source", "object"); 
+    if (hl) 
+      cJSON_AddRawToObject(msg, "hl", hl); 
+    int ret = AsmInstance_send_json(client_fd, msg); 
+    cJSON_Delete(msg); 
+    free(hl); 
+    return ret; 
+  }
   
-  const size_t brackets_cnt = 2;
-  const size_t colon_cnt    = 2;
-  const size_t comma_cnt    = 2;
-  const size_t quotes_cnt   = 4;
-  const size_t field_len = 8 + 3; // filepath and asm 
-  const size_t filename_len = strlen(filename); 
-
-  const uint32_t msg_bytes = brackets_cnt + 
-                             colon_cnt +
-                             comma_cnt + 
-                             quotes_cnt +
-                             field_len +
-                             filename_len +
-                             inst->asm_buflen;
+  /* the length comes from the same format the message is written with */
+  const char *source = inst->from_object ? ",\"source\":\"object\"" : ""; 
+  const char *hl_key = hl ? ",\"hl\":" : ""; 
+  const int head_len = snprintf(NULL, 0, "{\"filepath\":\"%s\",\"asm\":\"", filename); 
+  const uint32_t msg_bytes = head_len + inst->asm_buflen + strlen("\"") + strlen(source) + 
+                             strlen(hl_key) + hl_len + strlen("}"); 
   
   /* prefix the number of bytes for iterative decoding on the other side 
    * its a shame i cant let lua just look at this memory.. classic IPC */
+  const uint64_t write_ns = AsmMetrics_now(); 
+  const uint64_t trace_ns = AsmTrace_begin(); 
   if (write(client_fd, &msg_bytes, sizeof(uint32_t)) == -1) {
     fprintf(stderr, "Error [libc] write - %s\n", strerror(errno));
+    free(hl); 
     return ASM_INST_FAIL; 
   }
 
-  dprintf(client_fd,"{\"filepath\":\"%s\",\"asm\":\"%s\"}", filename, assembly);   
+  dprintf(client_fd,"{\"filepath\":\"%s\",\"asm\":\"%s\"%s%s%s}", filename, assembly, 
+          source, hl_key, hl ? hl : "");   
+  free(hl); 
+  AsmMetrics_since(ASM_PHASE_WRITE, write_ns); 
+  AsmMetrics_count(ASM_COUNT_BYTES_OUT, sizeof(uint32_t) + msg_bytes); 
+  AsmTrace_end("socket_write", trace_ns); 
   return ASM_INST_OK; 
 }
 
 
+/* 
+ * write the whole buffer even when the socket is non blocking, large 
+ * responses routinely outgrow the socket buffer 
+ */
+static int write_all(int client_fd, const char *buffer, size_t len) 
+{
+  size_t written = 0; 
+  while (written < len) {
+    ssize_t bytes = write(client_fd, buffer+written, len-written); 
+    if (bytes == -1) {
+      if (errno == EINTR) 
+        continue; 
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = { .fd = client_fd, .events = POLLOUT }; 
+        poll(&pfd, 1, 1000); 
+        continue; 
+      }
+      fprintf(stderr, "Error [libc] write - %s\n", strerror(errno));
+      return ASM_INST_FAIL; 
+    }
+    written += bytes; 
+  }
+  return ASM_INST_OK; 
+}
+
+
+int AsmInstance_send_json(int client_fd, cJSON *msg) 
+{
+  const uint64_t start_ns = AsmMetrics_now(); 
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  char *json = cJSON_PrintUnformatted(msg); 
+  if (!json) {
+    fprintf(stderr, "Error: [cJSON] cJSON_PrintUnformatted\n"); 
+    return ASM_INST_FAIL; 
+  }
+
+  /* same length prefix as the hand written messages */
+  const uint32_t msg_bytes = strlen(json); 
+  const uint64_t write_ns = AsmMetrics_now(); 
+  AsmMetrics_record(ASM_PHASE_SERIALIZE, write_ns - start_ns); 
+  if (trace_ns) 
+    AsmTrace_span("serialize", trace_ns, write_ns, 0, NULL); 
+
+  int ret = write_all(client_fd, (const char*)&msg_bytes, sizeof(uint32_t)); 
+  if (ret == ASM_INST_OK) 
+    ret = write_all(client_fd, json, msg_bytes); 
+
+  AsmMetrics_since(ASM_PHASE_WRITE, write_ns); 
+  AsmMetrics_count(ASM_COUNT_BYTES_OUT, sizeof(uint32_t) + msg_bytes); 
+  if (trace_ns) 
+    AsmTrace_span("socket_write", write_ns, AsmTrace_now(), 0, NULL); 
+
+  cJSON_free(json); 
+  return ret; 
+}
+
+
+int AsmInstance_variant_message(AsmInstance *inst, const char *name, int client_fd) 
+{
+  if (!name || strcmp(name, ASM_DEFAULT_VARIANT) == 0) 
+    return AsmInstance_assembly_message(inst, client_fd); 
+
+  AsmVariant *variant = AsmInstance_get_variant(inst, name); 
+  if (!variant || AsmInstance_compile_variant(inst, name) != ASM_INST_OK) {
+    fprintf(stderr, "[asm viewer] error - failed to compile variant %s\n", name);
+    return compile_error_message(inst, name, client_fd); 
+  }
+
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON_AddStringToObject(msg, "variant", variant->name); 
+  cJSON_AddStringToObject(msg, "asm", variant->asm_buffer ? variant->asm_buffer : ""); 
+
+  size_t hl_len; 
+  char *hl = highlight_spans(inst, variant->asm_buffer, &variant->lines, &hl_len); 
+  if (hl) 
+    cJSON_AddRawToObject(msg, "hl", hl); 
+  free(hl); 
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* every variant side by side, stale ones are compiled together */
+int AsmInstance_variants_message(AsmInstance *inst, int client_fd) 
+{
+  if (AsmInstance_compile_variant(inst, NULL) != ASM_INST_OK) {
+    fprintf(stderr, "[asm viewer] error - failed to compile variants\n");
+    return ASM_INST_FAIL; 
+  }
+
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON *list = cJSON_AddArrayToObject(msg, "variants"); 
+
+  cJSON *node = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(node, "name", ASM_DEFAULT_VARIANT); 
+  cJSON_AddStringToObject(node, "asm", inst->asm_buffer ? inst->asm_buffer : ""); 
+  if (inst->from_object) 
+    cJSON_AddStringToObject(node, "source", "object"); 
+  if (inst->compile_error) 
+    cJSON_AddStringToObject(node, "error", inst->compile_error); 
+  cJSON_AddItemToArray(list, node); 
+
+  for (unsigned int i=0; i<inst->nvariants; i++) {
+    AsmVariant *variant = &inst->variants[i]; 
+    node = cJSON_CreateObject(); 
+    cJSON_AddStringToObject(node, "name", variant->name); 
+    cJSON_AddStringToObject(node, "asm", variant->asm_buffer ? variant->asm_buffer : ""); 
+    if (variant->compile_error) 
+      cJSON_AddStringToObject(node, "error", variant->compile_error); 
+    cJSON_AddItemToArray(list, node); 
+  }
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* what changed in codegen between the last two compiles of this file */
+int AsmInstance_diff_message(AsmInstance *inst, int client_fd) 
+{
+  if (AsmInstance_compile(inst) != ASM_INST_OK) {
+    fprintf(stderr, "[asm viewer] error - failed to compile filtered assembly\n");
+    return compile_error_message(inst, NULL, client_fd); 
+  }
+
+  cJSON *msg = AsmDiff_functions(inst->prev_asm_buffer, inst->prev_asm_buflen, 
+                                 inst->asm_buffer, inst->asm_buflen); 
+  if (!msg) {
+    fprintf(stderr, "[asm viewer] error - failed to diff %s\n", inst->infile);
+    return ASM_INST_FAIL; 
+  }
+
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* the default output or a named variant, compiled if stale */
+struct asm_output {
+  const char *asm_buffer; 
+  unsigned long long asm_len; 
+  const char *command; 
+  AsmFuncStats *stats; 
+  unsigned int nstats; 
+  const AsmLines *lines; 
+}; 
+
+static int compile_output(AsmInstance *inst, const char *name, struct asm_output *out) 
+{
+  if (strcmp(name, ASM_DEFAULT_VARIANT) == 0) {
+    if (AsmInstance_compile(inst) != ASM_INST_OK) {
+      fprintf(stderr, "[asm viewer] error - failed to compile filtered assembly\n");
+      return ASM_INST_FAIL; 
+    }
+    out->asm_buffer = inst->asm_buffer; 
+    out->asm_len    = inst->asm_buflen; 
+    out->command    = inst->rebuild_command; 
+    out->stats      = inst->stats; 
+    out->nstats     = inst->asm_buffer ? inst->nstats : 0; 
+    out->lines      = &inst->lines; 
+    return ASM_INST_OK; 
+  }
+
+  AsmVariant *var = AsmInstance_get_variant(inst, name); 
+  if (!var || AsmInstance_compile_variant(inst, name) != ASM_INST_OK) {
+    fprintf(stderr, "[asm viewer] error - failed to compile variant %s\n", name);
+    return ASM_INST_FAIL; 
+  }
+  out->asm_buffer = var->asm_buffer; 
+  out->asm_len    = var->asm_buflen; 
+  out->command    = var->rebuild_command; 
+  out->stats      = var->stats; 
+  out->nstats     = var->asm_buffer ? var->nstats : 0; 
+  out->lines      = &var->lines; 
+  return ASM_INST_OK; 
+}
+
+
+/* the function's own lines, from its label up to the next function */
+static int function_lines(const struct asm_output *out, const char *function, 
+                          uint32_t *first, uint32_t *last) 
+{
+  const size_t len = strlen(function); 
+  for (unsigned int i=0; i<out->nstats; i++) {
+    const AsmFuncStats *fs = &out->stats[i]; 
+    if (fs->name_len != len || memcmp(out->asm_buffer + fs->name_offset, function, len) != 0) 
+      continue; 
+
+    const AsmLines *lines = out->lines; 
+    *first = AsmLines_at_offset(lines, fs->name_offset); 
+    if (*first == ASM_LINES_NONE) 
+      return ASM_INST_FAIL; 
+    *last = *first+1; 
+    while (*last < lines->n && lines->func[*last] == lines->func[*first]) 
+      (*last)++; 
+    return ASM_INST_OK; 
+  }
+  return ASM_INST_FAIL; 
+}
+
+
+/* 
+ * a window of an output, lines [start_line, start_line+count) or a 
+ * function with context lines either side. the line table of the last 
+ * compile has every line start, so this is a slice of the cached buffer 
+ */
+int AsmInstance_range_message(AsmInstance *inst, const char *variant, unsigned int start_line, 
+                              unsigned int count, const char *function, 
+                              unsigned int context, int client_fd) 
+{
+  const char *name = variant ? variant : ASM_DEFAULT_VARIANT; 
+  struct asm_output out; 
+  if (compile_output(inst, name, &out) != ASM_INST_OK) 
+    return compile_error_message(inst, name, client_fd); 
+
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  const AsmLines *lines = out.lines; 
+  const uint32_t total = out.asm_buffer ? lines->n : 0; 
+
+  uint32_t function_line = ASM_LINES_NONE; 
+  if (function) {
+    uint32_t first, last; 
+    if (function_lines(&out, function, &first, &last) != ASM_INST_OK) {
+      fprintf(stderr, "[asm viewer] error - no function named %s\n", function); 
+      return ASM_INST_FAIL; 
+    }
+    function_line = first; 
+    start_line = first > context ? first - context : 0; 
+    count = last + context - start_line; 
+  }
+
+  if (start_line > total) 
+    start_line = total; 
+  if (count > total - start_line) 
+    count = total - start_line; 
+  if (count > ASM_RANGE_MAX_LINES) 
+    count = ASM_RANGE_MAX_LINES; 
+
+  const size_t begin = count ? lines->offset[start_line] : 0; 
+  const size_t end   = start_line+count < total ? lines->offset[start_line+count] : 
+                       count ? out.asm_len : 0; 
+  char *slice = strndup(out.asm_buffer ? out.asm_buffer + begin : "", end - begin); 
+
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON_AddStringToObject(msg, "variant", name); 
+  cJSON_AddNumberToObject(msg, "start_line", start_line); 
+  cJSON_AddNumberToObject(msg, "count", count); 
+  cJSON_AddNumberToObject(msg, "total_lines", total); 
+  if (function_line != ASM_LINES_NONE) 
+    cJSON_AddNumberToObject(msg, "function_line", function_line); 
+  cJSON_AddStringToObject(msg, "asm", slice ? slice : ""); 
+  free(slice); 
+
+  if (inst->highlight && count) {
+    size_t hl_len; 
+    char *hl = AsmLines_highlight(lines, out.asm_buffer, start_line, count, &hl_len); 
+    if (hl) 
+      cJSON_AddRawToObject(msg, "hl", hl); 
+    free(hl); 
+  }
+  AsmTrace_end("range", trace_ns); 
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* 
+ * per function counters for the default output or a named variant, 
+ * gathered by the filter pass itself so this is only serialization 
+ */
+int AsmInstance_stats_message(AsmInstance *inst, const char *variant, int client_fd) 
+{
+  const char *name = variant ? variant : ASM_DEFAULT_VARIANT; 
+  struct asm_output out; 
+  if (compile_output(inst, name, &out) != ASM_INST_OK) 
+    return compile_error_message(inst, name, client_fd); 
+
+  const char *asm_buffer = out.asm_buffer; 
+  AsmFuncStats *stats    = out.stats; 
+  const unsigned int nstats = out.nstats; 
+
+  cJSON *msg = cJSON_CreateObject(); 
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON_AddStringToObject(msg, "variant", name); 
+  cJSON *list = cJSON_AddArrayToObject(msg, "functions"); 
+
+  AsmFuncStats total; 
+  memset(&total, 0, sizeof(AsmFuncStats)); 
+
+  char name_buffer[FILTER_DEMANGLE_MAX]; 
+  for (unsigned int i=0; i<nstats; i++) {
+    AsmFuncStats *fs = &stats[i]; 
+    size_t len = fs->name_len < sizeof(name_buffer)-1 ? fs->name_len : sizeof(name_buffer)-1; 
+    memcpy(name_buffer, asm_buffer + fs->name_offset, len); 
+    name_buffer[len] = '\0'; 
+
+    cJSON *node = cJSON_CreateObject(); 
+    cJSON_AddStringToObject(node, "name", name_buffer); 
+    cJSON_AddNumberToObject(node, "instructions", fs->ninstr); 
+    cJSON_AddNumberToObject(node, "size", fs->est_size); 
+    cJSON_AddNumberToObject(node, "calls", fs->ncalls); 
+    cJSON_AddNumberToObject(node, "branches", fs->nbranches); 
+    cJSON_AddNumberToObject(node, "vector_instructions", fs->nvector); 
+    cJSON_AddStringToObject(node, "vector_width", AsmFuncs_vector_name(fs->vector_width)); 
+    cJSON_AddItemToArray(list, node); 
+
+    total.ninstr    += fs->ninstr; 
+    total.est_size  += fs->est_size; 
+    total.ncalls    += fs->ncalls; 
+    total.nbranches += fs->nbranches; 
+    total.nvector   += fs->nvector; 
+    if (fs->vector_width > total.vector_width)
+      total.vector_width = fs->vector_width; 
+  }
+
+  cJSON *totals = cJSON_AddObjectToObject(msg, "totals"); 
+  cJSON_AddNumberToObject(totals, "functions", nstats); 
+  cJSON_AddNumberToObject(totals, "instructions", total.ninstr); 
+  cJSON_AddNumberToObject(totals, "size", total.est_size); 
+  cJSON_AddNumberToObject(totals, "calls", total.ncalls); 
+  cJSON_AddNumberToObject(totals, "branches", total.nbranches); 
+  cJSON_AddNumberToObject(totals, "vector_instructions", total.nvector); 
+  cJSON_AddStringToObject(totals, "vector_width", AsmFuncs_vector_name(total.vector_width)); 
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* line offset of "<label>:" inside [start, end), or end */
+static size_t find_label(const char *asm_buffer, size_t start, size_t end, const char *label) 
+{
+  const size_t label_len = strlen(label); 
+  size_t pos = start; 
+  while (pos < end) {
+    const char *line = asm_buffer + pos; 
+    const char *nl = memchr(line, '\n', end - pos); 
+    const size_t line_len = nl ? (size_t)(nl - line) : end - pos; 
+
+    if (line_len == label_len+1 && 
+        line[label_len] == ':' && 
+        memcmp(line, label, label_len) == 0) 
+      return pos; 
+    pos += line_len + (nl ? 1 : 0); 
+  }
+  return end; 
+}
+
+
+/* 
+ * llvm-mca over one function, or the label range [start_label, end_label) 
+ * inside it, e.g. the loop under the cursor. the cpu comes from the -march 
+ * the output was compiled with 
+ */
+int AsmInstance_analyze_message(AsmInstance *inst, const char *variant, const char *function, 
+                                const char *start_label, const char *end_label, 
+                                const char *work_dir, int client_fd) 
+{
+  const char *name = variant ? variant : ASM_DEFAULT_VARIANT; 
+  struct asm_output out; 
+  if (compile_output(inst, name, &out) != ASM_INST_OK) 
+    return compile_error_message(inst, name, client_fd); 
+
+  const char *asm_buffer = out.asm_buffer; 
+
+  AsmFunctionIndex index; 
+  if (AsmFunctionIndex_build(&index, asm_buffer, out.asm_len) != ASM_FUNCS_OK) 
+    return ASM_INST_FAIL; 
+
+  AsmFunction *func = AsmFunctionIndex_find(&index, function, strlen(function)); 
+  if (!func) {
+    fprintf(stderr, "[asm viewer] error - no function %s in %s\n", function, inst->infile);
+    AsmFunctionIndex_free(&index); 
+    return ASM_INST_FAIL; 
+  }
+
+  size_t start = func->body_start; 
+  size_t end   = func->body_end; 
+  if (start_label) 
+    start = find_label(asm_buffer, start, end, start_label); 
+  if (end_label) 
+    end = find_label(asm_buffer, start, end, end_label); 
+  AsmFunctionIndex_free(&index); 
+
+  if (start >= end) {
+    fprintf(stderr, "[asm viewer] error - empty range in %s\n", function);
+    return ASM_INST_FAIL; 
+  }
+
+  char cpu[ASM_MCA_CPU_MAX]; 
+  AsmMca_cpu_from_command(out.command, cpu, sizeof(cpu)); 
+
+  bool cached = false; 
+  cJSON *msg = AsmMca_analyze(asm_buffer + start, end - start, cpu, work_dir, &cached); 
+  if (!msg) {
+    fprintf(stderr, "[asm viewer] error - llvm-mca failed for %s\n", function);
+    return ASM_INST_FAIL; 
+  }
+
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON_AddStringToObject(msg, "function", function); 
+  cJSON_AddStringToObject(msg, "variant", name); 
+  cJSON_AddBoolToObject(msg, "cached", cached); 
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
+
+
+/* 
+ * hotness per asm line from an imported perf script or perf annotate 
+ * text file, line numbers index the buffer the assembly command sends 
+ */
+int AsmInstance_profile_message(AsmInstance *inst, const char *variant, const char *perf_file, 
+                                int client_fd) 
+{
+  const char *name = variant ? variant : ASM_DEFAULT_VARIANT; 
+  struct asm_output out; 
+  if (compile_output(inst, name, &out) != ASM_INST_OK) 
+    return compile_error_message(inst, name, client_fd); 
+
+  AsmPerfProfile *profile = AsmPerf_get(perf_file); 
+  if (!profile) {
+    fprintf(stderr, "[asm viewer] error - failed to load profile %s\n", perf_file);
+    return ASM_INST_FAIL; 
+  }
+
+  cJSON *msg = AsmPerf_annotate(profile, out.asm_buffer, out.asm_len); 
+  if (!msg) 
+    return ASM_INST_FAIL; 
+
+  cJSON_AddStringToObject(msg, "filepath", AsmInstance_get_filename(inst)); 
+  cJSON_AddStringToObject(msg, "variant", name); 
+
+  int ret = AsmInstance_send_json(client_fd, msg); 
+  cJSON_Delete(msg); 
+  return ret; 
+}
@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "asm_lines.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define LINES_INITIAL 1024
+
+
+void AsmLines_init(AsmLines *lines)
+{
+  memset(lines, 0, sizeof(AsmLines));
+}
+
+
+static void names_free(AsmNameTable *table)
+{
+  free(table->pool);
+  free(table->offsets);
+  free(table->buckets);
+  memset(table, 0, sizeof(AsmNameTable));
+}
+
+
+void AsmLines_free(AsmLines *lines)
+{
+  free(lines->offset);
+  free(lines->len);
+  free(lines->kind);
+  free(lines->nops);
+  free(lines->mnemonic);
+  free(lines->op_first);
+  free(lines->label);
+  free(lines->func);
+  free(lines->src_file);
+  free(lines->src_line);
+  free(lines->span_start);
+  free(lines->span_len);
+  names_free(&lines->mnemonics);
+  names_free(&lines->labels);
+  memset(lines, 0, sizeof(AsmLines));
+}
+
+
+size_t AsmLines_memory(const AsmLines *lines)
+{
+  const size_t per_line = sizeof(uint32_t) * 5 + sizeof(uint16_t) * 3 + 2;
+  return per_line * lines->max + 2 * sizeof(uint16_t) * lines->max_spans +
+         lines->mnemonics.pool_max + lines->labels.pool_max +
+         sizeof(uint32_t) * (lines->mnemonics.max + lines->mnemonics.nbuckets +
+                             lines->labels.max + lines->labels.nbuckets);
+}
+
+
+static uint64_t name_hash(const char *name, size_t len)
+{
+  uint64_t hash = FNV_OFFSET;
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static void names_insert(AsmNameTable *table, uint32_t id, uint64_t hash)
+{
+  uint32_t b = hash & (table->nbuckets-1);
+  while (table->buckets[b])
+    b = (b+1) & (table->nbuckets-1);
+  table->buckets[b] = id;
+}
+
+
+/* id of the name, added when new. 0 when out of memory */
+static uint32_t names_intern(AsmNameTable *table, const char *name, size_t len)
+{
+  const uint64_t hash = name_hash(name, len);
+  if (table->nbuckets) {
+    for (uint32_t b = hash & (table->nbuckets-1); table->buckets[b]; b = (b+1) & (table->nbuckets-1)) {
+      const char *s = table->pool + table->offsets[table->buckets[b]];
+      if (strncmp(s, name, len) == 0 && s[len] == '\0')
+        return table->buckets[b];
+    }
+  }
+
+  if (table->n+2 > table->max) {
+    const uint32_t max = table->max ? table->max*2 : 256;
+    uint32_t *offsets = (uint32_t*)realloc(table->offsets, sizeof(uint32_t) * max);
+    if (!offsets)
+      return 0;
+    table->offsets = offsets;
+    table->max = max;
+  }
+
+  if (table->pool_len + len + 1 > table->pool_max) {
+    size_t max = table->pool_max ? table->pool_max : 4096;
+    while (table->pool_len + len + 1 > max)
+      max *= 2;
+    char *pool = (char*)realloc(table->pool, max);
+    if (!pool)
+      return 0;
+    table->pool = pool;
+    table->pool_max = max;
+  }
+
+  if (2*(table->n+1) > table->nbuckets) {
+    const uint32_t nbuckets = table->nbuckets ? table->nbuckets*2 : 512;
+    uint32_t *buckets = (uint32_t*)calloc(nbuckets, sizeof(uint32_t));
+    if (!buckets)
+      return 0;
+    free(table->buckets);
+    table->buckets = buckets;
+    table->nbuckets = nbuckets;
+    for (uint32_t id=1; id<=table->n; id++) {
+      const char *s = table->pool + table->offsets[id];
+      names_insert(table, id, name_hash(s, strlen(s)));
+    }
+  }
+
+  const uint32_t id = ++table->n;
+  table->offsets[id] = table->pool_len;
+  memcpy(table->pool + table->pool_len, name, len);
+  table->pool[table->pool_len + len] = '\0';
+  table->pool_len += len+1;
+  names_insert(table, id, hash);
+  return id;
+}
+
+
+const char* AsmLines_name(const AsmNameTable *table, uint32_t id)
+{
+  if (!id || id > table->n)
+    return NULL;
+  return table->pool + table->offsets[id];
+}
+
+
+static int grow_lines(AsmLines *lines)
+{
+  const uint32_t max = lines->max ? lines->max*2 : LINES_INITIAL;
+
+#define GROW(field) do { \
+    void *p = realloc(lines->field, sizeof(*lines->field) * max); \
+    if (!p) \
+      return ASM_LINES_FAIL; \
+    lines->field = p; \
+  } while (0)
+
+  GROW(offset);
+  GROW(len);
+  GROW(kind);
+  GROW(nops);
+  GROW(mnemonic);
+  GROW(op_first);
+  GROW(label);
+  GROW(func);
+  GROW(src_file);
+  GROW(src_line);
+#undef GROW
+
+  lines->max = max;
+  return ASM_LINES_OK;
+}
+
+
+static int add_span(AsmLines *lines, size_t start, size_t len)
+{
+  if (lines->nspans == lines->max_spans) {
+    const uint32_t max = lines->max_spans ? lines->max_spans*2 : LINES_INITIAL;
+    uint16_t *span_start = (uint16_t*)realloc(lines->span_start, sizeof(uint16_t) * max);
+    if (!span_start)
+      return ASM_LINES_FAIL;
+    lines->span_start = span_start;
+    uint16_t *span_len = (uint16_t*)realloc(lines->span_len, sizeof(uint16_t) * max);
+    if (!span_len)
+      return ASM_LINES_FAIL;
+    lines->span_len = span_len;
+    lines->max_spans = max;
+  }
+
+  lines->span_start[lines->nspans] = start;
+  lines->span_len[lines->nspans]   = len;
+  lines->nspans++;
+  return ASM_LINES_OK;
+}
+
+
+static bool label_char(char ch)
+{
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') || ch == '_' || ch == '.';
+}
+
+
+/*
+ * "\tmnemonic op, op # comment" with operands split on top level commas.
+ * demangled names carry commas inside <> and (), memory operands inside
+ * [], string literals anything at all
+ */
+static void tokenize(AsmLines *lines, uint32_t i, const char *text, size_t len)
+{
+  size_t p = 0;
+  while (p < len && (text[p] == ' ' || text[p] == '\t'))
+    p++;
+  size_t m = p;
+  while (m < len && text[m] != ' ' && text[m] != '\t')
+    m++;
+  if (m == p)
+    return;
+  lines->mnemonic[i] = names_intern(&lines->mnemonics, text+p, m-p);
+
+  p = m;
+  int depth = 0;
+  while (p < len) {
+    while (p < len && (text[p] == ' ' || text[p] == '\t'))
+      p++;
+    if (p == len || text[p] == '#')
+      break;
+
+    size_t q = p;
+    bool quoted = false;
+    for (; q < len; q++) {
+      const char ch = text[q];
+      if (ch == '"' && text[q-1] != '\\')
+        quoted = !quoted;
+      else if (quoted)
+        continue;
+      else if (ch == '[' || ch == '(' || ch == '<')
+        depth++;
+      else if ((ch == ']' || ch == ')' || ch == '>') && depth)
+        depth--;
+      else if ((ch == ',' && !depth) || ch == '#')
+        break;
+    }
+
+    size_t end = q;
+    while (end > p && (text[end-1] == ' ' || text[end-1] == '\t'))
+      end--;
+    if (end > p && add_span(lines, p, end-p) == ASM_LINES_OK && lines->nops[i] < UINT8_MAX)
+      lines->nops[i]++;
+    if (q < len && text[q] == '#')
+      break;
+    p = q+1;
+  }
+
+  /* jumps name their target, calls into local labels too */
+  if (lines->kind[i] == ASM_LINE_INSTR && lines->nops[i] == 1) {
+    const size_t start = lines->span_start[lines->op_first[i]];
+    const size_t span  = lines->span_len[lines->op_first[i]];
+    if (span > 2 && text[start] == '.' && text[start+1] == 'L') {
+      size_t n = 2;
+      while (n < span && label_char(text[start+n]))
+        n++;
+      if (n == span)
+        lines->label[i] = names_intern(&lines->labels, text+start, span);
+    }
+  }
+}
+
+
+/* text is the line as written to the buffer, offset where it starts */
+int AsmLines_add(AsmLines *lines, const char *text, size_t offset, size_t len,
+                 bool func, uint16_t src_file, uint32_t src_line)
+{
+  if (offset > UINT32_MAX)
+    return ASM_LINES_FAIL;
+  if (lines->n == lines->max && grow_lines(lines) != ASM_LINES_OK) {
+    fprintf(stderr, "Error: [libc] realloc\n");
+    return ASM_LINES_FAIL;
+  }
+
+  while (len && text[len-1] == '\n')
+    len--;
+  if (len > UINT16_MAX)
+    len = UINT16_MAX;
+
+  const uint32_t i = lines->n++;
+  lines->offset[i]   = offset;
+  lines->len[i]      = len;
+  lines->nops[i]     = 0;
+  lines->mnemonic[i] = 0;
+  lines->op_first[i] = lines->nspans;
+  lines->label[i]    = 0;
+  lines->src_file[i] = src_file;
+  lines->src_line[i] = src_line;
+
+  if (!len)
+    lines->kind[i] = ASM_LINE_BLANK;
+  else if (func)
+    lines->kind[i] = ASM_LINE_FUNC;
+  else if (text[0] != ' ' && text[0] != '\t')
+    lines->kind[i] = ASM_LINE_LABEL;
+  else {
+    size_t p = 0;
+    while (p < len && (text[p] == ' ' || text[p] == '\t'))
+      p++;
+    lines->kind[i] = p < len && text[p] == '.' ? ASM_LINE_DATA : ASM_LINE_INSTR;
+  }
+
+  if (lines->kind[i] == ASM_LINE_FUNC)
+    lines->nfuncs++;
+  lines->func[i] = lines->nfuncs ? lines->nfuncs-1 : ASM_LINES_NONE;
+
+  if (lines->kind[i] == ASM_LINE_LABEL) {
+    size_t n = len;
+    while (n && text[n-1] != ':')
+      n--;
+    if (n > 1)
+      lines->label[i] = names_intern(&lines->labels, text, n-1);
+  }
+  else if (lines->kind[i] == ASM_LINE_INSTR || lines->kind[i] == ASM_LINE_DATA)
+    tokenize(lines, i, text, len);
+
+  return ASM_LINES_OK;
+}
+
+
+/* everything written at or after offset is gone, names stay interned */
+void AsmLines_truncate(AsmLines *lines, size_t offset, uint32_t nfuncs)
+{
+  while (lines->n && lines->offset[lines->n-1] >= offset)
+    lines->n--;
+  lines->nspans = lines->n ? lines->op_first[lines->n-1] + lines->nops[lines->n-1] : 0;
+  lines->nfuncs = nfuncs;
+}
+
+
+/* the line holding offset, binary search over the starts */
+uint32_t AsmLines_at_offset(const AsmLines *lines, size_t offset)
+{
+  if (!lines->n || offset < lines->offset[0])
+    return ASM_LINES_NONE;
+
+  uint32_t lo = 0;
+  uint32_t hi = lines->n;
+  while (hi - lo > 1) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (lines->offset[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/* intel syntax x86 names, the operand is already trimmed */
+static bool is_register(const char *s, size_t n)
+{
+  static const char *const regs[] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp", "rip",
+    "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
+    "ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
+    "al", "bl", "cl", "dl", "ah", "bh", "ch", "dh", "sil", "dil", "bpl", "spl",
+    "cs", "ds", "es", "fs", "gs", "ss", "st", NULL
+  };
+  if (n <= 3) {
+    for (unsigned int i=0; regs[i]; i++) {
+      if (regs[i][0] == s[0] && strncmp(s, regs[i], n) == 0 && regs[i][n] == '\0')
+        return true;
+    }
+  }
+
+  /* r8-r15 and their d/w/b halves, vector, mask and x87 stack registers */
+  size_t p = 0;
+  if (n >= 2 && s[0] == 'r')
+    p = 1;
+  else if (n >= 4 && (s[0] == 'x' || s[0] == 'y' || s[0] == 'z') && s[1] == 'm' && s[2] == 'm')
+    p = 3;
+  else if (n == 2 && s[0] == 'k')
+    p = 1;
+  else if (n >= 5 && memcmp(s, "st(", 3) == 0 && s[n-1] == ')')
+    return true;
+  else
+    return false;
+
+  const size_t digits = p;
+  while (p < n && s[p] >= '0' && s[p] <= '9')
+    p++;
+  if (p == digits)
+    return false;
+  return p == n || (s[0] == 'r' && p+1 == n && (s[p] == 'd' || s[p] == 'w' || s[p] == 'b'));
+}
+
+
+static int operand_class(const char *s, size_t n, uint8_t kind)
+{
+  const bool number = (s[0] >= '0' && s[0] <= '9') ||
+                      (n > 1 && s[0] == '-' && s[1] >= '0' && s[1] <= '9');
+  if (kind == ASM_LINE_DATA)
+    return number || s[0] == '"' ? ASM_HL_IMMEDIATE : ASM_HL_LABEL;
+
+  if (memchr(s, '[', n) || (n > 4 && memmem(s, n, " PTR ", 5)))
+    return ASM_HL_MEMORY;
+  if (number)
+    return ASM_HL_IMMEDIATE;
+  if (is_register(s, n))
+    return ASM_HL_REGISTER;
+  return ASM_HL_LABEL;
+}
+
+
+struct hl_writer {
+  char *data;
+  size_t len;
+  size_t max;
+  uint32_t line;           // of the previous span, lines are delta coded
+  bool fail;
+};
+
+
+static void write_uint(struct hl_writer *out, uint32_t value)
+{
+  char digits[10];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n)
+    out->data[out->len++] = digits[--n];
+}
+
+
+static void write_span(struct hl_writer *out, uint32_t line, size_t col, size_t len, int hl)
+{
+  if (out->fail || !len)
+    return;
+  if (out->len + 48 > out->max) {
+    const size_t max = out->max*2;
+    char *data = (char*)realloc(out->data, max);
+    if (!data) {
+      out->fail = true;
+      return;
+    }
+    out->data = data;
+    out->max = max;
+  }
+
+  if (out->data[out->len-1] != '[')
+    out->data[out->len++] = ',';
+  write_uint(out, line - out->line);
+  out->data[out->len++] = ',';
+  write_uint(out, col);
+  out->data[out->len++] = ',';
+  write_uint(out, len);
+  out->data[out->len++] = ',';
+  write_uint(out, hl);
+  out->line = line;
+}
+
+
+/*
+ * highlight spans of lines [first, first+count) as a json array, four
+ * numbers a span: line delta (the first against `first`), byte column,
+ * length and ASM_HL_* class. built from the tokens, the text is only
+ * read for mnemonic and comment positions
+ */
+char* AsmLines_highlight(const AsmLines *lines, const char *asm_buffer, uint32_t first,
+                         uint32_t count, size_t *len)
+{
+  if (first > lines->n)
+    first = lines->n;
+  const uint32_t last = count < lines->n - first ? first+count : lines->n;
+
+  /* about four short spans a line, grown when operands run long */
+  struct hl_writer out = { .max = 16 * (size_t)(last-first) + 64, .line = first };
+  out.data = (char*)malloc(out.max);
+  if (!out.data) {
+    fprintf(stderr, "Error: [libc] malloc\n");
+    return NULL;
+  }
+  out.data[out.len++] = '[';
+
+  for (uint32_t i=first; i<last; i++) {
+    const char *text = asm_buffer + lines->offset[i];
+    const uint8_t kind = lines->kind[i];
+
+    if (kind == ASM_LINE_FUNC || kind == ASM_LINE_LABEL) {
+      size_t n = lines->len[i];
+      if (n && text[n-1] == ':')
+        n--;
+      write_span(&out, i, 0, n, ASM_HL_LABEL);
+      continue;
+    }
+    if (kind != ASM_LINE_INSTR && kind != ASM_LINE_DATA)
+      continue;
+
+    size_t p = 0;
+    while (p < lines->len[i] && (text[p] == ' ' || text[p] == '\t'))
+      p++;
+    size_t m = p;
+    while (m < lines->len[i] && text[m] != ' ' && text[m] != '\t')
+      m++;
+    write_span(&out, i, p, m-p, ASM_HL_MNEMONIC);
+
+    size_t end = m;
+    for (uint32_t op=lines->op_first[i]; op<lines->op_first[i]+lines->nops[i]; op++) {
+      const char *s = text + lines->span_start[op];
+      write_span(&out, i, lines->span_start[op], lines->span_len[op],
+                 operand_class(s, lines->span_len[op], kind));
+      end = lines->span_start[op] + lines->span_len[op];
+    }
+
+    /* whatever follows the operands, the tokenizer stopped at its '#' */
+    while (end < lines->len[i] && text[end] != '#')
+      end++;
+    if (end < lines->len[i])
+      write_span(&out, i, end, lines->len[i]-end, ASM_HL_COMMENT);
+  }
+
+  if (out.fail) {
+    fprintf(stderr, "Error: [libc] realloc\n");
+    free(out.data);
+    return NULL;
+  }
+  out.data[out.len++] = ']';
+  out.data[out.len] = '\0';
+  *len = out.len;
+  return out.data;
+}
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "asm_mca.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define MCA_LINE_MAX 16384
+#define MCA_SYMBOL   "__mca_sym"
+
+struct mca_entry {
+  uint64_t key;
+  cJSON *result;
+  struct mca_entry *next;
+};
+
+static struct mca_entry *mca_table[MCA_HT_SIZE] = {NULL};
+
+
+static inline uint64_t fnv_hash(uint64_t hash, const char *data, size_t len)
+{
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static inline bool is_cpu_char(unsigned char ch)
+{
+  return (ch >= 'a' && ch <= 'z') ||
+         (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') ||
+         ch == '-' || ch == '_' || ch == '.';
+}
+
+
+/*
+ * -march= for gcc/clang, -mcpu= for arm style targets and
+ * -C target-cpu= for rustc. the last one wins, same as the compilers
+ */
+int AsmMca_cpu_from_command(const char *cmd, char *cpu, size_t cpu_max)
+{
+  static const char *prefixes[] = { "-march=", "-mcpu=", "target-cpu=" };
+  const char *found = NULL;
+  size_t found_len = 0;
+
+  for (const char *p = cmd; *p; p++) {
+    if (p != cmd && p[-1] != ' ' && p[-1] != 'C')
+      continue;
+
+    for (unsigned int i=0; i<sizeof(prefixes)/sizeof(prefixes[0]); i++) {
+      const size_t plen = strlen(prefixes[i]);
+      if (strncmp(p, prefixes[i], plen) != 0)
+        continue;
+
+      size_t n = 0;
+      while (is_cpu_char(p[plen+n]))
+        n++;
+      if (n) {
+        found = p+plen;
+        found_len = n;
+      }
+    }
+  }
+
+  if (!found || found_len >= cpu_max) {
+    snprintf(cpu, cpu_max, "x86-64");
+    return ASM_MCA_OK;
+  }
+
+  memcpy(cpu, found, found_len);
+  cpu[found_len] = '\0';
+  return ASM_MCA_OK;
+}
+
+
+/*
+ * symbols only show up as branch targets, before [rip] and after
+ * OFFSET FLAT:, all three are swapped for a placeholder. .L targets
+ * stay so loops still branch back to their own label
+ */
+static size_t sanitize_line(const char *line, size_t len, char *out, size_t out_max)
+{
+  size_t i = 0;
+  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+
+  /* labels pass through */
+  if (i == 0)
+    return snprintf(out, out_max, "%.*s\n", (int)len, line);
+
+  const char *mnemonic = line+i;
+  while (i < len && line[i] != ' ' && line[i] != '\t')
+    i++;
+  const size_t mlen = (line+i) - mnemonic;
+  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+
+  const char *ops = line+i;
+  const size_t ops_len = len-i;
+
+  const bool branch = mnemonic[0] == 'j' ||
+                      (mlen == 4 && memcmp(mnemonic, "call", 4) == 0);
+  const bool indirect = ops_len && (ops[0] == '[' || memmem(ops, ops_len, "PTR ", 4));
+  if (branch && ops_len && !indirect &&
+      !(ops_len > 2 && ops[0] == '.' && ops[1] == 'L'))
+  {
+    /* register targets are kept, anything else is a symbol */
+    bool symbol = true;
+    if (ops_len <= 3) {
+      symbol = false;
+      for (size_t k=0; k<ops_len; k++)
+        symbol |= !(ops[k] >= 'a' && ops[k] <= 'z') && !(ops[k] >= '0' && ops[k] <= '9');
+    }
+    if (symbol)
+      return snprintf(out, out_max, "\t%.*s\t" MCA_SYMBOL "\n", (int)mlen, mnemonic);
+  }
+
+  const char *flat = memmem(ops, ops_len, "FLAT:", 5);
+  if (flat) {
+    return snprintf(out, out_max, "\t%.*s\t%.*s" MCA_SYMBOL "\n",
+                    (int)mlen, mnemonic, (int)(flat+5 - ops), ops);
+  }
+
+  const char *rip = memmem(ops, ops_len, "[rip", 4);
+  if (rip) {
+    /* the symbol starts after PTR, or after the first operand for lea */
+    const char *start = ops;
+    const char *ptr = memmem(ops, rip - ops, "PTR ", 4);
+    if (ptr)
+      start = ptr+4;
+    else {
+      const char *comma = memchr(ops, ',', rip - ops);
+      if (comma && comma+1 < rip)
+        start = comma + (comma[1] == ' ' ? 2 : 1);
+    }
+
+    if (start == rip)
+      return snprintf(out, out_max, "\t%.*s\t%.*s\n", (int)mlen, mnemonic, (int)ops_len, ops);
+
+    return snprintf(out, out_max, "\t%.*s\t%.*s" MCA_SYMBOL "%.*s\n",
+                    (int)mlen, mnemonic,
+                    (int)(start - ops), ops,
+                    (int)(ops+ops_len - rip), rip);
+  }
+
+  return snprintf(out, out_max, "\t%.*s\t%.*s\n", (int)mlen, mnemonic, (int)ops_len, ops);
+}
+
+
+static int write_block(int fd, const char *block, size_t len)
+{
+  char *line_out = (char*)malloc(MCA_LINE_MAX);
+  const char *header = ".intel_syntax noprefix\n";
+  if (write(fd, header, strlen(header)) < 0) {
+    free(line_out);
+    return ASM_MCA_FAIL;
+  }
+
+  size_t pos = 0;
+  while (pos < len) {
+    const char *line = block + pos;
+    const char *nl = memchr(line, '\n', len - pos);
+    const size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+    pos += line_len + (nl ? 1 : 0);
+
+    if (!line_len)
+      continue;
+
+    size_t n = sanitize_line(line, line_len, line_out, MCA_LINE_MAX);
+    if (n >= MCA_LINE_MAX)
+      n = MCA_LINE_MAX-1;
+    if (write(fd, line_out, n) < 0) {
+      fprintf(stderr, "Error: [libc] write - %s\n", strerror(errno));
+      free(line_out);
+      return ASM_MCA_FAIL;
+    }
+  }
+
+  free(line_out);
+  return ASM_MCA_OK;
+}
+
+
+static char* run_mca(const char *path, const char *cpu)
+{
+  char cmd[PATH_MAX + 128];
+  snprintf(cmd, sizeof(cmd), ASM_MCA_BIN " -mcpu=%s --json %s 2> /dev/null", cpu, path);
+
+  FILE *fp = popen(cmd, "r");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  size_t out_max = 65536;
+  size_t out_len = 0;
+  char *out = (char*)malloc(out_max);
+  size_t bytes;
+  while ((bytes = fread(out+out_len, 1, out_max-out_len-1, fp))) {
+    out_len += bytes;
+    if (out_len == out_max-1) {
+      out_max *= 2;
+      char *new_out = (char*)realloc(out, out_max);
+      if (!new_out) {
+        fprintf(stderr, "Error: [libc] realloc\n");
+        free(out);
+        pclose(fp);
+        return NULL;
+      }
+      out = new_out;
+    }
+  }
+  out[out_len] = '\0';
+
+  if (pclose(fp) != 0) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+
+
+/*
+ * grouped units come out as "SBPort23.<byte>" where the unit index is
+ * written as a raw byte instead of a digit
+ */
+static const char* resource_name(cJSON *resources, int idx, char *buf, size_t buf_max)
+{
+  const char *name = cJSON_GetStringValue(cJSON_GetArrayItem(resources, idx));
+  if (!name)
+    return "unknown";
+
+  const size_t len = strlen(name);
+  if (len+2 > buf_max)
+    return name;
+
+  /* cJSON stops at the \u0000 of unit zero */
+  if (len && name[len-1] == '.') {
+    snprintf(buf, buf_max, "%s0", name);
+    return buf;
+  }
+
+  if (len > 1 && name[len-2] == '.' && (unsigned char)name[len-1] < 0x20) {
+    snprintf(buf, buf_max, "%.*s%d", (int)(len-1), name, name[len-1]);
+    return buf;
+  }
+
+  return name;
+}
+
+
+static double json_number(cJSON *obj, const char *name)
+{
+  cJSON *item = cJSON_GetObjectItemCaseSensitive(obj, name);
+  return cJSON_IsNumber(item) ? item->valuedouble : 0.0;
+}
+
+
+/*
+ * llvm-mca report, first code region only, reshaped to per iteration
+ * numbers. resource usage is already averaged over the iterations
+ */
+static cJSON* convert_report(cJSON *report, const char *cpu)
+{
+  cJSON *region = cJSON_GetArrayItem(cJSON_GetObjectItemCaseSensitive(report, "CodeRegions"), 0);
+  if (!region)
+    return NULL;
+
+  cJSON *summary  = cJSON_GetObjectItemCaseSensitive(region, "SummaryView");
+  cJSON *info     = cJSON_GetObjectItemCaseSensitive(
+                      cJSON_GetObjectItemCaseSensitive(region, "InstructionInfoView"),
+                      "InstructionList");
+  cJSON *pressure = cJSON_GetObjectItemCaseSensitive(
+                      cJSON_GetObjectItemCaseSensitive(region, "ResourcePressureView"),
+                      "ResourcePressureInfo");
+  cJSON *text     = cJSON_GetObjectItemCaseSensitive(region, "Instructions");
+  cJSON *resources = cJSON_GetObjectItemCaseSensitive(
+                       cJSON_GetObjectItemCaseSensitive(report, "TargetInfo"),
+                       "Resources");
+  if (!summary)
+    return NULL;
+
+  const double iterations = json_number(summary, "Iterations");
+  cJSON *msg = cJSON_CreateObject();
+  cJSON_AddStringToObject(msg, "cpu", cpu);
+  cJSON_AddNumberToObject(msg, "block_rthroughput", json_number(summary, "BlockRThroughput"));
+  cJSON_AddNumberToObject(msg, "uops", iterations ? json_number(summary, "TotaluOps") / iterations : 0);
+  cJSON_AddNumberToObject(msg, "uops_per_cycle", json_number(summary, "uOpsPerCycle"));
+  cJSON_AddNumberToObject(msg, "ipc", json_number(summary, "IPC"));
+  cJSON_AddNumberToObject(msg, "dispatch_width", json_number(summary, "DispatchWidth"));
+
+  const int ninstr = cJSON_GetArraySize(text);
+  const int nresources = cJSON_GetArraySize(resources);
+  double *totals = (double*)calloc(nresources ? nresources : 1, sizeof(double));
+  char name[128];
+
+  cJSON *list = cJSON_AddArrayToObject(msg, "instructions");
+  for (int i=0; i<ninstr; i++) {
+    cJSON *entry = cJSON_GetArrayItem(info, i);
+    cJSON *node = cJSON_CreateObject();
+    cJSON_AddStringToObject(node, "asm", cJSON_GetStringValue(cJSON_GetArrayItem(text, i)));
+    cJSON_AddNumberToObject(node, "uops", json_number(entry, "NumMicroOpcodes"));
+    cJSON_AddNumberToObject(node, "latency", json_number(entry, "Latency"));
+    cJSON_AddNumberToObject(node, "rthroughput", json_number(entry, "RThroughput"));
+    cJSON_AddObjectToObject(node, "pressure");
+    cJSON_AddItemToArray(list, node);
+  }
+
+  cJSON *usage;
+  cJSON_ArrayForEach(usage, pressure) {
+    const int inst_idx = (int)json_number(usage, "InstructionIndex");
+    const int res_idx  = (int)json_number(usage, "ResourceIndex");
+    const double value = json_number(usage, "ResourceUsage");
+    if (inst_idx < 0 || inst_idx >= ninstr || res_idx < 0 || res_idx >= nresources)
+      continue;
+
+    totals[res_idx] += value;
+    cJSON *node = cJSON_GetObjectItemCaseSensitive(cJSON_GetArrayItem(list, inst_idx), "pressure");
+    cJSON_AddNumberToObject(node, resource_name(resources, res_idx, name, sizeof(name)), value);
+  }
+
+  cJSON *resource_pressure = cJSON_AddObjectToObject(msg, "resource_pressure");
+  for (int i=0; i<nresources; i++) {
+    cJSON_AddNumberToObject(resource_pressure,
+                            resource_name(resources, i, name, sizeof(name)),
+                            totals[i]);
+  }
+
+  free(totals);
+  return msg;
+}
+
+
+cJSON* AsmMca_analyze(const char *block, size_t len, const char *cpu,
+                      const char *work_dir, bool *cached)
+{
+  for (const char *c = cpu; *c; c++) {
+    if (!is_cpu_char(*c))
+      return NULL;
+  }
+
+  uint64_t key = fnv_hash(FNV_OFFSET, block, len);
+  key = fnv_hash(key, cpu, strlen(cpu));
+
+  const uint32_t hash_idx = key % MCA_HT_SIZE;
+  for (struct mca_entry *slot = mca_table[hash_idx]; slot; slot = slot->next) {
+    if (slot->key == key) {
+      if (cached)
+        *cached = true;
+      return cJSON_Duplicate(slot->result, true);
+    }
+  }
+
+  if (cached)
+    *cached = false;
+
+  if (mkdir(work_dir, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/mca_XXXXXX.s", work_dir);
+  int fd = mkstemps(path, 2);
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] mkstemps - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  int ret = write_block(fd, block, len);
+  close(fd);
+
+  char *out = ret == ASM_MCA_OK ? run_mca(path, cpu) : NULL;
+  unlink(path);
+  if (!out)
+    return NULL;
+
+  cJSON *report = cJSON_Parse(out);
+  free(out);
+  if (!report)
+    return NULL;
+
+  cJSON *result = convert_report(report, cpu);
+  cJSON_Delete(report);
+  if (!result)
+    return NULL;
+
+  struct mca_entry *entry = (struct mca_entry*)malloc(sizeof(struct mca_entry));
+  entry->key = key;
+  entry->result = result;
+  entry->next = mca_table[hash_idx];
+  mca_table[hash_idx] = entry;
+  return cJSON_Duplicate(result, true);
+}
+
+
+void AsmMca_clear(void)
+{
+  for (unsigned int i=0; i<MCA_HT_SIZE; i++) {
+    struct mca_entry *slot = mca_table[i];
+    while (slot) {
+      struct mca_entry *next = slot->next;
+      cJSON_Delete(slot->result);
+      free(slot);
+      slot = next;
+    }
+    mca_table[i] = NULL;
+  }
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asm_metrics.h"
+
+static AsmHistogram phases[ASM_PHASE_COUNT];
+static uint64_t counters[ASM_COUNT_COUNT];
+static int jobs_in_flight = 0;
+static int jobs_peak = 0;
+static uint64_t start_time = 0;
+
+static const char *phase_names[ASM_PHASE_COUNT] = {
+  "queue_wait", "compile", "filter", "serialize", "socket_write", "request"
+};
+
+static const char *counter_names[ASM_COUNT_COUNT] = {
+  "requests", "errors", "cache_hit", "cache_miss", "cache_evict",
+  "compiles", "objects", "bytes_in", "bytes_out"
+};
+
+
+uint64_t AsmMetrics_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void AsmMetrics_record(int phase, uint64_t ns)
+{
+  AsmHistogram *h = &phases[phase];
+  const uint64_t us = ns / 1000;
+
+  unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+  if (bucket >= METRICS_BUCKETS)
+    bucket = METRICS_BUCKETS-1;
+
+  h->buckets[bucket]++;
+  h->count++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+}
+
+
+void AsmMetrics_since(int phase, uint64_t start_ns)
+{
+  AsmMetrics_record(phase, AsmMetrics_now() - start_ns);
+}
+
+
+void AsmMetrics_init(void)
+{
+  memset(phases, 0, sizeof(phases));
+  memset(counters, 0, sizeof(counters));
+  start_time = AsmMetrics_now();
+}
+
+
+void AsmMetrics_count(int counter, uint64_t n)
+{
+  counters[counter] += n;
+}
+
+
+void AsmMetrics_jobs(int delta)
+{
+  jobs_in_flight += delta;
+  if (jobs_in_flight > jobs_peak)
+    jobs_peak = jobs_in_flight;
+}
+
+
+/* upper bound of the bucket holding the q-th sample, in ms */
+static double percentile(AsmHistogram *h, double q)
+{
+  if (!h->count)
+    return 0;
+
+  uint64_t rank = (uint64_t)(q * h->count);
+  if (rank < q * h->count || rank == 0)
+    rank++;
+  uint64_t seen = 0;
+  for (unsigned int i=0; i<METRICS_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      const double upper_ms = (double)(1ULL << i) / 1000.0;
+      const double max_ms = h->max_ns / 1e6;
+      return upper_ms < max_ms ? upper_ms : max_ms;
+    }
+  }
+  return h->max_ns / 1e6;
+}
+
+
+cJSON* AsmMetrics_json(void)
+{
+  cJSON *msg = cJSON_CreateObject();
+  cJSON_AddNumberToObject(msg, "uptime_s", (AsmMetrics_now() - start_time) / 1e9);
+
+  cJSON *latency = cJSON_AddObjectToObject(msg, "latency");
+  for (unsigned int p=0; p<ASM_PHASE_COUNT; p++) {
+    AsmHistogram *h = &phases[p];
+    cJSON *node = cJSON_AddObjectToObject(latency, phase_names[p]);
+    cJSON_AddNumberToObject(node, "count", h->count);
+    cJSON_AddNumberToObject(node, "mean_ms", h->count ? h->sum_ns / 1e6 / h->count : 0);
+    cJSON_AddNumberToObject(node, "max_ms", h->max_ns / 1e6);
+    cJSON_AddNumberToObject(node, "p50_ms", percentile(h, 0.50));
+    cJSON_AddNumberToObject(node, "p90_ms", percentile(h, 0.90));
+    cJSON_AddNumberToObject(node, "p99_ms", percentile(h, 0.99));
+
+    /* [upper bound us, count], empty buckets left out */
+    cJSON *buckets = cJSON_AddArrayToObject(node, "buckets");
+    for (unsigned int i=0; i<METRICS_BUCKETS; i++) {
+      if (!h->buckets[i])
+        continue;
+      cJSON *pair = cJSON_CreateArray();
+      cJSON_AddItemToArray(pair, cJSON_CreateNumber((double)(1ULL << i)));
+      cJSON_AddItemToArray(pair, cJSON_CreateNumber(h->buckets[i]));
+      cJSON_AddItemToArray(buckets, pair);
+    }
+  }
+
+  cJSON *counts = cJSON_AddObjectToObject(msg, "counters");
+  for (unsigned int c=0; c<ASM_COUNT_COUNT; c++)
+    cJSON_AddNumberToObject(counts, counter_names[c], counters[c]);
+
+  const uint64_t lookups = counters[ASM_COUNT_CACHE_HIT] + counters[ASM_COUNT_CACHE_MISS];
+  cJSON_AddNumberToObject(counts, "cache_hit_rate",
+                          lookups ? (double)counters[ASM_COUNT_CACHE_HIT] / lookups : 0);
+
+  cJSON *jobs = cJSON_AddObjectToObject(msg, "jobs");
+  cJSON_AddNumberToObject(jobs, "in_flight", jobs_in_flight);
+  cJSON_AddNumberToObject(jobs, "peak", jobs_peak);
+  return msg;
+}
+
+
+/* written next to the file and renamed, readers never see half of it */
+int AsmMetrics_write_file(cJSON *metrics, const char *path)
+{
+  char *json = cJSON_PrintUnformatted(metrics);
+  if (!json)
+    return ASM_METRICS_FAIL;
+
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  FILE *fp = fopen(tmp_path, "w");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    cJSON_free(json);
+    return ASM_METRICS_FAIL;
+  }
+  fputs(json, fp);
+  fputc('\n', fp);
+  fclose(fp);
+  cJSON_free(json);
+
+  if (rename(tmp_path, path) != 0) {
+    fprintf(stderr, "Error: [libc] rename - %s\n", strerror(errno));
+    unlink(tmp_path);
+    return ASM_METRICS_FAIL;
+  }
+  return ASM_METRICS_OK;
+}
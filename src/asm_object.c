@@ -0,0 +1,738 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <elf.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "asm_object.h"
+
+#define OBJDUMP_FLAGS " -d -r -w -M intel --no-show-raw-insn "
+
+struct obj_symbol {
+  const char *name;            // into the mapped string table
+  unsigned int shndx;
+  uint64_t value;
+  uint64_t size;
+};
+
+struct obj_section {
+  const char *name;
+  unsigned int shndx;
+};
+
+struct obj_insn {
+  unsigned int section;        // index into sections
+  uint64_t addr;
+  char *text;                  // mnemonic and operands as objdump gave them
+};
+
+struct obj_reloc {
+  unsigned int section;
+  uint64_t addr;
+  char *type;
+  char *target;                // symbol with objdump's addend, "ext-0x4"
+};
+
+struct obj_file {
+  struct obj_symbol *funcs;
+  unsigned int nfuncs;
+  struct obj_section *sections;
+  unsigned int nsections;
+  struct obj_insn *insns;
+  unsigned int ninsns;
+  unsigned int max_insns;
+  struct obj_reloc *relocs;
+  unsigned int nrelocs;
+  unsigned int max_relocs;
+};
+
+struct out_buffer {
+  char *text;
+  size_t len;
+  size_t max;
+};
+
+
+/* nanoseconds, a build writes the object within the second it saved the source */
+static bool mtime_newer(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+
+/* "dep: a.c b.h \ c.h" every dependency no newer than the object */
+static bool deps_fresh(const char *depfile, const struct timespec *object_mtime, const char *directory)
+{
+  FILE *fp = fopen(depfile, "r");
+  if (!fp)
+    return false;
+
+  char token[PATH_MAX];
+  char path[2*PATH_MAX];
+  size_t j = 0;
+  bool target = true;
+  bool fresh = true;
+  int ch;
+  while (fresh) {
+    ch = fgetc(fp);
+    if (ch == '\\') {
+      const int next = fgetc(fp);
+      if (next == ' ') {
+        if (j < sizeof(token)-1)
+          token[j++] = ' ';
+        continue;
+      }
+      ch = next == '\n' ? ' ' : next;
+    }
+    if (ch != EOF && ch != ' ' && ch != '\t' && ch != '\n') {
+      if (j < sizeof(token)-1)
+        token[j++] = ch;
+      continue;
+    }
+
+    token[j] = '\0';
+    if (j && token[j-1] == ':')
+      target = false;
+    else if (j && !target) {
+      struct stat sb;
+      if (token[0] == '/' || !directory)
+        snprintf(path, sizeof(path), "%s", token);
+      else
+        snprintf(path, sizeof(path), "%s/%s", directory, token);
+      fresh = stat(path, &sb) == 0 && !mtime_newer(&sb.st_mtim, object_mtime);
+    }
+    j = 0;
+    if (ch == EOF)
+      break;
+  }
+  fclose(fp);
+  return fresh;
+}
+
+
+/*
+ * fresh when the object is as new as the source and the depfile written
+ * next to it (obj.d or obj.o.d) says no dependency changed since. no
+ * depfile, no way to know about headers, so not fresh
+ */
+bool AsmObject_fresh(const char *object, const struct timespec *source_mtime, const char *directory)
+{
+  struct stat sb;
+  if (stat(object, &sb) != 0 || mtime_newer(source_mtime, &sb.st_mtim))
+    return false;
+
+  char depfile[PATH_MAX];
+  snprintf(depfile, sizeof(depfile), "%s.d", object);
+  if (access(depfile, R_OK) != 0) {
+    const char *ext = strrchr(object, '.');
+    if (!ext || strchr(ext, '/'))
+      return false;
+    snprintf(depfile, sizeof(depfile), "%.*s.d", (int)(ext-object), object);
+  }
+  return deps_fresh(depfile, &sb.st_mtim, directory);
+}
+
+
+static int symbol_order(const void *a, const void *b)
+{
+  const struct obj_symbol *sa = (const struct obj_symbol*)a;
+  const struct obj_symbol *sb = (const struct obj_symbol*)b;
+  if (sa->shndx != sb->shndx)
+    return sa->shndx < sb->shndx ? -1 : 1;
+  if (sa->value != sb->value)
+    return sa->value < sb->value ? -1 : 1;
+  return strcmp(sa->name, sb->name);
+}
+
+
+/* defined functions of an x86-64 relocatable, names copied out of the map */
+static int read_symbols(struct obj_file *obj, const char *object)
+{
+  int fd = open(object, O_RDONLY);
+  if (fd == -1)
+    return ASM_OBJECT_FAIL;
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return ASM_OBJECT_FAIL;
+  }
+  const size_t size = sb.st_size;
+  const unsigned char *map = (const unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Error: [libc] mmap - %s\n", strerror(errno));
+    return ASM_OBJECT_FAIL;
+  }
+
+  int status = ASM_OBJECT_FAIL;
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr*)map;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+      eh->e_machine != EM_X86_64 || eh->e_type != ET_REL ||
+      eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > size || eh->e_shstrndx >= eh->e_shnum)
+  {
+    munmap((void*)map, size);
+    return ASM_OBJECT_FAIL;
+  }
+
+  const Elf64_Shdr *sh = (const Elf64_Shdr*)(map + eh->e_shoff);
+  const char *shstr = (const char*)map + sh[eh->e_shstrndx].sh_offset;
+  obj->sections = (struct obj_section*)malloc(sizeof(struct obj_section) * eh->e_shnum);
+  for (unsigned int i=0; i<eh->e_shnum; i++) {
+    if (sh[i].sh_type == SHT_PROGBITS && (sh[i].sh_flags & SHF_EXECINSTR)) {
+      obj->sections[obj->nsections].name  = strdup(shstr + sh[i].sh_name);
+      obj->sections[obj->nsections].shndx = i;
+      obj->nsections++;
+    }
+  }
+
+  for (unsigned int i=0; i<eh->e_shnum; i++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+        sh[i].sh_offset + sh[i].sh_size > size)
+      continue;
+
+    const Elf64_Sym *syms = (const Elf64_Sym*)(map + sh[i].sh_offset);
+    const size_t nsyms = sh[i].sh_size / sizeof(Elf64_Sym);
+    const char *strtab = (const char*)map + sh[sh[i].sh_link].sh_offset;
+    obj->funcs = (struct obj_symbol*)malloc(sizeof(struct obj_symbol) * (nsyms ? nsyms : 1));
+    for (size_t s=0; s<nsyms; s++) {
+      if (ELF64_ST_TYPE(syms[s].st_info) != STT_FUNC || syms[s].st_shndx == SHN_UNDEF ||
+          syms[s].st_shndx >= eh->e_shnum || !syms[s].st_size)
+        continue;
+      struct obj_symbol *func = &obj->funcs[obj->nfuncs++];
+      func->name  = strdup(strtab + syms[s].st_name);
+      func->shndx = syms[s].st_shndx;
+      func->value = syms[s].st_value;
+      func->size  = syms[s].st_size;
+    }
+    qsort(obj->funcs, obj->nfuncs, sizeof(struct obj_symbol), symbol_order);
+    status = ASM_OBJECT_OK;
+    break;
+  }
+
+  munmap((void*)map, size);
+  return status;
+}
+
+
+static void add_reloc(struct obj_file *obj, unsigned int section, const char *text)
+{
+  char *end;
+  const uint64_t addr = strtoull(text, &end, 16);
+  if (end[0] != ':')
+    return;
+  end++;
+  while (*end == ' ' || *end == '\t')
+    end++;
+  const char *type = end;
+  while (*end && *end != ' ' && *end != '\t')
+    end++;
+  const char *target = end;
+  while (*target == ' ' || *target == '\t')
+    target++;
+  size_t target_len = strlen(target);
+  while (target_len && (target[target_len-1] == '\n' || target[target_len-1] == ' '))
+    target_len--;
+
+  if (obj->nrelocs == obj->max_relocs) {
+    obj->max_relocs = obj->max_relocs ? obj->max_relocs*2 : 64;
+    obj->relocs = (struct obj_reloc*)realloc(obj->relocs, sizeof(struct obj_reloc) * obj->max_relocs);
+  }
+  struct obj_reloc *reloc = &obj->relocs[obj->nrelocs++];
+  reloc->section = section;
+  reloc->addr    = addr;
+  reloc->type    = strndup(type, end-type);
+  reloc->target  = strndup(target, target_len);
+}
+
+
+/* "\t<hex>: R_X86_64_..." either after an instruction (-w) or on its own line */
+static const char* find_reloc(const char *text)
+{
+  for (const char *p = strstr(text, "R_"); p; p = strstr(p+1, "R_")) {
+    const char *start = p;
+    while (start > text && start[-1] == ' ')
+      start--;
+    if (start == text || start[-1] != ':' || start == p)
+      continue;
+    start--;
+    const char *colon = start;
+    while (start > text && ((start[-1] >= '0' && start[-1] <= '9') || (start[-1] >= 'a' && start[-1] <= 'f')))
+      start--;
+    if (start < colon && (start == text || start[-1] == '\t' || start[-1] == ' '))
+      return start;
+  }
+  return NULL;
+}
+
+
+static int parse_objdump(struct obj_file *obj, FILE *pipe)
+{
+  const char *prefix = "Disassembly of section ";
+  const size_t prefix_len = strlen(prefix);
+  unsigned int section = obj->nsections;
+  unsigned int cursor = 0;
+
+  char *line = NULL;
+  size_t line_max = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_max, pipe)) != -1) {
+    if (strncmp(line, prefix, prefix_len) == 0) {
+      /* sections come in header order, names can repeat */
+      char *name = line + prefix_len;
+      name[strcspn(name, ":\n")] = '\0';
+      section = obj->nsections;
+      for (unsigned int i=cursor; i<obj->nsections; i++) {
+        if (strcmp(obj->sections[i].name, name) == 0) {
+          section = i;
+          cursor = i+1;
+          break;
+        }
+      }
+      continue;
+    }
+    if (section == obj->nsections)
+      continue;
+
+    const char *p = line;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    const char *reloc = find_reloc(p);
+    if (reloc == p) {
+      add_reloc(obj, section, p);
+      continue;
+    }
+
+    char *end;
+    const uint64_t addr = strtoull(p, &end, 16);
+    if (end == p || end[0] != ':' || (end[1] != '\t' && end[1] != ' '))
+      continue;
+    p = end+1;
+    while (*p == ' ' || *p == '\t')
+      p++;
+
+    size_t text_len = reloc ? (size_t)(reloc - p) : strlen(p);
+    for (const char *r = reloc; r; r = find_reloc(r+1))
+      add_reloc(obj, section, r);
+
+    /* objdump's "# <target>" note, the relocation says it better */
+    const char *comment = memmem(p, text_len, " # ", 3);
+    if (comment)
+      text_len = comment - p;
+    while (text_len && (p[text_len-1] == ' ' || p[text_len-1] == '\t' || p[text_len-1] == '\n'))
+      text_len--;
+    if (!text_len)
+      continue;
+
+    if (obj->ninsns == obj->max_insns) {
+      obj->max_insns = obj->max_insns ? obj->max_insns*2 : 1024;
+      obj->insns = (struct obj_insn*)realloc(obj->insns, sizeof(struct obj_insn) * obj->max_insns);
+    }
+    struct obj_insn *insn = &obj->insns[obj->ninsns++];
+    insn->section = section;
+    insn->addr    = addr;
+    insn->text    = strndup(p, text_len);
+  }
+  free(line);
+  return obj->ninsns ? ASM_OBJECT_OK : ASM_OBJECT_FAIL;
+}
+
+
+static void out_append(struct out_buffer *out, const char *text, size_t len)
+{
+  if (out->len + len + 1 > out->max) {
+    out->max = 2*(out->max + len + 1);
+    out->text = (char*)realloc(out->text, out->max);
+  }
+  memcpy(out->text + out->len, text, len);
+  out->len += len;
+  out->text[out->len] = '\0';
+}
+
+
+static void out_str(struct out_buffer *out, const char *text)
+{
+  out_append(out, text, strlen(text));
+}
+
+
+/* the function holding addr, sorted by section then address */
+static const struct obj_symbol* func_containing(const struct obj_file *obj, unsigned int shndx,
+                                                uint64_t addr)
+{
+  for (unsigned int i=0; i<obj->nfuncs; i++) {
+    const struct obj_symbol *func = &obj->funcs[i];
+    if (func->shndx == shndx && addr >= func->value && addr < func->value + func->size)
+      return func;
+  }
+  return NULL;
+}
+
+
+/*
+ * "ext-0x4" plus a pc relative correction, written the way gcc does, ext+8.
+ * calls and jumps to local functions are relocated against their section,
+ * ".text.unlikely+0x11", those are named through the function table
+ */
+static void write_target(struct out_buffer *out, const struct obj_file *obj,
+                         const char *target, int64_t correction)
+{
+  const char *sign = NULL;
+  for (const char *p = target+1; *p; p++) {
+    if ((*p == '+' || *p == '-') && p[1] == '0' && p[2] == 'x')
+      sign = p;
+  }
+  int64_t addend = 0;
+  if (sign) {
+    addend = (int64_t)strtoull(sign+3, NULL, 16);
+    addend = *sign == '-' ? -addend : addend;
+  }
+  addend += correction;
+
+  size_t name_len = sign ? (size_t)(sign-target) : strlen(target);
+  for (unsigned int i=0; i<obj->nsections && addend >= 0; i++) {
+    const struct obj_section *section = &obj->sections[i];
+    if (strlen(section->name) != name_len || memcmp(section->name, target, name_len) != 0)
+      continue;
+    const struct obj_symbol *func = func_containing(obj, section->shndx, addend);
+    if (func) {
+      target   = func->name;
+      name_len = strlen(func->name);
+      addend  -= func->value;
+    }
+    break;
+  }
+
+  char buffer[32];
+  out_append(out, target, name_len);
+  if (addend) {
+    snprintf(buffer, sizeof(buffer), "%+lld", (long long)addend);
+    out_str(out, buffer);
+  }
+}
+
+
+static bool is_branch(const char *mnemonic, size_t len)
+{
+  return (mnemonic[0] == 'j' && len > 1) ||
+         (len == 4 && memcmp(mnemonic, "call", 4) == 0) ||
+         (len >= 4 && memcmp(mnemonic, "loop", 4) == 0);
+}
+
+
+/* a direct branch operand, "38 <loop+0x28>", its address */
+static bool branch_target(const char *operands, uint64_t *addr)
+{
+  char *end;
+  *addr = strtoull(operands, &end, 16);
+  return end != operands && end[0] == ' ' && end[1] == '<';
+}
+
+
+static const struct obj_symbol* func_at(const struct obj_file *obj, unsigned int shndx, uint64_t addr)
+{
+  for (unsigned int i=0; i<obj->nfuncs; i++) {
+    if (obj->funcs[i].shndx == shndx && obj->funcs[i].value == addr)
+      return &obj->funcs[i];
+  }
+  return NULL;
+}
+
+
+static const struct obj_reloc* insn_reloc(const struct obj_file *obj, const struct obj_insn *insn,
+                                          uint64_t next_addr)
+{
+  for (unsigned int i=0; i<obj->nrelocs; i++) {
+    if (obj->relocs[i].section == insn->section &&
+        obj->relocs[i].addr >= insn->addr && obj->relocs[i].addr < next_addr)
+      return &obj->relocs[i];
+  }
+  return NULL;
+}
+
+
+static uint64_t next_insn_addr(const struct obj_file *obj, const struct obj_symbol *func, unsigned int i)
+{
+  return i+1 < obj->ninsns && obj->insns[i+1].section == obj->insns[i].section ?
+         obj->insns[i+1].addr : func->value + func->size;
+}
+
+
+/* ", " between operands as gcc writes them, commas inside [] included */
+static void write_operands(struct out_buffer *out, const char *operands, size_t len)
+{
+  size_t start = 0;
+  for (size_t i=0; i<len; i++) {
+    if (operands[i] != ',' || (i+1 < len && operands[i+1] == ' '))
+      continue;
+    out_append(out, operands+start, i+1-start);
+    out_str(out, " ");
+    start = i+1;
+  }
+  out_append(out, operands+start, len-start);
+}
+
+
+/* one instruction line, relocations put the symbols back into the operands */
+static void write_insn(struct out_buffer *out, const struct obj_file *obj,
+                       const struct obj_symbol *func, unsigned int func_id,
+                       const struct obj_insn *insn, uint64_t next_addr)
+{
+  static const char *const prefixes[] = { "lock", "rep", "repz", "repnz", "repe", "repne",
+                                          "notrack", "bnd", "cs", "ds", "data16", NULL };
+  const char *text = insn->text;
+  size_t mnemonic_len = strcspn(text, " \t");
+  for (unsigned int i=0; prefixes[i]; i++) {
+    if (mnemonic_len == strlen(prefixes[i]) && memcmp(text, prefixes[i], mnemonic_len) == 0 &&
+        text[mnemonic_len]) {
+      mnemonic_len += 1 + strcspn(text + mnemonic_len + 1, " \t");
+      break;
+    }
+  }
+  const char *operands = text + mnemonic_len;
+  while (*operands == ' ' || *operands == '\t')
+    operands++;
+  const size_t operands_len = strlen(operands);
+  const char *mnemonic = text;
+  const size_t base_len = strcspn(text, " \t");
+  const char *base = mnemonic_len > base_len ? text + base_len + 1 : text;
+
+  out_str(out, "\t");
+  out_append(out, mnemonic, mnemonic_len);
+  if (!operands_len) {
+    out_str(out, "\n");
+    return;
+  }
+  out_str(out, "\t");
+
+  const struct obj_reloc *reloc = insn_reloc(obj, insn, next_addr);
+  const bool branch = is_branch(base, mnemonic_len - (base - mnemonic));
+  uint64_t target;
+  if (branch && branch_target(operands, &target)) {
+    if (reloc) {
+      write_target(out, obj, reloc->target, (int64_t)(next_addr - reloc->addr));
+    }
+    else if (target >= func->value && target < func->value + func->size) {
+      char label[48];
+      snprintf(label, sizeof(label), ".L%u_%llx", func_id, (unsigned long long)target);
+      out_str(out, label);
+    }
+    else {
+      const struct obj_symbol *callee = func_at(obj, obj->sections[insn->section].shndx, target);
+      const char *open  = strchr(operands, '<');
+      const char *close = open ? strchr(open, '>') : NULL;
+      if (callee)
+        out_str(out, callee->name);
+      else if (close)
+        out_append(out, open+1, close-open-1);
+      else
+        out_append(out, operands, operands_len);
+    }
+    out_str(out, "\n");
+    return;
+  }
+
+  if (reloc) {
+    const bool pc_relative = strstr(reloc->type, "PC") || strstr(reloc->type, "PLT");
+    const bool got = strstr(reloc->type, "GOTPCREL") != NULL;
+    const char *rip = strstr(operands, "[rip");
+    const char *rip_end = rip ? strchr(rip, ']') : NULL;
+
+    /* sym[rip], gcc's form of a rip relative reference */
+    if (pc_relative && rip && rip_end) {
+      write_operands(out, operands, rip-operands);
+      write_target(out, obj, reloc->target, (int64_t)(next_addr - reloc->addr));
+      out_str(out, got ? "@GOTPCREL[rip]" : "[rip]");
+      write_operands(out, rip_end+1, strlen(rip_end+1));
+      out_str(out, "\n");
+      return;
+    }
+
+    /* absolute, the zero placeholder ("0x0", llvm's "0") is the symbol */
+    const char *zero = NULL;
+    size_t zero_len = 0;
+    for (const char *p = strchr(operands, '0'); p; p = strchr(p+1, '0')) {
+      const size_t len = p[1] == 'x' && p[2] == '0' ? 3 : 1;
+      if ((p == operands || !isalnum((unsigned char)p[-1])) && !isalnum((unsigned char)p[len])) {
+        zero = p;
+        zero_len = len;
+      }
+    }
+    if (!pc_relative && zero) {
+      write_operands(out, operands, zero-operands);
+      write_target(out, obj, reloc->target, 0);
+      write_operands(out, zero+zero_len, strlen(zero+zero_len));
+      out_str(out, "\n");
+      return;
+    }
+  }
+
+  write_operands(out, operands, operands_len);
+  out_str(out, "\n");
+}
+
+
+static int insn_order(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t*)a;
+  const uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/*
+ * aliases, symbols at the same address such as a D1/D2 destructor pair,
+ * follow func in the table and are written as .set the way gcc does
+ */
+static void write_function(struct out_buffer *out, const struct obj_file *obj,
+                           const struct obj_symbol *func, unsigned int naliases,
+                           unsigned int func_id)
+{
+  unsigned int first = obj->ninsns;
+  unsigned int last = 0;
+  for (unsigned int i=0; i<obj->ninsns; i++) {
+    const struct obj_insn *insn = &obj->insns[i];
+    if (obj->sections[insn->section].shndx != func->shndx ||
+        insn->addr < func->value || insn->addr >= func->value + func->size)
+      continue;
+    if (first == obj->ninsns)
+      first = i;
+    last = i+1;
+  }
+  if (first == obj->ninsns)
+    return;
+
+  /* local jump targets become .L labels */
+  uint64_t *targets = (uint64_t*)malloc(sizeof(uint64_t) * (last-first));
+  unsigned int ntargets = 0;
+  for (unsigned int i=first; i<last; i++) {
+    const char *text = obj->insns[i].text;
+    const size_t mnemonic_len = strcspn(text, " \t");
+    const char *operands = text + mnemonic_len;
+    while (*operands == ' ' || *operands == '\t')
+      operands++;
+    uint64_t target;
+    if (is_branch(text, mnemonic_len) && branch_target(operands, &target) &&
+        target >= func->value && target < func->value + func->size &&
+        !insn_reloc(obj, &obj->insns[i], next_insn_addr(obj, func, i)))
+      targets[ntargets++] = target;
+  }
+  qsort(targets, ntargets, sizeof(uint64_t), insn_order);
+
+  out_str(out, "\t.type\t");
+  out_str(out, func->name);
+  out_str(out, ", @function\n");
+  for (unsigned int i=1; i<=naliases; i++) {
+    out_str(out, "\t.set\t");
+    out_str(out, func[i].name);
+    out_str(out, ", ");
+    out_str(out, func->name);
+    out_str(out, "\n");
+  }
+  out_str(out, func->name);
+  out_str(out, ":\n");
+
+  unsigned int t = 0;
+  for (unsigned int i=first; i<last; i++) {
+    const struct obj_insn *insn = &obj->insns[i];
+    while (t < ntargets && targets[t] < insn->addr)
+      t++;
+    if (t < ntargets && targets[t] == insn->addr) {
+      char label[48];
+      snprintf(label, sizeof(label), ".L%u_%llx:\n", func_id, (unsigned long long)insn->addr);
+      out_str(out, label);
+      while (t < ntargets && targets[t] == insn->addr)
+        t++;
+    }
+    write_insn(out, obj, func, func_id, insn, next_insn_addr(obj, func, i));
+  }
+  free(targets);
+}
+
+
+/* what a tool's output added, symbols and sections stay from the ELF */
+static void obj_clear_text(struct obj_file *obj)
+{
+  for (unsigned int i=0; i<obj->ninsns; i++)
+    free(obj->insns[i].text);
+  for (unsigned int i=0; i<obj->nrelocs; i++) {
+    free(obj->relocs[i].type);
+    free(obj->relocs[i].target);
+  }
+  obj->ninsns  = 0;
+  obj->nrelocs = 0;
+}
+
+
+static void obj_free(struct obj_file *obj)
+{
+  for (unsigned int i=0; i<obj->nfuncs; i++)
+    free((char*)obj->funcs[i].name);
+  for (unsigned int i=0; i<obj->nsections; i++)
+    free((char*)obj->sections[i].name);
+  obj_clear_text(obj);
+  free(obj->funcs);
+  free(obj->sections);
+  free(obj->insns);
+  free(obj->relocs);
+}
+
+
+/* -S shaped text for the object's functions, NULL when it cannot be read */
+char* AsmObject_disassemble(const char *object, size_t *len)
+{
+  static const char *const tools[] = { "objdump", "llvm-objdump", NULL };
+
+  struct obj_file obj;
+  memset(&obj, 0, sizeof(struct obj_file));
+  if (read_symbols(&obj, object) != ASM_OBJECT_OK || !obj.nfuncs) {
+    obj_free(&obj);
+    return NULL;
+  }
+
+  int status = ASM_OBJECT_FAIL;
+  for (unsigned int i=0; tools[i] && status != ASM_OBJECT_OK; i++) {
+    const size_t max = strlen(object) + 64;
+    char *cmd = (char*)malloc(max);
+    snprintf(cmd, max, "%s" OBJDUMP_FLAGS "'%s' 2> /dev/null", tools[i], object);
+    FILE *pipe = popen(cmd, "r");
+    free(cmd);
+    if (!pipe) {
+      fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno));
+      continue;
+    }
+    /* a tool that failed part way leaves nothing for the next one */
+    obj_clear_text(&obj);
+    status = parse_objdump(&obj, pipe);
+    if (pclose(pipe) != 0)
+      status = ASM_OBJECT_FAIL;
+  }
+  if (status != ASM_OBJECT_OK) {
+    obj_free(&obj);
+    return NULL;
+  }
+
+  struct out_buffer out = { NULL, 0, 0 };
+  out_str(&out, "\t.text\n");
+  for (unsigned int i=0; i<obj.nfuncs; ) {
+    const struct obj_symbol *func = &obj.funcs[i];
+    unsigned int naliases = 0;
+    while (i+naliases+1 < obj.nfuncs && func[naliases+1].shndx == func->shndx &&
+           func[naliases+1].value == func->value)
+      naliases++;
+    write_function(&out, &obj, func, naliases, i);
+    i += naliases+1;
+  }
+
+  obj_free(&obj);
+  *len = out.len;
+  return out.text;
+}
@@ -0,0 +1,680 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include "asm_perf.h"
+#include "asm_funcs.h"
+#include "asm_demangle.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define PERF_LINE_MAX    16384
+#define PERF_NAME_MAX    16384
+
+static AsmPerfProfile *cached_profile = NULL;
+
+
+static inline uint64_t fnv_hash(const char *data, size_t len)
+{
+  uint64_t hash = FNV_OFFSET;
+  for (size_t i=0; i<len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static inline bool is_hex(const char *s, size_t len)
+{
+  if (!len)
+    return false;
+  for (size_t i=0; i<len; i++) {
+    const char ch = s[i];
+    if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f')))
+      return false;
+  }
+  return true;
+}
+
+
+static void profile_free(AsmPerfProfile *profile)
+{
+  for (unsigned int i=0; i<profile->nsyms; i++) {
+    free(profile->syms[i].name);
+    free(profile->syms[i].samples);
+  }
+  free(profile->syms);
+  free(profile->buckets);
+  free(profile->path);
+  free(profile);
+}
+
+
+static void rehash(AsmPerfProfile *profile)
+{
+  free(profile->buckets);
+  profile->nbuckets = profile->max_syms * 2;
+  profile->buckets = (int*)malloc(sizeof(int) * profile->nbuckets);
+  memset(profile->buckets, -1, sizeof(int) * profile->nbuckets);
+
+  for (unsigned int i=0; i<profile->nsyms; i++) {
+    uint64_t slot = fnv_hash(profile->syms[i].name, profile->syms[i].name_len) % profile->nbuckets;
+    while (profile->buckets[slot] != -1)
+      slot = (slot+1) % profile->nbuckets;
+    profile->buckets[slot] = i;
+  }
+}
+
+
+/* mangled names are demangled so both perf modes key the same way */
+static AsmPerfSymbol* profile_symbol(AsmPerfProfile *profile, const char *name, size_t len)
+{
+  if ((len > 2 && name[0] == '_' && (name[1] == 'Z' || name[1] == 'R'))) {
+    const char *demangled = AsmDemangle_symbol(name, len);
+    if (demangled) {
+      name = demangled;
+      len  = strlen(demangled);
+    }
+  }
+
+  uint64_t slot = fnv_hash(name, len) % profile->nbuckets;
+  while (profile->buckets[slot] != -1) {
+    AsmPerfSymbol *sym = &profile->syms[profile->buckets[slot]];
+    if (sym->name_len == len && memcmp(sym->name, name, len) == 0)
+      return sym;
+    slot = (slot+1) % profile->nbuckets;
+  }
+
+  if (profile->nsyms == profile->max_syms) {
+    profile->max_syms *= 2;
+    AsmPerfSymbol *new_syms = (AsmPerfSymbol*)realloc(profile->syms,
+                                                      sizeof(AsmPerfSymbol) * profile->max_syms);
+    if (!new_syms) {
+      fprintf(stderr, "Error: [libc] realloc\n");
+      return NULL;
+    }
+    profile->syms = new_syms;
+  }
+
+  AsmPerfSymbol *sym = &profile->syms[profile->nsyms++];
+  memset(sym, 0, sizeof(AsmPerfSymbol));
+  sym->name = (char*)malloc(len+1);
+  memcpy(sym->name, name, len);
+  sym->name[len] = '\0';
+  sym->name_len = len;
+
+  if (profile->nsyms * 2 > profile->nbuckets)
+    rehash(profile);
+  else
+    profile->buckets[slot] = profile->nsyms-1;
+  return sym;
+}
+
+
+static void add_sample(AsmPerfProfile *profile, AsmPerfSymbol *sym,
+                       uint64_t offset, int ordinal, double count)
+{
+  if (!sym || count <= 0)
+    return;
+
+  /* perf script repeats offsets, merge with the previous entry if equal */
+  if (sym->nsamples && sym->samples[sym->nsamples-1].offset == offset &&
+      sym->samples[sym->nsamples-1].ordinal == ordinal)
+  {
+    sym->samples[sym->nsamples-1].count += count;
+  }
+  else {
+    if (sym->nsamples == sym->max_samples) {
+      sym->max_samples = sym->max_samples ? sym->max_samples*2 : 16;
+      AsmPerfSample *new_samples = (AsmPerfSample*)realloc(sym->samples,
+                                                           sizeof(AsmPerfSample) * sym->max_samples);
+      if (!new_samples) {
+        fprintf(stderr, "Error: [libc] realloc\n");
+        return;
+      }
+      sym->samples = new_samples;
+    }
+    AsmPerfSample *sample = &sym->samples[sym->nsamples++];
+    sample->offset  = offset;
+    sample->ordinal = ordinal;
+    sample->count   = count;
+  }
+
+  sym->total     += count;
+  profile->total += count;
+}
+
+
+/*
+ * perf script, "comm pid time: period event: ip sym+0xoff (dso)" or
+ * just "ip sym+0xoff (dso)" for -F ip,sym and callchain frames. the ip
+ * is the hex token after the event name, or the first token
+ */
+static bool parse_script_line(const char *line, size_t len, const char **sym,
+                              size_t *sym_len, uint64_t *offset, bool *header)
+{
+  const char *dso = NULL;
+  for (size_t i=len; i>1; i--) {
+    if (line[i-2] == ' ' && line[i-1] == '(') {
+      dso = line+i-2;
+      break;
+    }
+  }
+  const size_t end = dso ? (size_t)(dso - line) : len;
+
+  const char *plus = NULL;
+  for (size_t i=end; i>=3; i--) {
+    if (memcmp(line+i-3, "+0x", 3) == 0) {
+      plus = line+i-3;
+      break;
+    }
+  }
+
+  /* locate the event name, samples without a symbol still mark a header */
+  const char *ip = NULL;
+  size_t ip_len = 0;
+  const char *first = NULL;
+  size_t first_len = 0;
+  bool prev_event = false;
+  *header = false;
+
+  size_t i = 0;
+  const size_t scan_end = plus ? (size_t)(plus - line) : end;
+  while (i < scan_end) {
+    while (i < scan_end && (line[i] == ' ' || line[i] == '\t'))
+      i++;
+    const size_t start = i;
+    while (i < scan_end && line[i] != ' ' && line[i] != '\t')
+      i++;
+    if (i == start)
+      break;
+
+    const char *tok = line+start;
+    const size_t tok_len = i-start;
+    if (!first) {
+      first = tok;
+      first_len = tok_len;
+    }
+
+    if (prev_event && is_hex(tok, tok_len)) {
+      ip = tok;
+      ip_len = tok_len;
+      break;
+    }
+
+    prev_event = false;
+    if (tok[tok_len-1] == ':') {
+      for (size_t k=0; k<tok_len; k++) {
+        if ((tok[k] >= 'a' && tok[k] <= 'z') || (tok[k] >= 'A' && tok[k] <= 'Z')) {
+          prev_event = true;
+          *header = true;
+        }
+      }
+    }
+  }
+
+  if (!plus)
+    return false;
+
+  if (!ip) {
+    if (!first || !is_hex(first, first_len))
+      return false;
+    ip = first;
+    ip_len = first_len;
+  }
+
+  const char *s = ip + ip_len;
+  while (s < plus && (*s == ' ' || *s == '\t'))
+    s++;
+  if (s >= plus)
+    return false;
+
+  *sym = s;
+  *sym_len = plus - s;
+  *offset = strtoull(plus+3, NULL, 16);
+  return true;
+}
+
+
+static bool is_nop(const char *mnemonic)
+{
+  return strncmp(mnemonic, "nop", 3) == 0 ||
+         strncmp(mnemonic, "xchg   %ax,%ax", 14) == 0 ||
+         strncmp(mnemonic, "data16", 6) == 0 ||
+         strncmp(mnemonic, "cs nop", 6) == 0;
+}
+
+
+struct annotate_state {
+  double samples;          // section sample count, percent -> samples
+  AsmPerfSymbol *sym;
+  uint64_t base;
+  int ordinal;
+};
+
+/*
+ * perf annotate --stdio. a "Percent |" header opens a section, the
+ * "<addr> <sym>:" line names it and "pct : addr: insn" lines follow.
+ * padding nops are not in the compiler output so they take no ordinal
+ */
+static void parse_annotate_line(AsmPerfProfile *profile, struct annotate_state *st,
+                                const char *line, size_t len)
+{
+  const char *bar = memmem(line, len, "Percent |", 9);
+  if (bar) {
+    const char *paren = memmem(line, len, " samples", 8);
+    st->samples = 100.0;
+    if (paren) {
+      const char *num = paren;
+      while (num > line && num[-1] >= '0' && num[-1] <= '9')
+        num--;
+      if (num < paren)
+        st->samples = strtod(num, NULL);
+    }
+    st->sym = NULL;
+    return;
+  }
+
+  const char *colon = memchr(line, ':', len);
+  if (!colon)
+    return;
+
+  const char *rest = colon+1;
+  const size_t rest_len = len - (rest - line);
+  while (rest < line+len && (*rest == ' ' || *rest == '\t'))
+    rest++;
+
+  /* "0000000000001139 <dot(float const*, float const*, int)>:" */
+  const char *lt = memchr(rest, '<', line+len - rest);
+  if (lt && lt > rest && is_hex(rest, lt-1 - rest) && line[len-1] == ':' && line[len-2] == '>') {
+    st->base    = strtoull(rest, NULL, 16);
+    st->sym     = profile_symbol(profile, lt+1, (line+len-2) - (lt+1));
+    st->ordinal = 0;
+    return;
+  }
+
+  if (!st->sym || rest_len == 0)
+    return;
+
+  /* percent column must be a number, source lines leave it blank */
+  char *end;
+  const double percent = strtod(line, &end);
+  if (end == line || end > colon)
+    return;
+
+  const char *addr = rest;
+  const char *addr_end = memchr(addr, ':', line+len - addr);
+  if (!addr_end || !is_hex(addr, addr_end - addr))
+    return;
+
+  const char *mnemonic = addr_end+1;
+  while (mnemonic < line+len && (*mnemonic == ' ' || *mnemonic == '\t'))
+    mnemonic++;
+  if (mnemonic >= line+len || is_nop(mnemonic))
+    return;
+
+  const uint64_t offset = strtoull(addr, NULL, 16) - st->base;
+  add_sample(profile, st->sym, offset, st->ordinal++, percent/100.0 * st->samples);
+}
+
+
+/* callchain position while reading perf script -g output */
+#define CHAIN_NONE 0
+#define CHAIN_LEAF 1
+#define CHAIN_DONE 2
+
+static AsmPerfProfile* profile_load(const char *path, struct stat *sb)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  AsmPerfProfile *profile = (AsmPerfProfile*)malloc(sizeof(AsmPerfProfile));
+  memset(profile, 0, sizeof(AsmPerfProfile));
+  profile->path     = strdup(path);
+  profile->mtime    = sb->st_mtime;
+  profile->size     = sb->st_size;
+  profile->max_syms = 256;
+  profile->syms     = (AsmPerfSymbol*)malloc(sizeof(AsmPerfSymbol) * profile->max_syms);
+  rehash(profile);
+
+  char *line = (char*)malloc(PERF_LINE_MAX);
+  struct annotate_state annotate = {0};
+  bool annotate_mode = false;
+  int chain = CHAIN_NONE;
+
+  while (fgets(line, PERF_LINE_MAX, fp)) {
+    size_t len = strlen(line);
+    while (len && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' '))
+      line[--len] = '\0';
+
+    if (!len) {
+      chain = CHAIN_NONE;
+      continue;
+    }
+
+    if (!annotate_mode && memmem(line, len, "Percent |", 9))
+      annotate_mode = true;
+
+    if (annotate_mode) {
+      parse_annotate_line(profile, &annotate, line, len);
+      continue;
+    }
+
+    const char *sym;
+    size_t sym_len;
+    uint64_t offset;
+    bool header;
+    const bool parsed = parse_script_line(line, len, &sym, &sym_len, &offset, &header);
+
+    /* with -g the header carries no symbol, only the leaf frame counts */
+    if (header) {
+      chain = parsed ? CHAIN_NONE : CHAIN_LEAF;
+      if (parsed)
+        add_sample(profile, profile_symbol(profile, sym, sym_len), offset, -1, 1.0);
+      continue;
+    }
+
+    if (!parsed || chain == CHAIN_DONE)
+      continue;
+
+    add_sample(profile, profile_symbol(profile, sym, sym_len), offset, -1, 1.0);
+    if (chain == CHAIN_LEAF)
+      chain = CHAIN_DONE;
+  }
+
+  free(line);
+  fclose(fp);
+  return profile;
+}
+
+
+/* reparsed only when the text file is replaced */
+AsmPerfProfile* AsmPerf_get(const char *path)
+{
+  struct stat sb;
+  if (stat(path, &sb) != 0) {
+    fprintf(stderr, "Error: [libc] stat - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  if (cached_profile &&
+      strcmp(cached_profile->path, path) == 0 &&
+      cached_profile->mtime == sb.st_mtime &&
+      cached_profile->size == sb.st_size)
+  {
+    return cached_profile;
+  }
+
+  AsmPerfProfile *profile = profile_load(path, &sb);
+  if (!profile)
+    return NULL;
+
+  if (cached_profile)
+    profile_free(cached_profile);
+  cached_profile = profile;
+  return profile;
+}
+
+
+void AsmPerf_clear(void)
+{
+  if (cached_profile)
+    profile_free(cached_profile);
+  cached_profile = NULL;
+}
+
+
+/* " [clone .isra.0]" and friends, gcc splits and clones keep the base */
+static size_t base_name_len(const char *name, size_t len)
+{
+  const char *clone = memmem(name, len, " [clone ", 8);
+  if (clone)
+    len = clone - name;
+  return len;
+}
+
+
+static AsmFunction* find_function(AsmFunctionIndex *index, AsmPerfSymbol *sym, bool *fuzzy)
+{
+  *fuzzy = false;
+  AsmFunction *func = AsmFunctionIndex_find(index, sym->name, sym->name_len);
+  if (func)
+    return func;
+
+  /* fuzzy, first without clone suffixes, then without parameter lists */
+  *fuzzy = true;
+  const size_t sym_base = base_name_len(sym->name, sym->name_len);
+  for (unsigned int i=0; i<index->nfuncs; i++) {
+    AsmFunction *f = &index->funcs[i];
+    if (base_name_len(f->name, f->name_len) == sym_base &&
+        memcmp(f->name, sym->name, sym_base) == 0)
+      return f;
+  }
+
+  const char *paren = memchr(sym->name, '(', sym_base);
+  const size_t sym_plain = paren ? (size_t)(paren - sym->name) : sym_base;
+  for (unsigned int i=0; i<index->nfuncs; i++) {
+    AsmFunction *f = &index->funcs[i];
+    const char *fparen = memchr(f->name, '(', f->name_len);
+    const size_t f_plain = fparen ? (size_t)(fparen - f->name) : base_name_len(f->name, f->name_len);
+    if (f_plain == sym_plain && memcmp(f->name, sym->name, sym_plain) == 0)
+      return f;
+  }
+  return NULL;
+}
+
+
+#define PERF_MAX_LOOPS 256
+
+/*
+ * .L labels that a later jump branches back to. those are loop heads,
+ * which gcc pads with ".p2align 4,,10; .p2align 3" and the filter drops
+ */
+static unsigned int loop_heads(const char *asm_buffer, size_t start, size_t end,
+                               uint64_t *heads)
+{
+  uint64_t seen[PERF_MAX_LOOPS];
+  unsigned int nseen = 0;
+  unsigned int nheads = 0;
+
+  size_t pos = start;
+  while (pos < end) {
+    const char *line = asm_buffer + pos;
+    const char *nl = memchr(line, '\n', end - pos);
+    const size_t line_len = nl ? (size_t)(nl - line) : end - pos;
+    pos += line_len + (nl ? 1 : 0);
+
+    if (line_len > 2 && line[0] == '.' && line[1] == 'L' && line[line_len-1] == ':') {
+      if (nseen < PERF_MAX_LOOPS)
+        seen[nseen++] = fnv_hash(line, line_len-1);
+      continue;
+    }
+
+    const char *target = memmem(line, line_len, "\t.L", 3);
+    if (!target || line_len < 2 || line[1] != 'j')
+      continue;
+
+    const uint64_t hash = fnv_hash(target+1, (line+line_len) - (target+1));
+    for (unsigned int i=0; i<nseen && nheads < PERF_MAX_LOOPS; i++) {
+      if (seen[i] == hash)
+        heads[nheads++] = hash;
+    }
+  }
+  return nheads;
+}
+
+
+static uint64_t align_loop(uint64_t offset)
+{
+  const uint64_t pad16 = (16 - (offset & 15)) & 15;
+  if (pad16 <= 10)
+    return offset + pad16;
+  return (offset + 7) & ~7ULL;
+}
+
+
+struct perf_line {
+  size_t line;             // line number in the asm buffer
+  uint64_t offset;         // estimated offset from the function start
+  double count;
+  int block;               // enclosing .L block, -1 before the first one
+};
+
+/*
+ * offsets from perf script are placed on estimated instruction sizes,
+ * so they can land an instruction or two off. the .L blocks the lines
+ * sit in are reported as well, which is the granularity that survives
+ * that error
+ */
+cJSON* AsmPerf_annotate(AsmPerfProfile *profile, const char *asm_buffer, size_t len)
+{
+  AsmFunctionIndex index;
+  if (AsmFunctionIndex_build(&index, asm_buffer, len) != ASM_FUNCS_OK)
+    return NULL;
+
+  /* line number of every function body start, functions are in order */
+  size_t *func_lines = (size_t*)malloc(sizeof(size_t) * (index.nfuncs ? index.nfuncs : 1));
+  size_t line_no = 0;
+  size_t pos = 0;
+  for (unsigned int i=0; i<index.nfuncs; i++) {
+    for (; pos < index.funcs[i].body_start; pos++)
+      line_no += asm_buffer[pos] == '\n';
+    func_lines[i] = line_no;
+  }
+
+  cJSON *msg = cJSON_CreateObject();
+  cJSON_AddStringToObject(msg, "profile", profile->path);
+  cJSON_AddNumberToObject(msg, "total_samples", profile->total);
+  cJSON *list = cJSON_AddArrayToObject(msg, "functions");
+  cJSON *unmatched = cJSON_AddArrayToObject(msg, "unmatched");
+
+  unsigned int max_lines = 256;
+  struct perf_line *lines = (struct perf_line*)malloc(sizeof(struct perf_line) * max_lines);
+
+  for (unsigned int s=0; s<profile->nsyms; s++) {
+    AsmPerfSymbol *sym = &profile->syms[s];
+    if (sym->total <= 0)
+      continue;
+
+    bool fuzzy;
+    AsmFunction *func = find_function(&index, sym, &fuzzy);
+    if (!func) {
+      cJSON_AddItemToArray(unmatched, cJSON_CreateString(sym->name));
+      continue;
+    }
+
+    /* instruction lines with their estimated offsets */
+    uint64_t heads[PERF_MAX_LOOPS];
+    const unsigned int nheads = loop_heads(asm_buffer, func->body_start, func->body_end, heads);
+    unsigned int nlines = 0;
+    int block = -1;
+    uint64_t offset = 0;
+    line_no = func_lines[func - index.funcs];
+    pos = func->body_start;
+
+    char name[PERF_NAME_MAX];
+    snprintf(name, sizeof(name), "%.*s", (int)func->name_len, func->name);
+
+    cJSON *node = cJSON_CreateObject();
+    cJSON_AddStringToObject(node, "name", name);
+    cJSON_AddStringToObject(node, "perf_symbol", sym->name);
+    cJSON_AddBoolToObject(node, "fuzzy", fuzzy);
+    cJSON_AddNumberToObject(node, "samples", sym->total);
+    cJSON_AddNumberToObject(node, "percent", profile->total ? 100.0 * sym->total / profile->total : 0);
+    cJSON *blocks = cJSON_AddArrayToObject(node, "blocks");
+
+    while (pos < func->body_end) {
+      const char *line = asm_buffer + pos;
+      const char *nl = memchr(line, '\n', func->body_end - pos);
+      const size_t line_len = nl ? (size_t)(nl - line) : func->body_end - pos;
+
+      if (line_len > 2 && line[0] == '.' && line[1] == 'L' && line[line_len-1] == ':') {
+        char label[256];
+        snprintf(label, sizeof(label), "%.*s", (int)(line_len-1), line);
+        cJSON *b = cJSON_CreateObject();
+        cJSON_AddStringToObject(b, "label", label);
+        cJSON_AddNumberToObject(b, "line", line_no);
+        cJSON_AddNumberToObject(b, "samples", 0);
+        cJSON_AddItemToArray(blocks, b);
+        block = cJSON_GetArraySize(blocks)-1;
+
+        const uint64_t hash = fnv_hash(line, line_len-1);
+        for (unsigned int i=0; i<nheads; i++) {
+          if (heads[i] == hash)
+            offset = align_loop(offset);
+        }
+      }
+      else if (line_len && (line[0] == ' ' || line[0] == '\t')) {
+        if (nlines == max_lines) {
+          max_lines *= 2;
+          struct perf_line *new_lines = (struct perf_line*)realloc(lines, sizeof(struct perf_line) * max_lines);
+          if (!new_lines) {
+            fprintf(stderr, "Error: [libc] realloc\n");
+            break;
+          }
+          lines = new_lines;
+        }
+        lines[nlines].line   = line_no;
+        lines[nlines].offset = offset;
+        lines[nlines].count  = 0;
+        lines[nlines].block  = block;
+        nlines++;
+        offset += AsmFuncs_estimate_size(line, line_len);
+      }
+
+      line_no++;
+      pos += line_len + (nl ? 1 : 0);
+    }
+
+    for (unsigned int i=0; i<sym->nsamples && nlines; i++) {
+      AsmPerfSample *sample = &sym->samples[i];
+      unsigned int idx;
+      if (sample->ordinal >= 0)
+        idx = (unsigned int)sample->ordinal < nlines ? (unsigned int)sample->ordinal : nlines-1;
+      else {
+        idx = 0;
+        while (idx+1 < nlines && lines[idx+1].offset <= sample->offset)
+          idx++;
+      }
+      lines[idx].count += sample->count;
+    }
+
+    cJSON *hot = cJSON_AddArrayToObject(node, "lines");
+    for (unsigned int i=0; i<nlines; i++) {
+      if (lines[i].count <= 0)
+        continue;
+      cJSON *l = cJSON_CreateObject();
+      cJSON_AddNumberToObject(l, "line", lines[i].line);
+      cJSON_AddNumberToObject(l, "samples", lines[i].count);
+      cJSON_AddNumberToObject(l, "percent", 100.0 * lines[i].count / sym->total);
+      cJSON_AddItemToArray(hot, l);
+
+      if (lines[i].block >= 0) {
+        cJSON *b = cJSON_GetObjectItemCaseSensitive(cJSON_GetArrayItem(blocks, lines[i].block), "samples");
+        cJSON_SetNumberValue(b, b->valuedouble + lines[i].count);
+      }
+    }
+
+    cJSON *b;
+    cJSON_ArrayForEach(b, blocks) {
+      const double count = cJSON_GetObjectItemCaseSensitive(b, "samples")->valuedouble;
+      cJSON_AddNumberToObject(b, "percent", 100.0 * count / sym->total);
+    }
+
+    cJSON_AddItemToArray(list, node);
+  }
+
+  free(lines);
+  free(func_lines);
+  AsmFunctionIndex_free(&index);
+  return msg;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asm_project.h"
+
+
+static bool search_file(const char *dirpath, const char *filename)
+{
+  DIR *dir = opendir(dirpath);
+  if (!dir) {
+    fprintf(stderr, "Error: [libc] opendir - %s\n", strerror(errno));
+    return true; // or handle error
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    // Skip "." and ".."
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    if (strcmp(entry->d_name, filename) == 0) {
+      closedir(dir);
+      return true;
+    }
+  }
+
+  closedir(dir);
+  return false; // Not found
+}
+
+
+/* project_path holds the directory on entry and the file path on success */
+bool AsmProject_find(char project_path[PATH_MAX], const char *project_file)
+{
+  strcat(project_path, "/");
+  if (search_file(project_path, project_file)) {
+    strcat(project_path, project_file);
+    return true;
+  }
+
+  strcat(project_path, "../");
+  if (search_file(project_path, project_file)) {
+    strcat(project_path, project_file);
+    return true;
+  }
+
+  return false;
+}
+
+
+cJSON* AsmProject_parse(const char *project_path, size_t *bytes)
+{
+  int fd = open(project_path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] open - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    fprintf(stderr, "Error: [libc] stat - %s\n", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  if ((sb.st_mode & S_IFMT) != S_IFREG) {
+    fprintf(stderr, "Error: project file is not a regular file\n");
+    close(fd);
+    return NULL;
+  }
+
+  const size_t json_mmap_size = sb.st_size;
+  if (bytes)
+    *bytes = json_mmap_size;
+  if (json_mmap_size == 0) {
+    fprintf(stderr, "Error: project file is empty\n");
+    close(fd);
+    return NULL;
+  }
+
+  // Map the file into memory
+  char *json_buffer = mmap(NULL, json_mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (json_buffer == MAP_FAILED) {
+    fprintf(stderr, "Error: [libc] mmap - %s\n", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  /* the mapping is not terminated, parse by length */
+  cJSON *parsed_json = cJSON_ParseWithLength(json_buffer, json_mmap_size);
+
+  munmap(json_buffer, json_mmap_size);
+  close(fd);
+
+  if (parsed_json == NULL) {
+    fprintf(stderr, "Error before: %s\n", cJSON_GetErrorPtr());
+    return NULL;
+  }
+  return parsed_json;
+}
@@ -11,13 +11,11 @@
 #include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
-#include <dirent.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
 
 #include <sys/types.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -25,15 +23,35 @@
 #include "cJSON.h"
 
 #include "asm_instance.h"
+#include "asm_mca.h"
+#include "asm_perf.h"
+#include "asm_metrics.h"
+#include "asm_trace.h"
+#include "asm_project.h"
+#include "asm_headers.h"
+#include "asm_filter.h"
 
 #define HT_SIZE 512
 #define PAGE_SIZE 4096
 #define ASM_WINDOW 4*PAGE_SIZE
+#define ASM_MAX_CLIENTS 64
 
 char project_dir[PATH_MAX] = {0}; // reuse for compile_commands.json path
 char socket_path[PATH_MAX] = {0}; 
+char cache_dir[PATH_MAX] = {0}; 
+char metrics_path[PATH_MAX] = {0}; 
+unsigned int metrics_interval = 0;  // seconds, 0 disables the metrics file
+bool trace_requests = false; 
+bool build_objects = false;  // fresh objects from the build stand in for compiles 
+FILE *record_fp = NULL;  // every request with its arrival time, for asm-replay 
+uint64_t record_start_ns = 0; 
+char trace_path[PATH_MAX] = {0}; 
+size_t compile_db_bytes = 0; 
 
 cJSON *compile_commands_json; 
+AsmHeaderIndex header_index; 
+bool header_index_built = false; 
+AsmCrate *crates = NULL;  // rust crate compiles, shared by every file of a crate 
 
 static volatile sig_atomic_t exit_flag = 0; 
 
@@ -63,102 +81,13 @@ static const char *get_tmp_dir(void) {
 }
 
 
-static bool search_file(const char *dirpath, const char *filename) 
-{
-  DIR *dir = opendir(dirpath);
-  if (!dir) {
-    fprintf(stderr, "Error: [libc] opendir - %s\n", strerror(errno)); 
-    return true; // or handle error
-  }
-
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    // Skip "." and ".."
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-      continue;
-
-    if (strcmp(entry->d_name, filename) == 0) {
-      closedir(dir);
-      return true; 
-    }
-  }
-
-  closedir(dir);
-  return false; // Not found
-}
-
-
-static bool find_project_file(const char *project_file) 
-{
-  strcat(project_dir, "/"); 
-  if (search_file(project_dir, project_file)) {
-    strcat(project_dir, project_file); 
-    return true; 
-  }
-
-  strcat(project_dir, "../"); 
-  if (search_file(project_dir, project_file)) {
-    strcat(project_dir, project_file); 
-    return true; 
-  }
-
-  return false; 
-}
-
-
-static cJSON* parse_project_commands() 
-{
-  int fd = open(project_dir, O_RDONLY);
-  if (fd == -1) {
-    fprintf(stderr, "Error: [libc] open - %s\n", strerror(errno)); 
-    return NULL;
-  }
-
-  struct stat sb;
-  if (fstat(fd, &sb) == -1) {
-    fprintf(stderr, "Error: [libc] stat - %s\n", strerror(errno)); 
-    close(fd);
-    return NULL;
-  }
-  
-  if ((sb.st_mode & S_IFMT) != S_IFREG) {
-    fprintf(stderr, "Error: project file is not a regular file\n"); 
-    return NULL; 
-  }
-
-  const size_t json_mmap_size = sb.st_size;
-  if (json_mmap_size == 0) {
-    fprintf(stderr, "Error: project file is empty\n");
-    close(fd);
-    return NULL;
-  }
-
-  // Map the file into memory
-  char *json_buffer = mmap(NULL, json_mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (json_buffer == MAP_FAILED) {
-    fprintf(stderr, "Error: [libc] mmap - %s\n", strerror(errno));
-    close(fd);
-    return NULL;  
-  }
-
-  /* parse the json using the C-JSON parser */
-  cJSON *parsed_json = cJSON_Parse(json_buffer);
-
-  if (parsed_json == NULL) {
-    fprintf(stderr, "Error before: %s\n", cJSON_GetErrorPtr());
-    return NULL; 
-  }
-
-  munmap(json_buffer, json_mmap_size); 
-  close(fd); 
-  return parsed_json; 
-}
-
-
 static void display_usage()
 {
   fprintf(stderr, "asm-server [project dir]\n"); 
-  fprintf(stderr, "asm-server [project dir]\n"); 
+  fprintf(stderr, "asm-server -m <seconds> [project dir]   write metrics every <seconds>\n"); 
+  fprintf(stderr, "asm-server -t [project dir]             write a chrome trace of every request\n"); 
+  fprintf(stderr, "asm-server -r <file> [project dir]      record requests for asm-replay\n"); 
+  fprintf(stderr, "asm-server -b [project dir]             disassemble the build's objects while fresh\n"); 
   exit(1); 
 }
 
@@ -169,6 +98,30 @@ static void process_cml(int argc, char *argv[])
   for (unsigned int i=1; i<argc; i++) {
     const char *ptr = argv[i]; 
     if (ptr[0] == '-' && ptr[1]) switch (ptr[1]) {
+      case 'm': 
+          if (++i >= argc) 
+            display_usage(); 
+          metrics_interval = strtoul(argv[i], NULL, 10); 
+          break; 
+
+      case 't': 
+          trace_requests = true; 
+          break; 
+
+      case 'b': 
+          build_objects = true; 
+          break; 
+
+      case 'r': 
+          if (++i >= argc) 
+            display_usage(); 
+          record_fp = fopen(argv[i], "w"); 
+          if (!record_fp) {
+            fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno)); 
+            display_usage(); 
+          }
+          break; 
+
       default: display_usage();  
     }
     else switch (j++) {
@@ -223,6 +176,66 @@ static uint16_t string_hash(const char *str)
 }
 
 
+static AsmInstance* find_asm_instance(struct hash_entry *hash_table[], const char *path) 
+{
+  struct hash_entry *slot = hash_table[string_hash(path)]; 
+  for (; slot; slot = slot->next) {
+    if (strcmp(path, AsmInstance_get_filename(slot->inst)) == 0) 
+      return slot->inst; 
+  }
+  return NULL; 
+}
+
+
+/* an includer that is already compiled has a warm tu cache */
+static bool tu_is_cached(const char *tu_file, void *ctx) 
+{
+  char path[PATH_MAX]; 
+  if (!realpath(tu_file, path)) 
+    return false; 
+  AsmInstance *inst = find_asm_instance((struct hash_entry**)ctx, path); 
+  return inst && AsmInstance_get_asm(inst); 
+}
+
+
+/* the compile db entry a header is built through, the index is made on first use */
+static cJSON* header_compile_node(struct hash_entry *hash_table[], const char *header) 
+{
+  if (!header_index_built) {
+    if (AsmHeaders_init(&header_index, compile_commands_json) != ASM_HEADERS_OK) 
+      return NULL; 
+    header_index_built = true; 
+  }
+
+  const uint64_t trace_ns = AsmTrace_begin(); 
+  cJSON *node = AsmHeaders_find_tu(&header_index, header, tu_is_cached, hash_table); 
+  AsmTrace_end_arg("header_lookup", trace_ns, header); 
+  return node; 
+}
+
+
+/* the crate of a rust instance, made on the first file opened from it */
+static AsmCrate* crate_for(AsmInstance *inst) 
+{
+  cJSON *node = inst->compile_node; 
+  const char *root = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file")); 
+  const char *dir  = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "directory")); 
+  if (!root || !dir) 
+    return NULL; 
+
+  AsmCrate *crate = AsmCrate_find(crates, root); 
+  if (crate) 
+    return crate; 
+
+  crate = AsmCrate_alloc(root, dir, AsmInstance_get_cmd(inst), cache_dir); 
+  if (crate) {
+    crate->next = crates; 
+    crates = crate; 
+  }
+  return crate; 
+}
+
+
 static AsmInstance* get_asm_instance(struct hash_entry *hash_table[], 
                                      size_t ht_size, 
                                      char *key, 
@@ -232,14 +245,10 @@ static AsmInstance* get_asm_instance(struct hash_entry *hash_table[],
   if (!realpath(key, expand_key)) 
     return NULL; 
 
-  uint16_t hash_idx = string_hash(key);    
-  struct hash_entry *slot = hash_table[hash_idx]; 
-  
-  while (slot) {
-    if (strcmp(expand_key, AsmInstance_get_filename(slot->inst)) == 0) 
-      return slot->inst; 
-    slot = slot->next;
-  }
+  uint16_t hash_idx = string_hash(expand_key);    
+  AsmInstance *found = find_asm_instance(hash_table, expand_key); 
+  if (found) 
+    return found; 
 
   AsmInstance *inst = AsmInstance_alloc(key); 
 
@@ -248,22 +257,51 @@ static AsmInstance* get_asm_instance(struct hash_entry *hash_table[],
     return NULL; 
   }
   
-  if (file_type == FILE_TYPE_C && 
+  const bool header = file_type == FILE_TYPE_C && AsmHeaders_is_header(inst->infile); 
+  if (header) {
+    cJSON *node = header_compile_node(hash_table, inst->infile); 
+    if (!node || AsmInstance_parse_command_header(inst, node) != ASM_INST_OK) {
+      fprintf(stderr, "[asm viewer] error - no translation unit in compile_commands.json includes %s\n", inst->infile); 
+      AsmInstance_free(inst); 
+      return NULL; 
+    }
+    fprintf(stderr, "[asm viewer] %s compiled through %s\n", inst->infile, inst->source_file); 
+  }
+  else if (file_type == FILE_TYPE_C && 
       AsmInstance_parse_command_C(inst, compile_commands_json) != ASM_INST_OK) 
   {
     fprintf(stderr, "[asm viewer] error - file %s not found in parsed compile_commands.json\n", inst->infile); 
-    free(inst); 
+    AsmInstance_free(inst); 
     return NULL; 
   }
   else if (file_type == FILE_TYPE_RUST && 
            AsmInstance_parse_command_RUST(inst, compile_commands_json) != ASM_INST_OK) 
   {
     fprintf(stderr, "[asm viewer] error - file %s not found in parsed compile_commands.json\n", inst->infile); 
-    free(inst); 
+    AsmInstance_free(inst); 
     return NULL; 
   }
 
-  slot = hash_table[hash_idx]; 
+  if (file_type == FILE_TYPE_RUST) {
+    AsmCrate *crate = crate_for(inst); 
+    if (crate && AsmInstance_set_crate(inst, crate) == ASM_INST_OK && inst->source_file) 
+      fprintf(stderr, "[asm viewer] %s compiled through %s\n", inst->infile, inst->source_file); 
+  }
+
+  /* without -b every unit compiles with the server's flags */
+  if (!build_objects) {
+    free(inst->object_file); 
+    inst->object_file = NULL; 
+  }
+
+  /* header parsing is cached between compiles where possible */
+  if (file_type == FILE_TYPE_C && !header && 
+      AsmInstance_enable_tu_cache(inst, cache_dir) != ASM_INST_OK) 
+  {
+    fprintf(stderr, "[asm viewer] warning - tu cache disabled for %s\n", inst->infile); 
+  }
+
+  struct hash_entry *slot = hash_table[hash_idx]; 
   if (!slot)
     slot = hash_table[hash_idx] = hash_entry_alloc(); 
   else {
@@ -278,7 +316,6 @@ static AsmInstance* get_asm_instance(struct hash_entry *hash_table[],
 }
 
 
-/* for now not needed, as server quits on stop */
 static void free_hash_table(struct hash_entry *hash_table[], size_t ht_size)
 {
   for (unsigned int i = 0; i < HT_SIZE; i++) {
@@ -287,51 +324,152 @@ static void free_hash_table(struct hash_entry *hash_table[], size_t ht_size)
     while (slot) {
       prev = slot; 
       slot = slot->next; 
+      AsmInstance_free(prev->inst); 
       free(prev); 
     }
+    hash_table[i] = NULL; 
   }
 }
 
 
-/* move to a nonblocking model using poll */
-int process_client_requests(int client_fd) 
-{
-  struct hash_entry *hash_table[HT_SIZE] = {NULL}; 
+/* instances live for the whole session so their caches survive requests */
+static struct hash_entry *hash_table[HT_SIZE] = {NULL}; 
 
-  const size_t bufmax = 16384;
-  char buffer[bufmax]; 
-  size_t bytes = read(client_fd, buffer, bufmax); 
-  
-  if (bytes == -1) {
-    // no data ready, just return to poll loop
-    if (errno == EAGAIN || errno == EWOULDBLOCK) 
-      return ASM_INST_OK;
-    else {
-      fprintf(stderr, "Error: [libc] read - %s\n", strerror(errno)); 
+
+/* 
+ * variants come in as [{"name": "O3", "compiler": "clang", "flags": "-O3"}], 
+ * compiler and flags are both optional 
+ */
+static int register_variants(AsmInstance *inst, cJSON *js_variants) 
+{
+  cJSON *node; 
+  cJSON_ArrayForEach(node, js_variants) {
+    char *name     = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "name")); 
+    char *compiler = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "compiler")); 
+    char *flags    = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "flags")); 
+    if (!name || AsmInstance_add_variant(inst, name, compiler, flags) != ASM_INST_OK) {
+      fprintf(stderr, "[asm viewer] error - invalid variant for %s\n", inst->infile); 
       return ASM_INST_FAIL; 
     }
   }
+  return ASM_INST_OK; 
+}
 
-  if (bytes == 0) {
-    fprintf(stderr, "[asm viewer] client disconneted\n");  
-    return ASM_INST_OK;
+
+/* 
+ * "source_only": true keeps just the functions defined in the requested 
+ * file, "keep": ["/abs/include/", "/abs/util.h"] adds project paths to it, 
+ * directories end in '/'. sticky per instance, like variants. a header 
+ * instance is always filtered down to itself 
+ */
+static int apply_source_filter(AsmInstance *inst, cJSON *js_request) 
+{
+  /* "library": true in the filter set is the same thing */
+  cJSON *js_source = cJSON_GetObjectItemCaseSensitive(js_request, "source_only"); 
+  if (!js_source) 
+    js_source = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(js_request, "filters"), 
+                                                 "library"); 
+  if (!cJSON_IsBool(js_source) || inst->ft == FILE_TYPE_RUST) 
+    return ASM_INST_OK; 
+
+  char keep[ASM_MAX_KEEP_PATHS][PATH_MAX]; 
+  const char *paths[ASM_MAX_KEEP_PATHS+1]; 
+  unsigned int npaths = 0; 
+
+  const bool header = inst->source_file != NULL; 
+  if (cJSON_IsTrue(js_source) || header) 
+    paths[npaths++] = AsmInstance_get_filename(inst); 
+
+  cJSON *node; 
+  cJSON *js_keep = cJSON_IsTrue(js_source) ? 
+                   cJSON_GetObjectItemCaseSensitive(js_request, "keep") : NULL; 
+  cJSON_ArrayForEach(node, js_keep) {
+    char *path = cJSON_GetStringValue(node); 
+    if (!path || npaths > ASM_MAX_KEEP_PATHS) 
+      continue; 
+
+    char *out = keep[npaths-1]; 
+    if (!realpath(path, out)) {
+      fprintf(stderr, "[asm viewer] warning - keep path %s - %s\n", path, strerror(errno)); 
+      continue; 
+    }
+
+    /* realpath drops the slash that marks a directory prefix */
+    const size_t len = strlen(path); 
+    const size_t out_len = strlen(out); 
+    if (len && path[len-1] == '/' && out_len+1 < PATH_MAX) 
+      strcpy(out+out_len, "/"); 
+    paths[npaths++] = out; 
   }
 
-  buffer[bytes] = '\0'; 
+  return AsmInstance_keep_sources(inst, paths, npaths); 
+}
 
-  // the buffer now comes in as a JSON, one level for easy parsing.
-  cJSON *js_request = cJSON_Parse(buffer);
-  if (js_request == NULL) {
-    fprintf(stderr, "Error: [cJSON] cJSON_Parse - %s\n", cJSON_GetErrorPtr());
-    return ASM_INST_FAIL; 
+
+/* 
+ * "filters": {"labels": true, "data": true, "library": true}, stages of 
+ * the filter pipeline on top of the default one. sticky per instance 
+ */
+static void apply_filter_options(AsmInstance *inst, cJSON *js_request) 
+{
+  cJSON *js_filters = cJSON_GetObjectItemCaseSensitive(js_request, "filters"); 
+  if (!cJSON_IsObject(js_filters)) 
+    return; 
+
+  unsigned int options = 0; 
+  if (cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(js_filters, "labels"))) 
+    options |= ASM_FILTER_UNUSED_LABELS; 
+  if (cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(js_filters, "data"))) 
+    options |= ASM_FILTER_DATA; 
+  AsmInstance_set_filter_options(inst, options); 
+}
+
+
+/* metrics plus what only the server can see, instances and the compile db */
+static cJSON* server_metrics(void) 
+{
+  cJSON *msg = AsmMetrics_json(); 
+
+  size_t ninstances = 0; 
+  size_t instance_bytes = 0; 
+  for (unsigned int i = 0; i < HT_SIZE; i++) {
+    for (struct hash_entry *slot = hash_table[i]; slot; slot = slot->next) {
+      ninstances++; 
+      instance_bytes += AsmInstance_memory(slot->inst); 
+    }
   }
 
+  for (AsmCrate *crate = crates; crate; crate = crate->next) 
+    instance_bytes += AsmCrate_memory(crate); 
+
+  cJSON *instances = cJSON_AddObjectToObject(msg, "instances"); 
+  cJSON_AddNumberToObject(instances, "count", ninstances); 
+  cJSON_AddNumberToObject(instances, "bytes", instance_bytes); 
+
+  cJSON *compile_db = cJSON_AddObjectToObject(msg, "compile_db"); 
+  cJSON_AddNumberToObject(compile_db, "entries", cJSON_GetArraySize(compile_commands_json)); 
+  cJSON_AddNumberToObject(compile_db, "bytes", compile_db_bytes); 
+  return msg; 
+}
+
+
+static int dispatch_request(cJSON *js_request, int client_fd) 
+{
   cJSON *js_filepath = cJSON_GetObjectItemCaseSensitive(js_request, "filepath");
   cJSON *js_command  = cJSON_GetObjectItemCaseSensitive(js_request, "command");
 
+  /* no filepath, server wide metrics */
+  if (!js_filepath && cJSON_IsString(js_command) && 
+      strcmp(js_command->valuestring, "stats") == 0) 
+  {
+    cJSON *msg = server_metrics(); 
+    int ret = AsmInstance_send_json(client_fd, msg); 
+    cJSON_Delete(msg); 
+    return ret; 
+  }
+
   if (!js_filepath || !js_command) {
     fprintf(stderr, "Error: [cJSON] cJSON_GetObjectItemCaseSensitive - %s\n", cJSON_GetErrorPtr());
-    cJSON_free(js_request); 
     return ASM_INST_FAIL; 
   }
 
@@ -339,10 +477,8 @@ int process_client_requests(int client_fd)
   char *command   = cJSON_GetStringValue(js_command); 
   if (!file_name || !command) {
     fprintf(stderr, "Error: [cJSON] cJSON_GetStringValue - %s\n", cJSON_GetErrorPtr());
-    cJSON_free(js_request); 
     return ASM_INST_FAIL; 
   }
-  cJSON_free(js_request); 
   
   char file_type = 0; // 0 - C, 1 - rust;
   char *ext = strrchr(file_name, '.');
@@ -353,7 +489,9 @@ int process_client_requests(int client_fd)
   if (strcmp(ext, "c")   == 0 ||
       strcmp(ext, "cpp") == 0 ||
       strcmp(ext, "h")   == 0 ||
-      strcmp(ext, "hpp") == 0)
+      strcmp(ext, "hpp") == 0 ||
+      strcmp(ext, "hh")  == 0 ||
+      strcmp(ext, "hxx") == 0)
   {
     file_type = FILE_TYPE_C;
   }
@@ -363,22 +501,202 @@ int process_client_requests(int client_fd)
   else 
     return ASM_INST_FAIL; 
 
+  const uint64_t trace_ns = AsmTrace_begin(); 
   AsmInstance *inst = get_asm_instance(hash_table, HT_SIZE, file_name, file_type);  
+  AsmTrace_end_arg("lookup", trace_ns, file_name); 
   if (!inst) {
     fprintf(stderr, "[asm viewer] error - failed to create asm instance\n");  
     return ASM_INST_FAIL; 
   }
-  
 
-  if (strcmp(command, "assembly")==0)
-    return AsmInstance_assembly_message(inst, client_fd); 
+  apply_filter_options(inst, js_request); 
+  if (apply_source_filter(inst, js_request) != ASM_INST_OK) 
+    return ASM_INST_FAIL; 
+
+  /* sticky like the filters, highlight spans ride along with the asm */
+  cJSON *js_highlight = cJSON_GetObjectItemCaseSensitive(js_request, "highlight"); 
+  if (cJSON_IsBool(js_highlight)) 
+    inst->highlight = cJSON_IsTrue(js_highlight); 
+
+  /* optional, "all" for every variant side by side */
+  char *variant = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "variant")); 
+
+  if (strcmp(command, "assembly")==0) {
+    if (variant && strcmp(variant, "all") == 0) 
+      return AsmInstance_variants_message(inst, client_fd); 
+
+    /* "start_line" and "count", or "function" and "context", page the output */
+    cJSON *js_start    = cJSON_GetObjectItemCaseSensitive(js_request, "start_line"); 
+    cJSON *js_function = cJSON_GetObjectItemCaseSensitive(js_request, "function"); 
+    if (cJSON_IsNumber(js_start) || cJSON_IsString(js_function)) {
+      cJSON *js_count   = cJSON_GetObjectItemCaseSensitive(js_request, "count"); 
+      cJSON *js_context = cJSON_GetObjectItemCaseSensitive(js_request, "context"); 
+      const int start   = cJSON_IsNumber(js_start) ? js_start->valueint : 0; 
+      const int count   = cJSON_IsNumber(js_count) ? js_count->valueint : ASM_RANGE_MAX_LINES; 
+      const int context = cJSON_IsNumber(js_context) ? js_context->valueint : ASM_RANGE_CONTEXT; 
+      return AsmInstance_range_message(inst, variant, start > 0 ? start : 0, count > 0 ? count : 0, 
+                                       cJSON_GetStringValue(js_function), 
+                                       context > 0 ? context : 0, client_fd); 
+    }
+    return AsmInstance_variant_message(inst, variant, client_fd); 
+  }
   else if (strcmp(command, "functions")==0) 
     return AsmInstance_function_message(inst, client_fd); 
+  else if (strcmp(command, "diff")==0) 
+    return AsmInstance_diff_message(inst, client_fd); 
+  else if (strcmp(command, "stats")==0) 
+    return AsmInstance_stats_message(inst, variant, client_fd); 
+  else if (strcmp(command, "analyze")==0) {
+    char *function = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "function")); 
+    if (!function) 
+      return ASM_INST_FAIL; 
+    return AsmInstance_analyze_message(inst, variant, function, 
+                                       cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "start_label")), 
+                                       cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "end_label")), 
+                                       cache_dir, client_fd); 
+  }
+  else if (strcmp(command, "profile")==0) {
+    char *perf_file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "perf")); 
+    if (!perf_file) 
+      return ASM_INST_FAIL; 
+    return AsmInstance_profile_message(inst, variant, perf_file, client_fd); 
+  }
+  else if (strcmp(command, "variants")==0) {
+    cJSON *js_variants = cJSON_GetObjectItemCaseSensitive(js_request, "variants"); 
+    if (cJSON_IsArray(js_variants) && register_variants(inst, js_variants) != ASM_INST_OK) 
+      return ASM_INST_FAIL; 
+    return AsmInstance_variants_message(inst, client_fd); 
+  }
   else 
     return ASM_INST_FAIL; 
 }
 
 
+/* 
+ * one json line per request, the raw text is kept so replay sends 
+ * exactly what the editor did, malformed requests included 
+ */
+static void record_request(const char *buffer, uint64_t ready_ns) 
+{
+  cJSON *line = cJSON_CreateObject(); 
+  cJSON_AddNumberToObject(line, "t_ms", (ready_ns - record_start_ns) / 1e6); 
+  cJSON_AddStringToObject(line, "request", buffer); 
+
+  char *json = cJSON_PrintUnformatted(line); 
+  if (json) {
+    fprintf(record_fp, "%s\n", json); 
+    fflush(record_fp); 
+    cJSON_free(json); 
+  }
+  cJSON_Delete(line); 
+}
+
+
+/* move to a nonblocking model using poll */
+int process_client_requests(int client_fd, uint64_t ready_ns) 
+{
+
+  const size_t bufmax = 16384;
+  char buffer[bufmax]; 
+  uint64_t trace_ns = AsmTrace_begin(); 
+  size_t bytes = read(client_fd, buffer, bufmax); 
+  
+  if (bytes == -1) {
+    // no data ready, just return to poll loop
+    if (errno == EAGAIN || errno == EWOULDBLOCK) 
+      return ASM_INST_OK;
+    else {
+      fprintf(stderr, "Error: [libc] read - %s\n", strerror(errno)); 
+      return ASM_INST_FAIL; 
+    }
+  }
+
+  if (bytes == 0) {
+    fprintf(stderr, "[asm viewer] client disconneted\n");  
+    return ASM_INST_OK;
+  }
+
+  buffer[bytes] = '\0'; 
+  AsmMetrics_count(ASM_COUNT_BYTES_IN, bytes); 
+  AsmTrace_end("receive", trace_ns); 
+
+  if (record_fp) 
+    record_request(buffer, ready_ns); 
+
+  // the buffer now comes in as a JSON, one level for easy parsing.
+  trace_ns = AsmTrace_begin(); 
+  cJSON *js_request = cJSON_Parse(buffer);
+  AsmTrace_end("parse", trace_ns); 
+  if (js_request == NULL) {
+    fprintf(stderr, "Error: [cJSON] cJSON_Parse - %s\n", cJSON_GetErrorPtr());
+    return ASM_INST_FAIL; 
+  }
+
+  const uint64_t dispatch_ns = AsmMetrics_now(); 
+  AsmMetrics_record(ASM_PHASE_QUEUE, dispatch_ns - ready_ns); 
+  AsmMetrics_count(ASM_COUNT_REQUESTS, 1); 
+
+  trace_ns = AsmTrace_begin(); 
+  int ret = dispatch_request(js_request, client_fd); 
+  AsmTrace_end_arg("request", trace_ns, 
+                   cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_request, "command"))); 
+  cJSON_Delete(js_request); 
+
+  AsmMetrics_since(ASM_PHASE_REQUEST, dispatch_ns); 
+  if (ret != ASM_INST_OK) 
+    AsmMetrics_count(ASM_COUNT_ERRORS, 1); 
+  return ret; 
+}
+
+
+/* 
+ * when each client was first seen readable, its queue wait runs from 
+ * there to dispatch. a zero timeout probe after every request stamps the 
+ * clients that became readable while it was served 
+ */
+static void stamp_ready(struct pollfd fds[], unsigned int nclients, uint64_t ready_since[]) 
+{
+  struct pollfd probe[ASM_MAX_CLIENTS]; 
+  for (unsigned int i=1; i<=nclients; i++) {
+    probe[i-1].fd = fds[i].fd; 
+    probe[i-1].events = POLLIN; 
+    probe[i-1].revents = 0; 
+  }
+  if (poll(probe, nclients, 0) <= 0) 
+    return; 
+
+  const uint64_t now_ns = AsmMetrics_now(); 
+  for (unsigned int i=1; i<=nclients; i++) {
+    if ((probe[i-1].revents & POLLIN) && !ready_since[i]) 
+      ready_since[i] = now_ns; 
+  }
+}
+
+
+static void accept_client(int server_fd, struct pollfd fds[], unsigned int *nclients) 
+{
+  int fd = accept(server_fd, NULL, NULL); 
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] accept - %s\n", strerror(errno)); 
+    return; 
+  }
+
+  if (*nclients == ASM_MAX_CLIENTS) {
+    fprintf(stderr, "[asm viewer] client limit reached, connection refused\n"); 
+    close(fd); 
+    return; 
+  }
+
+  int flags = fcntl(fd, F_GETFL, 0); 
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK); 
+
+  (*nclients)++; 
+  fds[*nclients].fd = fd; 
+  fds[*nclients].events = POLLIN; 
+  fds[*nclients].revents = 0; 
+}
+
+
 int main(int argc, char *argv[])
 {
   setlinebuf(stdout);
@@ -392,7 +710,7 @@ int main(int argc, char *argv[])
   sigaction(SIGTERM, &sa, NULL);
   signal(SIGPIPE, SIG_IGN);
 
-  if (find_project_file("compile_commands.json")) {
+  if (AsmProject_find(project_dir, ASM_PROJECT_FILE)) {
     fprintf(stderr, "[asm viewer] compile_commands.json found\n"); 
   }
   else {
@@ -401,7 +719,7 @@ int main(int argc, char *argv[])
     return 1;
   }
   
-  compile_commands_json = parse_project_commands(); 
+  compile_commands_json = AsmProject_parse(project_dir, &compile_db_bytes); 
   if (!compile_commands_json) {
     fprintf(stderr, "Error: failed to parse compile_commands.json\n"); 
     return 1; 
@@ -410,7 +728,18 @@ int main(int argc, char *argv[])
   pid_t pid = getpid(); 
   const char *tmp_dir = get_tmp_dir(); 
 
+  snprintf(cache_dir, sizeof(cache_dir), "%s/vimasm_cache_%u", tmp_dir, getuid()); 
+
   snprintf(socket_path, sizeof(socket_path), "%s/vimasm_%u.sock", tmp_dir, pid); 
+  snprintf(metrics_path, sizeof(metrics_path), "%s/vimasm_%u.metrics.json", tmp_dir, pid); 
+  AsmMetrics_init(); 
+  record_start_ns = AsmMetrics_now(); 
+  
+  if (trace_requests) {
+    snprintf(trace_path, sizeof(trace_path), "%s/vimasm_%u.trace.json", tmp_dir, pid); 
+    if (AsmTrace_open(trace_path) == ASM_TRACE_OK) 
+      fprintf(stderr, "[asm viewer] tracing requests to %s\n", trace_path); 
+  }
   
   fprintf(stderr, "[asm viewer] tmp directory for socket %s\n", tmp_dir); 
   fprintf(stderr, "[asm viewer] creating socket vimasm_%u.sock\n", pid); 
@@ -439,7 +768,7 @@ int main(int argc, char *argv[])
     return 1; 
   }
 
-  if (listen(server_fd, 1) != 0) {
+  if (listen(server_fd, ASM_MAX_CLIENTS) != 0) {
     fprintf(stderr, "Error: [libc] listen - %s\n", strerror(errno)); 
     unlink(socket_path); 
     return 1; 
@@ -468,34 +797,97 @@ int main(int argc, char *argv[])
 
   fprintf(stderr, "[asm viewer] client connected\n"); 
 
-  struct pollfd fds[1]; 
-  fds[0].fd = client_fd; 
+  /* 
+   * the editor is the first client, more may attach (load tests, a second 
+   * editor). the listening socket sits in slot 0, the server exits once 
+   * every client is gone 
+   */
+  struct pollfd fds[ASM_MAX_CLIENTS+1]; 
+  uint64_t ready_since[ASM_MAX_CLIENTS+1] = {0}; 
+  unsigned int nclients = 1; 
+  fds[0].fd = server_fd; 
   fds[0].events = POLLIN; 
+  fds[1].fd = client_fd; 
+  fds[1].events = POLLIN; 
   
   fprintf(stderr, "[asm viewer] polling client...\n"); 
 
+  uint64_t metrics_ns = AsmMetrics_now(); 
   while (!exit_flag) {
-    int ret = poll(fds, 1, 500); 
+    int ret = poll(fds, nclients+1, 500); 
     if (ret == -1) {
       fprintf(stderr, "Error: [libc] poll - %s\n", strerror(errno)); 
       break; 
     }
 
+    const uint64_t ready_ns = AsmMetrics_now(); 
+    if (metrics_interval && ready_ns - metrics_ns >= metrics_interval * 1000000000ULL) {
+      cJSON *metrics = server_metrics(); 
+      AsmMetrics_write_file(metrics, metrics_path); 
+      cJSON_Delete(metrics); 
+      metrics_ns = ready_ns; 
+    }
+
+    /* trace events are formatted while idle, or before the rings fill */
+    if (ret == 0 || AsmTrace_pending() > ASM_TRACE_RING/2) 
+      AsmTrace_flush(); 
+
     if (ret == 0) continue;
 
-    if (fds[0].revents & POLLIN) 
-      process_client_requests(client_fd); 
+    if (fds[0].revents & POLLIN) {
+      const unsigned int accepted = nclients; 
+      accept_client(server_fd, fds, &nclients); 
+      for (unsigned int i=accepted+1; i<=nclients; i++) 
+        ready_since[i] = 0; 
+    }
+
+    for (unsigned int i=1; i<=nclients; i++) {
+      if ((fds[i].revents & POLLIN) && !ready_since[i]) 
+        ready_since[i] = ready_ns; 
+    }
 
-    // Client closed connection or error
-    if (fds[0].revents & (POLLHUP | POLLERR)) 
-      break;
+    /* one request per ready client each pass, nobody starves */
+    for (unsigned int i=1; i<=nclients; i++) {
+      if (fds[i].revents & POLLIN) {
+        process_client_requests(fds[i].fd, ready_since[i]); 
+        ready_since[i] = 0; 
+        stamp_ready(fds, nclients, ready_since); 
+      }
+
+      // Client closed connection or error
+      if (fds[i].revents & (POLLHUP | POLLERR)) {
+        close(fds[i].fd); 
+        ready_since[i] = ready_since[nclients]; 
+        fds[i] = fds[nclients--]; 
+        i--; 
+      }
+    }
+
+    if (!nclients) 
+      break; 
   }
   
-  close(client_fd); 
+  for (unsigned int i=1; i<=nclients; i++) 
+    close(fds[i].fd); 
   close(server_fd); 
 
   unlink(socket_path); 
-
+  if (metrics_interval) 
+    unlink(metrics_path); 
+
+  AsmTrace_close(); 
+  if (record_fp) 
+    fclose(record_fp); 
+  free_hash_table(hash_table, HT_SIZE); 
+  if (header_index_built) 
+    AsmHeaders_free(&header_index); 
+  while (crates) {
+    AsmCrate *next = crates->next; 
+    AsmCrate_free(crates); 
+    crates = next; 
+  }
+  AsmMca_clear(); 
+  AsmPerf_clear(); 
   cJSON_free(compile_commands_json); 
   return 0; 
 }
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "asm_trace.h"
+
+/* one writer (the owning thread), one reader (whoever flushes) */
+struct trace_ring {
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  _Atomic uint64_t dropped;
+  int tid;
+  AsmTraceEvent events[ASM_TRACE_RING];
+};
+
+bool asm_trace_enabled = false;
+
+static struct trace_ring *rings[ASM_TRACE_MAX_THREADS];
+static _Atomic unsigned int nrings = 0;
+static _Thread_local struct trace_ring *local_ring = NULL;
+
+static FILE *trace_fp = NULL;
+static bool first_event = true;
+static int pid = 0;
+
+
+uint64_t AsmTrace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* first event on a thread claims a ring, threads past the limit are not traced */
+static struct trace_ring* thread_ring(void)
+{
+  if (local_ring)
+    return local_ring;
+
+  const unsigned int slot = atomic_fetch_add(&nrings, 1);
+  if (slot >= ASM_TRACE_MAX_THREADS)
+    return NULL;
+
+  struct trace_ring *ring = (struct trace_ring*)calloc(1, sizeof(struct trace_ring));
+  if (!ring) {
+    fprintf(stderr, "Error: [libc] calloc\n");
+    return NULL;
+  }
+  ring->tid = (int)syscall(SYS_gettid);
+  rings[slot] = ring;
+  local_ring = ring;
+  return ring;
+}
+
+
+void AsmTrace_span(const char *name, uint64_t start_ns, uint64_t end_ns,
+                   uint32_t id, const char *arg)
+{
+  struct trace_ring *ring = thread_ring();
+  if (!ring)
+    return;
+
+  const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= ASM_TRACE_RING) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  AsmTraceEvent *ev = &ring->events[head & (ASM_TRACE_RING-1)];
+  ev->name   = name;
+  ev->ts_ns  = start_ns;
+  ev->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+  ev->id     = id;
+  if (arg)
+    snprintf(ev->arg, sizeof(ev->arg), "%s", arg);
+  else
+    ev->arg[0] = '\0';
+
+  atomic_store_explicit(&ring->head, head+1, memory_order_release);
+}
+
+
+unsigned AsmTrace_pending(void)
+{
+  unsigned pending = 0;
+  unsigned int n = atomic_load(&nrings);
+  if (n > ASM_TRACE_MAX_THREADS)
+    n = ASM_TRACE_MAX_THREADS;
+
+  for (unsigned int i=0; i<n; i++) {
+    struct trace_ring *ring = rings[i];
+    if (ring)
+      pending += atomic_load(&ring->head) - atomic_load(&ring->tail);
+  }
+  return pending;
+}
+
+
+static void write_arg(const char *arg)
+{
+  fputs(",\"args\":{\"detail\":\"", trace_fp);
+  for (const char *p = arg; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      fputc('\\', trace_fp);
+    if ((unsigned char)*p < 0x20)
+      continue;
+    fputc(*p, trace_fp);
+  }
+  fputs("\"}", trace_fp);
+}
+
+
+static void write_event(const char *name, char ph, double ts_us, int tid,
+                        uint32_t id, double dur_us, const char *arg)
+{
+  fprintf(trace_fp, "%s{\"name\":\"%s\",\"cat\":\"asm\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+          first_event ? "" : ",\n", name, ph, ts_us, pid, tid);
+  first_event = false;
+
+  if (ph == 'X')
+    fprintf(trace_fp, ",\"dur\":%.3f", dur_us);
+  else
+    fprintf(trace_fp, ",\"id\":%u", id);
+
+  if (arg && arg[0])
+    write_arg(arg);
+  fputc('}', trace_fp);
+}
+
+
+void AsmTrace_flush(void)
+{
+  if (!trace_fp)
+    return;
+
+  unsigned int n = atomic_load(&nrings);
+  if (n > ASM_TRACE_MAX_THREADS)
+    n = ASM_TRACE_MAX_THREADS;
+
+  for (unsigned int i=0; i<n; i++) {
+    struct trace_ring *ring = rings[i];
+    if (!ring)
+      continue;
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; tail++) {
+      AsmTraceEvent *ev = &ring->events[tail & (ASM_TRACE_RING-1)];
+      const double ts_us = ev->ts_ns / 1000.0;
+      const double dur_us = ev->dur_ns / 1000.0;
+
+      /* overlapping spans (concurrent compiles) go on async tracks */
+      if (ev->id) {
+        write_event(ev->name, 'b', ts_us, ring->tid, ev->id, 0, ev->arg);
+        write_event(ev->name, 'e', ts_us + dur_us, ring->tid, ev->id, 0, NULL);
+      }
+      else
+        write_event(ev->name, 'X', ts_us, ring->tid, 0, dur_us, ev->arg);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  fflush(trace_fp);
+}
+
+
+/* json array format, the closing bracket is optional so a crash still leaves a usable file */
+int AsmTrace_open(const char *path)
+{
+  trace_fp = fopen(path, "w");
+  if (!trace_fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    return ASM_TRACE_FAIL;
+  }
+
+  pid = getpid();
+  first_event = true;
+  fputs("[\n", trace_fp);
+  fprintf(trace_fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"asm-server\"}}", pid);
+  first_event = false;
+  asm_trace_enabled = true;
+  return ASM_TRACE_OK;
+}
+
+
+void AsmTrace_close(void)
+{
+  if (!trace_fp)
+    return;
+
+  asm_trace_enabled = false;
+  AsmTrace_flush();
+
+  uint64_t dropped = 0;
+  unsigned int n = atomic_load(&nrings);
+  if (n > ASM_TRACE_MAX_THREADS)
+    n = ASM_TRACE_MAX_THREADS;
+  for (unsigned int i=0; i<n; i++) {
+    if (rings[i]) {
+      dropped += atomic_load(&rings[i]->dropped);
+      free(rings[i]);
+      rings[i] = NULL;
+    }
+  }
+  atomic_store(&nrings, 0);
+  local_ring = NULL;
+
+  if (dropped)
+    fprintf(stderr, "[asm viewer] trace ring full, %lu events dropped\n", (unsigned long)dropped);
+
+  fputs("\n]\n", trace_fp);
+  fclose(trace_fp);
+  trace_fp = NULL;
+}
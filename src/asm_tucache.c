@@ -0,0 +1,530 @@
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "asm_tucache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define PCH_UNGUARDED 3   // exit status of the pch build when the guard check fails
+
+
+uint64_t AsmTUCache_hash(uint64_t seed, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  uint64_t hash = seed ? seed : FNV_OFFSET;
+  for (size_t i=0; i<len; i++) {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static char* read_file(const char *path, size_t *len)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  char *buffer = (char*)malloc(sb.st_size + 1);
+  size_t total = 0;
+  while (total < (size_t)sb.st_size) {
+    ssize_t bytes = read(fd, buffer+total, sb.st_size-total);
+    if (bytes <= 0)
+      break;
+    total += bytes;
+  }
+  buffer[total] = '\0';
+
+  close(fd);
+  *len = total;
+  return buffer;
+}
+
+
+static bool hash_file(const char *path, AsmDepFile *dep)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    return false;
+  }
+
+  char buffer[16384];
+  ssize_t bytes;
+  uint64_t hash = FNV_OFFSET;
+  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+    hash = AsmTUCache_hash(hash, buffer, bytes);
+
+  close(fd);
+  dep->hash  = hash;
+  dep->mtime = sb.st_mtime;
+  dep->size  = sb.st_size;
+  return true;
+}
+
+
+static void deplist_clear(AsmDepList *list)
+{
+  for (unsigned int i=0; i<list->nfiles; i++)
+    free(list->files[i].path);
+  free(list->files);
+  list->files  = NULL;
+  list->nfiles = 0;
+}
+
+
+/*
+ * make style depfile, "target: dep dep \
+ *   dep ...". escaped spaces are part of the path
+ */
+static int deplist_parse(AsmDepList *list, const char *depfile,
+                         const char *skip_dir)
+{
+  size_t len;
+  char *text = read_file(depfile, &len);
+  if (!text)
+    return TU_CACHE_FAIL;
+
+  deplist_clear(list);
+  unsigned int max_files = 64;
+  list->files = (AsmDepFile*)malloc(sizeof(AsmDepFile) * max_files);
+
+  const size_t skip_len = strlen(skip_dir);
+  char path[PATH_MAX];
+  size_t plen = 0;
+  bool target = true;
+
+  for (size_t i=0; i<=len; i++) {
+    char ch = text[i];
+    if (ch == '\\' && i+1 < len) {
+      if (text[i+1] == '\n') {
+        i++;
+        ch = ' ';
+      }
+      else if (text[i+1] == ' ' || text[i+1] == '#') {
+        ch = text[++i];
+        if (plen < PATH_MAX-1)
+          path[plen++] = ch;
+        continue;
+      }
+    }
+
+    if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\0') {
+      if (!plen)
+        continue;
+      path[plen] = '\0';
+      plen = 0;
+
+      if (target) {
+        if (path[strlen(path)-1] == ':')
+          target = false;
+        continue;
+      }
+
+      /* our own artifacts are keyed separately */
+      if (strncmp(path, skip_dir, skip_len) == 0)
+        continue;
+
+      if (list->nfiles == max_files) {
+        max_files *= 2;
+        AsmDepFile *new_files = (AsmDepFile*)realloc(list->files,
+                                                     sizeof(AsmDepFile) * max_files);
+        if (!new_files) {
+          fprintf(stderr, "Error: [libc] realloc\n");
+          free(text);
+          return TU_CACHE_FAIL;
+        }
+        list->files = new_files;
+      }
+
+      AsmDepFile *dep = &list->files[list->nfiles];
+      if (!hash_file(path, dep))
+        continue;
+      dep->path = strdup(path);
+      list->nfiles++;
+    }
+    else if (plen < PATH_MAX-1)
+      path[plen++] = ch;
+  }
+
+  free(text);
+  return TU_CACHE_OK;
+}
+
+
+/* re-hash only what stat says has moved */
+static bool deplist_fresh(AsmDepList *list)
+{
+  bool fresh = true;
+  for (unsigned int i=0; i<list->nfiles; i++) {
+    AsmDepFile *dep = &list->files[i];
+    struct stat sb;
+    if (stat(dep->path, &sb) != 0)
+      return false;
+
+    if (sb.st_mtime == dep->mtime && sb.st_size == dep->size)
+      continue;
+
+    uint64_t old_hash = dep->hash;
+    if (!hash_file(dep->path, dep) || dep->hash != old_hash)
+      fresh = false;
+  }
+  return fresh;
+}
+
+
+/*
+ * the leading block of #include lines, blank lines and comments. anything
+ * else (defines, conditionals, code) ends the prefix so the pch never sees
+ * state that the rest of the file could depend on
+ */
+static size_t include_prefix_len(const char *src, size_t len)
+{
+  size_t prefix_end = 0;
+  bool in_comment = false;
+  size_t i = 0;
+
+  while (i < len) {
+    size_t line_end = i;
+    while (line_end < len && src[line_end] != '\n')
+      line_end++;
+
+    size_t j = i;
+    bool code = false;
+    while (j < line_end) {
+      if (in_comment) {
+        if (src[j] == '*' && j+1 < line_end && src[j+1] == '/') {
+          in_comment = false;
+          j += 2;
+        }
+        else
+          j++;
+        continue;
+      }
+
+      if (src[j] == ' ' || src[j] == '\t' || src[j] == '\r') {
+        j++;
+        continue;
+      }
+
+      if (src[j] == '/' && j+1 < line_end && src[j+1] == '/')
+        break;
+      if (src[j] == '/' && j+1 < line_end && src[j+1] == '*') {
+        in_comment = true;
+        j += 2;
+        continue;
+      }
+
+      if (src[j] == '#') {
+        size_t k = j+1;
+        while (k < line_end && (src[k] == ' ' || src[k] == '\t'))
+          k++;
+        if (line_end - k > 7 && memcmp(src+k, "include", 7) == 0) {
+          prefix_end = line_end < len ? line_end+1 : line_end;
+          break;
+        }
+      }
+
+      code = true;
+      break;
+    }
+
+    if (code)
+      break;
+    i = line_end+1;
+  }
+
+  return prefix_end;
+}
+
+
+AsmTUCache* AsmTUCache_alloc(const char *cache_root, const char *infile,
+                             const char *pch_command, bool is_cpp)
+{
+  if (mkdir(cache_root, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  AsmTUCache *cache = (AsmTUCache*)malloc(sizeof(AsmTUCache));
+  memset(cache, 0, sizeof(AsmTUCache));
+
+  /* servers of the same user share the root, not the artifacts */
+  uint64_t key = AsmTUCache_hash(0, infile, strlen(infile));
+  const int dir_len = snprintf(cache->dir, sizeof(cache->dir), "%s/tu_%016llx_%d",
+                               cache_root, (unsigned long long)key, (int)getpid());
+
+  /* the artifacts are named under dir, all of them have to fit */
+  if (dir_len < 0 || (size_t)dir_len + sizeof("/prefix.hpp.gch") > sizeof(cache->dir)) {
+    fprintf(stderr, "Error: tu cache directory %s - path too long\n", cache_root);
+    free(cache);
+    return NULL;
+  }
+
+  if (mkdir(cache->dir, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: [libc] mkdir - %s\n", strerror(errno));
+    free(cache);
+    return NULL;
+  }
+
+  if (snprintf(cache->prefix_header, sizeof(cache->prefix_header), "%s/prefix.%s",
+               cache->dir, is_cpp ? "hpp" : "h") < 0 ||
+      snprintf(cache->tu_depfile, sizeof(cache->tu_depfile), "%s/tu.d", cache->dir) < 0)
+  {
+    rmdir(cache->dir);
+    free(cache);
+    return NULL;
+  }
+
+  const char *slash = strrchr(infile, '/');
+  snprintf(cache->source_dir, sizeof(cache->source_dir), "%.*s",
+           slash ? (int)(slash - infile) : 1, slash ? infile : ".");
+  if (!cache->source_dir[0])
+    strcpy(cache->source_dir, "/");
+
+  /* clang looks for <header>.pch, gcc for <header>.gch */
+  const char *space = strchr(pch_command, ' ');
+  size_t compiler_len = space ? (size_t)(space - pch_command) : strlen(pch_command);
+  for (size_t i=0; i+5 <= compiler_len; i++) {
+    if (memcmp(pch_command+i, "clang", 5) == 0)
+      cache->is_clang = true;
+  }
+
+  cache->pch_command = strdup(pch_command);
+  cache->is_cpp = is_cpp;
+  return cache;
+}
+
+
+/* names under dir, AsmTUCache_alloc checked that they fit */
+static void pch_path(AsmTUCache *cache, char *pch_file, size_t max)
+{
+  if (snprintf(pch_file, max, "%s.%s", cache->prefix_header, cache->is_clang ? "pch" : "gch") < 0)
+    pch_file[0] = '\0';
+}
+
+
+static void prefix_depfile(AsmTUCache *cache, char *depfile, size_t max)
+{
+  if (snprintf(depfile, max, "%s/prefix.d", cache->dir) < 0)
+    depfile[0] = '\0';
+}
+
+
+/* the build runs in its own process group, the compiler goes with the shell */
+static void pch_cancel(AsmTUCache *cache)
+{
+  if (!cache->pch_pid)
+    return;
+  kill(-cache->pch_pid, SIGKILL);
+  waitpid(cache->pch_pid, NULL, 0);
+  cache->pch_pid = 0;
+}
+
+
+/*
+ * false while the background build runs. once it exits the pch is valid,
+ * or its prefix is keyed as failed and not retried
+ */
+static bool pch_reap(AsmTUCache *cache)
+{
+  if (!cache->pch_pid)
+    return true;
+
+  int status;
+  const pid_t pid = waitpid(cache->pch_pid, &status, WNOHANG);
+  if (pid == 0)
+    return false;
+  cache->pch_pid = 0;
+
+  char path[PATH_MAX];
+  if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    if (pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == PCH_UNGUARDED)
+      fprintf(stderr, "[asm viewer] warning - include prefix is not guarded, compiling without a pch\n");
+    else
+      fprintf(stderr, "[asm viewer] warning - precompiled header failed, compiling without it\n");
+    pch_path(cache, path, sizeof(path));
+    unlink(path);
+    cache->pch_failed_key = cache->pch_build_key;
+    return true;
+  }
+
+  prefix_depfile(cache, path, sizeof(path));
+  if (deplist_parse(&cache->prefix_deps, path, cache->dir) != TU_CACHE_OK)
+    return true;
+
+  cache->prefix_key = cache->pch_build_key;
+  cache->pch_valid = true;
+  return true;
+}
+
+
+void AsmTUCache_free(AsmTUCache *cache)
+{
+  pch_cancel(cache);
+
+  char path[PATH_MAX];
+  pch_path(cache, path, sizeof(path));
+  unlink(path);
+  prefix_depfile(cache, path, sizeof(path));
+  unlink(path);
+  unlink(cache->prefix_header);
+  unlink(cache->tu_depfile);
+  rmdir(cache->dir);
+
+  deplist_clear(&cache->prefix_deps);
+  deplist_clear(&cache->tu_deps);
+  free(cache->pch_command);
+  free(cache);
+}
+
+
+bool AsmTUCache_deps_fresh(AsmTUCache *cache)
+{
+  if (!cache->tu_deps.nfiles)
+    return false;
+  return deplist_fresh(&cache->tu_deps);
+}
+
+
+uint64_t AsmTUCache_tu_key(AsmTUCache *cache, const char *infile)
+{
+  AsmDepFile src;
+  if (!hash_file(infile, &src))
+    return 0;
+
+  uint64_t key = src.hash;
+  for (unsigned int i=0; i<cache->tu_deps.nfiles; i++)
+    key = AsmTUCache_hash(key, &cache->tu_deps.files[i].hash, sizeof(uint64_t));
+  return key;
+}
+
+
+int AsmTUCache_prepare_pch(AsmTUCache *cache, const char *infile)
+{
+  size_t src_len;
+  char *src = read_file(infile, &src_len);
+  if (!src)
+    return TU_CACHE_FAIL;
+
+  const size_t prefix_len = include_prefix_len(src, src_len);
+  if (!prefix_len) {
+    cache->pch_valid = false;
+    free(src);
+    return TU_CACHE_FAIL;
+  }
+
+  uint64_t key = AsmTUCache_hash(0, cache->pch_command, strlen(cache->pch_command));
+  key = AsmTUCache_hash(key, src, prefix_len);
+
+  /* still building, or building a prefix that has since been edited */
+  if (!pch_reap(cache)) {
+    if (key == cache->pch_build_key) {
+      free(src);
+      return TU_CACHE_FAIL;
+    }
+    pch_cancel(cache);
+  }
+
+  /* a prefix that failed once fails again, wait for it or the flags to change */
+  if (key == cache->pch_failed_key) {
+    cache->pch_valid = false;
+    free(src);
+    return TU_CACHE_FAIL;
+  }
+
+  char pch_file[PATH_MAX];
+  pch_path(cache, pch_file, sizeof(pch_file));
+
+  if (cache->pch_valid &&
+      key == cache->prefix_key &&
+      deplist_fresh(&cache->prefix_deps) &&
+      access(pch_file, R_OK) == 0)
+  {
+    free(src);
+    return TU_CACHE_OK;
+  }
+
+  cache->pch_valid = false;
+
+  FILE *fp = fopen(cache->prefix_header, "w");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    free(src);
+    return TU_CACHE_FAIL;
+  }
+  fwrite(src, 1, prefix_len, fp);
+  fclose(fp);
+  free(src);
+
+  char depfile[PATH_MAX];
+  prefix_depfile(cache, depfile, sizeof(depfile));
+
+  /*
+   * the unit sees the prefix twice, once through -include and again in
+   * its own #include lines. headers without guards break on that, so the
+   * prefix is compiled after itself once before the pch is trusted
+   */
+  const size_t cmd_max = 2*strlen(cache->pch_command) + 8*PATH_MAX;
+  char *cmd = (char*)malloc(cmd_max);
+  const int cmd_len = snprintf(cmd, cmd_max,
+           "%s -iquote %s -x %s %s -o %s -MD -MF %s -MT pch 2> /dev/null || exit 1; "
+           "%s -iquote %s -fsyntax-only -include %s -x %s %s 2> /dev/null || exit %d",
+           cache->pch_command, cache->source_dir,
+           cache->is_cpp ? "c++-header" : "c-header",
+           cache->prefix_header, pch_file, depfile,
+           cache->pch_command, cache->source_dir, cache->prefix_header,
+           cache->is_cpp ? "c++" : "c", cache->prefix_header, PCH_UNGUARDED);
+  if (cmd_len < 0 || (size_t)cmd_len >= cmd_max) {
+    free(cmd);
+    return TU_CACHE_FAIL;
+  }
+
+  /* built off the poll loop, the compile that asked goes without it */
+  const pid_t pid = fork();
+  if (pid == 0) {
+    setpgid(0, 0);
+    execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    _exit(127);
+  }
+  free(cmd);
+  if (pid > 0)
+    setpgid(pid, pid);
+  if (pid == -1) {
+    fprintf(stderr, "Error: [libc] fork - %s\n", strerror(errno));
+    return TU_CACHE_FAIL;
+  }
+
+  cache->pch_pid = pid;
+  cache->pch_build_key = key;
+  return TU_CACHE_FAIL;
+}
+
+
+int AsmTUCache_update_deps(AsmTUCache *cache)
+{
+  if (deplist_parse(&cache->tu_deps, cache->tu_depfile, cache->dir) != TU_CACHE_OK)
+    return TU_CACHE_FAIL;
+  return TU_CACHE_OK;
+}
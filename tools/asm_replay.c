@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include <string.h>
+
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cJSON.h"
+
+/*
+ * replays a request log written by asm-server -r against a server, either
+ * one already running (socket path) or a fresh one started after "--".
+ * requests keep their recorded spacing (scaled by -s) or go back to back
+ * with -f. the server has a single client, so a request waits for the
+ * previous response, latency is send to last byte of the response
+ */
+
+struct replay_request {
+  double t_ms;
+  char *text;
+  char command[32];
+  double latency_ms;
+  bool ok;
+};
+
+static void display_usage() {
+  fprintf(stderr, "usage:\n"
+                  "  asm-replay [-f] [-s speed] [-t timeout ms] <recording> <socket>\n"
+                  "  asm-replay [-f] [-s speed] [-t timeout ms] <recording> -- asm-server [args]\n"
+      );
+  exit(1);
+}
+
+
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+static struct replay_request* load_recording(const char *path, unsigned int *count)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    return NULL;
+  }
+
+  unsigned int n = 0;
+  unsigned int max = 64;
+  struct replay_request *reqs = (struct replay_request*)calloc(max, sizeof(struct replay_request));
+
+  char *line = NULL;
+  size_t line_max = 0;
+  while (getline(&line, &line_max, fp) != -1) {
+    cJSON *js = cJSON_Parse(line);
+    char *text = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js, "request"));
+    cJSON *js_t = cJSON_GetObjectItemCaseSensitive(js, "t_ms");
+    if (!text || !cJSON_IsNumber(js_t)) {
+      cJSON_Delete(js);
+      continue;
+    }
+
+    if (n == max) {
+      max *= 2;
+      reqs = (struct replay_request*)realloc(reqs, max * sizeof(struct replay_request));
+    }
+
+    struct replay_request *req = &reqs[n++];
+    memset(req, 0, sizeof(*req));
+    req->t_ms = js_t->valuedouble;
+    req->text = strdup(text);
+
+    /* grouping key for the per command report */
+    cJSON *js_req = cJSON_Parse(text);
+    char *command = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(js_req, "command"));
+    snprintf(req->command, sizeof(req->command), "%s", command ? command : "invalid");
+    cJSON_Delete(js_req);
+    cJSON_Delete(js);
+  }
+
+  free(line);
+  fclose(fp);
+  *count = n;
+  return reqs;
+}
+
+
+/* the server prints its socket path as the first line of stdout */
+static pid_t spawn_server(char *argv[], char *socket_path, size_t max)
+{
+  int fds[2];
+  if (pipe(fds) == -1) {
+    fprintf(stderr, "Error: [libc] pipe - %s\n", strerror(errno));
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Error: [libc] fork - %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execvp(argv[0], argv);
+    fprintf(stderr, "Error: [libc] execvp - %s\n", strerror(errno));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  FILE *fp = fdopen(fds[0], "r");
+  if (!fp || !fgets(socket_path, max, fp) || strncmp(socket_path, "VIMASM_NULL", 11) == 0) {
+    fprintf(stderr, "Error: server did not start\n");
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  socket_path[strcspn(socket_path, "\n")] = '\0';
+
+  /* keep the pipe open, a closed stdout would fail the server's later prints */
+  return pid;
+}
+
+
+static int connect_server(const char *socket_path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] socket - %s\n", strerror(errno));
+    return -1;
+  }
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Error: [libc] connect - %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/* read exactly len bytes before the deadline */
+static bool read_full(int fd, char *buffer, size_t len, double deadline_ms)
+{
+  size_t got = 0;
+  while (got < len) {
+    const double left = deadline_ms - now_ms();
+    if (left <= 0)
+      return false;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, (int)left + 1) <= 0)
+      continue;
+
+    ssize_t bytes = read(fd, buffer+got, len-got);
+    if (bytes == -1 && errno == EINTR)
+      continue;
+    if (bytes <= 0)
+      return false;
+    got += bytes;
+  }
+  return true;
+}
+
+
+/* failed requests get no response from the server, they show up as timeouts */
+static bool send_request(int fd, struct replay_request *req, int timeout_ms)
+{
+  const double start = now_ms();
+  const size_t len = strlen(req->text);
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t bytes = write(fd, req->text+sent, len-sent);
+    if (bytes == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Error: [libc] write - %s\n", strerror(errno));
+      return false;
+    }
+    sent += bytes;
+  }
+
+  uint32_t msg_bytes;
+  const double deadline = start + timeout_ms;
+  if (!read_full(fd, (char*)&msg_bytes, sizeof(msg_bytes), deadline))
+    return false;
+
+  char *msg = (char*)malloc(msg_bytes);
+  const bool ok = read_full(fd, msg, msg_bytes, deadline);
+  free(msg);
+
+  req->latency_ms = now_ms() - start;
+  return ok;
+}
+
+
+static int compare_double(const void *a, const void *b)
+{
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+
+static cJSON* latency_json(struct replay_request *reqs, unsigned int n, const char *command)
+{
+  double *lat = (double*)malloc((n ? n : 1) * sizeof(double));
+  unsigned int count = 0;
+  unsigned int errors = 0;
+  double sum = 0;
+  for (unsigned int i=0; i<n; i++) {
+    if (command && strcmp(reqs[i].command, command) != 0)
+      continue;
+    if (!reqs[i].ok) {
+      errors++;
+      continue;
+    }
+    lat[count++] = reqs[i].latency_ms;
+    sum += reqs[i].latency_ms;
+  }
+  qsort(lat, count, sizeof(double), compare_double);
+
+  cJSON *node = cJSON_CreateObject();
+  cJSON_AddNumberToObject(node, "count", count);
+  cJSON_AddNumberToObject(node, "errors", errors);
+  if (count) {
+    cJSON_AddNumberToObject(node, "mean_ms", sum / count);
+    cJSON_AddNumberToObject(node, "p50_ms", lat[(count-1) * 50 / 100]);
+    cJSON_AddNumberToObject(node, "p95_ms", lat[(count-1) * 95 / 100]);
+    cJSON_AddNumberToObject(node, "p99_ms", lat[(count-1) * 99 / 100]);
+    cJSON_AddNumberToObject(node, "max_ms", lat[count-1]);
+  }
+  free(lat);
+  return node;
+}
+
+
+int main(int argc, char *argv[])
+{
+  bool fast = false;
+  double speed = 1.0;
+  int timeout_ms = 30000;
+  const char *recording = NULL;
+  const char *socket_arg = NULL;
+  char **server_argv = NULL;
+
+  for (int i=1; i<argc; i++) {
+    const char *ptr = argv[i];
+    if (strcmp(ptr, "--") == 0) {
+      if (i+1 >= argc)
+        display_usage();
+      server_argv = &argv[i+1];
+      break;
+    }
+    else if (strcmp(ptr, "-f") == 0)
+      fast = true;
+    else if (strcmp(ptr, "-s") == 0 && i+1 < argc)
+      speed = strtod(argv[++i], NULL);
+    else if (strcmp(ptr, "-t") == 0 && i+1 < argc)
+      timeout_ms = atoi(argv[++i]);
+    else if (ptr[0] == '-')
+      display_usage();
+    else if (!recording)
+      recording = ptr;
+    else if (!socket_arg)
+      socket_arg = ptr;
+    else
+      display_usage();
+  }
+
+  if (!recording || (!socket_arg == !server_argv) || speed <= 0 || timeout_ms <= 0)
+    display_usage();
+
+  unsigned int n = 0;
+  struct replay_request *reqs = load_recording(recording, &n);
+  if (!reqs)
+    return 1;
+  if (!n) {
+    fprintf(stderr, "Error: no requests in %s\n", recording);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  char socket_path[PATH_MAX];
+  pid_t server_pid = 0;
+  if (server_argv) {
+    server_pid = spawn_server(server_argv, socket_path, sizeof(socket_path));
+    if (server_pid == -1)
+      return 1;
+  }
+  else
+    snprintf(socket_path, sizeof(socket_path), "%s", socket_arg);
+
+  int fd = connect_server(socket_path);
+  if (fd == -1) {
+    if (server_pid > 0) {
+      kill(server_pid, SIGTERM);
+      waitpid(server_pid, NULL, 0);
+    }
+    return 1;
+  }
+
+  const double start = now_ms();
+  const double first_t = reqs[0].t_ms;
+  for (unsigned int i=0; i<n; i++) {
+    if (!fast) {
+      const double wait = start + (reqs[i].t_ms - first_t) / speed - now_ms();
+      if (wait > 0) {
+        struct timespec ts = { (time_t)(wait / 1e3), (long)(((uint64_t)(wait * 1e6)) % 1000000000ULL) };
+        nanosleep(&ts, NULL);
+      }
+    }
+    reqs[i].ok = send_request(fd, &reqs[i], timeout_ms);
+  }
+  const double wall_ms = now_ms() - start;
+
+  close(fd);
+  if (server_pid > 0) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+  }
+
+  cJSON *report = cJSON_CreateObject();
+  cJSON_AddStringToObject(report, "recording", recording);
+  cJSON_AddStringToObject(report, "mode", fast ? "fast" : "timed");
+  cJSON_AddNumberToObject(report, "speed", speed);
+  cJSON_AddNumberToObject(report, "requests", n);
+  cJSON_AddNumberToObject(report, "wall_s", wall_ms / 1e3);
+  cJSON_AddNumberToObject(report, "throughput_rps", n / (wall_ms / 1e3));
+  cJSON_AddItemToObject(report, "latency", latency_json(reqs, n, NULL));
+
+  cJSON *commands = cJSON_AddObjectToObject(report, "commands");
+  for (unsigned int i=0; i<n; i++) {
+    if (!cJSON_GetObjectItemCaseSensitive(commands, reqs[i].command))
+      cJSON_AddItemToObject(commands, reqs[i].command, latency_json(reqs, n, reqs[i].command));
+  }
+
+  char *json = cJSON_Print(report);
+  printf("%s\n", json);
+  cJSON_free(json);
+  cJSON_Delete(report);
+
+  for (unsigned int i=0; i<n; i++)
+    free(reqs[i].text);
+  free(reqs);
+  return 0;
+}
@@ -1,4 +1,4 @@
-
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -15,39 +15,168 @@
 #include <sys/types.h>
 
 #include "cJSON.h"
+#include "compile_db.h"
+
+/*
+ * captures the rustc invocations of a cargo build as compile_commands.json.
+ * by default bear-cargo puts itself in as RUSTC_WRAPPER, every rustc run
+ * appends its argv, cwd and manifest dir to a log as one O_APPEND write
+ * (no locks, parallel jobs are fine) and then execs rustc. the log is
+ * merged once cargo exits. --scrape is the old capture, a verbose build
+ * with cargo's "Running" lines parsed out of its output.
+ * -o, --append and --force are the compile_db.h writer's, --append keeps
+ * the entries of crates that were not rebuilt this time
+ */
+
+#define LOG_ENV     "BEAR_CARGO_LOG"
+#define WRAPPER_ENV "BEAR_CARGO_WRAPPER"   // a wrapper that was already set, chained
 
 static void display_usage() {
   fprintf(stderr, "usage:\n"
-                  "  bear-cargo -- cargo build [flags]\n"
+                  "  bear-cargo [--scrape] [--append] [--force] [-o file] -- cargo build [flags]\n"
       ); 
   exit(1);
 }
 
 
-int main(int argc, char *argv[])
+/* the crate source, the first argument naming a .rs file */
+static const char* source_arg(int argc, char *argv[])
 {
-  unsigned int i;
+  for (int i=0; i<argc; i++) {
+    const size_t len = strlen(argv[i]);
+    if (argv[i][0] != '-' && len > 3 && strcmp(argv[i] + len - 3, ".rs") == 0)
+      return argv[i];
+  }
+  return NULL;
+}
 
-  /* our options */
-  for (i=1; i<argc; i++) {
-    const char *ptr = argv[i]; 
-    if (strcmp(ptr, "--") == 0) {
-      break;
-    }
+
+/* run by cargo in place of rustc, argv[1] is rustc itself */
+static int wrap_rustc(const char *log_path, int argc, char *argv[])
+{
+  /* probes such as rustc -vV have no source and are not logged */
+  if (argc > 1 && source_arg(argc-1, argv+1)) {
+    char cwd[PATH_MAX];
+    const char *manifest_dir = getenv("CARGO_MANIFEST_DIR");
+
+    cJSON *record = cJSON_CreateObject();
+    cJSON_AddStringToObject(record, "cwd", getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    cJSON_AddStringToObject(record, "manifest_dir", manifest_dir ? manifest_dir : "");
+    cJSON *args = cJSON_AddArrayToObject(record, "argv");
+    for (int i=1; i<argc; i++)
+      cJSON_AddItemToArray(args, cJSON_CreateString(argv[i]));
+
+    char *text = cJSON_PrintUnformatted(record);
+    const size_t len = strlen(text);
+    text[len] = '\n';
+    CompileDb_log_append(log_path, text, len+1);
+    cJSON_free(text);
+    cJSON_Delete(record);
   }
- 
-  if (++i >= argc || strcmp(argv[i],"cargo")!=0) {
-    fprintf(stderr, "Error: format is bear-cargo -- cargo build [options]\n");
-    display_usage();
-    return 1; 
+
+  const char *chained = getenv(WRAPPER_ENV);
+  if (chained && *chained) {
+    argv[0] = (char*)chained;
+    execvp(chained, argv);
   }
+  else if (argc > 1)
+    execvp(argv[1], argv+1);
 
-  if (++i >= argc || strcmp(argv[i],"build")!=0) {
-    fprintf(stderr, "Error: format is bear-cargo -- cargo build [options]\n");
-    display_usage();
-    return 1; 
+  fprintf(stderr, "Error: [libc] execvp - %s\n", strerror(errno));
+  return 127;
+}
+
+
+/*
+ * a log record to a compile db entry. the source goes in as an absolute
+ * path, cargo gives workspace members paths relative to the workspace
+ * root while the entry's directory is the package's manifest dir. there
+ * is no "output", rustc writes the crate's artifacts under --out-dir
+ * with names cargo picks, no object to stand in for a compile
+ */
+static int merge_record(CompileDb *db, cJSON *record)
+{
+  const char *cwd          = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(record, "cwd"));
+  const char *manifest_dir = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(record, "manifest_dir"));
+  cJSON *args = cJSON_GetObjectItemCaseSensitive(record, "argv");
+  if (!cwd || !manifest_dir || !cJSON_IsArray(args))
+    return -1;
+
+  const int argc = cJSON_GetArraySize(args);
+  char **argv = (char**)malloc(sizeof(char*) * (argc ? argc : 1));
+  int n = 0;
+  for (cJSON *arg = args->child; arg; arg = arg->next) {
+    if (cJSON_IsString(arg))
+      argv[n++] = arg->valuestring;
   }
- 
+
+  const char *source = source_arg(n, argv);
+  char joined[2*PATH_MAX];
+  char src_file[PATH_MAX];
+  if (!source) {
+    free(argv);
+    return -1;
+  }
+  if (source[0] == '/')
+    snprintf(joined, sizeof(joined), "%s", source);
+  else
+    snprintf(joined, sizeof(joined), "%s/%s", cwd, source);
+  if (!realpath(joined, src_file))
+    snprintf(src_file, sizeof(src_file), "%s", joined);
+
+  size_t len = 0;
+  size_t max = 4096;
+  char *command = (char*)malloc(max);
+  command[0] = '\0';
+  for (int i=0; i<n; i++)
+    CompileDb_quote(&command, &len, &max, argv[i] == source ? src_file : argv[i]);
+
+  cJSON *node = cJSON_CreateObject();
+  cJSON_AddStringToObject(node, "directory", *manifest_dir ? manifest_dir : cwd);
+  cJSON_AddStringToObject(node, "file", src_file);
+  cJSON_AddStringToObject(node, "command", command);
+
+  CompileDb_add(db, node);
+  free(command);
+  free(argv);
+  return 1;
+}
+
+
+static int capture_wrapper(CompileDb *db, char *argv[], int first)
+{
+  char self[PATH_MAX];
+  const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self)-1);
+  if (self_len == -1) {
+    fprintf(stderr, "Error: [libc] readlink - %s\n", strerror(errno));
+    return -1;
+  }
+  self[self_len] = '\0';
+
+  char log_path[PATH_MAX];
+  if (!CompileDb_log_create(log_path, sizeof(log_path), "bear_cargo"))
+    return -1;
+
+  const char *wrapper = getenv("RUSTC_WRAPPER");
+  if (wrapper && *wrapper)
+    setenv(WRAPPER_ENV, wrapper, 1);
+  setenv("RUSTC_WRAPPER", self, 1);
+  setenv(LOG_ENV, log_path, 1);
+
+  if (CompileDb_run(argv+first-2) != 0)
+    fprintf(stderr, "Warning: cargo build failed, compile commands may be incomplete\n");
+
+  const int captured = CompileDb_merge_log(db, log_path, merge_record);
+
+  /* cargo only runs rustc for crates that are out of date */
+  if (!captured)
+    fprintf(stderr, "Warning: no rustc invocations captured, the build was fresh (cargo clean first)\n");
+  return captured;
+}
+
+
+static int capture_scrape(CompileDb *db, char *argv[], int argc, int first)
+{
   char cargo_cmd[8192];
   cargo_cmd[0] = '\0';
   
@@ -57,7 +186,7 @@ int main(int argc, char *argv[])
   memcpy(cargo_cmd, cargo_invoke, len); 
   cargo_cmd[len] = '\0';
 
-  for (++i;i<argc; i++) {
+  for (int i=first; i<argc; i++) {
     cargo_cmd[len++] = ' ';
     cargo_cmd[len] = '\0';
     strcat(cargo_cmd, argv[i]); 
@@ -66,10 +195,10 @@ int main(int argc, char *argv[])
   FILE *p = popen(cargo_cmd, "r");
   if (!p) {
     fprintf(stderr, "Error: [libc] popen - %s\n", strerror(errno));
-    return 1; 
+    return -1; 
   }
 
-  cJSON *compile_commands = cJSON_CreateArray();
+  int captured = 0; 
   
   unsigned int dir_len; 
   unsigned int build_len; 
@@ -174,17 +303,77 @@ int main(int argc, char *argv[])
       cJSON_AddStringToObject(node, "directory", directory); 
       cJSON_AddStringToObject(node, "file", src_file); 
       cJSON_AddStringToObject(node, "command", build_command); 
-      cJSON_AddStringToObject(node, "output", ""); 
-      cJSON_AddItemToArray(compile_commands, node); 
+      CompileDb_add(db, node); 
+      captured++; 
     }
   }
   
-  char *json = cJSON_Print(compile_commands); 
-  printf("%s\n", json); 
-
-  cJSON_free(compile_commands); 
-  fclose(p); 
-  return 0; 
+  const int status = pclose(p); 
+  if (status == -1) 
+    fprintf(stderr, "Error: [libc] pclose - %s\n", strerror(errno)); 
+  else if (status != 0) 
+    fprintf(stderr, "Warning: cargo build failed, compile commands may be incomplete\n"); 
+  return captured; 
 }
 
 
+
+
+int main(int argc, char *argv[])
+{
+  const char *log_path = getenv(LOG_ENV);
+  if (log_path)
+    return wrap_rustc(log_path, argc, argv);
+
+  int i;
+  bool scrape = false;
+  bool append = false;
+  bool force = false;
+  const char *out_path = NULL;
+
+  /* our options */
+  for (i=1; i<argc; i++) {
+    const char *ptr = argv[i]; 
+    if (strcmp(ptr, "--") == 0) {
+      break;
+    }
+    else if (strcmp(ptr, "--scrape") == 0) 
+      scrape = true; 
+    else if (strcmp(ptr, "--append") == 0) 
+      append = true; 
+    else if (strcmp(ptr, "--force") == 0) 
+      force = true; 
+    else if (strcmp(ptr, "-o") == 0 && i+1 < argc) 
+      out_path = argv[++i]; 
+    else 
+      display_usage(); 
+  }
+ 
+  if (++i >= argc || strcmp(argv[i],"cargo")!=0) {
+    fprintf(stderr, "Error: format is bear-cargo -- cargo build [options]\n");
+    display_usage();
+    return 1; 
+  }
+
+  if (++i >= argc || strcmp(argv[i],"build")!=0) {
+    fprintf(stderr, "Error: format is bear-cargo -- cargo build [options]\n");
+    display_usage();
+    return 1; 
+  }
+
+  /* merging needs the old database, the default name is the usual one */
+  if (append && !out_path) 
+    out_path = "compile_commands.json"; 
+
+  CompileDb db; 
+  if (!CompileDb_open(&db, out_path)) 
+    return 1; 
+
+  const int captured = scrape ? capture_scrape(&db, argv, argc, i+1) 
+                              : capture_wrapper(&db, argv, i+1); 
+  if (captured < 0) {
+    CompileDb_discard(&db); 
+    return 1; 
+  }
+  return CompileDb_close(&db, append, force); 
+}
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <string.h>
+
+#include "cJSON.h"
+#include "compile_db.h"
+
+/*
+ * captures the compiler invocations of any build (make, ninja, scripts) as
+ * compile_commands.json. libbear_exec.so, next to this binary, is put in
+ * LD_PRELOAD for the build and logs every compile it sees exec'd, the log
+ * is merged once the build exits. -o, --append and --force are the
+ * compile_db.h writer's, --append keeps the entries of files not rebuilt
+ * this time
+ */
+
+#define LOG_ENV     "BEAR_EXEC_LOG"
+#define PRELOAD_LIB "libbear_exec.so"
+
+static void display_usage() {
+  fprintf(stderr, "usage:\n"
+                  "  bear-exec [--append] [--force] [-o file] -- <build command>\n"
+      );
+  exit(1);
+}
+
+
+static bool is_source(const char *arg)
+{
+  static const char *const exts[] = { "c", "cc", "cp", "cpp", "cxx", "c++", "C", NULL };
+  const char *ext = strrchr(arg, '.');
+  if (arg[0] == '-' || !ext || strchr(ext, '/'))
+    return false;
+  for (unsigned int i=0; exts[i]; i++) {
+    if (strcmp(ext+1, exts[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/* options whose value is a path, the server runs commands from its own cwd */
+static bool takes_path(const char *arg)
+{
+  static const char *const opts[] = { "-I", "-isystem", "-iquote", "-idirafter",
+                                      "-include", "-imacros", "-o", NULL };
+  for (unsigned int i=0; opts[i]; i++) {
+    if (strcmp(arg, opts[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/*
+ * arguments taken by a depfile option, 0 for any other. the server runs
+ * the command again for its own output, a depfile written then would land
+ * in its cwd or over the build's, the one AsmObject_fresh reads
+ */
+static int depfile_option(const char *arg)
+{
+  static const char *const flags[] = { "-MD", "-MMD", "-MP", NULL };
+  static const char *const opts[]  = { "-MF", "-MT", "-MQ", NULL };
+  for (unsigned int i=0; flags[i]; i++) {
+    if (strcmp(arg, flags[i]) == 0)
+      return 1;
+  }
+  for (unsigned int i=0; opts[i]; i++) {
+    if (strncmp(arg, opts[i], 3) == 0)
+      return arg[3] ? 1 : 2;
+  }
+  return 0;
+}
+
+
+static void absolute(char *out, size_t max, const char *cwd, const char *path)
+{
+  char joined[2*PATH_MAX];
+  if (path[0] == '/')
+    snprintf(joined, sizeof(joined), "%s", path);
+  else
+    snprintf(joined, sizeof(joined), "%s/%s", cwd, path);
+  if (!realpath(joined, out))
+    snprintf(out, max, "%s", joined);
+}
+
+
+/* one entry per source of the compile, the other sources left out */
+static int merge_record(CompileDb *db, cJSON *record)
+{
+  const char *cwd = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(record, "cwd"));
+  cJSON *args = cJSON_GetObjectItemCaseSensitive(record, "argv");
+  if (!cwd || !cJSON_IsArray(args))
+    return -1;
+
+  const int argc = cJSON_GetArraySize(args);
+  char **argv = (char**)malloc(sizeof(char*) * (argc ? argc : 1));
+  int n = 0;
+  for (cJSON *arg = args->child; arg; arg = arg->next) {
+    if (cJSON_IsString(arg))
+      argv[n++] = arg->valuestring;
+  }
+
+  int added = 0;
+  char path[PATH_MAX];
+  char src_file[PATH_MAX];
+  char output[PATH_MAX] = "";
+  size_t max = 4096;
+  char *command = (char*)malloc(max);
+
+  for (int s=0; s<n; s++) {
+    if (!is_source(argv[s]) || (s && (takes_path(argv[s-1]) || depfile_option(argv[s-1]) == 2)))
+      continue;
+    absolute(src_file, sizeof(src_file), cwd, argv[s]);
+
+    size_t len = 0;
+    command[0] = '\0';
+    for (int i=0; i<n; i++) {
+      const char *arg = argv[i];
+      const int depfile_args = depfile_option(arg);
+      if (depfile_args) {
+        i += depfile_args-1;
+        continue;
+      }
+      if (i == s)
+        arg = src_file;
+      else if (is_source(arg) && !(i && takes_path(argv[i-1])))
+        continue;
+      else if (i && takes_path(argv[i-1])) {
+        absolute(path, sizeof(path), cwd, arg);
+        if (strcmp(argv[i-1], "-o") == 0)
+          snprintf(output, sizeof(output), "%s", path);
+        arg = path;
+      }
+      else if (strncmp(arg, "-I", 2) == 0 && arg[2] && arg[2] != '/') {
+        char joined[PATH_MAX+2];
+        absolute(path, sizeof(path), cwd, arg+2);
+        snprintf(joined, sizeof(joined), "-I%s", path);
+        CompileDb_quote(&command, &len, &max, joined);
+        continue;
+      }
+      CompileDb_quote(&command, &len, &max, arg);
+    }
+
+    cJSON *node = cJSON_CreateObject();
+    cJSON_AddStringToObject(node, "directory", cwd);
+    cJSON_AddStringToObject(node, "file", src_file);
+    cJSON_AddStringToObject(node, "command", command);
+    cJSON_AddStringToObject(node, "output", output);
+    CompileDb_add(db, node);
+    added++;
+  }
+
+  free(command);
+  free(argv);
+  return added;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int i;
+  bool append = false;
+  bool force = false;
+  const char *out_path = NULL;
+
+  /* our options */
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--") == 0)
+      break;
+    else if (strcmp(argv[i], "--append") == 0)
+      append = true;
+    else if (strcmp(argv[i], "--force") == 0)
+      force = true;
+    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+      out_path = argv[++i];
+    else
+      display_usage();
+  }
+  if (++i >= argc)
+    display_usage();
+
+  char self[PATH_MAX];
+  const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self)-1);
+  if (self_len == -1) {
+    fprintf(stderr, "Error: [libc] readlink - %s\n", strerror(errno));
+    return 1;
+  }
+  self[self_len] = '\0';
+
+  char lib[PATH_MAX+sizeof(PRELOAD_LIB)];
+  char *slash = strrchr(self, '/');
+  snprintf(lib, sizeof(lib), "%.*s/" PRELOAD_LIB, (int)(slash ? slash-self : 1), slash ? self : ".");
+  if (access(lib, R_OK) != 0) {
+    fprintf(stderr, "Error: %s - %s\n", lib, strerror(errno));
+    return 1;
+  }
+
+  /* merging needs the old database, the default name is the usual one */
+  if (append && !out_path)
+    out_path = "compile_commands.json";
+
+  CompileDb db;
+  char log_path[PATH_MAX];
+  if (!CompileDb_open(&db, out_path))
+    return 1;
+  if (!CompileDb_log_create(log_path, sizeof(log_path), "bear_exec")) {
+    CompileDb_discard(&db);
+    return 1;
+  }
+
+  const char *preload = getenv("LD_PRELOAD");
+  char preload_value[2*PATH_MAX+2];
+  if (preload && *preload)
+    snprintf(preload_value, sizeof(preload_value), "%s:%s", lib, preload);
+  else
+    snprintf(preload_value, sizeof(preload_value), "%s", lib);
+  setenv("LD_PRELOAD", preload_value, 1);
+  setenv(LOG_ENV, log_path, 1);
+
+  if (CompileDb_run(argv+i) != 0)
+    fprintf(stderr, "Warning: build failed, compile commands may be incomplete\n");
+
+  const int captured = CompileDb_merge_log(&db, log_path, merge_record);
+  if (captured < 0) {
+    CompileDb_discard(&db);
+    return 1;
+  }
+  if (!captured)
+    fprintf(stderr, "Warning: no compiler invocations captured, the build was up to date (clean first)\n");
+  return CompileDb_close(&db, append, force);
+}
@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <spawn.h>
+
+#include <string.h>
+
+#include <sys/mman.h>
+
+/*
+ * LD_PRELOADed into a build by bear-exec. exec and posix_spawn calls are
+ * passed straight through, compiler runs are logged first as one JSON line,
+ * {"cwd":...,"argv":[...]}, with a single O_APPEND write. an exec can come
+ * from a vfork child so nothing here allocates, the record is built on the
+ * stack (an mmap for huge command lines). everything that is not a compiler
+ * costs a basename compare, so a make -j64 does not notice it.
+ * an environment handed to execve without our variables (env -i, scrubbing
+ * build tools) gets them put back so the capture follows the whole build
+ */
+
+#define LOG_ENV      "BEAR_EXEC_LOG"
+#define PRELOAD_ENV  "LD_PRELOAD"
+#define RECORD_STACK 16384
+
+typedef int (*execve_fn)(const char*, char *const[], char *const[]);
+typedef int (*posix_spawn_fn)(pid_t*, const char*, const posix_spawn_file_actions_t*,
+                              const posix_spawnattr_t*, char *const[], char *const[]);
+
+extern char **environ;
+
+static execve_fn      real_execve;
+static execve_fn      real_execvpe;
+static posix_spawn_fn real_posix_spawn;
+static posix_spawn_fn real_posix_spawnp;
+
+static char log_path[PATH_MAX];
+static char log_entry[PATH_MAX + sizeof(LOG_ENV)+1];   // LOG_ENV=path
+static char self_path[PATH_MAX];                       // this library
+
+#define PRELOAD_MAX (2*PATH_MAX + sizeof(PRELOAD_ENV)+2)
+
+
+__attribute__((constructor))
+static void preload_init(void)
+{
+  real_execve       = (execve_fn)dlsym(RTLD_NEXT, "execve");
+  real_execvpe      = (execve_fn)dlsym(RTLD_NEXT, "execvpe");
+  real_posix_spawn  = (posix_spawn_fn)dlsym(RTLD_NEXT, "posix_spawn");
+  real_posix_spawnp = (posix_spawn_fn)dlsym(RTLD_NEXT, "posix_spawnp");
+
+  const char *path = getenv(LOG_ENV);
+  if (path && strlen(path) < sizeof(log_path)) {
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    snprintf(log_entry, sizeof(log_entry), LOG_ENV "=%s", path);
+  }
+
+  Dl_info info;
+  if (dladdr((void*)preload_init, &info) && info.dli_fname)
+    snprintf(self_path, sizeof(self_path), "%s", info.dli_fname);
+}
+
+
+/* cc, gcc-12, x86_64-linux-gnu-g++, clang++-15, never cc1 */
+static bool is_compiler(const char *path)
+{
+  static const char *const names[] = { "cc", "c++", "gcc", "g++", "clang", "clang++", NULL };
+
+  const char *base = strrchr(path, '/');
+  base = base ? base+1 : path;
+  size_t len = strlen(base);
+
+  /* a version suffix only counts after a dash */
+  size_t stem = len;
+  while (stem && ((base[stem-1] >= '0' && base[stem-1] <= '9') || base[stem-1] == '.'))
+    stem--;
+  if (stem < len && stem && base[stem-1] == '-')
+    len = stem-1;
+
+  for (unsigned int i=0; names[i]; i++) {
+    const size_t name_len = strlen(names[i]);
+    if (len < name_len || memcmp(base + len - name_len, names[i], name_len) != 0)
+      continue;
+    if (len == name_len || base[len - name_len - 1] == '-')
+      return true;
+  }
+  return false;
+}
+
+
+/* a compile of sources, not a link, a preprocess or clang's own -cc1 */
+static bool is_compile(const char *path, char *const argv[])
+{
+  if (!log_path[0] || !argv || !argv[0] || !is_compiler(path))
+    return false;
+  if (argv[1] && strcmp(argv[1], "-cc1") == 0)
+    return false;
+  for (unsigned int i=1; argv[i]; i++) {
+    if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-S") == 0)
+      return true;
+  }
+  return false;
+}
+
+
+/* JSON string body, counted only when out is NULL */
+static size_t escape(char *out, const char *str)
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t n = 0;
+  for (const unsigned char *p = (const unsigned char*)str; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      if (out) {
+        out[n] = '\\';
+        out[n+1] = *p;
+      }
+      n += 2;
+    }
+    else if (*p < 0x20) {
+      if (out) {
+        memcpy(out+n, "\\u00", 4);
+        out[n+4] = hex[*p >> 4];
+        out[n+5] = hex[*p & 15];
+      }
+      n += 6;
+    }
+    else {
+      if (out)
+        out[n] = *p;
+      n++;
+    }
+  }
+  return n;
+}
+
+
+static size_t format_record(char *out, const char *cwd, char *const argv[])
+{
+  size_t n = 0;
+#define PUT(s) do { const size_t l_ = strlen(s); if (out) memcpy(out+n, s, l_); n += l_; } while (0)
+  PUT("{\"cwd\":\"");
+  n += escape(out ? out+n : NULL, cwd);
+  PUT("\",\"argv\":[");
+  for (unsigned int i=0; argv[i]; i++) {
+    PUT(i ? ",\"" : "\"");
+    n += escape(out ? out+n : NULL, argv[i]);
+    PUT("\"");
+  }
+  PUT("]}\n");
+#undef PUT
+  return n;
+}
+
+
+static void log_compile(const char *path, char *const argv[])
+{
+  if (!is_compile(path, argv))
+    return;
+
+  const int saved_errno = errno;
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    cwd[0] = '\0';
+
+  char stack[RECORD_STACK];
+  const size_t len = format_record(NULL, cwd, argv);
+  char *record = stack;
+  if (len > sizeof(stack)) {
+    record = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (record == MAP_FAILED) {
+      errno = saved_errno;
+      return;
+    }
+  }
+  format_record(record, cwd, argv);
+
+  const int fd = open(log_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd != -1) {
+    if (write(fd, record, len) != (ssize_t)len)
+      fprintf(stderr, "Error: [libc] bear-exec log - %s\n", strerror(errno));
+    close(fd);
+  }
+  if (record != stack)
+    munmap(record, len);
+  errno = saved_errno;
+}
+
+
+static size_t env_count(char *const envp[])
+{
+  size_t n = 0;
+  while (envp && envp[n])
+    n++;
+  return n;
+}
+
+
+/*
+ * envp as given when it still carries the capture, otherwise a copy in env
+ * (env_count+3 slots) with the log put back and this library put in front
+ * of whatever LD_PRELOAD is left, preload is the buffer for that entry
+ */
+static char *const* capture_env(char *const envp[], char **env, char *preload)
+{
+  if (!log_path[0])
+    return envp;
+
+  bool has_log = false;
+  bool has_preload = !self_path[0];
+  const char *old_preload = NULL;
+  for (size_t i=0; envp && envp[i]; i++) {
+    if (strcmp(envp[i], log_entry) == 0)
+      has_log = true;
+    else if (strncmp(envp[i], PRELOAD_ENV "=", sizeof(PRELOAD_ENV)) == 0) {
+      old_preload = envp[i] + sizeof(PRELOAD_ENV);
+      has_preload = has_preload || strstr(old_preload, self_path) != NULL;
+    }
+  }
+  if (has_log && has_preload)
+    return envp;
+
+  size_t n = 0;
+  for (size_t i=0; envp && envp[i]; i++) {
+    if (strncmp(envp[i], LOG_ENV "=", sizeof(LOG_ENV)) != 0 &&
+        strncmp(envp[i], PRELOAD_ENV "=", sizeof(PRELOAD_ENV)) != 0)
+      env[n++] = envp[i];
+  }
+  env[n++] = log_entry;
+
+  if (has_preload && old_preload)
+    env[n++] = (char*)old_preload - sizeof(PRELOAD_ENV);
+  else if (!has_preload) {
+    if (old_preload && *old_preload &&
+        strlen(old_preload) + strlen(self_path) + sizeof(PRELOAD_ENV)+2 < PRELOAD_MAX)
+      snprintf(preload, PRELOAD_MAX, PRELOAD_ENV "=%s:%s", self_path, old_preload);
+    else
+      snprintf(preload, PRELOAD_MAX, PRELOAD_ENV "=%s", self_path);
+    env[n++] = preload;
+  }
+  env[n] = NULL;
+  return env;
+}
+
+
+int execve(const char *path, char *const argv[], char *const envp[])
+{
+  log_compile(path, argv);
+  char *env[env_count(envp) + 3];
+  char preload[PRELOAD_MAX];
+  return real_execve(path, argv, capture_env(envp, env, preload));
+}
+
+
+int execvpe(const char *file, char *const argv[], char *const envp[])
+{
+  log_compile(file, argv);
+  char *env[env_count(envp) + 3];
+  char preload[PRELOAD_MAX];
+  return real_execvpe(file, argv, capture_env(envp, env, preload));
+}
+
+
+int execv(const char *path, char *const argv[])
+{
+  return execve(path, argv, environ);
+}
+
+
+int execvp(const char *file, char *const argv[])
+{
+  return execvpe(file, argv, environ);
+}
+
+
+/* the execl family gathers its arguments and goes through the above */
+static size_t varg_count(const char *arg, va_list ap)
+{
+  size_t n = 0;
+  va_list copy;
+  va_copy(copy, ap);
+  for (const char *a = arg; a; a = va_arg(copy, const char*))
+    n++;
+  va_end(copy);
+  return n;
+}
+
+
+int execl(const char *path, const char *arg, ...)
+{
+  va_list ap;
+  va_start(ap, arg);
+  const size_t n = varg_count(arg, ap);
+  char *argv[n+1];
+  for (size_t i=0; i<n; i++)
+    argv[i] = i ? va_arg(ap, char*) : (char*)arg;
+  argv[n] = NULL;
+  va_end(ap);
+  return execve(path, argv, environ);
+}
+
+
+int execlp(const char *file, const char *arg, ...)
+{
+  va_list ap;
+  va_start(ap, arg);
+  const size_t n = varg_count(arg, ap);
+  char *argv[n+1];
+  for (size_t i=0; i<n; i++)
+    argv[i] = i ? va_arg(ap, char*) : (char*)arg;
+  argv[n] = NULL;
+  va_end(ap);
+  return execvpe(file, argv, environ);
+}
+
+
+int execle(const char *path, const char *arg, ...)
+{
+  va_list ap;
+  va_start(ap, arg);
+  const size_t n = varg_count(arg, ap);
+  char *argv[n+1];
+  for (size_t i=0; i<n; i++)
+    argv[i] = i ? va_arg(ap, char*) : (char*)arg;
+  argv[n] = NULL;
+  if (n)
+    va_arg(ap, char*);   // the terminating NULL, envp follows it
+  char *const *envp = va_arg(ap, char *const*);
+  va_end(ap);
+  return execve(path, argv, envp);
+}
+
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *actions,
+                const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+  log_compile(path, argv);
+  char *env[env_count(envp) + 3];
+  char preload[PRELOAD_MAX];
+  return real_posix_spawn(pid, path, actions, attr, argv, capture_env(envp, env, preload));
+}
+
+
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *actions,
+                 const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+  log_compile(file, argv);
+  char *env[env_count(envp) + 3];
+  char preload[PRELOAD_MAX];
+  return real_posix_spawnp(pid, file, actions, attr, argv, capture_env(envp, env, preload));
+}
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "compile_db.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+
+static uint64_t path_hash(const char *path)
+{
+  uint64_t hash = FNV_OFFSET;
+  for (; *path; path++) {
+    hash ^= (unsigned char)*path;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+static bool db_captured(const CompileDb *db, const char *file)
+{
+  if (!db->nbuckets)
+    return false;
+  for (unsigned int b = path_hash(file) & (db->nbuckets-1); db->files[b]; b = (b+1) & (db->nbuckets-1)) {
+    if (strcmp(db->files[b], file) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+static void db_remember(CompileDb *db, const char *file)
+{
+  if (db_captured(db, file))
+    return;
+
+  if (2*(db->nfiles+1) > db->nbuckets) {
+    char **old = db->files;
+    const unsigned int old_buckets = db->nbuckets;
+    db->nbuckets = db->nbuckets ? 2*db->nbuckets : 256;
+    db->files = (char**)calloc(db->nbuckets, sizeof(char*));
+    for (unsigned int i=0; i<old_buckets; i++) {
+      if (!old[i])
+        continue;
+      unsigned int b = path_hash(old[i]) & (db->nbuckets-1);
+      while (db->files[b])
+        b = (b+1) & (db->nbuckets-1);
+      db->files[b] = old[i];
+    }
+    free(old);
+  }
+
+  unsigned int b = path_hash(file) & (db->nbuckets-1);
+  while (db->files[b])
+    b = (b+1) & (db->nbuckets-1);
+  db->files[b] = strdup(file);
+  db->nfiles++;
+}
+
+
+bool CompileDb_open(CompileDb *db, const char *out_path)
+{
+  memset(db, 0, sizeof(CompileDb));
+  if (!out_path) {
+    db->fp = stdout;
+    return true;
+  }
+
+  /* same directory as the target so the rename stays on one filesystem */
+  snprintf(db->out_path, sizeof(db->out_path), "%s", out_path);
+  snprintf(db->tmp_path, sizeof(db->tmp_path), "%s.XXXXXX", out_path);
+  int fd = mkstemp(db->tmp_path);
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] mkstemp - %s\n", strerror(errno));
+    return false;
+  }
+  fchmod(fd, 0644);
+  db->fp = fdopen(fd, "w");
+  return db->fp != NULL;
+}
+
+
+/* writes and deletes the entry, flushed so a pipe sees it straight away */
+static void db_write(CompileDb *db, cJSON *node)
+{
+  char *json = cJSON_Print(node);
+  fprintf(db->fp, "%s%s", db->nentries++ ? ",\n" : "[\n", json);
+  fflush(db->fp);
+  cJSON_free(json);
+  cJSON_Delete(node);
+}
+
+
+void CompileDb_add(CompileDb *db, cJSON *node)
+{
+  const char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file"));
+  if (file)
+    db_remember(db, file);
+  db_write(db, node);
+}
+
+
+static char* read_file(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return NULL;
+
+  struct stat sb;
+  char *text = NULL;
+  if (fstat(fileno(fp), &sb) == 0 && (text = (char*)malloc(sb.st_size+1))) {
+    const size_t len = fread(text, 1, sb.st_size, fp);
+    text[len] = '\0';
+  }
+  fclose(fp);
+  return text;
+}
+
+
+/* entries of the old database whose files were not rebuilt this time */
+static void db_keep_old(CompileDb *db)
+{
+  char *text = read_file(db->out_path);
+  if (!text)
+    return;
+
+  cJSON *old = cJSON_Parse(text);
+  free(text);
+  if (!cJSON_IsArray(old)) {
+    fprintf(stderr, "Warning: %s is not a compile db, not merged\n", db->out_path);
+    cJSON_Delete(old);
+    return;
+  }
+
+  unsigned int kept = 0;
+  while (old->child) {
+    cJSON *node = cJSON_DetachItemViaPointer(old, old->child);
+    const char *file = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(node, "file"));
+    if (file && !db_captured(db, file)) {
+      db_write(db, node);
+      kept++;
+    }
+    else
+      cJSON_Delete(node);
+  }
+  cJSON_Delete(old);
+  fprintf(stderr, "%u entries kept from %s\n", kept, db->out_path);
+}
+
+
+int CompileDb_close(CompileDb *db, bool append, bool force)
+{
+  if (append && db->out_path[0])
+    db_keep_old(db);
+
+  /* a build with nothing to do captures nothing, the old database stays */
+  if (!db->nentries && db->out_path[0] && !force && access(db->out_path, F_OK) == 0) {
+    fprintf(stderr, "Warning: no compile captured, %s left as it was (--force empties it)\n", db->out_path);
+    CompileDb_discard(db);
+    return 0;
+  }
+  fprintf(db->fp, "%s]\n", db->nentries ? "\n" : "[");
+
+  for (unsigned int i=0; i<db->nbuckets; i++)
+    free(db->files[i]);
+  free(db->files);
+
+  if (!db->out_path[0])
+    return fflush(db->fp) == 0 ? 0 : 1;
+
+  bool ok = fflush(db->fp) == 0 && fsync(fileno(db->fp)) == 0;
+  ok = fclose(db->fp) == 0 && ok;
+  if (ok && rename(db->tmp_path, db->out_path) == 0)
+    return 0;
+
+  fprintf(stderr, "Error: [libc] writing %s - %s\n", db->out_path, strerror(errno));
+  unlink(db->tmp_path);
+  return 1;
+}
+
+
+/* single quoted unless every character is shell safe */
+void CompileDb_quote(char **out, size_t *len, size_t *max, const char *arg)
+{
+  bool safe = *arg != '\0';
+  for (const char *p = arg; *p && safe; p++)
+    safe = strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-./=:,+@%", *p) != NULL;
+
+  const size_t need = 4*strlen(arg) + 4;
+  if (*len + need >= *max) {
+    *max = 2*(*max + need);
+    *out = (char*)realloc(*out, *max);
+  }
+
+  char *dst = *out + *len;
+  if (*len)
+    *dst++ = ' ';
+  if (!safe)
+    *dst++ = '\'';
+  for (const char *p = arg; *p; p++) {
+    if (*p == '\'' && !safe) {
+      memcpy(dst, "'\\''", 4);
+      dst += 4;
+    }
+    else
+      *dst++ = *p;
+  }
+  if (!safe)
+    *dst++ = '\'';
+  *dst = '\0';
+  *len = dst - *out;
+}
+
+
+/* a failed capture leaves the target as it was */
+void CompileDb_discard(CompileDb *db)
+{
+  for (unsigned int i=0; i<db->nbuckets; i++)
+    free(db->files[i]);
+  free(db->files);
+  if (db->tmp_path[0]) {
+    fclose(db->fp);
+    unlink(db->tmp_path);
+  }
+}
+
+
+/* an empty log in $TMPDIR, <prefix>_XXXXXX */
+bool CompileDb_log_create(char *path, size_t max, const char *prefix)
+{
+  const char *tmp_dir = getenv("TMPDIR");
+  snprintf(path, max, "%s/%s_XXXXXX", tmp_dir ? tmp_dir : "/tmp", prefix);
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    fprintf(stderr, "Error: [libc] mkstemp - %s\n", strerror(errno));
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+
+/* one write per record, O_APPEND keeps concurrent records whole */
+int CompileDb_log_append(const char *log_path, const char *record, size_t len)
+{
+  int fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  const bool ok = fd != -1 && write(fd, record, len) == (ssize_t)len;
+  if (!ok)
+    fprintf(stderr, "Error: [libc] compile db log - %s\n", strerror(errno));
+  if (fd != -1)
+    close(fd);
+  return ok ? 0 : -1;
+}
+
+
+/* the build with its stdout on our stderr, our stdout may be the db */
+int CompileDb_run(char *argv[])
+{
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Error: [libc] fork - %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid == 0) {
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    execvp(argv[0], argv);
+    fprintf(stderr, "Error: [libc] execvp - %s\n", strerror(errno));
+    _exit(127);
+  }
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+/* every record of the log through merge, the log is removed after */
+int CompileDb_merge_log(CompileDb *db, const char *log_path, CompileDbMerge merge)
+{
+  FILE *fp = fopen(log_path, "r");
+  if (!fp) {
+    fprintf(stderr, "Error: [libc] fopen - %s\n", strerror(errno));
+    unlink(log_path);
+    return -1;
+  }
+
+  int captured = 0;
+  char *line = NULL;
+  size_t line_max = 0;
+  while (getline(&line, &line_max, fp) != -1) {
+    cJSON *record = cJSON_Parse(line);
+    const int added = record ? merge(db, record) : -1;
+    if (added < 0)
+      fprintf(stderr, "Warning: compile db log record ignored\n");
+    else
+      captured += added;
+    cJSON_Delete(record);
+  }
+  free(line);
+  fclose(fp);
+  unlink(log_path);
+  return captured;
+}
@@ -0,0 +1,49 @@
+#ifndef COMPILE_DB_H
+#define COMPILE_DB_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include "cJSON.h"
+
+/*
+ * compile_commands.json writer shared by the capture tools. entries are
+ * written out one at a time as they are captured. with an output path the
+ * database goes to a temp file renamed over the target, so a reader never
+ * sees half of it, and append keeps the target's entries for files that
+ * were not rebuilt this time. a capture with no entries leaves the target
+ * as it was unless forced.
+ * the tools capture through a log, every compiler run appends one JSON
+ * record per line with a single O_APPEND write (no locks, parallel jobs
+ * are fine) and the log is merged once the build exits
+ */
+
+typedef struct CompileDb {
+  FILE *fp;
+  char out_path[PATH_MAX];       // empty for stdout
+  char tmp_path[PATH_MAX];
+  unsigned int nentries;
+  char **files;                  // open addressed on the path hash
+  unsigned int nfiles;
+  unsigned int nbuckets;
+} CompileDb;
+
+/* one log record to entries added with CompileDb_add, returns how many */
+typedef int (*CompileDbMerge)(CompileDb*, cJSON *record);
+
+
+bool CompileDb_open(CompileDb*, const char *out_path) __nonnull((1));
+void CompileDb_add(CompileDb*, cJSON *node) __nonnull((1,2));
+int  CompileDb_close(CompileDb*, bool append, bool force) __nonnull((1));
+void CompileDb_discard(CompileDb*) __nonnull((1));
+
+void CompileDb_quote(char **out, size_t *len, size_t *max, const char *arg) __nonnull((1,2,3,4));
+
+bool CompileDb_log_create(char *path, size_t max, const char *prefix) __nonnull((1,3));
+int  CompileDb_log_append(const char *log_path, const char *record, size_t len) __nonnull((1,2));
+int  CompileDb_run(char *argv[]) __nonnull((1));
+int  CompileDb_merge_log(CompileDb*, const char *log_path, CompileDbMerge merge) __nonnull((1,2,3));
+
+#endif